@@ -0,0 +1,72 @@
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <optional>
+#include <cstdint>
+
+#include "benchmark/benchmark.h"
+
+#include "arp_cache.h"
+
+// Lookups of random present neighbors while other threads do the same.
+
+static IPv4_t neighbor_ip(std::size_t i) {
+    return static_cast<IPv4_t>(0x0A00'0000 + i);
+}
+
+// The vector searched under a mutex the handler used before.
+struct Linear {
+    struct Entry {
+        IPv4_t ip_address;
+        MAC_t mac_address;
+    };
+
+    std::vector<Entry> cache;
+    std::mutex mutex;
+
+    std::optional<MAC_t> lookup(IPv4_t ip) {
+        std::lock_guard lock(mutex);
+        auto it = std::ranges::find(cache, ip, &Entry::ip_address);
+        return it != cache.end() ? std::optional{it->mac_address} : std::nullopt;
+    }
+};
+
+static std::unique_ptr<Linear> linear;
+static std::unique_ptr<arp::Cache> cache;
+
+static void BM_Linear(benchmark::State& state) {
+    const auto count = static_cast<std::size_t>(state.range(0));
+    if (state.thread_index() == 0) {
+        linear = std::make_unique<Linear>();
+        for (std::size_t i = 0; i < count; ++i) {
+            linear->cache.push_back({neighbor_ip(i), i});
+        }
+    }
+
+    uint64_t x = 0x9E37'79B9'7F4A'7C15 + static_cast<uint64_t>(state.thread_index());
+    for (auto _ : state) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        benchmark::DoNotOptimize(linear->lookup(neighbor_ip(x % count)));
+    }
+}
+
+static void BM_Cache(benchmark::State& state) {
+    const auto count = static_cast<std::size_t>(state.range(0));
+    if (state.thread_index() == 0) {
+        cache = std::make_unique<arp::Cache>(arp::Cache::Config{.capacity = count});
+        for (std::size_t i = 0; i < count; ++i) {
+            cache->insert(neighbor_ip(i), i);
+        }
+    }
+
+    const auto now = arp::Cache::clock::now();
+    uint64_t x = 0x9E37'79B9'7F4A'7C15 + static_cast<uint64_t>(state.thread_index());
+    for (auto _ : state) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        benchmark::DoNotOptimize(cache->lookup(neighbor_ip(x % count), now));
+    }
+}
+
+BENCHMARK(BM_Linear)->RangeMultiplier(10)->Range(10, 100'000)->ThreadRange(1, 8);
+BENCHMARK(BM_Cache)->RangeMultiplier(10)->Range(10, 100'000)->ThreadRange(1, 8);
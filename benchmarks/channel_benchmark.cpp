@@ -0,0 +1,70 @@
+#include <thread>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "benchmark/benchmark.h"
+
+#include "channel.h"
+#include "spsc_channel.h"
+#include "bounded_channel.h"
+
+// One producer thread handing values to the benchmark thread.
+template<typename C>
+static void BM_Transfer(benchmark::State& state) {
+    for (auto _ : state) {
+        C channel;
+        const auto count = state.range(0);
+
+        std::jthread producer{[&]{
+            for (int64_t i = 0; i < count; ++i) {
+                channel.push(i);
+            }
+            channel.close();
+        }};
+
+        int64_t sum{};
+        for (auto value : channel) {
+            sum += value;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_Transfer<Channel<int64_t>>)->Arg(1 << 16)->UseRealTime();
+BENCHMARK(BM_Transfer<SpscChannel<int64_t>>)->Arg(1 << 16)->UseRealTime();
+
+// Batches of 32 through the bounded channel.
+static void BM_TransferBulk(benchmark::State& state) {
+    for (auto _ : state) {
+        BoundedChannel<int64_t> channel;
+        const auto count = state.range(0);
+
+        std::jthread producer{[&]{
+            std::vector<int64_t> batch;
+            for (int64_t i = 0; i < count; i += 32) {
+                batch.clear();
+                for (int64_t j = i; j < std::min(i + 32, count); ++j) {
+                    batch.push_back(j);
+                }
+                channel.push_bulk(batch);
+            }
+            channel.close();
+        }};
+
+        int64_t sum{};
+        std::vector<int64_t> values;
+        while (channel.pop_bulk(values, 32) != 0) {
+            for (auto value : values) {
+                sum += value;
+            }
+            values.clear();
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_Transfer<BoundedChannel<int64_t>>)->Arg(1 << 16)->UseRealTime();
+BENCHMARK(BM_TransferBulk)->Arg(1 << 16)->UseRealTime();
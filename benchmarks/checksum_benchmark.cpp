@@ -0,0 +1,68 @@
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "benchmark/benchmark.h"
+
+#include "checksum.h"
+
+// The word by word loop the IPv4 header checksum used before.
+static uint16_t legacy(std::span<const std::byte> bytes) {
+    uint32_t sum{};
+    for (std::size_t i = 0; i + 1 < bytes.size(); i += 2) {
+        uint16_t value;
+        std::copy_n(&bytes[i], 2, reinterpret_cast<std::byte*>(&value));
+        sum += value;
+    }
+    while (sum >> 16 != 0) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+}
+
+static std::vector<std::byte> make_data(std::size_t size) {
+    std::vector<std::byte> data(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        data[i] = static_cast<std::byte>(i * 31 + 7);
+    }
+    return data;
+}
+
+static void BM_Legacy(benchmark::State& state) {
+    auto data = make_data(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(data.data());
+        benchmark::DoNotOptimize(legacy(data));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+
+static void BM_Kernel(benchmark::State& state, checksum::Kernel kernel) {
+    if (!checksum::is_supported(kernel)) {
+        state.SkipWithError("kernel not supported by this CPU");
+        return;
+    }
+    auto data = make_data(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(data.data());
+        benchmark::DoNotOptimize(checksum::fold(checksum::sum(data, 0, kernel)));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+
+static void BM_Compute(benchmark::State& state) {
+    auto data = make_data(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(data.data());
+        benchmark::DoNotOptimize(checksum::compute(data));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+
+#define SIZES Arg(20)->Arg(64)->Arg(1500)->Arg(9000)
+
+BENCHMARK(BM_Legacy)->SIZES;
+BENCHMARK_CAPTURE(BM_Kernel, generic, checksum::Kernel::Generic)->SIZES;
+BENCHMARK_CAPTURE(BM_Kernel, sse2, checksum::Kernel::SSE2)->SIZES;
+BENCHMARK_CAPTURE(BM_Kernel, avx2, checksum::Kernel::AVX2)->SIZES;
+BENCHMARK(BM_Compute)->SIZES;
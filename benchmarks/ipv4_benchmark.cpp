@@ -0,0 +1,152 @@
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "benchmark/benchmark.h"
+
+#include "ipv4.h"
+#include "internet_layer.h"
+
+// Reassembly of datagrams sent over a 1500 byte MTU.
+
+constexpr std::size_t fragment_payload = 1480;
+
+using Fragment = std::vector<std::byte>;
+
+static std::vector<Fragment> fragment(uint16_t id, std::size_t size) {
+    constexpr std::size_t header_length = ipv4::Format::byte_size();
+
+    std::vector<Fragment> fragments;
+    for (std::size_t offset = 0; offset < size; offset += fragment_payload) {
+        auto length = std::min(fragment_payload, size - offset);
+
+        Fragment bytes(header_length + length);
+        ipv4::Packet packet{std::span{bytes}};
+        packet.set<"version">(4);
+        packet.set<"header_length">(5);
+        packet.set<"total_length">(static_cast<uint16_t>(header_length + length));
+        packet.set<"id">(id);
+        packet.set<"more_fragments">(offset + length < size);
+        packet.set<"fragment_offset">(static_cast<uint16_t>(offset / 8));
+        packet.set<"ttl">(64);
+        packet.set<"protocol">(ipv4::Protocol::UDP);
+        packet.set<"source_address">("10.0.0.1"_ipv4);
+        packet.set<"destination_address">("10.0.0.4"_ipv4);
+        std::ranges::fill(packet.payload(), static_cast<std::byte>(id));
+
+        fragments.push_back(std::move(bytes));
+    }
+    return fragments;
+}
+
+static void run(benchmark::State& state, const std::vector<Fragment>& stream, std::size_t datagrams) {
+    ipv4::Assembler assembler;
+    std::size_t completed{};
+
+    for (auto _ : state) {
+        for (auto& bytes : stream) {
+            auto datagram = assembler.assemble(ipv4::Packet{std::span<const std::byte>{bytes}});
+            completed += datagram.has_value();
+            benchmark::DoNotOptimize(datagram);
+        }
+    }
+
+    if (completed != datagrams * state.iterations()) {
+        state.SkipWithError("datagram not reassembled");
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * datagrams) * state.range(0));
+}
+
+static void BM_InOrder(benchmark::State& state) {
+    auto stream = fragment(1, static_cast<std::size_t>(state.range(0)));
+    run(state, stream, 1);
+}
+
+static void BM_Reverse(benchmark::State& state) {
+    auto stream = fragment(1, static_cast<std::size_t>(state.range(0)));
+    std::ranges::reverse(stream);
+    run(state, stream, 1);
+}
+
+// Fragments of several datagrams arriving round robin.
+static void BM_Interleaved(benchmark::State& state) {
+    constexpr uint16_t datagrams = 8;
+
+    std::vector<std::vector<Fragment>> streams;
+    for (uint16_t id = 0; id < datagrams; ++id) {
+        streams.push_back(fragment(id, static_cast<std::size_t>(state.range(0))));
+    }
+
+    std::vector<Fragment> stream;
+    for (std::size_t i = 0; i < streams[0].size(); ++i) {
+        for (auto& fragments : streams) {
+            stream.push_back(fragments[i]);
+        }
+    }
+    run(state, stream, datagrams);
+}
+
+// Discards written frames, so sending measures the stack alone.
+struct CopySink {
+    device::ssize_t write(std::span<const std::byte> frame) noexcept {
+        benchmark::DoNotOptimize(frame.data());
+        return static_cast<device::ssize_t>(frame.size());
+    }
+
+    device::ssize_t try_read(std::span<std::byte>, device::Timeout) noexcept {
+        return 0;
+    }
+};
+
+struct GatherSink : CopySink {
+    device::ssize_t writev(device::Parts parts) noexcept {
+        std::size_t size = 0;
+        for (auto part : parts) {
+            benchmark::DoNotOptimize(part.data());
+            size += part.size();
+        }
+        return static_cast<device::ssize_t>(size);
+    }
+};
+
+// Datagrams to a resolved neighbor. Without writev every fragment is
+// copied into a frame buffer first.
+template<typename Sink>
+static void BM_Send(benchmark::State& state) {
+    constexpr IPv4_t ip = "10.0.0.4"_ipv4;
+    constexpr IPv4_t neighbor = "10.0.0.1"_ipv4;
+    constexpr MAC_t mac = "02:00:00:00:00:04"_mac;
+    constexpr MAC_t neighbor_mac = "02:00:00:00:00:01"_mac;
+
+    InternetLayer<Sink> stack(ip, neighbor, {mac, Sink{}});
+
+    arp::Packet<std::array<std::byte, arp::Format::byte_size()>> reply;
+    reply.set<"hardware_type">(1);
+    reply.set<"protocol_type">(0x0800);
+    reply.set<"hardware_size">(6);
+    reply.set<"protocol_size">(4);
+    reply.set<"opcode">(arp::OpCode::REPLY);
+    reply.set<"source_mac">(neighbor_mac);
+    reply.set<"source_ip">(neighbor);
+    reply.set<"destination_mac">(mac);
+    reply.set<"destination_ip">(ip);
+    stack.handle(arp::Packet{std::span<const std::byte>{reply.bytes}});
+
+    std::vector<std::byte> payload(static_cast<std::size_t>(state.range(0)), std::byte{0x5A});
+
+    for (auto _ : state) {
+        if (!stack.send(neighbor, ipv4::Protocol::UDP, payload)) {
+            state.SkipWithError("datagram not sent");
+            break;
+        }
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+
+BENCHMARK(BM_InOrder)->Arg(8000)->Arg(65000);
+BENCHMARK(BM_Reverse)->Arg(8000)->Arg(65000);
+BENCHMARK(BM_Interleaved)->Arg(8000)->Arg(65000);
+BENCHMARK(BM_Send<CopySink>)->Arg(1400)->Arg(8000)->Arg(65000);
+BENCHMARK(BM_Send<GatherSink>)->Arg(1400)->Arg(8000)->Arg(65000);
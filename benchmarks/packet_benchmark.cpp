@@ -0,0 +1,176 @@
+#include <array>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+#include "benchmark/benchmark.h"
+
+#include "packet.h"
+#include "ethernet.h"
+#include "arp.h"
+#include "ipv4.h"
+
+// Every field of the protocol formats through the word path packet::get and
+// packet::set pick now, against the general bitwise path they used before.
+
+enum class Path {
+    Word,
+    Bitwise
+};
+
+template<typename Format, typename Field>
+struct Location {
+    static constexpr auto bit_begin = Format::field_start(Field::name);
+    static constexpr auto first_bit = bit_begin % 8;
+    static constexpr auto byte_begin = bit_begin / 8;
+    static constexpr auto byte_length = utils::bits_to_bytes(first_bit + Field::bit_length);
+};
+
+// Cycles through a few packets so the reads cannot be hoisted out of the loop.
+template<typename Format>
+auto make_packets() {
+    std::array<std::array<std::byte, Format::byte_size()>, 64> packets;
+    for (std::size_t i = 0; i < packets.size(); ++i) {
+        for (std::size_t j = 0; j < Format::byte_size(); ++j) {
+            packets[i][j] = static_cast<std::byte>(i * 131 + j * 37 + 11);
+        }
+    }
+    return packets;
+}
+
+template<typename Format, typename Field, Path path>
+void BM_Get(benchmark::State& state) {
+    using L = Location<Format, Field>;
+    using Type = typename Field::type;
+
+    auto packets = make_packets<Format>();
+    std::size_t i{};
+
+    for (auto _ : state) {
+        auto field = std::span<const std::byte>{packets[i++ % packets.size()]}.template subspan<L::byte_begin, L::byte_length>();
+        if constexpr (path == Path::Word) {
+            benchmark::DoNotOptimize(packet::get_word<L::first_bit, Field::bit_length, Type>(field));
+        } else {
+            benchmark::DoNotOptimize(packet::get_bitwise<L::first_bit, Field::bit_length, Type>(field));
+        }
+    }
+}
+
+template<typename Format, typename Field, Path path>
+void BM_Set(benchmark::State& state) {
+    using L = Location<Format, Field>;
+    using Type = typename Field::type;
+    using Underlying = typename packet::detail::underlying<Type>::type;
+
+    std::array<std::byte, Format::byte_size()> bytes{};
+    Underlying counter{};
+
+    for (auto _ : state) {
+        auto value = Type{counter++};
+        benchmark::DoNotOptimize(value);
+        auto field = std::span{bytes}.template subspan<L::byte_begin, L::byte_length>();
+        if constexpr (path == Path::Word) {
+            packet::set_word<L::first_bit, Field::bit_length>(field, value);
+        } else {
+            packet::set_bitwise<L::first_bit, Field::bit_length>(field, value);
+        }
+        benchmark::ClobberMemory();
+    }
+}
+
+template<typename Format>
+struct Register;
+
+template<typename... Fields>
+struct Register<packet::Format_t<Fields...>> {
+    using Format = packet::Format_t<Fields...>;
+
+    template<typename Field>
+    static void field(std::string_view format_name) {
+        auto name = std::string{format_name} + "/" + std::string{std::string_view{Field::name}};
+        benchmark::RegisterBenchmark(("BM_Get/" + name + "/word").c_str(), BM_Get<Format, Field, Path::Word>);
+        benchmark::RegisterBenchmark(("BM_Get/" + name + "/bitwise").c_str(), BM_Get<Format, Field, Path::Bitwise>);
+        benchmark::RegisterBenchmark(("BM_Set/" + name + "/word").c_str(), BM_Set<Format, Field, Path::Word>);
+        benchmark::RegisterBenchmark(("BM_Set/" + name + "/bitwise").c_str(), BM_Set<Format, Field, Path::Bitwise>);
+    }
+
+    static bool all(std::string_view format_name) {
+        (field<Fields>(format_name), ...);
+        return true;
+    }
+};
+
+static const bool registered =
+    Register<ethernet::Format>::all("ethernet") &&
+    Register<arp::Format>::all("arp") &&
+    Register<ipv4::Format>::all("ipv4");
+
+// Whole header: one decode against a get per field, one encode against a set per field.
+template<typename Format>
+void BM_Decode(benchmark::State& state) {
+    auto packets = make_packets<Format>();
+    std::size_t i{};
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Format::decode(packets[i++ % packets.size()]));
+    }
+}
+
+template<typename Format>
+void BM_GetEach(benchmark::State& state) {
+    auto packets = make_packets<Format>();
+    std::size_t i{};
+
+    for (auto _ : state) {
+        auto& bytes = packets[i++ % packets.size()];
+        typename Format::Header header;
+        [&]<typename... Fields>(packet::Format_t<Fields...>*) {
+            (header.template set<Fields::name>(Format::template get<Fields::name>(bytes)), ...);
+        }(static_cast<Format*>(nullptr));
+        benchmark::DoNotOptimize(header);
+    }
+}
+
+template<typename Format>
+void BM_Encode(benchmark::State& state) {
+    auto packets = make_packets<Format>();
+    std::array<typename Format::Header, 64> headers;
+    for (std::size_t i = 0; i < headers.size(); ++i) {
+        headers[i] = Format::decode(packets[i]);
+    }
+    std::array<std::byte, Format::byte_size()> bytes{};
+    std::size_t i{};
+
+    for (auto _ : state) {
+        Format::encode(bytes, headers[i++ % headers.size()]);
+        benchmark::DoNotOptimize(bytes);
+    }
+}
+
+template<typename Format>
+void BM_SetEach(benchmark::State& state) {
+    auto packets = make_packets<Format>();
+    std::array<typename Format::Header, 64> headers;
+    for (std::size_t i = 0; i < headers.size(); ++i) {
+        headers[i] = Format::decode(packets[i]);
+    }
+    std::array<std::byte, Format::byte_size()> bytes{};
+    std::size_t i{};
+
+    for (auto _ : state) {
+        auto& header = headers[i++ % headers.size()];
+        [&]<typename... Fields>(packet::Format_t<Fields...>*) {
+            (Format::template set<Fields::name>(bytes, header.template get<Fields::name>()), ...);
+        }(static_cast<Format*>(nullptr));
+        benchmark::DoNotOptimize(bytes);
+    }
+}
+
+BENCHMARK(BM_Decode<ipv4::Format>);
+BENCHMARK(BM_GetEach<ipv4::Format>);
+BENCHMARK(BM_Encode<ipv4::Format>);
+BENCHMARK(BM_SetEach<ipv4::Format>);
+BENCHMARK(BM_Decode<arp::Format>);
+BENCHMARK(BM_GetEach<arp::Format>);
+BENCHMARK(BM_Encode<arp::Format>);
+BENCHMARK(BM_SetEach<arp::Format>);
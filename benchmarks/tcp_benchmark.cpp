@@ -0,0 +1,97 @@
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+#include <time.h>
+
+#include "benchmark/benchmark.h"
+
+#include "internet_layer.h"
+#include "memory_device.h"
+#include "tcp.h"
+
+// Bulk transfer over one connection between two stacks connected back to
+// back in memory. Besides the goodput it reports the CPU time of the whole
+// process per byte moved, which covers both stacks and their link threads.
+
+constexpr IPv4_t ip = "10.0.0.4"_ipv4;
+constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+constexpr IPv4_t gateway = "10.0.0.1"_ipv4;
+constexpr MAC_t mac = "02:00:00:00:00:04"_mac;
+constexpr MAC_t peer_mac = "02:00:00:00:00:07"_mac;
+
+constexpr std::size_t transfer_size = 16 << 20;
+
+using Stack = InternetLayer<MemoryDevice>;
+
+static double cpu_seconds() {
+    timespec time{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_nsec) * 1e-9;
+}
+
+static void BM_BulkTransfer(benchmark::State& state, tcp::CongestionFactory congestion) {
+    auto [device, peer_device] = MemoryDevice::pair();
+    const tcp::Config config{.send_buffer = 4 << 20, .receive_buffer = 4 << 20, .congestion = congestion};
+    Stack receiver(ip, gateway, {mac, std::move(device)}, {}, {}, config);
+    Stack sender(peer_ip, gateway, {peer_mac, std::move(peer_device)}, {}, {}, config);
+
+    std::jthread receiver_thread([&](std::stop_token stop_token){
+        receiver.run(stop_token);
+    });
+    std::jthread sender_thread([&](std::stop_token stop_token){
+        sender.run(stop_token);
+    });
+
+    auto listener = receiver.listen(5001);
+    std::atomic<std::size_t> received{};
+    std::jthread sink([&]{
+        auto connection = listener->accept();
+        std::vector<std::byte> buffer(256 << 10);
+        while (auto count = connection->receive(buffer)) {
+            received.fetch_add(count, std::memory_order_release);
+            received.notify_one();
+        }
+    });
+
+    auto connection = sender.connect(ip, 5001);
+    if (!connection) {
+        state.SkipWithError("connect failed");
+        listener->close();
+        return;
+    }
+
+    std::vector<std::byte> data(transfer_size, std::byte{0x5A});
+    std::size_t sent = 0;
+    constexpr auto retransmitted = static_cast<std::size_t>(stats::Counter::TcpRetransmitted);
+    const auto retransmitted_before = stats::read()[retransmitted];
+    const auto cpu_start = cpu_seconds();
+
+    for (auto _ : state) {
+        sent += connection->send(data);
+        for (auto current = received.load(std::memory_order_acquire); current < sent; current = received.load(std::memory_order_acquire)) {
+            received.wait(current, std::memory_order_acquire);
+        }
+    }
+
+    const auto cpu = cpu_seconds() - cpu_start;
+    const auto retransmitted_after = stats::read()[retransmitted];
+
+    connection->shutdown();
+    sink.join();
+    receiver_thread.request_stop();
+    sender_thread.request_stop();
+    receiver_thread.join();
+    sender_thread.join();
+
+    const auto bytes = static_cast<double>(sent);
+    state.SetBytesProcessed(static_cast<int64_t>(sent));
+    state.counters["Gbit/s"] = benchmark::Counter(bytes * 8 / 1e9, benchmark::Counter::kIsRate);
+    state.counters["cpu_ns/byte"] = cpu * 1e9 / bytes;
+    state.counters["retransmitted"] = static_cast<double>(retransmitted_after - retransmitted_before);
+}
+
+BENCHMARK_CAPTURE(BM_BulkTransfer, reno, tcp::reno)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_BulkTransfer, cubic, tcp::cubic)->UseRealTime()->Unit(benchmark::kMillisecond);
@@ -0,0 +1,91 @@
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "benchmark/benchmark.h"
+
+#include "internet_layer.h"
+#include "buffer_pool.h"
+#include "udp.h"
+
+// Receive path of small datagrams: demux, checksum and queueing, with the
+// socket drained in batches of state.range(0).
+
+constexpr IPv4_t ip = "10.0.0.4"_ipv4;
+constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+constexpr MAC_t mac = "02:00:00:00:00:04"_mac;
+
+struct NullDevice {
+    device::ssize_t write(std::span<const std::byte> frame) noexcept {
+        return static_cast<device::ssize_t>(frame.size());
+    }
+
+    device::ssize_t try_read(std::span<std::byte>, device::Timeout) noexcept {
+        return 0;
+    }
+};
+
+static std::vector<std::byte> udp_frame(std::size_t size) {
+    constexpr std::size_t headers = ethernet::Format::byte_size() + ipv4::Format::byte_size();
+    std::vector<std::byte> bytes(headers + udp::Format::byte_size() + size);
+
+    ethernet::Packet<std::span<std::byte>> frame{std::span{bytes}};
+    frame.set<"destination_mac">(mac);
+    frame.set<"ethertype">(ethernet::Ethertype::IPv4);
+
+    auto packet = frame.data<ipv4::Packet>();
+    packet.set<"version">(4);
+    packet.set<"header_length">(5);
+    packet.set<"total_length">(static_cast<uint16_t>(bytes.size() - ethernet::Format::byte_size()));
+    packet.set<"ttl">(64);
+    packet.set<"protocol">(ipv4::Protocol::UDP);
+    packet.set<"source_address">(peer_ip);
+    packet.set<"destination_address">(ip);
+    packet.update_checksum();
+
+    udp::Packet<std::span<std::byte>> datagram{std::span{bytes}.subspan(headers)};
+    datagram.set<"source_port">(1234);
+    datagram.set<"destination_port">(5000);
+    datagram.set<"length">(static_cast<uint16_t>(udp::Format::byte_size() + size));
+    std::ranges::fill(datagram.data(), std::byte{0x5A});
+    datagram.set<"checksum">(udp::checksum(peer_ip, ip, datagram.to_span(0, udp::Format::byte_size()), datagram.data()));
+
+    return bytes;
+}
+
+static void BM_Receive(benchmark::State& state) {
+    const auto batch = static_cast<std::size_t>(state.range(0));
+
+    InternetLayer<NullDevice> stack(ip, "10.0.0.1"_ipv4, {mac, NullDevice{}});
+    auto socket = stack.bind(5000, batch);
+    buffer::Pool pool{{.buffer_count = 2 * batch + 64}};
+
+    auto bytes = udp_frame(64);
+    std::vector<udp::Datagram> received;
+    received.reserve(batch);
+
+    for (auto _ : state) {
+        // As the link layer does, each frame in a buffer of its own.
+        for (std::size_t i = 0; i < batch; ++i) {
+            auto buffer = pool.allocate();
+            std::ranges::copy(bytes, buffer.bytes().begin());
+            buffer.resize(bytes.size());
+
+            ethernet::Packet frame{std::span<const std::byte>{buffer.data()}};
+            stack.handle(frame.data<ipv4::Packet>(), buffer);
+        }
+
+        received.clear();
+        if (socket->recv_many(received, batch) != batch) {
+            state.SkipWithError("datagram lost");
+            break;
+        }
+        benchmark::DoNotOptimize(received.data());
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+}
+
+BENCHMARK(BM_Receive)->Arg(1)->Arg(8)->Arg(32);
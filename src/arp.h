@@ -16,13 +16,14 @@
 #include "types.h"
 #include "packet.h"
 #include "ethernet.h"
+#include "device.h"
+#include "virtio_net.h"
+#include "arp_cache.h"
+#include "token_bucket.h"
+#include "logging.h"
+#include "stats.h"
 
 namespace arp {
-    struct Entry {
-        IPv4_t ip_address;
-        MAC_t mac_address;
-    };
-
     enum class OpCode: uint16_t {
         REQUEST = 1,
         REPLY = 2
@@ -45,130 +46,494 @@ namespace arp {
         using packet::Packet<Range, Format>::Packet;
 
         bool is_valid() const {
+            return this->bytes.size() == Format::byte_size() && is_valid(this->decode());
+        }
+
+        bool is_valid(const Format::Header& header) const {
             return 
                 this->bytes.size() == Format::byte_size() && 
-                this->template get<"hardware_type">() == 1 &&
-                this->template get<"protocol_type">() == 0x0800 && 
-                this->template get<"hardware_size">() == 6 &&
-                this->template get<"protocol_size">() == 4;
+                header.get<"hardware_type">() == 1 &&
+                header.get<"protocol_type">() == 0x0800 && 
+                header.get<"hardware_size">() == 6 &&
+                header.get<"protocol_size">() == 4;
         }
     };
 
     template<typename Range>
     Packet(Range r) -> Packet<Range>;
 
+    struct Config {
+        Cache::Config cache{};
+
+        // Requests sent per unresolved neighbor. The n-th retry follows
+        // retry_interval * 2^(n-1) after the previous request, at most
+        // max_retry_interval.
+        unsigned max_attempts = 3;
+        Cache::clock::duration retry_interval = std::chrono::seconds{1};
+        Cache::clock::duration max_retry_interval = std::chrono::seconds{4};
+
+        // A neighbor that never answered is failed fast for this long.
+        Cache::clock::duration hold_down = std::chrono::seconds{20};
+
+        // Shared by the requests of all neighbors.
+        TokenBucket::Config request_limit{.rate = 20, .burst = 10};
+
+        // Neighbors in use are asked again with a unicast request this long
+        // before they go stale.
+        Cache::clock::duration refresh_lead = std::chrono::seconds{5};
+
+        // Gratuitous ARP sent by announce(), as in RFC 5227.
+        unsigned announcements = 2;
+        Cache::clock::duration announce_interval = std::chrono::seconds{2};
+    };
+
     template<typename InternetLayer>
     class Handler {
-        std::vector<Entry> cache;
+    public:
+        // Packets parked per unresolved neighbor, and unresolved neighbors tracked.
+        static constexpr std::size_t max_parked = 8;
+        static constexpr std::size_t max_pending = 64;
+
+    private:
+        struct Parked {
+            ethernet::Ethertype ethertype;
+            std::vector<std::byte> data;
+            virtio_net::Format::Header offload;
+        };
+
+        // A neighbor that is being resolved, or failed to be.
+        struct Pending {
+            IPv4_t ip_address;
+            State state = State::Incomplete;
+            unsigned attempts{};
+            // When the next request is due while incomplete, the end of the
+            // hold down once failed.
+            Cache::clock::time_point deadline;
+            std::vector<Parked> parked;
+            std::size_t waiters{};
+            // Tells the entry apart from one added for the same neighbor
+            // after it is gone.
+            uint64_t generation{};
+        };
+
+        const Config config;
+        Cache cache;
+
+        // Only misses go through here.
         std::mutex mutex;
-        std::condition_variable cache_updated;
+        std::condition_variable resolved;
+        std::vector<Pending> pending;
+        uint64_t generations{};
+        TokenBucket request_limit;
+        unsigned announcements_left{};
+        Cache::clock::time_point next_announcement;
 
         InternetLayer& internet_layer() {
             return static_cast<InternetLayer&>(*this);
         }
 
-        bool update(Entry entry) {
-            auto it = std::ranges::find(cache, entry.ip_address, &Entry::ip_address);
-            if (it != cache.end()) {
-                it->mac_address = entry.mac_address;
-
-                return true;
+        // Marks the neighbor as in use, so it is refreshed before it goes stale.
+        std::optional<MAC_t> lookup(IPv4_t ip) {
+            auto neighbor = cache.reference(ip);
+            if (neighbor && neighbor->state != State::Expired) {
+                return neighbor->mac_address;
             }
-            return false;
+            return std::nullopt;
         }
 
-        void insert(Entry entry) {
-            cache.push_back(entry);
+        auto find_pending(IPv4_t ip) {
+            return std::ranges::find(pending, ip, &Pending::ip_address);
         }
+
+        Cache::clock::duration backoff(unsigned attempts) const;
+
+        // The functions below collect the requests to send in due, they are
+        // sent by flush() once mutex is released. Those returning bool tell
+        // whether waiters in resolve() have to be woken up. Caller holds mutex.
+
+        // Finds or adds the pending entry of ip, the first request of a new
+        // entry is sent right away.
+        Pending* track_locked(IPv4_t ip, Cache::clock::time_point now, std::vector<IPv4_t>& due, bool& wake);
+        // Sends the next request of entry once it is due, or fails it when
+        // it is out of attempts.
+        bool step_locked(Pending& entry, Cache::clock::time_point now, std::vector<IPv4_t>& due);
+        bool advance_locked(Cache::clock::time_point now, std::vector<IPv4_t>& due);
+
+        void flush(const std::vector<IPv4_t>& due, bool wake);
+        void complete(IPv4_t ip, MAC_t mac);
+        void request(IPv4_t ip, MAC_t destination = ethernet::mac_broadcast);
+        // RFC 5227 announcement: a broadcast request with our address as both
+        // sender and target, and a zero target hardware address.
+        void send_announcement();
+        void send_request(IPv4_t target_ip, MAC_t target_mac, MAC_t destination);
     public:
-        Handler() requires(std::derived_from<InternetLayer, Handler>) = default;
+        explicit Handler(Config config = {}) requires(std::derived_from<InternetLayer, Handler>)
+            : config{config},
+              cache{config.cache},
+              request_limit{config.request_limit}
+            {}
 
         void handle(arp::Packet<std::span<const std::byte>> packet);
+
+        // Sends the payload to a neighbor without waiting for it to be
+        // resolved. On a miss the packet is parked until the reply arrives.
+        // Returns false when it had to be dropped.
+        bool send_to(IPv4_t ip, ethernet::Ethertype ethertype, std::span<const std::byte> payload) {
+            return send_to(ip, ethertype, device::Parts{&payload, 1});
+        }
+        // Same with the payload in pieces, they are only joined when parked.
+        // offload goes with the payload to LinkLayer::send().
+        bool send_to(IPv4_t ip, ethernet::Ethertype ethertype, device::Parts payload, const virtio_net::Format::Header& offload = {});
+
+        // Blocks until the neighbor answers or all requests went unanswered.
         std::optional<MAC_t> resolve(IPv4_t ip);
+
+        // Sends due retries, refreshes and announcements, and ends hold
+        // downs. To be called periodically.
+        void poll(Cache::clock::time_point now = Cache::clock::now());
+
+        // Broadcasts our own address, so peers learn it without a round trip.
+        void announce(Cache::clock::time_point now = Cache::clock::now());
+
+        std::optional<State> state(IPv4_t ip);
     };
 
     template<typename InternetLayer>
     void Handler<InternetLayer>::handle(arp::Packet<std::span<const std::byte>> packet){
-        if (!packet.is_valid()) {
-            std::cout << "Invalid ARP packet\n";
+        const auto header = packet.bytes.size() == Format::byte_size() ? packet.decode() : Format::Header{};
+
+        if (!packet.is_valid(header)) {
+            logging::debug("Invalid ARP packet");
+            stats::add(stats::Counter::ArpInvalid);
             return;
         }
 
-        arp::Entry entry = {
-            packet.get<"source_ip">(),
-            packet.get<"source_mac">()
-        };
+        const auto sender_ip = header.get<"source_ip">();
+        const auto sender_mac = header.get<"source_mac">();
 
-        std::unique_lock lock(mutex);
+        // RFC 826: refresh a known sender, add it when the packet is for us.
+        if (internet_layer().get_ip() == header.get<"destination_ip">()) {
+            cache.insert(sender_ip, sender_mac);
+            complete(sender_ip, sender_mac);
+
+            if (header.get<"opcode">() == arp::OpCode::REQUEST) {
+                auto reply_header = header;
+                reply_header.set<"opcode">(arp::OpCode::REPLY);
+                reply_header.set<"destination_mac">(sender_mac);
+                reply_header.set<"destination_ip">(sender_ip);
+                reply_header.set<"source_mac">(internet_layer().get_mac());
+                reply_header.set<"source_ip">(internet_layer().get_ip());
 
-        bool merge = update(entry);
+                arp::Packet<std::array<std::byte, arp::Format::byte_size()>> reply;
+                reply.encode(reply_header);
 
-        if (internet_layer().get_ip() == packet.get<"destination_ip">()) {
-            if (!merge) {
-                insert(entry);
+                stats::add(stats::Counter::ArpReplies);
+                internet_layer().send(sender_mac, ethernet::Ethertype::ARP, reply.bytes);
             }
+        } else if (cache.update(sender_ip, sender_mac)) {
+            complete(sender_ip, sender_mac);
+        }
+    }
 
-            lock.unlock();
-            cache_updated.notify_all();
-            
-            if (packet.get<"opcode">() == arp::OpCode::REQUEST) {
-                arp::Packet<std::array<std::byte, arp::Format::byte_size()>> reply;
-                std::ranges::copy(packet.bytes, std::begin(reply.bytes));
-                
-                const auto source_mac = packet.get<"source_mac">();
-                const auto source_ip = packet.get<"source_ip">();
-
-                reply.set<"opcode">(arp::OpCode::REPLY);
-                reply.set<"destination_mac">(source_mac);
-                reply.set<"destination_ip">(source_ip);
-                reply.set<"source_mac">(internet_layer().get_mac());
-                reply.set<"source_ip">(internet_layer().get_ip());
-
-                internet_layer().send(source_mac, ethernet::Ethertype::ARP, reply.bytes);
+    template<typename InternetLayer>
+    Cache::clock::duration Handler<InternetLayer>::backoff(unsigned attempts) const {
+        auto interval = config.retry_interval;
+        for (unsigned i = 1; i < attempts && interval < config.max_retry_interval; ++i) {
+            interval *= 2;
+        }
+        return std::min(interval, config.max_retry_interval);
+    }
+
+    template<typename InternetLayer>
+    auto Handler<InternetLayer>::track_locked(IPv4_t ip, Cache::clock::time_point now, std::vector<IPv4_t>& due, bool& wake) -> Pending* {
+        if (auto it = find_pending(ip); it != pending.end()) {
+            return &*it;
+        }
+        if (pending.size() == max_pending) {
+            return nullptr;
+        }
+
+        auto& entry = pending.emplace_back(ip);
+        entry.deadline = now;
+        entry.generation = ++generations;
+        wake |= step_locked(entry, now, due);
+        return &entry;
+    }
+
+    template<typename InternetLayer>
+    bool Handler<InternetLayer>::step_locked(Pending& entry, Cache::clock::time_point now, std::vector<IPv4_t>& due) {
+        if (entry.state == State::Failed || now < entry.deadline) {
+            return false;
+        }
+
+        if (entry.attempts >= std::max(config.max_attempts, 1u)) {
+            entry.state = State::Failed;
+            entry.deadline = now + config.hold_down;
+            stats::add(stats::Counter::ArpDrops, entry.parked.size());
+            entry.parked.clear();
+            stats::add(stats::Counter::ArpFailed);
+            return entry.waiters != 0;
+        }
+
+        if (!request_limit.try_acquire(now)) {
+            // Not an attempt, tried again once there is a token.
+            stats::add(stats::Counter::ArpRateLimited);
+            entry.deadline = request_limit.available_at(now);
+            return false;
+        }
+
+        if (entry.attempts != 0) {
+            stats::add(stats::Counter::ArpRetries);
+        }
+        ++entry.attempts;
+        entry.deadline = now + backoff(entry.attempts);
+        due.push_back(entry.ip_address);
+        return false;
+    }
+
+    template<typename InternetLayer>
+    bool Handler<InternetLayer>::advance_locked(Cache::clock::time_point now, std::vector<IPv4_t>& due) {
+        bool wake = false;
+        for (auto& entry : pending) {
+            wake |= step_locked(entry, now, due);
+        }
+        std::erase_if(pending, [&](const Pending& entry) {
+            return entry.state == State::Failed && entry.waiters == 0 && now >= entry.deadline;
+        });
+        return wake;
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::flush(const std::vector<IPv4_t>& due, bool wake) {
+        if (wake) {
+            resolved.notify_all();
+        }
+        for (auto ip : due) {
+            request(ip);
+        }
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::complete(IPv4_t ip, MAC_t mac) {
+        std::vector<Parked> parked;
+        bool wake = false;
+        {
+            // Also orders the cache update before a waiter's predicate check.
+            // A late reply ends a hold down as well.
+            std::lock_guard lock(mutex);
+            auto it = find_pending(ip);
+            if (it == pending.end()) {
+                return;
+            }
+            parked = std::move(it->parked);
+            wake = it->waiters != 0;
+            pending.erase(it);
+        }
+
+        if (wake) {
+            resolved.notify_all();
+        }
+        for (auto& packet : parked) {
+            std::span<const std::byte> data{packet.data};
+            internet_layer().send(mac, packet.ethertype, device::Parts{&data, 1}, packet.offload);
+        }
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::request(IPv4_t ip, MAC_t destination) {
+        send_request(ip, destination, destination);
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::send_announcement() {
+        send_request(internet_layer().get_ip(), 0, ethernet::mac_broadcast);
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::send_request(IPv4_t target_ip, MAC_t target_mac, MAC_t destination) {
+        Format::Header header;
+        header.set<"hardware_type">(1);
+        header.set<"protocol_type">(0x0800);
+        header.set<"hardware_size">(6);
+        header.set<"protocol_size">(4);
+        header.set<"opcode">(OpCode::REQUEST);
+        header.set<"source_mac">(internet_layer().get_mac());
+        header.set<"source_ip">(internet_layer().get_ip());
+        header.set<"destination_mac">(target_mac);
+        header.set<"destination_ip">(target_ip);
+
+        Packet<std::array<std::byte, Format::byte_size()>> request;
+        request.encode(header);
+
+        stats::add(stats::Counter::ArpRequests);
+        internet_layer().send(destination, ethernet::Ethertype::ARP, request.to_span());
+    }
+
+    template<typename InternetLayer>
+    bool Handler<InternetLayer>::send_to(IPv4_t ip, ethernet::Ethertype ethertype, device::Parts payload, const virtio_net::Format::Header& offload) {
+        auto mac = lookup(ip);
+        std::vector<IPv4_t> due;
+        bool wake = false;
+        bool parked = false;
+
+        if (!mac) {
+            std::lock_guard lock(mutex);
+
+            // complete() takes mutex after updating the cache, so either the
+            // reply is visible here or it will find the parked packet.
+            mac = lookup(ip);
+            if (!mac) {
+                auto now = Cache::clock::now();
+                wake = advance_locked(now, due);
+
+                auto entry = track_locked(ip, now, due, wake);
+                if (entry != nullptr && entry->state == State::Failed) {
+                    stats::add(stats::Counter::ArpHeldDown);
+                } else if (entry != nullptr && entry->parked.size() < max_parked) {
+                    auto& packet = entry->parked.emplace_back(ethertype, std::vector<std::byte>{}, offload);
+                    for (auto part : payload) {
+                        packet.data.insert(packet.data.end(), part.begin(), part.end());
+                    }
+                    parked = true;
+                }
+                if (!parked) {
+                    stats::add(stats::Counter::ArpDrops);
+                }
             }
-        } else if (merge) {
-            lock.unlock();
-            cache_updated.notify_all();
         }
+
+        flush(due, wake);
+        if (mac) {
+            return internet_layer().send(*mac, ethertype, payload, offload);
+        }
+        return parked;
     }
 
     template<typename InternetLayer>
     std::optional<MAC_t> Handler<InternetLayer>::resolve(IPv4_t ip) {
+        if (auto mac = lookup(ip)) {
+            return mac;
+        }
+
         std::unique_lock lock(mutex);
+        std::optional<MAC_t> mac;
+        std::vector<IPv4_t> due;
+        bool wake = false;
+        bool waiting = false;
+        // The entry counting this call among its waiters, if still there.
+        uint64_t generation{};
+        auto waited = [&]{
+            auto it = find_pending(ip);
+            return it != pending.end() && it->generation == generation ? it : pending.end();
+        };
 
-        auto it = std::ranges::find(cache, ip, &Entry::ip_address);
+        while (true) {
+            auto now = Cache::clock::now();
+            wake |= advance_locked(now, due);
 
-        if (it == cache.end()) {
-            insert({ip, ethernet::mac_broadcast});
+            mac = lookup(ip);
+            if (mac || (waiting && waited() == pending.end())) {
+                break;
+            }
+
+            auto entry = track_locked(ip, now, due, wake);
+            if (entry == nullptr) {
+                break;
+            }
+            if (entry->state == State::Failed) {
+                if (!waiting) {
+                    stats::add(stats::Counter::ArpHeldDown);
+                }
+                break;
+            }
+            if (!waiting) {
+                ++entry->waiters;
+                generation = entry->generation;
+                waiting = true;
+            }
 
-            Packet<std::array<std::byte, Format::byte_size()>> request;
-            request.set<"hardware_type">(1);
-            request.set<"protocol_type">(0x0800);
-            request.set<"hardware_size">(6);
-            request.set<"protocol_size">(4);
-            request.set<"opcode">(OpCode::REQUEST);
-            request.set<"source_mac">(internet_layer().get_mac());
-            request.set<"source_ip">(internet_layer().get_ip());
-            request.set<"destination_mac">(ethernet::mac_broadcast);
-            request.set<"destination_ip">(ip);
+            if (!due.empty() || wake) {
+                lock.unlock();
+                flush(due, wake);
+                due.clear();
+                wake = false;
+                lock.lock();
+                continue;
+            }
 
-            internet_layer().send(ethernet::mac_broadcast, ethernet::Ethertype::ARP, request.to_span());
-        } else if (it->mac_address != ethernet::mac_broadcast) {
-            return it->mac_address;
+            auto deadline = entry->deadline;
+            resolved.wait_until(lock, deadline, [&]{
+                auto it = find_pending(ip);
+                return lookup(ip).has_value() || it == pending.end() || it->state == State::Failed;
+            });
         }
 
-        using namespace std::chrono_literals;
+        if (waiting) {
+            if (auto it = waited(); it != pending.end()) {
+                --it->waiters;
+            }
+        }
+        lock.unlock();
+        flush(due, wake);
+        return mac;
+    }
 
-        auto success = cache_updated.wait_for(lock, 1s, [&]{
-            it = std::ranges::find(cache, ip, &Entry::ip_address);
-            return (it != cache.end() && it->mac_address != ethernet::mac_broadcast);
-        });
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::poll(Cache::clock::time_point now) {
+        auto stale = cache.refresh(now, config.refresh_lead);
+        std::vector<IPv4_t> due;
+        bool wake;
+        bool announcement = false;
+        {
+            std::lock_guard lock(mutex);
+            wake = advance_locked(now, due);
 
-        if (success) {
-            return it->mac_address;
-        } else {
-            cache.erase(it);
-            return std::nullopt;
+            // Skipped refreshes are retried by refresh() one lead later.
+            std::erase_if(stale, [&](const Neighbor&) {
+                if (request_limit.try_acquire(now)) {
+                    return false;
+                }
+                stats::add(stats::Counter::ArpRateLimited);
+                return true;
+            });
+
+            if (announcements_left != 0 && now >= next_announcement) {
+                --announcements_left;
+                next_announcement = now + config.announce_interval;
+                announcement = true;
+            }
+        }
+
+        flush(due, wake);
+        for (auto& neighbor : stale) {
+            stats::add(stats::Counter::ArpRefreshes);
+            request(neighbor.ip_address, neighbor.mac_address);
+        }
+        if (announcement) {
+            send_announcement();
+        }
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::announce(Cache::clock::time_point now) {
+        {
+            std::lock_guard lock(mutex);
+            announcements_left = config.announcements;
+            next_announcement = now;
+        }
+        poll(now);
+    }
+
+    template<typename InternetLayer>
+    std::optional<State> Handler<InternetLayer>::state(IPv4_t ip) {
+        if (auto neighbor = cache.lookup(ip); neighbor && neighbor->state != State::Expired) {
+            return neighbor->state;
+        }
+
+        std::lock_guard lock(mutex);
+        if (auto it = find_pending(ip); it != pending.end()) {
+            return it->state;
         }
+        return std::nullopt;
     }
 }
\ No newline at end of file
@@ -0,0 +1,279 @@
+#include <bit>
+#include <algorithm>
+
+#include "arp_cache.h"
+
+namespace arp {
+    Cache::Cache(Config config)
+        : config{config},
+          mask{std::bit_ceil(std::max<std::size_t>(config.capacity, 1) * 2) - 1},
+          shift{static_cast<unsigned>(64 - std::countr_zero(mask + 1))},
+          slots{std::make_unique<Slot[]>(mask + 1)}
+    {}
+
+    std::size_t Cache::home(IPv4_t ip) const noexcept {
+        // Fibonacci hashing, addresses of one subnet differ in the low bits only.
+        return static_cast<std::size_t>((ip * uint64_t{0x9E37'79B9'7F4A'7C15}) >> shift) & mask;
+    }
+
+    auto Cache::read(const Slot& slot) noexcept -> Snapshot {
+        while (true) {
+            auto sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence % 2 != 0) {
+                continue;
+            }
+
+            Snapshot snapshot{
+                slot.ip_address.load(std::memory_order_relaxed),
+                slot.mac_address.load(std::memory_order_relaxed),
+                slot.updated.load(std::memory_order_relaxed),
+                slot.state.load(std::memory_order_relaxed)
+            };
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == sequence) {
+                return snapshot;
+            }
+        }
+    }
+
+    void Cache::write(Slot& slot, const Snapshot& snapshot) noexcept {
+        if (snapshot.state != SlotState::Used || slot.ip_address.load(std::memory_order_relaxed) != snapshot.ip_address) {
+            slot.referenced.store(false, std::memory_order_relaxed);
+        }
+        slot.probes.store(0, std::memory_order_relaxed);
+
+        auto sequence = slot.sequence.load(std::memory_order_relaxed);
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.ip_address.store(snapshot.ip_address, std::memory_order_relaxed);
+        slot.mac_address.store(snapshot.mac_address, std::memory_order_relaxed);
+        slot.updated.store(snapshot.updated, std::memory_order_relaxed);
+        slot.state.store(snapshot.state, std::memory_order_relaxed);
+
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    State Cache::state_of(clock::rep updated, clock::time_point now) const noexcept {
+        auto age = clock::duration{now.time_since_epoch().count() - updated};
+        if (age < config.reachable_time) {
+            return State::Reachable;
+        }
+        if (age < config.reachable_time + config.stale_time) {
+            return State::Stale;
+        }
+        return State::Expired;
+    }
+
+    auto Cache::find(IPv4_t ip, Snapshot& snapshot) const noexcept -> Slot* {
+        while (true) {
+            auto sequence = moves.load(std::memory_order_acquire);
+
+            auto index = home(ip);
+            for (std::size_t probes = 0; probes <= mask; ++probes, index = (index + 1) & mask) {
+                snapshot = read(slots[index]);
+
+                if (snapshot.state == SlotState::Free) {
+                    break;
+                }
+                if (snapshot.ip_address == ip) {
+                    return &slots[index];
+                }
+            }
+
+            // The entry may have moved behind us.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence % 2 == 0 && moves.load(std::memory_order_relaxed) == sequence) {
+                return nullptr;
+            }
+        }
+    }
+
+    std::optional<Neighbor> Cache::lookup(IPv4_t ip, clock::time_point now) const noexcept {
+        Snapshot snapshot;
+        if (find(ip, snapshot) == nullptr) {
+            return std::nullopt;
+        }
+        return Neighbor{
+            ip,
+            snapshot.mac_address,
+            state_of(snapshot.updated, now),
+            clock::time_point{clock::duration{snapshot.updated}}
+        };
+    }
+
+    std::optional<Neighbor> Cache::reference(IPv4_t ip, clock::time_point now) noexcept {
+        Snapshot snapshot;
+        auto slot = find(ip, snapshot);
+        if (slot == nullptr) {
+            return std::nullopt;
+        }
+
+        // Hot entries stay marked, so the cache line is not written on every send.
+        if (!slot->referenced.load(std::memory_order_relaxed)) {
+            slot->referenced.store(true, std::memory_order_relaxed);
+        }
+        return Neighbor{
+            ip,
+            snapshot.mac_address,
+            state_of(snapshot.updated, now),
+            clock::time_point{clock::duration{snapshot.updated}}
+        };
+    }
+
+    std::vector<Neighbor> Cache::refresh(clock::time_point now, clock::duration lead) {
+        std::lock_guard lock(mutex);
+
+        std::vector<Neighbor> due;
+        for (std::size_t i = 0; i <= mask; ++i) {
+            auto& slot = slots[i];
+            if (
+                slot.state.load(std::memory_order_relaxed) != SlotState::Used ||
+                !slot.referenced.load(std::memory_order_relaxed)
+            ) {
+                continue;
+            }
+
+            auto updated = slot.updated.load(std::memory_order_relaxed);
+            auto state = state_of(updated, now);
+            auto probes = slot.probes.load(std::memory_order_relaxed);
+            auto age = clock::duration{now.time_since_epoch().count() - updated};
+
+            if (state == State::Expired || age < config.reachable_time - lead + probes * lead) {
+                continue;
+            }
+
+            slot.referenced.store(false, std::memory_order_relaxed);
+            if (probes != UINT8_MAX) {
+                slot.probes.store(static_cast<uint8_t>(probes + 1), std::memory_order_relaxed);
+            }
+            due.push_back({
+                slot.ip_address.load(std::memory_order_relaxed),
+                slot.mac_address.load(std::memory_order_relaxed),
+                state,
+                clock::time_point{clock::duration{updated}}
+            });
+        }
+        return due;
+    }
+
+    auto Cache::find_locked(IPv4_t ip, bool for_insert) noexcept -> Slot* {
+        auto index = home(ip);
+        for (std::size_t probes = 0; probes <= mask; ++probes, index = (index + 1) & mask) {
+            auto& slot = slots[index];
+
+            if (slot.state.load(std::memory_order_relaxed) == SlotState::Free) {
+                return for_insert ? &slot : nullptr;
+            }
+            if (slot.ip_address.load(std::memory_order_relaxed) == ip) {
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+    void Cache::remove_locked(std::size_t index) noexcept {
+        auto sequence = moves.load(std::memory_order_relaxed);
+        moves.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        // Backward shift deletion, every entry that may live in the hole
+        // moves there, leaving a hole of its own.
+        auto hole = index;
+        for (auto i = (index + 1) & mask; slots[i].state.load(std::memory_order_relaxed) != SlotState::Free; i = (i + 1) & mask) {
+            auto& slot = slots[i];
+            auto ip = slot.ip_address.load(std::memory_order_relaxed);
+            if (((i - home(ip)) & mask) >= ((i - hole) & mask)) {
+                auto referenced = slot.referenced.load(std::memory_order_relaxed);
+                auto probes = slot.probes.load(std::memory_order_relaxed);
+                write(slots[hole], {
+                    ip,
+                    slot.mac_address.load(std::memory_order_relaxed),
+                    slot.updated.load(std::memory_order_relaxed),
+                    SlotState::Used
+                });
+                slots[hole].referenced.store(referenced, std::memory_order_relaxed);
+                slots[hole].probes.store(probes, std::memory_order_relaxed);
+                hole = i;
+            }
+        }
+        write(slots[hole], {0, 0, 0, SlotState::Free});
+
+        moves.store(sequence + 2, std::memory_order_release);
+    }
+
+    bool Cache::update(IPv4_t ip, MAC_t mac, clock::time_point now) {
+        std::lock_guard lock(mutex);
+
+        auto slot = find_locked(ip, false);
+        if (slot == nullptr) {
+            return false;
+        }
+
+        write(*slot, {ip, mac, now.time_since_epoch().count(), SlotState::Used});
+        return true;
+    }
+
+    bool Cache::insert(IPv4_t ip, MAC_t mac, clock::time_point now) {
+        std::lock_guard lock(mutex);
+
+        auto slot = find_locked(ip, true);
+        const auto is_new = [&]{
+            return slot == nullptr || slot->state.load(std::memory_order_relaxed) == SlotState::Free;
+        };
+
+        if (is_new() && used.load(std::memory_order_relaxed) == config.capacity) {
+            if (expire_locked(now) == 0) {
+                return false;
+            }
+            slot = find_locked(ip, true);
+        }
+        if (slot == nullptr) {
+            return false;
+        }
+
+        if (is_new()) {
+            used.fetch_add(1, std::memory_order_relaxed);
+        }
+        write(*slot, {ip, mac, now.time_since_epoch().count(), SlotState::Used});
+        return true;
+    }
+
+    bool Cache::erase(IPv4_t ip) {
+        std::lock_guard lock(mutex);
+
+        auto slot = find_locked(ip, false);
+        if (slot == nullptr) {
+            return false;
+        }
+
+        remove_locked(static_cast<std::size_t>(slot - slots.get()));
+        used.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::size_t Cache::expire_locked(clock::time_point now) noexcept {
+        std::size_t expired{};
+        for (std::size_t i = 0; i <= mask;) {
+            auto& slot = slots[i];
+            if (
+                slot.state.load(std::memory_order_relaxed) == SlotState::Used &&
+                state_of(slot.updated.load(std::memory_order_relaxed), now) == State::Expired
+            ) {
+                // Another entry may have moved into the slot.
+                remove_locked(i);
+                ++expired;
+            } else {
+                ++i;
+            }
+        }
+        used.fetch_sub(expired, std::memory_order_relaxed);
+        return expired;
+    }
+
+    std::size_t Cache::expire(clock::time_point now) {
+        std::lock_guard lock(mutex);
+        return expire_locked(now);
+    }
+}
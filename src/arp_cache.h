@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "types.h"
+
+namespace arp {
+    // The cache only holds the first three, unresolved neighbors are
+    // tracked by the handler.
+    enum class State : uint8_t {
+        Reachable,
+        Stale,
+        Expired,
+        Incomplete,
+        Failed
+    };
+
+    struct Neighbor {
+        IPv4_t ip_address;
+        MAC_t mac_address;
+        State state;
+        std::chrono::steady_clock::time_point updated;
+    };
+
+    // Neighbor table, open addressing with linear probing. Every slot is
+    // guarded by a sequence lock, so lookup() never blocks and never writes
+    // shared memory, while writers are serialized by a mutex. Removing an
+    // entry moves the later entries of its probe sequence back instead of
+    // leaving a tombstone, a lookup that misses while they move retries.
+    // Entries age from reachable to stale to expired, expired slots are
+    // reused once the table fills up.
+    class Cache {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        struct Config {
+            std::size_t capacity = 1024;
+            clock::duration reachable_time = std::chrono::seconds{30};
+            clock::duration stale_time = std::chrono::minutes{10};
+        };
+
+    private:
+        enum class SlotState : uint8_t {
+            Free,
+            Used
+        };
+
+        struct alignas(32) Slot {
+            std::atomic<uint32_t> sequence{};
+            std::atomic<IPv4_t> ip_address{};
+            std::atomic<MAC_t> mac_address{};
+            std::atomic<clock::rep> updated{};
+            std::atomic<SlotState> state{SlotState::Free};
+            // Outside the sequence lock, only hints for refresh().
+            std::atomic<bool> referenced{};
+            std::atomic<uint8_t> probes{};
+        };
+
+        struct Snapshot {
+            IPv4_t ip_address;
+            MAC_t mac_address;
+            clock::rep updated;
+            SlotState state;
+        };
+
+        Config config;
+        std::size_t mask;
+        unsigned shift;
+        std::unique_ptr<Slot[]> slots;
+
+        std::mutex mutex;
+        std::atomic<std::size_t> used{};
+        // Sequence lock over moving entries, odd while remove_locked() runs.
+        std::atomic<uint32_t> moves{};
+
+        std::size_t home(IPv4_t ip) const noexcept;
+        static Snapshot read(const Slot& slot) noexcept;
+        static void write(Slot& slot, const Snapshot& snapshot) noexcept;
+        State state_of(clock::rep updated, clock::time_point now) const noexcept;
+        Slot* find(IPv4_t ip, Snapshot& snapshot) const noexcept;
+
+        // Slot holding ip, or where it would go. Caller holds mutex.
+        Slot* find_locked(IPv4_t ip, bool for_insert) noexcept;
+        void remove_locked(std::size_t index) noexcept;
+        std::size_t expire_locked(clock::time_point now) noexcept;
+    public:
+        Cache() : Cache(Config{}) {}
+        explicit Cache(Config config);
+        Cache(const Cache&) = delete;
+
+        // Safe to call concurrently with anything else.
+        std::optional<Neighbor> lookup(IPv4_t ip, clock::time_point now = clock::now()) const noexcept;
+
+        // Like lookup(), and marks the entry as in use for refresh(). Only
+        // writes to the slot when the mark is not set yet.
+        std::optional<Neighbor> reference(IPv4_t ip, clock::time_point now = clock::now()) noexcept;
+
+        // Entries referenced since their last probe that go stale within
+        // lead, or already are. Probes of one entry are at least lead apart,
+        // an update starts over.
+        std::vector<Neighbor> refresh(clock::time_point now, clock::duration lead);
+
+        // Refreshes an existing entry, returns false if there is none.
+        bool update(IPv4_t ip, MAC_t mac, clock::time_point now = clock::now());
+
+        // Adds or refreshes an entry, returns false when the table is full.
+        bool insert(IPv4_t ip, MAC_t mac, clock::time_point now = clock::now());
+
+        bool erase(IPv4_t ip);
+
+        // Removes expired entries and returns how many there were.
+        std::size_t expire(clock::time_point now = clock::now());
+
+        std::size_t size() const noexcept {
+            return used.load(std::memory_order_relaxed);
+        }
+
+        std::size_t capacity() const noexcept {
+            return config.capacity;
+        }
+    };
+}
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <ranges>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Fixed capacity counterpart of Channel for any number of producers and
+// consumers. The bulk operations move a whole batch per lock acquisition.
+// What happens to a value pushed into a full channel is set by the
+// overflow policy, values thrown away are counted in dropped().
+template <typename T>
+class BoundedChannel {
+public:
+    enum class Overflow {
+        Block,
+        DropNewest,
+        DropOldest
+    };
+
+    struct Config {
+        std::size_t capacity = 1024;
+        Overflow overflow = Overflow::Block;
+    };
+
+private:
+    const Config config;
+    const std::unique_ptr<std::optional<T>[]> slots;
+    std::size_t head{};
+    std::size_t size{};
+    bool is_open = true;
+
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::size_t consumers_waiting{};
+    std::size_t producers_waiting{};
+
+    std::atomic<uint64_t> drops{};
+
+    bool reserve(std::unique_lock<std::mutex>& lock);
+    void wait_for_values(std::unique_lock<std::mutex>& lock);
+    T take();
+public:
+    BoundedChannel() : BoundedChannel(Config{}) {}
+    explicit BoundedChannel(Config config);
+    BoundedChannel(const BoundedChannel&) = delete;
+
+    // Returns false when the value was dropped or the channel is closed.
+    bool push(T value);
+
+    template <typename... U>
+    bool emplace(U&&... args);
+
+    // Moves the values in, returns how many were queued.
+    template <std::ranges::input_range R>
+    std::size_t push_bulk(R&& values);
+
+    void close();
+
+    std::optional<T> pop();
+
+    // Waits for values and appends up to max of them to out. Returns 0 once
+    // the channel is closed and drained, so max must not be 0.
+    std::size_t pop_bulk(std::vector<T>& out, std::size_t max);
+
+    std::size_t capacity() const noexcept {
+        return config.capacity;
+    }
+
+    uint64_t dropped() const noexcept {
+        return drops.load(std::memory_order_relaxed);
+    }
+
+    class InputIter;
+    class Sentinel{};
+
+    InputIter begin();
+    Sentinel end();
+};
+
+template <typename T>
+BoundedChannel<T>::BoundedChannel(Config config)
+    : config{config.capacity != 0 ? config : Config{1, config.overflow}},
+      slots{std::make_unique<std::optional<T>[]>(this->config.capacity)}
+{}
+
+// Makes room for one value. Returns false if the value has to be thrown away.
+template <typename T>
+bool BoundedChannel<T>::reserve(std::unique_lock<std::mutex>& lock) {
+    while (is_open && size == config.capacity) {
+        switch (config.overflow) {
+        case Overflow::Block:
+            // A bulk push may fill the channel before anyone was notified.
+            if (consumers_waiting != 0) {
+                not_empty.notify_all();
+            }
+            ++producers_waiting;
+            not_full.wait(lock);
+            --producers_waiting;
+            break;
+        case Overflow::DropNewest:
+            drops.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        case Overflow::DropOldest:
+            take();
+            drops.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+    return is_open;
+}
+
+template <typename T>
+void BoundedChannel<T>::wait_for_values(std::unique_lock<std::mutex>& lock) {
+    while (is_open && size == 0) {
+        ++consumers_waiting;
+        not_empty.wait(lock);
+        --consumers_waiting;
+    }
+}
+
+template <typename T>
+T BoundedChannel<T>::take() {
+    auto& slot = slots[head];
+    T value = std::move(*slot);
+    slot.reset();
+
+    head = head + 1 == config.capacity ? 0 : head + 1;
+    --size;
+    return value;
+}
+
+template <typename T>
+bool BoundedChannel<T>::push(T value) {
+    return emplace(std::move(value));
+}
+
+template <typename T>
+template <typename... U>
+bool BoundedChannel<T>::emplace(U&&... args) {
+    bool wake;
+    {
+        std::unique_lock lock(mutex);
+        if (!reserve(lock)) {
+            return false;
+        }
+
+        auto tail = head + size;
+        slots[tail < config.capacity ? tail : tail - config.capacity].emplace(std::forward<U>(args)...);
+        ++size;
+        wake = consumers_waiting != 0;
+    }
+    if (wake) {
+        not_empty.notify_one();
+    }
+    return true;
+}
+
+template <typename T>
+template <std::ranges::input_range R>
+std::size_t BoundedChannel<T>::push_bulk(R&& values) {
+    std::size_t pushed{};
+    bool wake;
+    {
+        std::unique_lock lock(mutex);
+        for (auto&& value : values) {
+            if (!reserve(lock)) {
+                if (!is_open) {
+                    break;
+                }
+                continue;
+            }
+
+            auto tail = head + size;
+            slots[tail < config.capacity ? tail : tail - config.capacity].emplace(std::move(value));
+            ++size;
+            ++pushed;
+        }
+        wake = consumers_waiting != 0 && pushed != 0;
+    }
+    if (wake) {
+        if (pushed == 1) {
+            not_empty.notify_one();
+        } else {
+            not_empty.notify_all();
+        }
+    }
+    return pushed;
+}
+
+template <typename T>
+void BoundedChannel<T>::close() {
+    {
+        std::lock_guard lock(mutex);
+        is_open = false;
+    }
+    not_empty.notify_all();
+    not_full.notify_all();
+}
+
+template <typename T>
+std::optional<T> BoundedChannel<T>::pop() {
+    std::optional<T> value;
+    bool wake;
+    {
+        std::unique_lock lock(mutex);
+        wait_for_values(lock);
+
+        if (size == 0) {
+            return std::nullopt;
+        }
+        value = take();
+        wake = producers_waiting != 0;
+    }
+    if (wake) {
+        not_full.notify_one();
+    }
+    return value;
+}
+
+template <typename T>
+std::size_t BoundedChannel<T>::pop_bulk(std::vector<T>& out, std::size_t max) {
+    assert(max != 0);
+
+    std::size_t count;
+    bool wake;
+    {
+        std::unique_lock lock(mutex);
+        wait_for_values(lock);
+
+        count = std::min(size, max);
+        for (std::size_t i = 0; i < count; ++i) {
+            out.push_back(take());
+        }
+        wake = producers_waiting != 0 && count != 0;
+    }
+    if (wake) {
+        if (count == 1) {
+            not_full.notify_one();
+        } else {
+            not_full.notify_all();
+        }
+    }
+    return count;
+}
+
+template <typename T>
+class BoundedChannel<T>::InputIter {
+    friend class BoundedChannel;
+
+    BoundedChannel& channel;
+    std::optional<T> value;
+
+    InputIter(BoundedChannel& channel) : channel{channel}, value{channel.pop()} {}
+public:
+    T& operator*() {
+        return *value;
+    }
+    bool operator==(BoundedChannel::Sentinel) {
+        return !value.has_value();
+    }
+    InputIter& operator++() {
+        value = channel.pop();
+        return *this;
+    }
+};
+
+template <typename T>
+auto BoundedChannel<T>::begin() -> InputIter {
+    return InputIter(*this);
+}
+
+template <typename T>
+auto BoundedChannel<T>::end() -> Sentinel {
+    return Sentinel{};
+}
@@ -0,0 +1,169 @@
+#include <system_error>
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/mman.h>
+
+#include "buffer_pool.h"
+
+namespace buffer {
+    namespace {
+        constexpr std::size_t huge_page_size = 2 << 20;
+
+        constexpr std::size_t round_up(std::size_t value, std::size_t multiple) {
+            return (value + multiple - 1) / multiple * multiple;
+        }
+    }
+
+    namespace detail {
+        // Small per-thread index into Pool::caches. When a thread finishes, the
+        // buffers left in its caches go back to the shared free lists and the
+        // index is handed out again.
+        class ThreadIndex {
+            static inline std::mutex mutex;
+            static inline std::vector<std::size_t> released;
+            static inline std::vector<Pool*> pools;
+            static inline std::size_t next{};
+
+            std::size_t index;
+        public:
+            ThreadIndex() {
+                std::lock_guard lock(mutex);
+                if (released.empty()) {
+                    index = next++;
+                } else {
+                    index = released.back();
+                    released.pop_back();
+                }
+            }
+            ~ThreadIndex() {
+                std::lock_guard lock(mutex);
+                if (index < Pool::max_threads) {
+                    for (auto pool : pools) {
+                        auto& cache = pool->caches[index];
+                        pool->drain(cache, cache.slots.size());
+                    }
+                }
+                released.push_back(index);
+            }
+
+            static void add(Pool* pool) {
+                std::lock_guard lock(mutex);
+                pools.push_back(pool);
+            }
+
+            static void remove(Pool* pool) {
+                std::lock_guard lock(mutex);
+                std::erase(pools, pool);
+            }
+
+            std::size_t get() const noexcept {
+                return index;
+            }
+        };
+    }
+
+    namespace {
+        thread_local detail::ThreadIndex thread_index;
+    }
+
+    Pool::Pool(Config config)
+        : config{config},
+          stride{sizeof(detail::Slot) + round_up(config.buffer_size, cache_line_size)},
+          caches{std::make_unique<Cache[]>(max_threads)}
+    {
+        memory_size = stride * config.buffer_count;
+
+        void* address = MAP_FAILED;
+        if (config.huge_pages) {
+            memory_size = round_up(memory_size, huge_page_size);
+            address = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            huge_pages = address != MAP_FAILED;
+        }
+        if (address == MAP_FAILED) {
+            address = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (address != MAP_FAILED && config.huge_pages) {
+                // No reserved huge pages, transparent ones are the next best thing.
+                huge_pages = madvise(address, memory_size, MADV_HUGEPAGE) == 0;
+            }
+        }
+        if (address == MAP_FAILED) {
+            throw std::system_error{errno, std::system_category(), "Cannot map buffer pool"};
+        }
+        memory = static_cast<std::byte*>(address);
+
+        for (std::size_t i = config.buffer_count; i > 0; --i) {
+            auto start = memory + (i - 1) * stride;
+            auto slot = new (start) detail::Slot{{0}, 0, 0, static_cast<uint32_t>(config.buffer_size), start + sizeof(detail::Slot), this, free_list};
+            free_list = slot;
+        }
+
+        for (std::size_t i = 0; i < max_threads; ++i) {
+            caches[i].slots.reserve(config.cache_size);
+        }
+
+        detail::ThreadIndex::add(this);
+    }
+
+    Pool::~Pool() {
+        detail::ThreadIndex::remove(this);
+        munmap(memory, memory_size);
+    }
+
+    auto Pool::thread_cache() noexcept -> Cache* {
+        auto index = thread_index.get();
+        return index < max_threads && config.cache_size > 1 ? &caches[index] : nullptr;
+    }
+
+    std::size_t Pool::refill(Cache& cache) noexcept {
+        std::lock_guard lock(mutex);
+        while (free_list != nullptr && cache.slots.size() < config.cache_size / 2) {
+            cache.slots.push_back(std::exchange(free_list, free_list->next));
+        }
+        return cache.slots.size();
+    }
+
+    void Pool::drain(Cache& cache, std::size_t count) noexcept {
+        std::lock_guard lock(mutex);
+        for (; count > 0; --count) {
+            auto slot = cache.slots.back();
+            cache.slots.pop_back();
+            slot->next = std::exchange(free_list, slot);
+        }
+    }
+
+    Buffer Pool::allocate() noexcept {
+        detail::Slot* slot = nullptr;
+
+        if (auto cache = thread_cache(); cache != nullptr) {
+            if (cache->slots.empty() && refill(*cache) == 0) {
+                return {};
+            }
+            slot = cache->slots.back();
+            cache->slots.pop_back();
+        } else {
+            std::lock_guard lock(mutex);
+            if (free_list == nullptr) {
+                return {};
+            }
+            slot = std::exchange(free_list, free_list->next);
+        }
+
+        slot->references.store(1, std::memory_order_relaxed);
+        slot->size = 0;
+        slot->offset = 0;
+        return Buffer{slot};
+    }
+
+    void Pool::release(detail::Slot* slot) noexcept {
+        if (auto cache = thread_cache(); cache != nullptr) {
+            if (cache->slots.size() == config.cache_size) {
+                drain(*cache, config.cache_size / 2);
+            }
+            cache->slots.push_back(slot);
+        } else {
+            std::lock_guard lock(mutex);
+            slot->next = std::exchange(free_list, slot);
+        }
+    }
+}
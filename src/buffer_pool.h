@@ -0,0 +1,194 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <utility>
+
+#include "ethernet.h"
+
+namespace buffer {
+    inline constexpr std::size_t cache_line_size = 64;
+
+    class Pool;
+
+    namespace detail {
+        class ThreadIndex;
+
+        // Lives in the cache line in front of the buffer data, or in a
+        // Lender for memory that is not a pool's.
+        struct alignas(cache_line_size) Slot {
+            std::atomic<uint32_t> references;
+            uint32_t size;
+            // Bytes in front of the data in use.
+            uint32_t offset;
+            uint32_t capacity;
+            std::byte* memory;
+            // Null when lent, the memory goes back to its owner by itself.
+            Pool* pool;
+            Slot* next;
+
+            std::byte* data() {
+                return memory;
+            }
+        };
+    }
+
+    // Reference counted handle to a fixed size buffer owned by a Pool.
+    // Copies share the buffer, it goes back to the pool with the last handle.
+    class Buffer {
+        friend class Pool;
+        friend class Lender;
+
+        detail::Slot* slot = nullptr;
+
+        explicit Buffer(detail::Slot* slot) : slot{slot} {}
+        void release() noexcept;
+    public:
+        Buffer() = default;
+        Buffer(const Buffer& other) noexcept : slot{other.slot} {
+            if (slot != nullptr) {
+                slot->references.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        Buffer(Buffer&& other) noexcept : slot{std::exchange(other.slot, nullptr)} {}
+        Buffer& operator=(Buffer other) noexcept {
+            std::swap(slot, other.slot);
+            return *this;
+        }
+        ~Buffer() {
+            release();
+        }
+
+        explicit operator bool() const noexcept {
+            return slot != nullptr;
+        }
+
+        std::size_t capacity() const noexcept {
+            return slot != nullptr ? slot->capacity : 0;
+        }
+
+        // Acquire pairs with the release of other references, so seeing 1
+        // means their reads of the buffer are done and it can be written.
+        std::size_t use_count() const noexcept {
+            return slot != nullptr ? slot->references.load(std::memory_order_acquire) : 0;
+        }
+
+        // The whole buffer, regardless of the size in use.
+        std::span<std::byte> bytes() const noexcept {
+            return slot != nullptr ? std::span{slot->data(), capacity()} : std::span<std::byte>{};
+        }
+
+        std::span<std::byte> data() const noexcept {
+            return slot != nullptr ? std::span{slot->data() + slot->offset, slot->size} : std::span<std::byte>{};
+        }
+
+        // The first size bytes of the buffer are in use.
+        void resize(std::size_t size) noexcept {
+            slot->offset = 0;
+            slot->size = static_cast<uint32_t>(size);
+        }
+
+        // Drops count bytes from the front of the data, e.g. a header the
+        // layers above are not to see.
+        void trim_front(std::size_t count) noexcept {
+            slot->offset += static_cast<uint32_t>(count);
+            slot->size -= static_cast<uint32_t>(count);
+        }
+    };
+
+    // Slab of equally sized, cache line aligned buffers carved out of one
+    // mapping. Every thread keeps a small cache of free buffers, so
+    // allocate() and the release of the last handle only touch the shared
+    // free list once per cache_size / 2 buffers. The pool has to outlive
+    // every Buffer allocated from it.
+    class Pool {
+    public:
+        struct Config {
+            std::size_t buffer_count = 8192;
+            std::size_t buffer_size = ethernet::max_size;
+            std::size_t cache_size = 64;
+            bool huge_pages = false;
+        };
+
+        static constexpr std::size_t max_threads = 64;
+
+    private:
+        friend class Buffer;
+        friend class detail::ThreadIndex;
+
+        struct alignas(cache_line_size) Cache {
+            std::vector<detail::Slot*> slots;
+        };
+
+        Config config;
+        std::size_t stride;
+        std::byte* memory = nullptr;
+        std::size_t memory_size{};
+        bool huge_pages = false;
+
+        std::mutex mutex;
+        detail::Slot* free_list = nullptr;
+        std::unique_ptr<Cache[]> caches;
+
+        void release(detail::Slot* slot) noexcept;
+        Cache* thread_cache() noexcept;
+        std::size_t refill(Cache& cache) noexcept;
+        void drain(Cache& cache, std::size_t count) noexcept;
+    public:
+        Pool() : Pool(Config{}) {}
+        explicit Pool(Config config);
+        Pool(const Pool&) = delete;
+        ~Pool();
+
+        // Returns an empty Buffer when the pool is exhausted.
+        Buffer allocate() noexcept;
+
+        std::size_t buffer_size() const noexcept {
+            return config.buffer_size;
+        }
+
+        bool uses_huge_pages() const noexcept {
+            return huge_pages;
+        }
+    };
+
+    // Hands out Buffers over memory owned by someone else, e.g. the blocks
+    // of a packet ring the kernel fills. A region is in use until the last
+    // Buffer lent from it is gone, its owner checks in_use() before reusing
+    // the memory. The Lender has to outlive every Buffer it lent.
+    class Lender {
+        std::unique_ptr<detail::Slot[]> slots;
+    public:
+        explicit Lender(std::size_t regions) : slots{std::make_unique<detail::Slot[]>(regions)} {}
+
+        // The region must not be in use.
+        Buffer lend(std::size_t region, std::span<std::byte> memory) noexcept {
+            auto& slot = slots[region];
+            slot.size = static_cast<uint32_t>(memory.size());
+            slot.offset = 0;
+            slot.capacity = static_cast<uint32_t>(memory.size());
+            slot.memory = memory.data();
+            slot.pool = nullptr;
+            slot.references.store(1, std::memory_order_relaxed);
+            return Buffer{&slot};
+        }
+
+        bool in_use(std::size_t region) const noexcept {
+            // Pairs with the release of the last Buffer, whatever was done
+            // with the memory through it happens before the owner reuses it.
+            return slots[region].references.load(std::memory_order_acquire) != 0;
+        }
+    };
+
+    inline void Buffer::release() noexcept {
+        if (slot != nullptr && slot->references.fetch_sub(1, std::memory_order_acq_rel) == 1 && slot->pool != nullptr) {
+            slot->pool->release(slot);
+        }
+        slot = nullptr;
+    }
+}
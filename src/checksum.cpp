@@ -0,0 +1,155 @@
+#include <cstring>
+
+#include "checksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHECKSUM_X86
+#include <immintrin.h>
+#endif
+
+namespace checksum {
+    namespace {
+        template<typename T>
+        T load(const std::byte* data) {
+            T value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        // Adds native 32 bit words into a 64 bit accumulator, carries are
+        // folded back in by fold(). Good for inputs far beyond 4 GiB.
+        uint64_t sum_generic(const std::byte* data, std::size_t size, uint64_t sum) {
+            constexpr uint64_t low = 0xFFFF'FFFF;
+
+            for (; size >= 32; data += 32, size -= 32) {
+                auto a = load<uint64_t>(data);
+                auto b = load<uint64_t>(data + 8);
+                auto c = load<uint64_t>(data + 16);
+                auto d = load<uint64_t>(data + 24);
+                sum += (a & low) + (a >> 32) + (b & low) + (b >> 32);
+                sum += (c & low) + (c >> 32) + (d & low) + (d >> 32);
+            }
+            for (; size >= 8; data += 8, size -= 8) {
+                auto a = load<uint64_t>(data);
+                sum += (a & low) + (a >> 32);
+            }
+            if (size >= 4) {
+                sum += load<uint32_t>(data);
+                data += 4;
+                size -= 4;
+            }
+            if (size >= 2) {
+                sum += load<uint16_t>(data);
+                data += 2;
+                size -= 2;
+            }
+            if (size == 1) {
+                // The missing byte of the last word is zero.
+                std::byte word[2] = {*data, std::byte{0}};
+                sum += load<uint16_t>(word);
+            }
+
+            return sum;
+        }
+
+#ifdef CHECKSUM_X86
+        __attribute__((target("sse2")))
+        uint64_t sum_sse2(const std::byte* data, std::size_t size, uint64_t sum) {
+            const auto zero = _mm_setzero_si128();
+            auto acc0 = zero;
+            auto acc1 = zero;
+
+            for (; size >= 32; data += 32, size -= 32) {
+                auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+                auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+                acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+                acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+                acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+                acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+            }
+
+            alignas(16) uint64_t lanes[2];
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), _mm_add_epi64(acc0, acc1));
+
+            return sum_generic(data, size, sum + lanes[0] + lanes[1]);
+        }
+
+        __attribute__((target("avx2")))
+        uint64_t sum_avx2(const std::byte* data, std::size_t size, uint64_t sum) {
+            const auto zero = _mm256_setzero_si256();
+            auto acc0 = zero;
+            auto acc1 = zero;
+
+            for (; size >= 64; data += 64, size -= 64) {
+                auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+                auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32));
+                acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+                acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+                acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+                acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+            }
+
+            alignas(32) uint64_t lanes[4];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi64(acc0, acc1));
+
+            return sum_sse2(data, size, sum + lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+        }
+#endif
+
+        Kernel select_kernel() noexcept {
+#ifdef CHECKSUM_X86
+            // Runs from a static initializer, possibly before libgcc's own.
+            __builtin_cpu_init();
+#endif
+            if (is_supported(Kernel::AVX2)) {
+                return Kernel::AVX2;
+            }
+            if (is_supported(Kernel::SSE2)) {
+                return Kernel::SSE2;
+            }
+            return Kernel::Generic;
+        }
+
+        const Kernel selected_kernel = select_kernel();
+    }
+
+    bool is_supported(Kernel kernel) noexcept {
+        switch (kernel) {
+        case Kernel::Generic:
+            return true;
+#ifdef CHECKSUM_X86
+        case Kernel::SSE2:
+            return __builtin_cpu_supports("sse2");
+        case Kernel::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+        }
+    }
+
+    Kernel best_kernel() noexcept {
+        return selected_kernel;
+    }
+
+    uint64_t sum(std::span<const std::byte> bytes, uint64_t initial, Kernel kernel) noexcept {
+        switch (kernel) {
+#ifdef CHECKSUM_X86
+        case Kernel::AVX2:
+            return sum_avx2(bytes.data(), bytes.size(), initial);
+        case Kernel::SSE2:
+            return sum_sse2(bytes.data(), bytes.size(), initial);
+#endif
+        default:
+            return sum_generic(bytes.data(), bytes.size(), initial);
+        }
+    }
+
+    uint64_t sum(std::span<const std::byte> bytes, uint64_t initial) noexcept {
+        // IPv4 headers are the common case and too short for vectors to pay off.
+        if (bytes.size() < 64) {
+            return sum_generic(bytes.data(), bytes.size(), initial);
+        }
+        return sum(bytes, initial, selected_kernel);
+    }
+}
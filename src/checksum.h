@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <bit>
+
+// Internet checksum (RFC 1071).
+namespace checksum {
+    enum class Kernel {
+        Generic,
+        SSE2,
+        AVX2
+    };
+
+    bool is_supported(Kernel kernel) noexcept;
+
+    // Fastest kernel supported by the CPU, selected once at startup.
+    Kernel best_kernel() noexcept;
+
+    // Adds the 16 bit words of bytes to an unfolded one's complement sum.
+    // Sums of consecutive chunks can be chained through initial as long as
+    // every chunk but the last has an even length.
+    uint64_t sum(std::span<const std::byte> bytes, uint64_t initial, Kernel kernel) noexcept;
+    uint64_t sum(std::span<const std::byte> bytes, uint64_t initial = 0) noexcept;
+
+    // Folds a sum into the 16 bit one's complement sum, in host byte order.
+    constexpr uint16_t fold(uint64_t sum) noexcept {
+        while (sum >> 16 != 0) {
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+
+        auto folded = static_cast<uint16_t>(sum);
+        if constexpr (std::endian::native == std::endian::little) {
+            folded = std::byteswap(folded);
+        }
+        return folded;
+    }
+
+    // Checksum to store in a header, or 0 when verifying a header that
+    // already contains a valid one.
+    inline uint16_t compute(std::span<const std::byte> bytes) noexcept {
+        return static_cast<uint16_t>(~fold(sum(bytes)));
+    }
+
+    // Checksum after one 16 bit word it covers changed from old_word to
+    // new_word, without summing the rest again (RFC 1624, eqn. 3). All in
+    // the byte order compute() returns.
+    constexpr uint16_t update(uint16_t checksum, uint16_t old_word, uint16_t new_word) noexcept {
+        uint32_t sum = uint32_t{static_cast<uint16_t>(~checksum)} + static_cast<uint16_t>(~old_word) + new_word;
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        return static_cast<uint16_t>(~sum);
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+#include <chrono>
+
+#include "buffer_pool.h"
+
+namespace device {
+    using ssize_t = std::make_signed_t<std::size_t>;
+    using Timeout = std::chrono::duration<int, std::milli>;
+
+    // A source and sink of raw ethernet frames. LinkLayer is templated on it,
+    // so the per-frame calls are resolved at compile time.
+    //
+    // try_read returns the frame length, 0 on timeout and a negative value
+    // when the device can no longer be read from.
+    template<typename T>
+    concept Device =
+        std::move_constructible<T> &&
+        requires(T& device, std::span<const std::byte> frame, std::span<std::byte> buffer, Timeout timeout) {
+            { device.write(frame) } -> std::same_as<ssize_t>;
+            { device.try_read(buffer, timeout) } -> std::same_as<ssize_t>;
+        };
+
+    // A device that can pass a whole burst of received frames to a handler
+    // in place, without copying them into a caller supplied buffer. Each
+    // frame comes with a Buffer holding it, a copy of which keeps the frame
+    // valid after the handler returns. Frames with an empty one have to be
+    // copied to be kept.
+    //
+    // receive returns the number of frames handled, 0 on timeout and
+    // a negative value when the device can no longer be read from.
+    template<typename T>
+    concept BurstDevice =
+        Device<T> &&
+        requires(T& device, void (*handler)(std::span<const std::byte>, const buffer::Buffer&), Timeout timeout) {
+            { device.receive(handler, timeout) } -> std::same_as<ssize_t>;
+        };
+
+    // A frame handed over in pieces, e.g. headers and a slice of a payload.
+    using Parts = std::span<const std::span<const std::byte>>;
+    inline constexpr std::size_t max_parts = 8;
+
+    // A device that writes a frame from up to max_parts pieces without
+    // them being joined into one buffer first.
+    template<typename T>
+    concept GatherDevice =
+        Device<T> &&
+        requires(T& device, Parts parts) {
+            { device.writev(parts) } -> std::same_as<ssize_t>;
+        };
+
+    // A device whose frames may be preceded by a virtio-net header in both
+    // directions (IFF_VNET_HDR). offloads() are the virtio_net::Offload flags
+    // of the frames it receives.
+    template<typename T>
+    concept VnetDevice =
+        GatherDevice<T> &&
+        requires(const T& device) {
+            { device.has_vnet_header() } -> std::same_as<bool>;
+            { device.offloads() } -> std::same_as<unsigned>;
+        };
+
+    // A device with several receive queues, e.g. a multi-queue TAP. LinkLayer
+    // reads each queue from a thread of its own and writes to the device.
+    template<typename T>
+    concept MultiQueueDevice =
+        Device<T> &&
+        Device<typename T::Queue> &&
+        requires(T& device, std::size_t index) {
+            { device.queue_count() } -> std::same_as<std::size_t>;
+            { device.queue(index) } -> std::same_as<typename T::Queue&>;
+        };
+}
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <ranges>
+
+#include "gro.h"
+#include "tcp.h"
+
+namespace gro {
+    Merger::Merger(Config config, buffer::Pool& pool)
+        : config{config},
+          pool{pool}
+    {
+        flows.reserve(config.max_flows);
+        ready.reserve(config.max_flows + 1);
+    }
+
+    bool Merger::add(Packet packet, const buffer::Buffer& frame, bool checksum_valid) {
+        if (!config.enabled || packet.bytes.size() < ipv4::Format::byte_size()) {
+            return false;
+        }
+
+        const auto header = packet.decode();
+        if (header.get<"protocol">() != ipv4::Protocol::TCP ||
+            header.get<"more_fragments">() != 0 ||
+            header.get<"fragment_offset">() != 0 ||
+            !packet.is_valid(header))
+        {
+            return false;
+        }
+
+        const auto bytes = packet.payload(header);
+        if (bytes.size() < tcp::Format::byte_size()) {
+            return false;
+        }
+
+        const auto segment = tcp::Packet<std::span<const std::byte>>{bytes}.decode();
+        const auto source_address = header.get<"source_address">();
+        const auto destination_address = header.get<"destination_address">();
+        const auto source_port = segment.get<"source_port">();
+        const auto destination_port = segment.get<"destination_port">();
+
+        const std::size_t tcp_size = segment.get<"data_offset">() * 4u;
+        // Segments that carry anything but data and an acknowledgment go up
+        // on their own, so does one TCP would count as a checksum error.
+        const bool candidate =
+            frame &&
+            header.get<"header_length">() * 4u == ipv4::Format::byte_size() &&
+            tcp_size >= tcp::Format::byte_size() && tcp_size < bytes.size() &&
+            segment.get<"ack">() &&
+            !segment.get<"syn">() && !segment.get<"fin">() && !segment.get<"rst">() &&
+            !segment.get<"urg">() && !segment.get<"cwr">() && !segment.get<"ece">() &&
+            (checksum_valid || tcp::checksum(source_address, destination_address, bytes) == 0);
+
+        auto flow = std::ranges::find_if(flows, [&](const Flow& flow){
+            return flow.source_address == source_address &&
+                   flow.destination_address == destination_address &&
+                   flow.source_port == source_port &&
+                   flow.destination_port == destination_port;
+        });
+
+        const auto payload = bytes.subspan(tcp_size);
+        if (flow != flows.end()) {
+            const auto first = Packet{flow->first};
+            const auto first_options = flow->first.subspan(ipv4::Format::byte_size() + tcp::Format::byte_size(), flow->header_size - ipv4::Format::byte_size() - tcp::Format::byte_size());
+            const bool joins =
+                candidate &&
+                segment.get<"sequence">() == flow->next_sequence &&
+                segment.get<"acknowledgment">() == flow->acknowledgment &&
+                header.get<"type_of_service">() == first.get<"type_of_service">() &&
+                ipv4::Format::byte_size() + tcp_size == flow->header_size &&
+                std::ranges::equal(bytes.subspan(tcp::Format::byte_size(), tcp_size - tcp::Format::byte_size()), first_options) &&
+                payload.size() <= flow->segment_size &&
+                flow->size + payload.size() <= config.max_size;
+
+            if (joins && append(*flow, payload)) {
+                flow->window = segment.get<"window">();
+                flow->push = segment.get<"psh">();
+                // A short or pushed segment ends what the sender sent at once.
+                if (flow->push || payload.size() < flow->segment_size) {
+                    finish(flow);
+                }
+                return true;
+            }
+            finish(flow);
+        }
+
+        if (!candidate || segment.get<"psh">()) {
+            return false;
+        }
+
+        if (flows.size() >= config.max_flows) {
+            finish(flows.begin());
+        }
+
+        const auto header_size = ipv4::Format::byte_size() + tcp_size;
+        flows.push_back(Flow{
+            .source_address = source_address,
+            .destination_address = destination_address,
+            .source_port = source_port,
+            .destination_port = destination_port,
+            .frame = frame,
+            .first = packet.bytes.first(header.get<"total_length">()),
+            .merged = {},
+            .size = header.get<"total_length">(),
+            .header_size = header_size,
+            .segment_size = payload.size(),
+            .segments = 1,
+            .next_sequence = segment.get<"sequence">() + static_cast<uint32_t>(payload.size()),
+            .acknowledgment = segment.get<"acknowledgment">(),
+            .window = segment.get<"window">(),
+            .push = false
+        });
+        return true;
+    }
+
+    bool Merger::append(Flow& flow, std::span<const std::byte> payload) {
+        if (!flow.merged) {
+            auto merged = pool.allocate();
+            if (!merged || merged.capacity() < config.max_size) {
+                return false;
+            }
+            std::ranges::copy(flow.first, merged.bytes().begin());
+            flow.merged = std::move(merged);
+            flow.first = flow.merged.bytes().first(flow.size);
+            flow.frame = {};
+        }
+
+        std::ranges::copy(payload, flow.merged.bytes().begin() + static_cast<std::ptrdiff_t>(flow.size));
+        flow.size += payload.size();
+        flow.segments += 1;
+        flow.next_sequence += static_cast<uint32_t>(payload.size());
+        return true;
+    }
+
+    void Merger::finish(std::vector<Flow>::iterator flow) {
+        if (flow->merged) {
+            const auto bytes = flow->merged.bytes().first(flow->size);
+            ipv4::Packet<std::span<std::byte>> packet{bytes};
+            packet.set<"total_length">(static_cast<uint16_t>(flow->size));
+            packet.update_checksum();
+
+            tcp::Packet<std::span<std::byte>> segment{packet.payload()};
+            segment.set<"window">(flow->window);
+            segment.set<"psh">(flow->push);
+
+            flow->merged.resize(flow->size);
+            ready.push_back({std::move(flow->merged), bytes});
+            counters.merged += flow->segments;
+            counters.flushed += 1;
+        } else {
+            ready.push_back({std::move(flow->frame), flow->first});
+        }
+        flows.erase(flow);
+    }
+
+    void Merger::flush() {
+        while (!flows.empty()) {
+            finish(flows.begin());
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <limits>
+#include <concepts>
+
+#include "types.h"
+#include "ipv4.h"
+#include "device.h"
+#include "buffer_pool.h"
+
+// Generic receive offload. Consecutive TCP segments of one connection that
+// arrive in the same burst are merged into one larger IPv4 packet, so the
+// layers above run once per burst rather than once per frame.
+namespace gro {
+    struct Config {
+        bool enabled = true;
+        // Connections held at once, a segment of another one flushes the
+        // one held the longest.
+        std::size_t max_flows = 8;
+        // Largest merged packet, IPv4 header included.
+        std::size_t max_size = std::numeric_limits<uint16_t>::max();
+        // Frames read in a row before everything held is flushed.
+        std::size_t max_burst = 64;
+        // How long a read waits for the rest of a burst while packets are held.
+        device::Timeout flush_timeout{0};
+        // Buffers of merged packets, shared by the receive queues.
+        std::size_t buffer_count = 256;
+    };
+
+    struct Stats {
+        // Segments that went up as part of a merged packet.
+        uint64_t merged;
+        // Merged packets that went up.
+        uint64_t flushed;
+    };
+
+    // Holds segments of the current burst. Not thread safe, every receive
+    // queue has one of its own.
+    class Merger {
+    public:
+        using Packet = ipv4::Packet<std::span<const std::byte>>;
+
+    private:
+        struct Flow {
+            IPv4_t source_address;
+            IPv4_t destination_address;
+            uint16_t source_port;
+            uint16_t destination_port;
+
+            // The first segment, in the frame it was received in, until
+            // another one joins it.
+            buffer::Buffer frame;
+            std::span<const std::byte> first;
+
+            // IPv4 and TCP headers of the first segment followed by the
+            // payloads so far.
+            buffer::Buffer merged;
+            std::size_t size;
+            std::size_t header_size;
+            // Payload of the first segment, later ones are no larger.
+            std::size_t segment_size;
+            uint64_t segments;
+
+            uint32_t next_sequence;
+            uint32_t acknowledgment;
+            uint16_t window;
+            bool push;
+        };
+
+        struct Ready {
+            buffer::Buffer frame;
+            std::span<const std::byte> packet;
+        };
+
+        Config config;
+        buffer::Pool& pool;
+        std::vector<Flow> flows;
+        std::vector<Ready> ready;
+        Stats counters{};
+
+        bool append(Flow& flow, std::span<const std::byte> payload);
+        void finish(std::vector<Flow>::iterator flow);
+
+    public:
+        // Merged packets are built in buffers of pool, which has to hold
+        // config.max_size bytes in each.
+        Merger(Config config, buffer::Pool& pool);
+
+        // Takes the packet, or returns false when it is to be handled on its
+        // own. Either way packets of its connection held before are moved to
+        // the ready ones, which go up first. frame is the pool buffer holding
+        // the packet, it is kept instead of copying a segment nothing joins.
+        bool add(Packet packet, const buffer::Buffer& frame, bool checksum_valid);
+
+        // Ends the burst, everything held becomes ready.
+        void flush();
+
+        // Hands the ready packets to deliver in order, along with the buffer
+        // holding each. Their TCP checksums were verified, but the one of a
+        // merged packet is left as it was in the first segment.
+        template<std::invocable<Packet, const buffer::Buffer&> Deliver>
+        void drain(Deliver&& deliver) {
+            for (auto& packet : ready) {
+                deliver(Packet{packet.packet}, packet.frame);
+            }
+            ready.clear();
+        }
+
+        bool empty() const noexcept {
+            return flows.empty();
+        }
+
+        Stats stats() const noexcept {
+            return counters;
+        }
+    };
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <span>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "types.h"
+#include "packet.h"
+#include "ethernet.h"
+#include "ipv4.h"
+#include "stats.h"
+#include "checksum.h"
+
+namespace icmp {
+    enum class Type : uint8_t {
+        EchoReply = 0,
+        DestinationUnreachable = 3,
+        EchoRequest = 8,
+        TimeExceeded = 11
+    };
+
+    // Header of echo messages, other types use the last four bytes differently.
+    using Format = packet::Format<
+        {"type", 8, packet::field_type<Type>},
+        {"code", 8},
+        {"checksum", 16},
+        {"id", 16},
+        {"sequence", 16}
+    >;
+
+    template<typename Range>
+    using Packet = packet::Packet<Range, Format>;
+
+    template<typename InternetLayer>
+    class Handler {
+        InternetLayer& internet_layer() {
+            return static_cast<InternetLayer&>(*this);
+        }
+    public:
+        Handler() requires(std::derived_from<InternetLayer, Handler>) = default;
+
+        // Answers echo requests to our address and returns true, other
+        // messages are left to the caller. A request received in a frame
+        // buffer is turned into the reply inside it, with both checksums
+        // updated incrementally, and sent back without any allocation.
+        bool handle(ipv4::Datagram& datagram);
+    };
+
+    template<typename InternetLayer>
+    bool Handler<InternetLayer>::handle(ipv4::Datagram& datagram) {
+        auto message = datagram.payload();
+        if (message.size() < Format::byte_size() || datagram.destination_address != internet_layer().get_ip()) {
+            return false;
+        }
+
+        Packet<std::span<std::byte>> packet{message};
+        if (packet.get<"type">() != Type::EchoRequest) {
+            return false;
+        }
+        stats::add(stats::Counter::IcmpEchoRequests);
+
+        // The rest of the message is echoed as it is, a corrupted request
+        // gets a reply with an equally wrong checksum.
+        const uint16_t code = packet.get<"code">();
+        packet.set<"type">(Type::EchoReply);
+        packet.set<"checksum">(checksum::update(
+            packet.get<"checksum">(),
+            static_cast<uint16_t>(std::to_underlying(Type::EchoRequest) << 8 | code),
+            static_cast<uint16_t>(std::to_underlying(Type::EchoReply) << 8 | code)
+        ));
+
+        if (!datagram.is_borrowed() || datagram.header_offset < ethernet::Format::byte_size()) {
+            // Reassembled, possibly larger than the MTU, or not in an
+            // ethernet frame.
+            if (internet_layer().send(datagram.source_address, ipv4::Protocol::ICMP, message)) {
+                stats::add(stats::Counter::IcmpEchoReplies);
+            }
+            return true;
+        }
+
+        // The frame still holds the request's headers, the ethernet header
+        // right in front of the IPv4 one. Swapping the addresses leaves the
+        // header checksum as it is, only the TTL needs an update.
+        ethernet::Packet frame{datagram.frame.data().subspan(datagram.header_offset - ethernet::Format::byte_size())};
+        auto ip = frame.data<ipv4::Packet>();
+
+        ip.set<"source_address">(datagram.destination_address);
+        ip.set<"destination_address">(datagram.source_address);
+
+        const uint16_t protocol = std::to_underlying(ipv4::Protocol::ICMP);
+        const uint16_t ttl = internet_layer().get_ttl();
+        const uint16_t old_ttl = ip.get<"ttl">();
+        ip.set<"ttl">(internet_layer().get_ttl());
+        ip.set<"checksum">(checksum::update(
+            ip.get<"checksum">(),
+            static_cast<uint16_t>(old_ttl << 8 | protocol),
+            static_cast<uint16_t>(ttl << 8 | protocol)
+        ));
+
+        internet_layer().send(frame.get<"source_mac">(), ethernet::Ethertype::IPv4, ip.to_span(0, ip.get<"total_length">()));
+        stats::add(stats::Counter::IcmpEchoReplies);
+        return true;
+    }
+}
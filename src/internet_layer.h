@@ -2,54 +2,110 @@
 
 #include <thread>
 #include <chrono>
+#include <vector>
 
 #include "types.h"
 #include "link_layer.h"
 #include "arp.h"
 #include "ipv4.h"
-#include "channel.h"
+#include "icmp.h"
+#include "udp.h"
+#include "tcp.h"
+#include "bounded_channel.h"
+#include "device.h"
+#include "tap.h"
+#include "logging.h"
+
+template <device::Device Device = Tap>
+class InternetLayer :
+    public LinkLayer<InternetLayer<Device>, Device>,
+    public arp::Handler<InternetLayer<Device>>,
+    public ipv4::Handler<InternetLayer<Device>>,
+    public icmp::Handler<InternetLayer<Device>>,
+    public udp::Handler<InternetLayer<Device>>,
+    public tcp::Handler<InternetLayer<Device>>
+{
+    using Link = LinkLayer<InternetLayer, Device>;
 
-class InternetLayer : public LinkLayer<InternetLayer>, public arp::Handler<InternetLayer>, public ipv4::Handler<InternetLayer> {
     IPv4_t ip_address;
     IPv4_t gateway;
 
-    Channel<ipv4::Datagram> datagrams;
+    // Filled by the link thread, drained by run(). Under overload new
+    // datagrams are dropped rather than stalling the receive path.
+    BoundedChannel<ipv4::Datagram> datagrams{{
+        .capacity = 1024,
+        .overflow = BoundedChannel<ipv4::Datagram>::Overflow::DropNewest
+    }};
 public:
-    InternetLayer(IPv4_t ip_address, IPv4_t gateway, LinkLayer link_layer)
-        : LinkLayer{std::move(link_layer)},
+    InternetLayer(IPv4_t ip_address, IPv4_t gateway, Link link_layer, arp::Config arp_config = {}, ipv4::Config ipv4_config = {}, tcp::Config tcp_config = {})
+        : Link{std::move(link_layer)},
+          arp::Handler<InternetLayer>{arp_config},
+          ipv4::Handler<InternetLayer>{ipv4_config},
+          tcp::Handler<InternetLayer>{tcp_config},
           ip_address{ip_address},
           gateway{gateway}
         {}
 
     IPv4_t get_ip() {return ip_address;}
+    IPv4_t get_gateway() {return gateway;}
+
+    uint64_t dropped_datagrams() const {return datagrams.dropped();}
 
     template<std::same_as<ipv4::Datagram> T>
     void handle(T&& datagram) {
-        datagrams.emplace(std::forward<T>(datagram));
+        // Echo requests are answered right away on the link thread.
+        if (datagram.protocol == ipv4::Protocol::ICMP && icmp::Handler<InternetLayer>::handle(datagram)) {
+            return;
+        }
+        if (datagram.protocol == ipv4::Protocol::UDP) {
+            udp::Handler<InternetLayer>::handle(std::move(datagram));
+            return;
+        }
+        if (datagram.protocol == ipv4::Protocol::TCP) {
+            tcp::Handler<InternetLayer>::handle(datagram);
+            return;
+        }
+        if (!datagrams.emplace(std::forward<T>(datagram))) {
+            stats::add(stats::Counter::IPv4QueueFull);
+        }
     }
     using arp::Handler<InternetLayer>::handle;
     using ipv4::Handler<InternetLayer>::handle;
+    using Link::send;
+    using ipv4::Handler<InternetLayer>::send;
+
+    // Runs the timers of the protocols, called periodically by the link thread.
+    void poll(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+        arp::Handler<InternetLayer>::poll(now);
+        ipv4::Handler<InternetLayer>::poll(now);
+        tcp::Handler<InternetLayer>::poll(now);
+    }
 
     void run(std::stop_token stop_token) {
+        this->announce();
+
         std::jthread link_thread([&]{
-            LinkLayer::run(stop_token);
+            Link::run(stop_token);
             datagrams.close();
         });
         
         using namespace std::chrono_literals;
-        using clock = std::chrono::system_clock;
         while (false) {
             std::this_thread::sleep_for(5s);
-            auto mac = resolve(gateway);
+            auto mac = this->resolve(gateway);
             if (mac.has_value()) {
-                std::cout << std::format("[{:%T}] IP {} is at MAC {}\n", clock::now(), format_ipv4(gateway), format_mac(*mac));
+                logging::info("IP {} is at MAC {}", format_ipv4(gateway), format_mac(*mac));
                 break;
             } else {
-                std::cout << std::format("[{:%T}] Could not resolve IP {}\n", clock::now(), format_ipv4(gateway));
+                logging::info("Could not resolve IP {}", format_ipv4(gateway));
             }
         }
-        for (auto datagram : datagrams) {
-            std::cout << std::format("[{:%T}] IPv4 datagram with protocol {:0>2x}\n", clock::now(), std::to_underlying(datagram.protocol));
+        std::vector<ipv4::Datagram> batch;
+        while (datagrams.pop_bulk(batch, 32) != 0) {
+            for (auto& datagram : batch) {
+                logging::debug("IPv4 datagram with protocol {:0>2x}", std::to_underlying(datagram.protocol));
+            }
+            batch.clear();
         }
     }
 };
\ No newline at end of file
@@ -1,69 +1,338 @@
 #include <algorithm>
+#include <bit>
+#include <cstring>
 
 #include "ipv4.h"
 
 namespace ipv4 {
-    void Assembler::remove_older_then(clock::duration age) {
-        auto time_point = clock::now() - age;
-        while (!queue.empty() && queue.front().first < time_point)
-        {
-            datagrams.erase(queue.front().second);
-            queue.pop();
+    namespace {
+        // Largest datagram the total length field can describe.
+        constexpr std::size_t max_size = std::numeric_limits<uint16_t>::max();
+        constexpr std::size_t unknown_size = std::numeric_limits<std::size_t>::max();
+
+        // Backward shift deletion for linear probing, so lookups never have
+        // to skip tombstones.
+        template<typename Slot, typename Home, typename IsEmpty>
+        void shift_back(std::vector<Slot>& slots, std::size_t index, std::size_t mask, Home home, IsEmpty is_empty) {
+            auto hole = index;
+            for (auto i = (index + 1) & mask; !is_empty(slots[i]); i = (i + 1) & mask) {
+                if (((i - home(slots[i])) & mask) >= ((i - hole) & mask)) {
+                    slots[hole] = slots[i];
+                    hole = i;
+                }
+            }
+            slots[hole] = Slot{};
+        }
+    }
+
+    Assembler::Assembler(Config config)
+        : config{config},
+          mask{std::bit_ceil(std::max<std::size_t>(config.max_datagrams, 1) * 2) - 1},
+          shift{static_cast<unsigned>(64 - std::countr_zero(mask + 1))},
+          slots(mask + 1),
+          sources(mask + 1),
+          entries(std::max<std::size_t>(config.max_datagrams, 1))
+    {
+        free_entries.reserve(entries.size());
+        for (auto i = entries.size(); i-- > 0;) {
+            free_entries.push_back(static_cast<uint32_t>(i));
         }
     }
 
-    std::optional<Datagram> Assembler::assemble(Packet<std::span<const std::byte>> packet) {
-        using namespace std::chrono_literals;
-        remove_older_then(1s);
+    std::size_t Assembler::home(const Key& key) const noexcept {
+        auto addresses = uint64_t{key.source_address} << 32 | key.destination_address;
+        auto rest = uint64_t{key.id} << 8 | std::to_underlying(key.protocol);
+        auto hash = (addresses ^ (rest * 0xC2B2'AE3D'27D4'EB4F)) * 0x9E37'79B9'7F4A'7C15;
+        return static_cast<std::size_t>(hash >> shift) & mask;
+    }
 
-        std::optional<std::vector<std::byte>> data;
+    std::size_t Assembler::home(IPv4_t source_address) const noexcept {
+        return static_cast<std::size_t>((source_address * uint64_t{0x9E37'79B9'7F4A'7C15}) >> shift) & mask;
+    }
 
-        if (packet.get<"more_fragments">() == 0 && packet.get<"fragment_offset">() == 0) {
-            data = std::vector<std::byte>{packet.payload().begin(), packet.payload().end()};
-        } else {
-            Key key {
-                packet.get<"source_address">(),
-                packet.get<"destination_address">(),
-                Protocol{packet.get<"protocol">()},
-                packet.get<"id">()
-            };
+    std::size_t Assembler::find(const Key& key) const noexcept {
+        for (auto index = home(key); slots[index].entry != empty; index = (index + 1) & mask) {
+            if (slots[index].key == key) {
+                return index;
+            }
+        }
+        return slots.size();
+    }
+
+    // There are never more sources than datagrams, so there is always room.
+    auto Assembler::source(IPv4_t address) -> Source& {
+        auto index = home(address);
+        while (sources[index].datagrams != 0 && sources[index].address != address) {
+            index = (index + 1) & mask;
+        }
+        sources[index].address = address;
+        return sources[index];
+    }
+
+    uint32_t Assembler::start(const Key& key, clock::time_point now) {
+        if (free_entries.empty()) {
+            evict(std::nullopt, empty);
+        }
+
+        auto index = home(key);
+        while (slots[index].entry != empty) {
+            index = (index + 1) & mask;
+        }
+
+        auto entry = free_entries.back();
+        free_entries.pop_back();
+        slots[index] = {key, entry};
 
-            auto& datagram = datagrams[key];
+        auto& datagram = entries[entry];
+        datagram.key = key;
+        datagram.started = now;
+        datagram.total_size = unknown_size;
+        datagram.holes.assign({{0, max_size}});
+        datagram.charged = 0;
 
-            if (datagram.offsets_received.empty()) {
-                queue.push({clock::now(), key});
+        datagram.older = newest;
+        datagram.newer = empty;
+        (newest != empty ? entries[newest].newer : oldest) = entry;
+        newest = entry;
+
+        ++source(key.source_address).datagrams;
+        account(entry);
+        return entry;
+    }
+
+    void Assembler::erase(uint32_t entry) {
+        auto& datagram = entries[entry];
+
+        (datagram.older != empty ? entries[datagram.older].newer : oldest) = datagram.newer;
+        (datagram.newer != empty ? entries[datagram.newer].older : newest) = datagram.older;
+
+        auto address = datagram.key.source_address;
+        auto& owner = source(address);
+        owner.bytes -= datagram.charged;
+        memory -= datagram.charged;
+        if (--owner.datagrams == 0) {
+            shift_back(
+                sources, static_cast<std::size_t>(&owner - sources.data()), mask,
+                [&](const Source& source) { return home(source.address); },
+                [](const Source& source) { return source.datagrams == 0; }
+            );
+        }
+
+        shift_back(
+            slots, find(datagram.key), mask,
+            [&](const Slot& slot) { return home(slot.key); },
+            [](const Slot& slot) { return slot.entry == empty; }
+        );
+
+        // A flood of tiny fragments must not leave large hole lists behind.
+        if (datagram.holes.capacity() > 16) {
+            datagram.holes = std::vector<Hole>{};
+        }
+        datagram.data = std::vector<std::byte>{};
+        free_entries.push_back(entry);
+    }
+
+    void Assembler::remove_older_than(clock::time_point time_point) {
+        while (oldest != empty && entries[oldest].started < time_point) {
+            erase(oldest);
+            ++counters.timeouts;
+            stats::add(stats::Counter::ReassemblyTimeouts);
+        }
+    }
+
+    void Assembler::expire(clock::time_point now) {
+        remove_older_than(now - config.timeout);
+    }
+
+    bool Assembler::evict(std::optional<IPv4_t> source_address, uint32_t keep) {
+        for (auto entry = oldest; entry != empty; entry = entries[entry].newer) {
+            if (entry != keep && (!source_address || entries[entry].key.source_address == *source_address)) {
+                erase(entry);
+                ++counters.evictions;
+                stats::add(stats::Counter::ReassemblyEvictions);
+                return true;
             }
+        }
+        return false;
+    }
 
-            auto fragment_offset = packet.get<"fragment_offset">();
-            if (!datagram.offsets_received.insert(fragment_offset).second) {
-                return std::nullopt;
+    bool Assembler::make_room(uint32_t entry, std::size_t bytes) {
+        const auto address = entries[entry].key.source_address;
+        if (entries[entry].charged + bytes > std::min(config.max_bytes, config.max_bytes_per_source)) {
+            return false;
+        }
+
+        while (source(address).bytes + bytes > config.max_bytes_per_source) {
+            if (!evict(address, entry)) {
+                return false;
+            }
+        }
+        while (memory + bytes > config.max_bytes) {
+            if (!evict(std::nullopt, entry)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Assembler::account(uint32_t entry) {
+        auto& datagram = entries[entry];
+        auto footprint = datagram.data.capacity() + datagram.holes.capacity() * sizeof(Hole);
+
+        auto& owner = source(datagram.key.source_address);
+        owner.bytes = owner.bytes - datagram.charged + footprint;
+        memory = memory - datagram.charged + footprint;
+        datagram.charged = footprint;
+    }
+
+    bool Assembler::add(uint32_t entry, std::size_t offset, std::span<const std::byte> payload, bool more_fragments) {
+        auto& datagram = entries[entry];
+        const auto end = offset + payload.size();
+        auto& holes = datagram.holes;
+
+        if (!more_fragments) {
+            // Nothing may have been received past the end, nor another end.
+            if (datagram.total_size != unknown_size ? end != datagram.total_size : datagram.data.size() > end) {
+                return false;
             }
+        } else if (end > datagram.total_size) {
+            return false;
+        }
 
-            std::size_t begin = fragment_offset * 8;
-            std::size_t length = packet.payload().size();
-            std::size_t end = begin + length;
+        if (datagram.data.size() < end) {
+            // Sized once when the end is known, otherwise grows geometrically.
+            auto capacity = datagram.data.capacity();
+            if (!more_fragments) {
+                capacity = std::max(capacity, end);
+            } else if (capacity < end) {
+                capacity = std::max(end, 2 * capacity);
+            }
 
-            datagram.data.resize(std::max(datagram.data.size(), end));
-            std::ranges::copy(packet.payload(), datagram.data.begin() + begin);
-            datagram.bytes_received += length;
+            if (capacity > datagram.data.capacity()) {
+                if (!make_room(entry, capacity - datagram.data.capacity())) {
+                    return false;
+                }
+                datagram.data.reserve(capacity);
+            }
+            datagram.data.resize(end);
+        }
+        std::memcpy(datagram.data.data() + offset, payload.data(), payload.size());
 
-            if (packet.get<"more_fragments">() == 0) {
-                datagram.total_size = end;
+        if (!more_fragments) {
+            datagram.total_size = end;
+            std::erase_if(holes, [&](const Hole& hole) { return hole.first >= end; });
+            if (!holes.empty()) {
+                holes.back().last = std::min(holes.back().last, end);
             }
+        }
 
-            if (datagram.total_size == datagram.bytes_received) {
-                data = std::move(datagram.data);
-                datagrams.erase(key);
+        for (std::size_t i = 0; i < holes.size();) {
+            auto hole = holes[i];
+            if (hole.last <= offset || end <= hole.first) {
+                ++i;
+            } else if (hole.first < offset && end < hole.last) {
+                // Within a single hole, which is split in two.
+                holes[i].last = offset;
+                holes.insert(holes.begin() + static_cast<std::ptrdiff_t>(i) + 1, {end, hole.last});
+                break;
+            } else if (hole.first < offset) {
+                holes[i++].last = offset;
+            } else if (end < hole.last) {
+                holes[i++].first = end;
+            } else {
+                holes.erase(holes.begin() + static_cast<std::ptrdiff_t>(i));
             }
         }
 
-        return data.transform([&](auto& data) {
+        account(entry);
+        return true;
+    }
+
+    std::optional<Datagram> Assembler::assemble(Packet<std::span<const std::byte>> packet, const buffer::Buffer& frame) {
+        return assemble(packet, packet.decode(), frame);
+    }
+
+    std::optional<Datagram> Assembler::assemble(Packet<std::span<const std::byte>> packet, const Format::Header& header, const buffer::Buffer& frame) {
+        const auto more_fragments = header.get<"more_fragments">() != 0;
+        const auto offset = std::size_t{header.get<"fragment_offset">()} * 8;
+        const auto payload = packet.payload(header);
+
+        if (!more_fragments && offset == 0) {
+            auto frame_bytes = frame.data();
+
+            if (
+                !frame_bytes.empty() &&
+                packet.bytes.data() >= frame_bytes.data() &&
+                payload.data() + payload.size() <= frame_bytes.data() + frame_bytes.size()
+            ) {
+                return Datagram {
+                    header.get<"source_address">(),
+                    header.get<"destination_address">(),
+                    header.get<"protocol">(),
+                    {},
+                    frame,
+                    frame_bytes.subspan(static_cast<std::size_t>(payload.data() - frame_bytes.data()), payload.size()),
+                    static_cast<std::size_t>(packet.bytes.data() - frame_bytes.data())
+                };
+            }
+
             return Datagram {
-                packet.get<"source_address">(),
-                packet.get<"destination_address">(),
-                Protocol{packet.get<"protocol">()},
-                std::move(data)
+                header.get<"source_address">(),
+                header.get<"destination_address">(),
+                header.get<"protocol">(),
+                {payload.begin(), payload.end()},
+                {},
+                {}
             };
-        });
+        }
+
+        // All but the last fragment carry a multiple of 8 bytes.
+        if (
+            payload.empty() ||
+            (more_fragments && payload.size() % 8 != 0) ||
+            offset + payload.size() > max_size
+        ) {
+            ++counters.dropped;
+            return std::nullopt;
+        }
+
+        const auto now = clock::now();
+        remove_older_than(now - config.timeout);
+
+        const Key key {
+            header.get<"source_address">(),
+            header.get<"destination_address">(),
+            header.get<"protocol">(),
+            header.get<"id">()
+        };
+
+        const auto index = find(key);
+        const auto is_new = index == slots.size();
+        const auto entry = is_new ? start(key, now) : slots[index].entry;
+        if (!add(entry, offset, payload, more_fragments)) {
+            if (is_new) {
+                erase(entry);
+            }
+            ++counters.dropped;
+            return std::nullopt;
+        }
+
+        auto& datagram = entries[entry];
+        if (!datagram.holes.empty()) {
+            return std::nullopt;
+        }
+
+        Datagram result {
+            key.source_address,
+            key.destination_address,
+            key.protocol,
+            std::move(datagram.data),
+            {},
+            {}
+        };
+        erase(entry);
+        ++counters.completed;
+        stats::add(stats::Counter::ReassemblyCompleted);
+        return result;
     }
-}
\ No newline at end of file
+}
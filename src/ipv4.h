@@ -7,16 +7,24 @@
 #include <cstdint>
 #include <vector>
 #include <cstddef>
-#include <set>
-#include <map>
-#include <queue>
 #include <chrono>
 #include <utility>
 #include <limits>
 #include <optional>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <concepts>
 
 #include "packet.h"
 #include "types.h"
+#include "buffer_pool.h"
+#include "checksum.h"
+#include "ethernet.h"
+#include "device.h"
+#include "virtio_net.h"
+#include "stats.h"
 
 namespace ipv4 {
     enum class Protocol : uint8_t {
@@ -52,7 +60,16 @@ namespace ipv4 {
         std::span<typename Packet::ConstValueType> options() const;
         std::span<typename Packet::ConstValueType> payload() const;
 
+        // Same as above, with the lengths taken from an already decoded header.
+        std::span<typename Packet::ValueType> payload(const Format::Header& header);
+        std::span<typename Packet::ConstValueType> payload(const Format::Header& header) const;
+
+        // Lengths are consistent with the buffer and the header checksum is correct.
+        bool is_valid() const;
+        bool is_valid(const Format::Header& header) const;
+
         uint16_t calculate_checksum() const;
+        void update_checksum();
     };
 
     template<typename Range>
@@ -63,12 +80,58 @@ namespace ipv4 {
         IPv4_t destination_address;
         Protocol protocol;
 
+        // Payload of a reassembled datagram.
         std::vector<std::byte> data;
+
+        // Frame an unfragmented datagram was received in, payload points into it.
+        buffer::Buffer frame;
+        std::span<std::byte> borrowed;
+        // Where its IPv4 header starts in frame, the link layer's headers
+        // and whatever the device put in front of them come before.
+        std::size_t header_offset{};
+
+        // The device checked the checksum of the payload's protocol.
+        bool checksum_valid = false;
+
+        bool is_borrowed() const {
+            return static_cast<bool>(frame);
+        }
+
+        std::span<std::byte> payload() {
+            return is_borrowed() ? borrowed : std::span{data};
+        }
+
+        std::span<const std::byte> payload() const {
+            return is_borrowed() ? borrowed : std::span{data};
+        }
     };
 
+    // Reassembles fragmented datagrams. Datagrams in progress are kept in an
+    // open addressing table, the bytes still missing in each are tracked as
+    // a list of holes as described in RFC 815. The memory they hold is
+    // bounded in total and per source address, the oldest datagrams are
+    // evicted to stay within the budgets.
     class Assembler {
+    public:
         using clock = std::chrono::steady_clock;
 
+        struct Config {
+            std::size_t max_datagrams = 256;
+            std::size_t max_bytes = 4 << 20;
+            std::size_t max_bytes_per_source = 1 << 20;
+            clock::duration timeout = std::chrono::seconds{1};
+        };
+
+        struct Stats {
+            uint64_t completed;
+            uint64_t timeouts;
+            uint64_t evictions;
+            // Fragments that were malformed, contradicted earlier ones or
+            // did not fit the budgets.
+            uint64_t dropped;
+        };
+
+    private:
         struct Key {
             IPv4_t source_address;
             IPv4_t destination_address;
@@ -76,36 +139,158 @@ namespace ipv4 {
             uint16_t id;
 
             bool operator==(const Key&) const = default;
-            auto operator<=>(const Key&) const = default;
         };
 
-        struct Value {
+        // Bytes [first, last) are still missing.
+        struct Hole {
+            std::size_t first;
+            std::size_t last;
+        };
+
+        static constexpr uint32_t empty = std::numeric_limits<uint32_t>::max();
+
+        struct Reassembly {
+            Key key;
+            clock::time_point started;
+            // Unknown until the last fragment arrives.
+            std::size_t total_size;
+            std::vector<Hole> holes;
             std::vector<std::byte> data;
-            std::size_t total_size = std::numeric_limits<std::size_t>::max();
-            std::size_t bytes_received{};
-            std::set<uint16_t> offsets_received;
+            // Bytes counted against the budgets.
+            std::size_t charged;
+            // Neighbors in the list of datagrams by start time.
+            uint32_t older;
+            uint32_t newer;
+        };
+
+        struct Slot {
+            Key key;
+            uint32_t entry = empty;
+        };
+
+        // Memory held by one source address, unused while it has no datagrams.
+        struct Source {
+            IPv4_t address;
+            uint32_t datagrams{};
+            std::size_t bytes{};
         };
 
-        std::map<Key, Value> datagrams;
-        std::queue<std::pair<clock::time_point, Key>> queue;
+        Config config;
+        std::size_t mask;
+        unsigned shift;
+        std::vector<Slot> slots;
+        std::vector<Source> sources;
+
+        // Entries are reused, so their hole lists keep their capacity.
+        std::vector<Reassembly> entries;
+        std::vector<uint32_t> free_entries;
+        uint32_t oldest = empty;
+        uint32_t newest = empty;
+
+        std::size_t memory{};
+        Stats counters{};
+
+        std::size_t home(const Key& key) const noexcept;
+        std::size_t home(IPv4_t source_address) const noexcept;
+        std::size_t find(const Key& key) const noexcept;
+        Source& source(IPv4_t address);
+
+        uint32_t start(const Key& key, clock::time_point now);
+        void erase(uint32_t entry);
+        void remove_older_than(clock::time_point time_point);
+
+        // Evicts the oldest datagram other than keep, of the given source if
+        // there is one. Returns false if there is none.
+        bool evict(std::optional<IPv4_t> source_address, uint32_t keep);
+        // Evicts other datagrams until the entry can grow by bytes.
+        bool make_room(uint32_t entry, std::size_t bytes);
+        // Brings the entry's charge up to date with what it holds.
+        void account(uint32_t entry);
+
+        // Returns false when the fragment contradicts the ones received
+        // before, or does not fit.
+        bool add(uint32_t entry, std::size_t offset, std::span<const std::byte> payload, bool more_fragments);
 
-        void remove_older_then(clock::duration);
-    
     public:
-        [[nodiscard]] std::optional<Datagram> assemble(Packet<std::span<const std::byte>> packet);
+        Assembler() : Assembler(Config{}) {}
+        explicit Assembler(Config config);
+
+        // When frame holds the packet, unfragmented datagrams borrow their payload from it.
+        [[nodiscard]] std::optional<Datagram> assemble(Packet<std::span<const std::byte>> packet, const buffer::Buffer& frame = {});
+        [[nodiscard]] std::optional<Datagram> assemble(Packet<std::span<const std::byte>> packet, const Format::Header& header, const buffer::Buffer& frame = {});
+
+        // Drops the datagrams that waited longer than the timeout. Fragments
+        // only do it when they arrive, so it is also called while idle.
+        void expire(clock::time_point now = clock::now());
+
+        // Datagrams in progress.
+        std::size_t size() const noexcept {
+            return entries.size() - free_entries.size();
+        }
+
+        // Bytes held by the datagrams in progress.
+        std::size_t memory_used() const noexcept {
+            return memory;
+        }
+
+        Stats stats() const noexcept {
+            return counters;
+        }
+    };
+
+    struct Config {
+        // Largest packet sent in one frame, larger datagrams are fragmented.
+        std::size_t mtu = 1500;
+        uint8_t ttl = 64;
+        // Destinations outside of it are sent through the gateway.
+        IPv4_t netmask = "255.255.255.0"_ipv4;
+        Assembler::Config reassembly{};
     };
 
     template<typename InternetLayer>
     class Handler {
+        const Config config;
+        // Shared by the receive queues, only fragments take the lock.
+        std::mutex reassembly_mutex;
         Assembler assembler;
+        std::atomic<uint16_t> next_id{};
 
         InternetLayer& internet_layer() {
             return static_cast<InternetLayer&>(*this);
         }
     public:
-        Handler() requires(std::derived_from<InternetLayer, Handler>) = default;
+        // Payload of the largest datagram.
+        static constexpr std::size_t max_payload = std::numeric_limits<uint16_t>::max() - Format::byte_size();
+
+        explicit Handler(Config config = {}) requires(std::derived_from<InternetLayer, Handler>)
+            : config{config},
+              assembler{config.reassembly}
+            {}
+
+        // frame is the pool buffer holding the packet, if it was received into one.
+        // checksum_valid tells that the device checked the transport checksum.
+        void handle(Packet<std::span<const std::byte>> packet, const buffer::Buffer& frame = {}, bool checksum_valid = false);
+
+        // Runs the reassembly timeout, called periodically by the link thread.
+        void poll(Assembler::clock::time_point now = Assembler::clock::now()) {
+            std::lock_guard lock(reassembly_mutex);
+            assembler.expire(now);
+        }
+
+        uint8_t get_ttl() const {return config.ttl;}
+        std::size_t get_mtu() const {return config.mtu;}
 
-        void handle(Packet<std::span<const std::byte>> packet);
+        // Sends a datagram from our address. Datagrams larger than the MTU are
+        // fragmented, each fragment is written as its header followed by
+        // slices of the payload, which is never copied unless it is parked
+        // for ARP. The payload may come in fewer than device::max_parts
+        // pieces. Returns false when it is too large or a fragment was dropped.
+        bool send(IPv4_t destination, Protocol protocol, std::span<const std::byte> payload) {
+            return send(destination, protocol, device::Parts{&payload, 1});
+        }
+        // offload is the payload's part of the virtio-net header, for a device
+        // that has one. A datagram the device segments is never fragmented.
+        bool send(IPv4_t destination, Protocol protocol, device::Parts payload, const virtio_net::Format::Header& offload = {});
     };
 
     template<typename Range>
@@ -126,6 +311,18 @@ namespace ipv4 {
         );
     }
 
+    template<typename Range>
+    auto Packet<Range>::payload(const Format::Header& header) -> std::span<typename Packet::ValueType> {
+        auto header_length = header.get<"header_length">() * 4;
+        return this->to_span(header_length, header.get<"total_length">() - header_length);
+    }
+
+    template<typename Range>
+    auto Packet<Range>::payload(const Format::Header& header) const -> std::span<typename Packet::ConstValueType> {
+        auto header_length = header.get<"header_length">() * 4;
+        return this->to_span(header_length, header.get<"total_length">() - header_length);
+    }
+
     template<typename Range>
     auto Packet<Range>::options() -> std::span<typename Packet::ValueType> {
         return std::span{
@@ -142,37 +339,144 @@ namespace ipv4 {
         };
     }
 
+    template<typename Range>
+    bool Packet<Range>::is_valid() const {
+        return this->bytes.size() >= Format::byte_size() && is_valid(this->decode());
+    }
+
+    template<typename Range>
+    bool Packet<Range>::is_valid(const Format::Header& header) const {
+        const std::size_t header_length = header.get<"header_length">() * 4u;
+        const std::size_t total_length = header.get<"total_length">();
+
+        return
+            header.get<"version">() == 4 &&
+            header_length >= Format::byte_size() &&
+            header_length <= total_length &&
+            total_length <= this->bytes.size() &&
+            calculate_checksum() == 0;
+    }
+
     template<typename Range>
     uint16_t Packet<Range>::calculate_checksum() const {
-        auto header_span = std::span{this->to_span().begin(), options().end()};
-        auto nums = 
-            header_span 
-            | std::views::chunk(2) 
-            | std::views::transform([](auto word){
-                uint16_t value;
-                std::ranges::copy(
-                    word,
-                    reinterpret_cast<std::byte*>(&value)
-                );
-                return value;
-            });
-        auto sum = std::accumulate(nums.begin(), nums.end(), std::uint32_t{});
-        while (sum >> 16 != 0) {
-            sum = (sum & 0xFFFF) + (sum >> 16);
-        }
-
-        auto checksum = static_cast<uint16_t>(sum);
-
-        if constexpr (std::endian::native == std::endian::little) {
-            checksum = std::byteswap(checksum);
-        }
-
-        return ~checksum;
+        return checksum::compute(this->to_span(0, this->template get<"header_length">() * 4u));
+    }
+
+    template<typename Range>
+    void Packet<Range>::update_checksum() {
+        this->template set<"checksum">(0);
+        this->template set<"checksum">(calculate_checksum());
+    }
+
+    template<typename InternetLayer>
+    bool Handler<InternetLayer>::send(IPv4_t destination, Protocol protocol, device::Parts payload, const virtio_net::Format::Header& offload) {
+        constexpr std::size_t header_length = Format::byte_size();
+
+        std::size_t size = 0;
+        for (auto part : payload) {
+            size += part.size();
+        }
+        if (size > max_payload || payload.size() >= device::max_parts) {
+            return false;
+        }
+
+        const auto source = internet_layer().get_ip();
+        const auto is_broadcast = destination == "255.255.255.255"_ipv4;
+        const auto next_hop = ((destination ^ source) & config.netmask) == 0 ? destination : internet_layer().get_gateway();
+
+        const auto segmented = offload.get<"gso_type">() != virtio_net::GsoType::None;
+        // All fragments but the last carry a multiple of 8 bytes.
+        const auto fragment_size = segmented ? size : std::max<std::size_t>((config.mtu - std::min(config.mtu, header_length)) & ~std::size_t{7}, 8);
+
+        // Offsets move past our header.
+        auto vnet_header = offload;
+        if (vnet_header.get<"flags">() & virtio_net::NeedsChecksum) {
+            vnet_header.set<"checksum_start">(static_cast<uint16_t>(vnet_header.get<"checksum_start">() + header_length));
+        }
+        if (segmented) {
+            vnet_header.set<"header_length">(static_cast<uint16_t>(vnet_header.get<"header_length">() + header_length));
+        }
+
+        Format::Header header;
+        header.set<"version">(4);
+        header.set<"header_length">(header_length / 4);
+        header.set<"id">(next_id.fetch_add(1, std::memory_order_relaxed));
+        header.set<"ttl">(config.ttl);
+        header.set<"protocol">(protocol);
+        header.set<"source_address">(source);
+        header.set<"destination_address">(destination);
+
+        Packet<std::array<std::byte, header_length>> packet;
+        std::array<std::span<const std::byte>, device::max_parts> parts;
+
+        // Position in the payload the next fragment starts at.
+        std::size_t part = 0;
+        std::size_t part_offset = 0;
+
+        bool sent = true;
+        std::size_t offset = 0;
+        do {
+            const auto length = std::min(fragment_size, size - offset);
+            header.set<"total_length">(static_cast<uint16_t>(header_length + length));
+            header.set<"more_fragments">(offset + length < size);
+            header.set<"fragment_offset">(static_cast<uint16_t>(offset / 8));
+            packet.encode(header);
+            packet.update_checksum();
+
+            parts[0] = packet.to_span();
+            std::size_t count = 1;
+            for (auto left = length; left != 0;) {
+                auto current = payload[part];
+                auto slice = current.subspan(part_offset, std::min(left, current.size() - part_offset));
+                if (!slice.empty()) {
+                    parts[count++] = slice;
+                }
+
+                left -= slice.size();
+                part_offset += slice.size();
+                if (part_offset == current.size()) {
+                    ++part;
+                    part_offset = 0;
+                }
+            }
+
+            auto fragment = device::Parts{parts}.first(count);
+            if (is_broadcast) {
+                sent &= internet_layer().send(ethernet::mac_broadcast, ethernet::Ethertype::IPv4, fragment, vnet_header);
+            } else {
+                sent &= internet_layer().send_to(next_hop, ethernet::Ethertype::IPv4, fragment, vnet_header);
+            }
+            offset += length;
+        } while (offset < size);
+
+        if (sent) {
+            stats::add(stats::Counter::IPv4Sent);
+            stats::add(stats::Counter::IPv4BytesSent, size);
+        }
+        return sent;
     }
 
     template<typename LinkLayer>
-    void Handler<LinkLayer>::handle(Packet<std::span<const std::byte>> packet) {
-        auto datagram = assembler.assemble(packet);
+    void Handler<LinkLayer>::handle(Packet<std::span<const std::byte>> packet, const buffer::Buffer& frame, bool checksum_valid) {
+        if (packet.bytes.size() < Format::byte_size()) {
+            stats::add(stats::Counter::IPv4Invalid);
+            return;
+        }
+
+        const auto header = packet.decode();
+        if (!packet.is_valid(header)) {
+            stats::add(stats::Counter::IPv4Invalid);
+            return;
+        }
+
+        std::optional<Datagram> datagram;
+        if (header.get<"more_fragments">() == 0 && header.get<"fragment_offset">() == 0) {
+            datagram = assembler.assemble(packet, header, frame);
+            datagram->checksum_valid = checksum_valid;
+        } else {
+            std::lock_guard lock(reassembly_mutex);
+            datagram = assembler.assemble(packet, header, frame);
+        }
 
         if (datagram) {
             internet_layer().handle(std::move(*datagram));
@@ -1,87 +1,384 @@
 #pragma once
 
 #include <thread>
+#include <chrono>
 #include <algorithm>
 #include <span>
 #include <cstddef>
 #include <concepts>
+#include <memory>
+#include <vector>
+#include <limits>
+
+#include <pthread.h>
+#include <sched.h>
 
 #include "types.h"
 #include "ethernet.h"
 #include "arp.h"
 #include "ipv4.h"
+#include "device.h"
+#include "virtio_net.h"
 #include "tap.h"
+#include "buffer_pool.h"
+#include "gro.h"
+#include "logging.h"
+#include "stats.h"
 
-template <typename InternetLayer>
+template <typename InternetLayer, device::Device Device = Tap>
 class LinkLayer {
     MAC_t mac_address;
-    Tap tap_device;
+    Device net_device;
+    std::unique_ptr<buffer::Pool> rx_pool;
+    // CPU the receive thread of each queue is pinned to.
+    std::vector<int> rx_cpus;
+    gro::Config gro_config;
+    std::unique_ptr<buffer::Pool> gro_pool;
 
     InternetLayer& internet_layer() {
         return static_cast<InternetLayer&>(*this);
     }
+
+    void handle_frame(std::span<const std::byte> frame, const buffer::Buffer& buffer, gro::Merger& merger, bool checksum_valid = false);
+    void deliver(gro::Merger& merger);
+    // Ethernet frames and their bytes, a segmentation offloaded one counts once.
+    void count_sent(device::Parts payload);
+    void poll_timers(std::chrono::steady_clock::time_point& next_poll);
+    // Reads one queue until stopped, only one of them runs the timers.
+    template<device::Device Queue>
+    void receive(Queue& queue, std::stop_token stop_token, bool runs_timers);
+    void pin(std::size_t queue);
+    // Receive buffers also hold the virtio-net header in front of a frame.
+    // With TSO4 the kernel hands over TCP segments it did not cut, of up to
+    // a full sized IPv4 datagram.
+    buffer::Pool::Config rx_pool_config(buffer::Pool::Config config) const {
+        if (has_vnet_header()) {
+            auto frame_size = ethernet::max_size;
+            if (offloads() & virtio_net::TSO4) {
+                frame_size = ethernet::Format::byte_size() + std::numeric_limits<uint16_t>::max();
+            }
+            config.buffer_size = std::max(config.buffer_size, virtio_net::Format::byte_size() + frame_size);
+        }
+        return config;
+    }
 public:
-    LinkLayer(MAC_t mac_address, Tap tap_device)
+    // Timers run at least this often, reads wait no longer for a frame.
+    static constexpr std::chrono::milliseconds timer_interval{10};
+
+    LinkLayer(MAC_t mac_address, Device device, buffer::Pool::Config pool_config = {}, std::vector<int> rx_cpus = {}, gro::Config gro_config = {})
         requires(std::derived_from<InternetLayer, LinkLayer>)
         : mac_address{mac_address}, 
-          tap_device{std::move(tap_device)}
+          net_device{std::move(device)},
+          rx_pool{std::make_unique<buffer::Pool>(rx_pool_config(pool_config))},
+          rx_cpus{std::move(rx_cpus)},
+          gro_config{gro_config},
+          gro_pool{std::make_unique<buffer::Pool>(buffer::Pool::Config{
+              .buffer_count = gro_config.enabled ? gro_config.buffer_count : 1,
+              .buffer_size = gro_config.max_size,
+              .cache_size = 16
+          })}
         {}
 
     MAC_t get_mac() {return mac_address;}
-    void send(MAC_t destination, ethernet::Ethertype ethertype, std::span<const std::byte> payload);
+    Device& get_device() {return net_device;}
+
+    // Frames are written with a virtio-net header, so the device completes
+    // checksums and segments large frames.
+    bool has_vnet_header() const {
+        if constexpr (device::VnetDevice<Device>) {
+            return net_device.has_vnet_header();
+        } else {
+            return false;
+        }
+    }
+
+    // The virtio_net::Offload flags the device accepts, none without a header.
+    unsigned offloads() const {
+        if constexpr (device::VnetDevice<Device>) {
+            return has_vnet_header() ? net_device.offloads() : 0;
+        } else {
+            return 0;
+        }
+    }
+
+    // Returns false when the frame is dropped as too large for the device.
+    bool send(MAC_t destination, ethernet::Ethertype ethertype, std::span<const std::byte> payload);
+    // The payload is given in pieces, handed to the device as they are when
+    // it can gather them. offload is the payload's part of the virtio-net
+    // header, with offsets from its start, used if the device has one.
+    bool send(MAC_t destination, ethernet::Ethertype ethertype, device::Parts payload, const virtio_net::Format::Header& offload = {});
+    // Receives until stopped. Each queue of a multi-queue device is read
+    // by a thread of its own, the first one by the calling thread. TCP
+    // segments of a connection read in one burst go up merged.
     void run(std::stop_token stop_token);
 };
 
-template <typename InternetLayer>
-void LinkLayer<InternetLayer>::send(MAC_t destination, ethernet::Ethertype ethertype, std::span<const std::byte> payload) {
-    ethernet::Packet<std::array<std::byte, ethernet::max_size>> packet;
+template <typename InternetLayer, device::Device Device>
+bool LinkLayer<InternetLayer, Device>::send(MAC_t destination, ethernet::Ethertype ethertype, std::span<const std::byte> payload) {
+    return send(destination, ethertype, device::Parts{&payload, 1});
+}
+
+template <typename InternetLayer, device::Device Device>
+bool LinkLayer<InternetLayer, Device>::send(MAC_t destination, ethernet::Ethertype ethertype, device::Parts payload, const virtio_net::Format::Header& offload) {
+    ethernet::Packet<std::array<std::byte, ethernet::Format::byte_size()>> header;
+
+    header.set<"destination_mac">(destination);
+    header.set<"source_mac">(mac_address);
+    header.set<"ethertype">(ethertype);
+
+    std::array<std::span<const std::byte>, device::max_parts + 1> parts;
+    std::size_t count = 0;
 
-    packet.set<"destination_mac">(destination);
-    packet.set<"source_mac">(mac_address);
-    packet.set<"ethertype">(ethertype);
+    virtio_net::Packet<std::array<std::byte, virtio_net::Format::byte_size()>> vnet;
+    if (has_vnet_header()) {
+        auto vnet_header = offload;
+        constexpr auto ethernet_size = static_cast<uint16_t>(ethernet::Format::byte_size());
+        if (vnet_header.get<"flags">() & virtio_net::NeedsChecksum) {
+            vnet_header.set<"checksum_start">(static_cast<uint16_t>(vnet_header.get<"checksum_start">() + ethernet_size));
+        }
+        if (vnet_header.get<"gso_type">() != virtio_net::GsoType::None) {
+            vnet_header.set<"header_length">(static_cast<uint16_t>(vnet_header.get<"header_length">() + ethernet_size));
+        }
+        vnet.encode(vnet_header);
+        parts[count++] = vnet.to_span();
+    }
+    parts[count++] = header.to_span();
+
+    if constexpr (device::GatherDevice<Device>) {
+        if (count + payload.size() <= device::max_parts) {
+            std::ranges::copy(payload, parts.begin() + static_cast<std::ptrdiff_t>(count));
+
+            count_sent(payload);
+            net_device.writev(std::span{parts}.first(count + payload.size()));
+            return true;
+        }
+    }
+
+    // Segmentation offloaded frames do not fit, they come in few pieces.
+    // Those that still come here, e.g. for a device that cannot gather, are
+    // dropped.
+    std::array<std::byte, virtio_net::Format::byte_size() + ethernet::max_size> frame;
+    auto last = frame.begin();
+    for (auto part : std::span{parts}.first(count)) {
+        last = std::ranges::copy(part, last).out;
+    }
+    for (auto part : payload) {
+        if (part.size() > static_cast<std::size_t>(frame.end() - last)) {
+            stats::add(stats::Counter::OversizedFrames);
+            return false;
+        }
+        last = std::ranges::copy(part, last).out;
+    }
+
+    count_sent(payload);
+    net_device.write({frame.begin(), last});
+    return true;
+}
+
+template <typename InternetLayer, device::Device Device>
+void LinkLayer<InternetLayer, Device>::count_sent(device::Parts payload) {
+    std::size_t size = ethernet::Format::byte_size();
+    for (auto part : payload) {
+        size += part.size();
+    }
+    stats::add(stats::Counter::FramesSent);
+    stats::add(stats::Counter::BytesSent, size);
+}
 
-    auto [_, last] = std::ranges::copy(payload, packet.data().begin());
+template <typename InternetLayer, device::Device Device>
+void LinkLayer<InternetLayer, Device>::run(std::stop_token stop_token) {
+    if constexpr (device::MultiQueueDevice<Device>) {
+        // The queues stop with the first one, or when the caller asks to.
+        std::vector<std::jthread> queues;
+        for (std::size_t i = 1; i < net_device.queue_count(); ++i) {
+            queues.emplace_back([this, i](std::stop_token queue_stop){
+                pin(i);
+                receive(net_device.queue(i), queue_stop, false);
+            });
+        }
+        std::stop_callback stop_queues(stop_token, [&]{
+            for (auto& queue : queues) {
+                queue.request_stop();
+            }
+        });
 
-    tap_device.write({packet.to_span().begin(), last});
+        pin(0);
+        receive(net_device.queue(0), stop_token, true);
+    } else {
+        pin(0);
+        receive(net_device, stop_token, true);
+    }
 }
 
-template <typename InternetLayer>
-void LinkLayer<InternetLayer>::run(std::stop_token stop_token) {
-        std::byte buffer[ethernet::max_size];
+template <typename InternetLayer, device::Device Device>
+template <device::Device Queue>
+void LinkLayer<InternetLayer, Device>::receive(Queue& queue, std::stop_token stop_token, bool runs_timers) {
+
+    std::chrono::steady_clock::time_point next_poll{};
+    gro::Merger merger{gro_config, *gro_pool};
 
-    while (!stop_token.stop_requested()) {
-        using namespace std::chrono_literals;
-        auto read = tap_device.try_read(buffer, 100ms);
+    if constexpr (device::BurstDevice<Queue>) {
+        while (!stop_token.stop_requested()) {
+            auto received = queue.receive(
+                [&](std::span<const std::byte> frame, const buffer::Buffer& buffer){
+                    handle_frame(frame, buffer, merger);
+                },
+                timer_interval
+            );
 
-        if (read < 0) {
-            break;
+            if (received < 0) {
+                break;
+            }
+            merger.flush();
+            deliver(merger);
+            if (runs_timers) {
+                poll_timers(next_poll);
+            }
         }
-        if (read < 38) {
-            continue;
+    } else {
+        // Frames are read straight into pool buffers, so upper layers can keep
+        // a reference to one instead of copying it. The buffer is reused until
+        // that happens.
+        buffer::Buffer buffer;
+        std::vector<std::byte> fallback(rx_pool->buffer_size());
+        std::size_t burst = 0;
+
+        while (!stop_token.stop_requested()) {
+            if (!buffer || buffer.use_count() > 1) {
+                buffer = rx_pool->allocate();
+            }
+
+            // The burst ends with a read that would wait, or a long one.
+            auto bytes = buffer ? buffer.bytes() : std::span<std::byte>{fallback};
+            device::ssize_t read = queue.try_read(bytes, merger.empty() ? device::Timeout{timer_interval} : gro_config.flush_timeout);
+
+            if (read < 0) {
+                break;
+            }
+
+            auto frame = bytes.first(static_cast<std::size_t>(read));
+            if (buffer) {
+                buffer.resize(frame.size());
+            }
+
+            bool checksum_valid = false;
+            if constexpr (device::VnetDevice<Queue>) {
+                // Anything shorter is too short for handle_frame() as well.
+                if (queue.has_vnet_header() && frame.size() >= virtio_net::Format::byte_size()) {
+                    checksum_valid = virtio_net::checksum_valid(virtio_net::Packet{frame}.decode());
+                    frame = frame.subspan(virtio_net::Format::byte_size());
+                    // The buffer holds the ethernet frame, as without the header.
+                    if (buffer) {
+                        buffer.trim_front(virtio_net::Format::byte_size());
+                    }
+                }
+            }
+
+            handle_frame(frame, buffer, merger, checksum_valid);
+            if (read == 0 || ++burst >= gro_config.max_burst) {
+                merger.flush();
+                deliver(merger);
+                burst = 0;
+                if constexpr (requires { queue.flush(); }) {
+                    // Devices that queue writes send the burst's replies together.
+                    queue.flush();
+                }
+            }
+            if (runs_timers) {
+                poll_timers(next_poll);
+            }
         }
+    }
+}
 
-        std::cout << std::format("[{:%T}] read {} bytes\n", std::chrono::system_clock::now(), read);
+template <typename InternetLayer, device::Device Device>
+void LinkLayer<InternetLayer, Device>::pin(std::size_t queue) {
+    if (queue >= rx_cpus.size() || rx_cpus[queue] < 0) {
+        return;
+    }
+
+    // Best effort, the thread keeps running where it is if this fails.
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(static_cast<std::size_t>(rx_cpus[queue]), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
 
-        ethernet::Packet packet{std::span{buffer, buffer + read}};
+template <typename InternetLayer, device::Device Device>
+void LinkLayer<InternetLayer, Device>::poll_timers(std::chrono::steady_clock::time_point& next_poll) {
 
-        if (auto destination = packet.get<"destination_mac">(); destination != mac_address && destination != ethernet::mac_broadcast) {
-            continue;
+    auto now = std::chrono::steady_clock::now();
+    if (now >= next_poll) {
+        internet_layer().poll(now);
+        next_poll = now + timer_interval;
+    }
+}
+
+template <typename InternetLayer, device::Device Device>
+void LinkLayer<InternetLayer, Device>::deliver(gro::Merger& merger) {
+    merger.drain([this](gro::Merger::Packet packet, const buffer::Buffer& frame){
+        internet_layer().handle(packet, frame, true);
+    });
+}
+
+template <typename InternetLayer, device::Device Device>
+void LinkLayer<InternetLayer, Device>::handle_frame(std::span<const std::byte> frame, const buffer::Buffer& buffer, gro::Merger& merger, bool checksum_valid) {
+    if (frame.empty()) {
+        return;
+    }
+
+    stats::add(stats::Counter::FramesReceived);
+    stats::add(stats::Counter::BytesReceived, frame.size());
+    if (frame.size() < 38) {
+        stats::add(stats::Counter::ShortFrames);
+        return;
+    }
+
+    logging::debug("read {} bytes", frame.size());
+
+    ethernet::Packet packet{frame};
+
+    if (auto destination = packet.get<"destination_mac">(); destination != mac_address && destination != ethernet::mac_broadcast) {
+        stats::add(stats::Counter::WrongDestination);
+        return;
+    }
+
+    auto ethertype = ethernet::Ethertype{packet.get<"ethertype">()};
+
+    switch (ethertype) {
+    case ethernet::Ethertype::ARP:
+        logging::debug("ARP packet");
+        stats::add(stats::Counter::ArpReceived);
+        internet_layer().handle(packet.data<arp::Packet>());
+        break;
+    case ethernet::Ethertype::IPv4: {
+        logging::debug("IP packet");
+        stats::add(stats::Counter::IPv4Received);
+        auto ip_packet = packet.data<ipv4::Packet>();
+        auto held = buffer;
+        if (!buffer) {
+            // The frame is not ours to keep, copy it into a pool buffer
+            // so the datagram does not need an allocation of its own.
+            if (auto copy = rx_pool->allocate(); copy && copy.capacity() >= frame.size()) {
+                std::ranges::copy(frame, copy.bytes().begin());
+                copy.resize(frame.size());
+
+                ethernet::Packet copied{std::span<const std::byte>{copy.data()}};
+                ip_packet = copied.data<ipv4::Packet>();
+                held = std::move(copy);
+            }
         }
 
-        auto ethertype = ethernet::Ethertype{packet.get<"ethertype">()};
-
-        switch (ethertype) {
-        case ethernet::Ethertype::ARP:
-            std::cout << "ARP packet\n";
-            internet_layer().handle(packet.data<arp::Packet>());
-            break;
-        case ethernet::Ethertype::IPv4:
-            std::cout << "IP packet\n";
-            internet_layer().handle(packet.data<ipv4::Packet>());
-            break;
-        default:
-            std::cout << std::format("Unknown packet {:0>2X}\n", std::to_underlying(ethertype));
-            break;
+        const bool merged = merger.add(ip_packet, held, checksum_valid);
+        deliver(merger);
+        if (!merged) {
+            internet_layer().handle(ip_packet, held, checksum_valid);
         }
+        break;
+    }
+    default:
+        logging::debug("Unknown packet {:0>2X}", std::to_underlying(ethertype));
+        stats::add(stats::Counter::UnknownEthertype);
+        break;
     }
 }
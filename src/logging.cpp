@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include "logging.h"
+#include "spsc_channel.h"
+
+namespace logging {
+    namespace {
+        using Ring = SpscChannel<detail::Record>;
+
+        constexpr std::size_t ring_capacity = 1024;
+        constexpr std::chrono::milliseconds flush_interval{10};
+
+        class Logger {
+            // Taken to drain the rings, so only one thread pops at a time.
+            std::mutex mutex;
+            std::vector<std::shared_ptr<Ring>> rings;
+            std::ostream* output = &std::cout;
+            std::vector<detail::Record> batch;
+            std::string text;
+            std::atomic<uint64_t> lost{};
+
+            std::jthread thread;
+
+            void run(std::stop_token stop_token) {
+                std::mutex sleep_mutex;
+                std::condition_variable_any sleep;
+                std::unique_lock lock(sleep_mutex);
+                while (!stop_token.stop_requested()) {
+                    drain();
+                    sleep.wait_for(lock, stop_token, flush_interval, []{return false;});
+                }
+            }
+
+        public:
+            Logger() : thread{[this](std::stop_token stop_token){ run(stop_token); }} {}
+
+            ~Logger() {
+                thread.request_stop();
+                thread.join();
+                drain();
+            }
+
+            void add(std::shared_ptr<Ring> ring) {
+                std::lock_guard lock(mutex);
+                rings.push_back(std::move(ring));
+            }
+
+            void drain() {
+                std::lock_guard lock(mutex);
+                std::erase_if(rings, [&](const std::shared_ptr<Ring>& ring){
+                    // Nothing is pushed once the thread is gone.
+                    const bool orphaned = ring.use_count() == 1;
+                    while (auto record = ring->try_pop()) {
+                        batch.push_back(*record);
+                    }
+                    return orphaned;
+                });
+                if (batch.empty()) {
+                    return;
+                }
+
+                // Each ring is in order, the threads are merged by time.
+                std::ranges::stable_sort(batch, {}, &detail::Record::time);
+                for (const auto& record : batch) {
+                    text += std::format("[{:%T}] ", record.time);
+                    record.write(record, text);
+                    text += '\n';
+                }
+                *output << text;
+                output->flush();
+
+                batch.clear();
+                text.clear();
+            }
+
+            void set_output(std::ostream& stream) {
+                std::lock_guard lock(mutex);
+                output = &stream;
+            }
+
+            void drop() noexcept {
+                lost.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            uint64_t dropped() const noexcept {
+                return lost.load(std::memory_order_relaxed);
+            }
+        };
+
+        Logger& logger() {
+            static Logger instance;
+            return instance;
+        }
+
+        struct Producer {
+            std::shared_ptr<Ring> ring = std::make_shared<Ring>(ring_capacity);
+
+            Producer() {
+                logger().add(ring);
+            }
+        };
+    }
+
+    void detail::push(const Record& record) {
+        thread_local Producer producer;
+        if (!producer.ring->try_push(record)) {
+            logger().drop();
+        }
+    }
+
+    void flush() {
+        logger().drain();
+    }
+
+    void set_output(std::ostream& output) {
+        logger().set_output(output);
+    }
+
+    uint64_t dropped() noexcept {
+        return logger().dropped();
+    }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <new>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <algorithm>
+
+// Messages are not formatted where they are logged. The arguments are
+// copied into a ring of the logging thread and a background thread formats
+// and writes them, so logging costs the caller about as much as a memcpy.
+// A full ring drops messages rather than making the caller wait.
+//
+// Levels below NETSTACK_LOG_LEVEL are compiled out: 0 keeps everything,
+// 1 (the default) drops the per-packet debug messages.
+#ifndef NETSTACK_LOG_LEVEL
+#define NETSTACK_LOG_LEVEL 1
+#endif
+
+namespace logging {
+    enum class Level : uint8_t {
+        Debug,
+        Info,
+        Warning,
+        Error
+    };
+
+    inline constexpr Level min_level = static_cast<Level>(NETSTACK_LOG_LEVEL);
+
+    namespace detail {
+        // A string argument, cut to what fits. A cut one ends in cut_mark,
+        // so it does not pass for the whole string.
+        struct Text {
+            static constexpr std::string_view cut_mark = "...";
+
+            uint8_t size;
+            char data[63];
+
+            explicit Text(std::string_view text) noexcept
+                : size{static_cast<uint8_t>(std::min(text.size(), sizeof(data)))}
+            {
+                if (text.size() <= sizeof(data)) {
+                    std::copy_n(text.begin(), size, data);
+                } else {
+                    auto end = std::copy_n(text.begin(), sizeof(data) - cut_mark.size(), data);
+                    std::ranges::copy(cut_mark, end);
+                }
+            }
+
+            std::string_view get() const noexcept {
+                return {data, size};
+            }
+        };
+
+        template<typename T>
+        inline constexpr bool is_text =
+            std::is_convertible_v<const T&, std::string_view> && !std::is_same_v<T, std::nullptr_t>;
+
+        // How an argument is kept until it is formatted, and what it is
+        // formatted as.
+        template<typename T>
+        using Stored = std::conditional_t<is_text<T>, Text, T>;
+        template<typename T>
+        using Formatted = std::conditional_t<is_text<T>, std::string_view, T>;
+
+        template<typename T>
+        decltype(auto) load(const T& stored) noexcept {
+            if constexpr (std::is_same_v<T, Text>) {
+                return stored.get();
+            } else {
+                return (stored);
+            }
+        }
+
+        struct Record {
+            static constexpr std::size_t arguments_size = 160;
+
+            void (*write)(const Record& record, std::string& out);
+            std::string_view format;
+            std::chrono::system_clock::time_point time;
+            Level level;
+            alignas(std::max_align_t) std::array<std::byte, arguments_size> arguments;
+        };
+
+        template<typename... Stored>
+        void write(const Record& record, std::string& out) {
+            const auto& arguments = *std::launder(reinterpret_cast<const std::tuple<Stored...>*>(record.arguments.data()));
+            std::apply(
+                [&](const auto&... stored){
+                    [&](const auto&... values){
+                        out += std::vformat(record.format, std::make_format_args(values...));
+                    }(load(stored)...);
+                },
+                arguments
+            );
+        }
+
+        // Queues the record on the ring of the calling thread.
+        void push(const Record& record);
+    }
+
+    template<Level level, typename... Args>
+    void log(std::format_string<detail::Formatted<std::decay_t<Args>>...> format, Args&&... args) {
+        if constexpr (level >= min_level) {
+            using Arguments = std::tuple<detail::Stored<std::decay_t<Args>>...>;
+            static_assert(sizeof(Arguments) <= detail::Record::arguments_size, "Too many arguments to log");
+            static_assert(std::is_trivially_copy_constructible_v<Arguments> && std::is_trivially_destructible_v<Arguments>, "Arguments are copied as bytes");
+
+            detail::Record record;
+            record.write = &detail::write<detail::Stored<std::decay_t<Args>>...>;
+            record.format = format.get();
+            record.time = std::chrono::system_clock::now();
+            record.level = level;
+            std::construct_at(reinterpret_cast<Arguments*>(record.arguments.data()), detail::Stored<std::decay_t<Args>>(args)...);
+            detail::push(record);
+        }
+    }
+
+    // One per packet, compiled out by default.
+    template<typename... Args>
+    void debug(std::format_string<detail::Formatted<std::decay_t<Args>>...> format, Args&&... args) {
+        log<Level::Debug>(format, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    void info(std::format_string<detail::Formatted<std::decay_t<Args>>...> format, Args&&... args) {
+        log<Level::Info>(format, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    void warning(std::format_string<detail::Formatted<std::decay_t<Args>>...> format, Args&&... args) {
+        log<Level::Warning>(format, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    void error(std::format_string<detail::Formatted<std::decay_t<Args>>...> format, Args&&... args) {
+        log<Level::Error>(format, std::forward<Args>(args)...);
+    }
+
+    // Writes what was logged so far before returning.
+    void flush();
+
+    // Where the messages go, std::cout unless set.
+    void set_output(std::ostream& output);
+
+    // Messages lost to full rings.
+    uint64_t dropped() noexcept;
+}
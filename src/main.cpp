@@ -1,17 +1,34 @@
-#include <iostream>
 #include <expected>
 #include <cstdint>
-#include <format>
 #include <atomic>
 #include <thread>
 #include <csignal>
+#include <charconv>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <string_view>
 
 #include "packet.h"
 #include "tap.h"
+#include "uring_tap.h"
+#include "packet_socket.h"
+#include "virtio_net.h"
 #include "internet_layer.h"
+#include "logging.h"
 
 static std::atomic_flag request_stop;
 
+template<typename Stack>
+static void run_until_interrupted(Stack& dev) {
+    std::jthread thread([&](std::stop_token stop_token){
+        dev.run(stop_token);
+    });
+
+    request_stop.wait(false);
+    logging::info("Terminating");
+}
+
 int main(int argc, char* argv[]) {
     std::signal(SIGINT, [](int){
         request_stop.test_and_set();
@@ -20,34 +37,102 @@ int main(int argc, char* argv[]) {
 
     auto ip = parse_ipv4(argc > 1 ? argv[1] : "10.0.0.4");
     if (!ip.has_value()) {
-        std::cout << "Invalid IP\n";
+        logging::error("Invalid IP");
         return 1;
     }
     auto gateway = parse_ipv4(argc > 2 ? argv[2] : "10.0.0.1");
     if (!ip.has_value()) {
-        std::cout << "Invalid gateway IP\n";
+        logging::error("Invalid gateway IP");
         return 1;
     }
     auto mac = parse_mac(argc > 3 ? argv[3] : "00:0c:29:6d:50:25");
     if (!mac.has_value()) {
-        std::cout << "Invalid MAC\n";
+        logging::error("Invalid MAC");
         return 1;
     }
     
-    auto tap_device = Tap::try_new();
+    std::size_t queues = 1;
+    if (argc > 4) {
+        auto [end, error] = std::from_chars(argv[4], argv[4] + std::strlen(argv[4]), queues);
+        if (error != std::errc{} || *end != '\0' || queues == 0) {
+            logging::error("Invalid queue count");
+            return 1;
+        }
+    }
 
-    if (!tap_device.has_value()) {
-        std::cout << std::format("Failed to create TAP device\n{}\n", tap_device.error().what());
+    // tap reads the device with system calls, uring through io_uring.
+    // packet:<interface> attaches to an existing interface through the
+    // memory mapped rings of a packet socket instead.
+    std::string_view device = argc > 5 ? argv[5] : "tap";
+    constexpr std::string_view packet_prefix = "packet:";
+    if (device != "tap" && device != "uring" && !device.starts_with(packet_prefix)) {
+        logging::error("Invalid device, expected tap, uring or packet:<interface>");
+        return 1;
+    }
+    if (device != "tap" && queues != 1) {
+        logging::error("Only TAP devices have several queues");
         return 1;
     }
-    std::cout << std::format("Created TAP device {}\n", tap_device->get_name());
 
-    InternetLayer dev(*ip, *gateway, {*mac, std::move(*tap_device)});
+    // The kernel checks and completes checksums, and segments what we send.
+    // With TSO4 it also hands us TCP segments of up to 64KB it did not cut,
+    // the receive buffers are sized for them.
+    constexpr unsigned offloads = virtio_net::Checksum | virtio_net::TSO4;
 
-    std::jthread thread([&](std::stop_token stop_token){
-        dev.run(stop_token);
-    });
+    if (device.starts_with(packet_prefix)) {
+        auto packet_socket = PacketSocket::try_new(device.substr(packet_prefix.size()));
+        if (!packet_socket.has_value()) {
+            logging::error("Failed to open packet socket: {}", packet_socket.error().what());
+            return 1;
+        }
+        logging::info("Attached to {} through a packet socket", packet_socket->get_name());
 
-    request_stop.wait(false);
-    std::cout << "\nTerminating\n";
+        InternetLayer<PacketSocket> dev(*ip, *gateway, {*mac, std::move(*packet_socket)});
+        run_until_interrupted(dev);
+    } else if (device == "uring") {
+        // Frames are passed on as read, without a virtio-net header.
+        auto tap_device = Tap::try_new();
+        if (!tap_device.has_value()) {
+            logging::error("Failed to create TAP device: {}", tap_device.error().what());
+            return 1;
+        }
+        auto uring_device = UringTap::try_new(std::move(*tap_device));
+        if (!uring_device.has_value()) {
+            logging::error("Failed to set up io_uring: {}", uring_device.error().what());
+            return 1;
+        }
+        logging::info("Created TAP device {} read through io_uring", uring_device->get_name());
+
+        InternetLayer<UringTap> dev(*ip, *gateway, {*mac, std::move(*uring_device)});
+        run_until_interrupted(dev);
+    } else if (queues == 1) {
+        auto tap_device = Tap::try_new(offloads);
+
+        if (!tap_device.has_value()) {
+            logging::error("Failed to create TAP device: {}", tap_device.error().what());
+            return 1;
+        }
+        logging::info("Created TAP device {}", tap_device->get_name());
+
+        InternetLayer<Tap> dev(*ip, *gateway, {*mac, std::move(*tap_device)});
+        run_until_interrupted(dev);
+    } else {
+        auto tap_device = MultiQueueTap::try_new(queues, offloads);
+
+        if (!tap_device.has_value()) {
+            logging::error("Failed to create TAP device: {}", tap_device.error().what());
+            return 1;
+        }
+        logging::info("Created TAP device {} with {} queues", tap_device->get_name(), queues);
+
+        // One core per queue.
+        std::vector<int> cpus(queues);
+        const auto cores = std::max(std::thread::hardware_concurrency(), 1u);
+        for (std::size_t i = 0; i < queues; ++i) {
+            cpus[i] = static_cast<int>(i % cores);
+        }
+
+        InternetLayer<MultiQueueTap> dev(*ip, *gateway, {*mac, std::move(*tap_device), {}, std::move(cpus)});
+        run_until_interrupted(dev);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include <algorithm>
+
+#include "memory_device.h"
+
+MemoryDevice::Ring::Ring(std::size_t capacity) : slots(std::max<std::size_t>(capacity, 1)) {}
+
+bool MemoryDevice::Ring::push(std::span<const std::byte> frame) {
+    return push(device::Parts{&frame, 1});
+}
+
+bool MemoryDevice::Ring::push(device::Parts parts) {
+    std::size_t size = 0;
+    for (auto part : parts) {
+        size += part.size();
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        if (!is_open || count == slots.size() || size > ethernet::max_size) {
+            return false;
+        }
+
+        auto& slot = slots[(head + count) % slots.size()];
+        slot.size = size;
+        auto out = slot.bytes.begin();
+        for (auto part : parts) {
+            out = std::ranges::copy(part, out).out;
+        }
+        ++count;
+    }
+    cv.notify_one();
+    return true;
+}
+
+device::ssize_t MemoryDevice::Ring::pop_locked(std::span<std::byte> buffer) {
+    if (count == 0) {
+        return is_open ? 0 : -1;
+    }
+
+    auto& slot = slots[head];
+    auto size = std::min(slot.size, buffer.size());
+    std::ranges::copy_n(slot.bytes.begin(), static_cast<std::ptrdiff_t>(size), buffer.begin());
+
+    head = (head + 1) % slots.size();
+    --count;
+
+    return static_cast<device::ssize_t>(size);
+}
+
+device::ssize_t MemoryDevice::Ring::pop(std::span<std::byte> buffer) {
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [&]{return !(is_open && count == 0);});
+
+    return pop_locked(buffer);
+}
+
+device::ssize_t MemoryDevice::Ring::try_pop(std::span<std::byte> buffer, device::Timeout timeout) {
+    std::unique_lock lock(mutex);
+    cv.wait_for(lock, timeout, [&]{return !(is_open && count == 0);});
+
+    return pop_locked(buffer);
+}
+
+void MemoryDevice::Ring::close() {
+    {
+        std::lock_guard lock(mutex);
+        is_open = false;
+    }
+    cv.notify_all();
+}
+
+MemoryDevice::MemoryDevice(std::shared_ptr<Ring> rx, std::shared_ptr<Ring> tx)
+    : rx{std::move(rx)},
+      tx{std::move(tx)}
+    {}
+
+MemoryDevice::MemoryDevice(std::size_t capacity)
+    : MemoryDevice{std::make_shared<Ring>(capacity), std::make_shared<Ring>(capacity)}
+    {}
+
+std::pair<MemoryDevice, MemoryDevice> MemoryDevice::pair(std::size_t capacity) {
+    auto a_to_b = std::make_shared<Ring>(capacity);
+    auto b_to_a = std::make_shared<Ring>(capacity);
+
+    return {MemoryDevice{b_to_a, a_to_b}, MemoryDevice{a_to_b, b_to_a}};
+}
+
+device::ssize_t MemoryDevice::write(std::span<const std::byte> frame) noexcept {
+    if (!tx->push(frame)) {
+        return -1;
+    }
+    return static_cast<device::ssize_t>(frame.size());
+}
+
+device::ssize_t MemoryDevice::writev(device::Parts parts) noexcept {
+    if (!tx->push(parts)) {
+        return -1;
+    }
+
+    std::size_t size = 0;
+    for (auto part : parts) {
+        size += part.size();
+    }
+    return static_cast<device::ssize_t>(size);
+}
+
+device::ssize_t MemoryDevice::read(std::span<std::byte> buffer) noexcept {
+    return rx->pop(buffer);
+}
+
+device::ssize_t MemoryDevice::try_read(std::span<std::byte> buffer, device::Timeout timeout) noexcept {
+    return rx->try_pop(buffer, timeout);
+}
+
+bool MemoryDevice::inject(std::span<const std::byte> frame) {
+    return rx->push(frame);
+}
+
+device::ssize_t MemoryDevice::take(std::span<std::byte> buffer, device::Timeout timeout) {
+    return tx->try_pop(buffer, timeout);
+}
+
+void MemoryDevice::close() {
+    rx->close();
+}
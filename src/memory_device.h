@@ -0,0 +1,67 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <array>
+#include <span>
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <utility>
+
+#include "device.h"
+#include "ethernet.h"
+
+// Device backed by two in-memory frame rings. Frames written by the stack
+// can be collected with take(), frames put with inject() are returned by
+// read()/try_read(). Two devices created with pair() are connected back to back.
+class MemoryDevice {
+public:
+    class Ring {
+        struct Slot {
+            std::size_t size;
+            std::array<std::byte, ethernet::max_size> bytes;
+        };
+
+        std::vector<Slot> slots;
+        std::size_t head{};
+        std::size_t count{};
+        bool is_open = true;
+        std::mutex mutex;
+        std::condition_variable cv;
+
+        device::ssize_t pop_locked(std::span<std::byte> buffer);
+    public:
+        explicit Ring(std::size_t capacity);
+
+        bool push(std::span<const std::byte> frame);
+        bool push(device::Parts parts);
+        device::ssize_t pop(std::span<std::byte> buffer);
+        device::ssize_t try_pop(std::span<std::byte> buffer, device::Timeout timeout);
+        void close();
+    };
+
+private:
+    std::shared_ptr<Ring> rx;
+    std::shared_ptr<Ring> tx;
+
+    MemoryDevice(std::shared_ptr<Ring> rx, std::shared_ptr<Ring> tx);
+public:
+    static constexpr std::size_t default_capacity = 1024;
+
+    explicit MemoryDevice(std::size_t capacity = default_capacity);
+    static std::pair<MemoryDevice, MemoryDevice> pair(std::size_t capacity = default_capacity);
+
+    // Frames are dropped when the ring is full, like a TAP queue overflowing.
+    device::ssize_t write(std::span<const std::byte>) noexcept;
+    device::ssize_t writev(device::Parts) noexcept;
+    device::ssize_t read(std::span<std::byte>) noexcept;
+    device::ssize_t try_read(std::span<std::byte>, device::Timeout timeout) noexcept;
+
+    bool inject(std::span<const std::byte> frame);
+    device::ssize_t take(std::span<std::byte> buffer, device::Timeout timeout);
+
+    // Makes reads on this device fail once the pending frames are consumed.
+    void close();
+};
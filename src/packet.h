@@ -8,9 +8,11 @@
 #include <type_traits>
 #include <vector>
 #include <array>
+#include <tuple>
 #include <span>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <bit>
 
 #include "utils.h"
@@ -78,8 +80,9 @@ namespace packet {
         return std::ranges::adjacent_find(names) == names.end();
     }
 
+    // General path, works for fields of any length and alignment.
     template<std::size_t first_bit, std::size_t bit_length, typename ReturnType>
-    ReturnType get(std::span<const std::byte, utils::bits_to_bytes(first_bit + bit_length)> bytes) {
+    ReturnType get_bitwise(std::span<const std::byte, utils::bits_to_bytes(first_bit + bit_length)> bytes) {
         constexpr auto bit_end = (first_bit + bit_length) % 8;
 
         const auto field_bytes = [&]{
@@ -134,7 +137,7 @@ namespace packet {
     }
 
     template<std::size_t first_bit, std::size_t bit_length, typename Type>
-    void set(std::span<std::byte, utils::bits_to_bytes(first_bit + bit_length)> bytes, Type value) {
+    void set_bitwise(std::span<std::byte, utils::bits_to_bytes(first_bit + bit_length)> bytes, Type value) {
         using ExtendedValueType = utils::leastN_t<first_bit + bit_length>;
 
         constexpr auto bit_end = (first_bit + bit_length) % 8;
@@ -228,6 +231,124 @@ namespace packet {
         }
     }
 
+    namespace detail {
+        template<typename T>
+        struct underlying {
+            using type = T;
+        };
+
+        template<typename T>
+            requires (std::is_enum_v<T>)
+        struct underlying<T> {
+            using type = std::underlying_type_t<T>;
+        };
+
+        // Integer fields spanning at most 8 bytes fit in a single machine word.
+        template<std::size_t first_bit, std::size_t bit_length, typename Type>
+        concept word_field =
+            std::integral<typename underlying<Type>::type> &&
+            utils::bits_to_bytes(first_bit + bit_length) <= 8;
+
+        // The field bytes are loaded into the most significant end of Word.
+        template<std::size_t byte_length>
+        using word_t = utils::leastN_t<byte_length * 8>;
+
+        template<typename Word>
+        constexpr Word low_bits(std::size_t count) {
+            return count == sizeof(Word) * 8 ? static_cast<Word>(~Word{}) : static_cast<Word>((Word{1} << count) - 1);
+        }
+
+        // Fields of 3, 5, 6 or 7 bytes are moved in power of two pieces, going
+        // through a zero padded Word on the stack stalls store forwarding.
+        template<typename Word, std::size_t N>
+        Word load(std::span<const std::byte, N> bytes) {
+            if constexpr (N == 0) {
+                return Word{};
+            } else if constexpr (N == sizeof(Word)) {
+                Word word;
+                std::memcpy(&word, bytes.data(), N);
+                if constexpr (std::endian::native == std::endian::little) {
+                    word = std::byteswap(word);
+                }
+                return word;
+            } else {
+                constexpr auto head = std::bit_floor(N);
+                using Head = word_t<head>;
+                return static_cast<Word>(
+                    static_cast<Word>(load<Head>(bytes.template first<head>())) << ((sizeof(Word) - head) * 8) |
+                    load<Word>(bytes.template last<N - head>()) >> (head * 8)
+                );
+            }
+        }
+
+        template<typename Word, std::size_t N>
+        void store(std::span<std::byte, N> bytes, Word word) {
+            if constexpr (N == sizeof(Word)) {
+                if constexpr (std::endian::native == std::endian::little) {
+                    word = std::byteswap(word);
+                }
+                std::memcpy(bytes.data(), &word, N);
+            } else if constexpr (N != 0) {
+                constexpr auto head = std::bit_floor(N);
+                using Head = word_t<head>;
+                store(bytes.template first<head>(), static_cast<Head>(word >> ((sizeof(Word) - head) * 8)));
+                store(bytes.template last<N - head>(), static_cast<Word>(word << (head * 8)));
+            }
+        }
+    }
+
+    // One load, shift and mask. For byte aligned fields of 1, 2, 4 or 8
+    // bytes this is a plain load and byteswap.
+    template<std::size_t first_bit, std::size_t bit_length, typename ReturnType>
+        requires (detail::word_field<first_bit, bit_length, ReturnType>)
+    ReturnType get_word(std::span<const std::byte, utils::bits_to_bytes(first_bit + bit_length)> bytes) {
+        using Underlying = typename detail::underlying<ReturnType>::type;
+        using Word = detail::word_t<utils::bits_to_bytes(first_bit + bit_length)>;
+        constexpr auto shift = sizeof(Word) * 8 - first_bit - bit_length;
+
+        auto word = static_cast<Word>(detail::load<Word>(bytes) >> shift);
+        if constexpr (bit_length != sizeof(Word) * 8) {
+            word &= detail::low_bits<Word>(bit_length);
+        }
+
+        return ReturnType{static_cast<Underlying>(word)};
+    }
+
+    // One load, mask and store, the load is skipped for whole bytes.
+    template<std::size_t first_bit, std::size_t bit_length, typename Type>
+        requires (detail::word_field<first_bit, bit_length, Type>)
+    void set_word(std::span<std::byte, utils::bits_to_bytes(first_bit + bit_length)> bytes, Type value) {
+        constexpr auto byte_length = utils::bits_to_bytes(first_bit + bit_length);
+        using Word = detail::word_t<byte_length>;
+        constexpr auto shift = sizeof(Word) * 8 - first_bit - bit_length;
+        constexpr auto mask = static_cast<Word>(detail::low_bits<Word>(bit_length) << shift);
+
+        auto word = static_cast<Word>(static_cast<Word>(value) << shift) & mask;
+        if constexpr (first_bit != 0 || bit_length % 8 != 0) {
+            word |= detail::load<Word>(std::span<const std::byte, byte_length>{bytes}) & static_cast<Word>(~mask);
+        }
+
+        detail::store(bytes, static_cast<Word>(word));
+    }
+
+    template<std::size_t first_bit, std::size_t bit_length, typename ReturnType>
+    ReturnType get(std::span<const std::byte, utils::bits_to_bytes(first_bit + bit_length)> bytes) {
+        if constexpr (detail::word_field<first_bit, bit_length, ReturnType>) {
+            return get_word<first_bit, bit_length, ReturnType>(bytes);
+        } else {
+            return get_bitwise<first_bit, bit_length, ReturnType>(bytes);
+        }
+    }
+
+    template<std::size_t first_bit, std::size_t bit_length, typename Type>
+    void set(std::span<std::byte, utils::bits_to_bytes(first_bit + bit_length)> bytes, Type value) {
+        if constexpr (detail::word_field<first_bit, bit_length, Type>) {
+            set_word<first_bit, bit_length>(bytes, value);
+        } else {
+            set_bitwise<first_bit, bit_length>(bytes, value);
+        }
+    }
+
     template<field_concept... Fields>
         requires (
             are_names_unique<Fields...>() &&
@@ -307,6 +428,152 @@ namespace packet {
             
             ::packet::set<bit_begin % 8, bit_length>(bytes.subspan<byte_begin, byte_length>(), value);
         }
+
+        static constexpr std::size_t field_index(std::string_view name) {
+            std::size_t index{};
+            std::size_t i{};
+            ((Fields::name == name ? (index = i, ++i) : ++i), ...);
+            return index;
+        }
+
+        // Every field of a header, decoded into host order.
+        struct Header {
+            std::tuple<typename Fields::type...> fields{};
+
+            template<utils::StringLiteral name>
+                requires (contains(name))
+            field_type<name> get() const {
+                return std::get<field_index(name)>(fields);
+            }
+
+            template<utils::StringLiteral name>
+                requires (contains(name))
+            void set(field_type<name> value) {
+                std::get<field_index(name)>(fields) = value;
+            }
+
+            bool operator==(const Header&) const = default;
+        };
+
+    private:
+        template<std::size_t i>
+        using field_at = std::tuple_element_t<i, std::tuple<Fields...>>;
+
+        static constexpr std::array<std::size_t, sizeof...(Fields)> starts{field_start(Fields::name)...};
+        static constexpr std::array<std::size_t, sizeof...(Fields)> lengths{Fields::bit_length...};
+
+        // Fields sharing bytes form a group, which starts and ends on byte
+        // boundaries and is read or written as a whole.
+        static constexpr std::size_t group_first(std::size_t i) {
+            while (starts[i] % 8 != 0) {
+                --i;
+            }
+            return i;
+        }
+
+        static constexpr std::size_t group_last(std::size_t i) {
+            while ((starts[i] + lengths[i]) % 8 != 0 && i + 1 < sizeof...(Fields)) {
+                ++i;
+            }
+            return i;
+        }
+
+        template<std::size_t first, std::size_t last>
+        static constexpr bool is_word_group() {
+            return
+                utils::bits_to_bytes(starts[last] + lengths[last]) - starts[first] / 8 <= 8 &&
+                []<std::size_t... i>(std::index_sequence<i...>) {
+                    return (std::integral<typename detail::underlying<typename field_at<first + i>::type>::type> && ...);
+                }(std::make_index_sequence<last - first + 1>{});
+        }
+
+        template<std::size_t first>
+        static void decode_group(std::span<const std::byte> bytes, Header& header) {
+            constexpr auto last = group_last(first);
+
+            if constexpr (is_word_group<first, last>()) {
+                constexpr auto byte_begin = starts[first] / 8;
+                constexpr auto byte_length = utils::bits_to_bytes(starts[last] + lengths[last]) - byte_begin;
+                using Word = detail::word_t<byte_length>;
+
+                const auto word = detail::load<Word>(bytes.subspan<byte_begin, byte_length>());
+
+                [&]<std::size_t... i>(std::index_sequence<i...>) {
+                    ([&]{
+                        using Type = typename field_at<first + i>::type;
+                        using Underlying = typename detail::underlying<Type>::type;
+                        constexpr auto shift = sizeof(Word) * 8 - (starts[first + i] - byte_begin * 8) - lengths[first + i];
+
+                        auto value = static_cast<Word>(word >> shift) & detail::low_bits<Word>(lengths[first + i]);
+                        std::get<first + i>(header.fields) = Type{static_cast<Underlying>(value)};
+                    }(), ...);
+                }(std::make_index_sequence<last - first + 1>{});
+            } else {
+                [&]<std::size_t... i>(std::index_sequence<i...>) {
+                    ((std::get<first + i>(header.fields) = get<field_at<first + i>::name>(bytes)), ...);
+                }(std::make_index_sequence<last - first + 1>{});
+            }
+        }
+
+        template<std::size_t first>
+        static void encode_group(std::span<std::byte> bytes, const Header& header) {
+            constexpr auto last = group_last(first);
+
+            if constexpr (is_word_group<first, last>()) {
+                constexpr auto byte_begin = starts[first] / 8;
+                constexpr auto bit_end = starts[last] + lengths[last];
+                constexpr auto byte_length = utils::bits_to_bytes(bit_end) - byte_begin;
+                using Word = detail::word_t<byte_length>;
+
+                Word word{};
+                [&]<std::size_t... i>(std::index_sequence<i...>) {
+                    ([&]{
+                        constexpr auto shift = sizeof(Word) * 8 - (starts[first + i] - byte_begin * 8) - lengths[first + i];
+                        auto value = static_cast<Word>(std::get<first + i>(header.fields)) & detail::low_bits<Word>(lengths[first + i]);
+                        word |= static_cast<Word>(value << shift);
+                    }(), ...);
+                }(std::make_index_sequence<last - first + 1>{});
+
+                const auto group_bytes = bytes.subspan<byte_begin, byte_length>();
+                if constexpr (bit_end % 8 != 0) {
+                    // Only a format that does not end on a byte boundary gets here.
+                    constexpr auto mask = detail::low_bits<Word>(sizeof(Word) * 8 - (bit_end - byte_begin * 8));
+                    word |= static_cast<Word>(detail::load<Word>(std::span<const std::byte, byte_length>{group_bytes}) & mask);
+                }
+                detail::store(group_bytes, word);
+            } else {
+                [&]<std::size_t... i>(std::index_sequence<i...>) {
+                    (set<field_at<first + i>::name>(bytes, std::get<first + i>(header.fields)), ...);
+                }(std::make_index_sequence<last - first + 1>{});
+            }
+        }
+
+    public:
+        // Reads every field in one pass, each group of fields that share
+        // bytes is loaded once.
+        static Header decode(std::span<const std::byte> bytes) {
+            Header header;
+            [&]<std::size_t... i>(std::index_sequence<i...>) {
+                ([&]{
+                    if constexpr (group_first(i) == i) {
+                        decode_group<i>(bytes, header);
+                    }
+                }(), ...);
+            }(std::make_index_sequence<sizeof...(Fields)>{});
+            return header;
+        }
+
+        // Writes every field in one pass, each group of fields that share
+        // bytes is stored once.
+        static void encode(std::span<std::byte> bytes, const Header& header) {
+            [&]<std::size_t... i>(std::index_sequence<i...>) {
+                ([&]{
+                    if constexpr (group_first(i) == i) {
+                        encode_group<i>(bytes, header);
+                    }
+                }(), ...);
+            }(std::make_index_sequence<sizeof...(Fields)>{});
+        }
     };
 
     template<std::ranges::contiguous_range Range_, typename Format_>
@@ -342,6 +609,16 @@ namespace packet {
             Format::template set<name>(bytes, value);
         }
 
+        typename Format::Header decode() const {
+            return Format::decode(bytes);
+        }
+
+        void encode(const typename Format::Header& header)
+            requires (!std::is_const_v<ValueType>)
+        {
+            Format::encode(bytes, header);
+        }
+
         std::span<ValueType> to_span(std::size_t offset = 0, std::size_t count = std::dynamic_extent) {
             return std::span{bytes}.subspan(offset, count);
         }
@@ -0,0 +1,295 @@
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#include "packet_socket.h"
+
+namespace {
+    std::system_error error(const char* what) {
+        return std::system_error{errno, std::system_category(), what};
+    }
+
+    uint32_t load_status(const uint32_t& status) {
+        return std::atomic_ref{const_cast<uint32_t&>(status)}.load(std::memory_order_acquire);
+    }
+
+    void store_status(uint32_t& status, uint32_t value) {
+        std::atomic_ref{status}.store(value, std::memory_order_release);
+    }
+
+    // Offset of frame data in a TX ring slot when PACKET_TX_HAS_OFF is not set.
+    constexpr std::size_t tx_data_offset = TPACKET_ALIGN(sizeof(tpacket3_hdr));
+}
+
+PacketSocket::PacketSocket(int fd, std::string name, Config config, std::byte* ring, std::size_t ring_size)
+    : fd{fd},
+      name{std::move(name)},
+      config{config},
+      ring{ring},
+      ring_size{ring_size},
+      lender{config.rx_block_count}
+{
+    held.reserve(config.rx_block_count);
+}
+
+std::expected<PacketSocket, std::system_error> PacketSocket::try_new(std::string_view interface, Config config) noexcept {
+    std::string name{interface};
+
+    auto index = if_nametoindex(name.c_str());
+    if (index == 0) {
+        return std::unexpected{error("Unknown network interface")};
+    }
+
+    if (
+        config.frame_size == 0 || config.block_size % config.frame_size != 0 ||
+        config.rx_block_count == 0 || config.tx_block_count == 0
+    ) {
+        return std::unexpected{std::system_error{EINVAL, std::system_category(), "Invalid packet ring geometry"}};
+    }
+
+    int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd < 0) {
+        return std::unexpected{error("Cannot open packet socket")};
+    }
+
+    auto fail = [&](const char* what) {
+        auto result = error(what);
+        close(fd);
+        return std::unexpected{result};
+    };
+
+    int version = TPACKET_V3;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        return fail("Cannot select TPACKET_V3");
+    }
+
+    int one = 1;
+    // Both are optimizations: frames we send must not show up on the RX ring
+    // and TX does not need to go through the qdisc layer.
+    setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+    setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+
+    const auto frames_per_block = config.block_size / config.frame_size;
+
+    tpacket_req3 rx_request{};
+    rx_request.tp_block_size = config.block_size;
+    rx_request.tp_block_nr = config.rx_block_count;
+    rx_request.tp_frame_size = config.frame_size;
+    rx_request.tp_frame_nr = frames_per_block * config.rx_block_count;
+    rx_request.tp_retire_blk_tov = config.block_timeout_ms;
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &rx_request, sizeof(rx_request)) < 0) {
+        return fail("Cannot set up packet RX ring");
+    }
+
+    tpacket_req3 tx_request{};
+    tx_request.tp_block_size = config.block_size;
+    tx_request.tp_block_nr = config.tx_block_count;
+    tx_request.tp_frame_size = config.frame_size;
+    tx_request.tp_frame_nr = frames_per_block * config.tx_block_count;
+    if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &tx_request, sizeof(tx_request)) < 0) {
+        return fail("Cannot set up packet TX ring");
+    }
+
+    std::size_t ring_size = std::size_t{config.block_size} * (config.rx_block_count + config.tx_block_count);
+    auto ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED | MAP_POPULATE, fd, 0);
+    if (ring == MAP_FAILED) {
+        ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (ring == MAP_FAILED) {
+        return fail("Cannot map packet rings");
+    }
+
+    sockaddr_ll address{};
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_ALL);
+    address.sll_ifindex = static_cast<int>(index);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        munmap(ring, ring_size);
+        return fail("Cannot bind packet socket");
+    }
+
+    try {
+        return PacketSocket{fd, std::move(name), config, static_cast<std::byte*>(ring), ring_size};
+    } catch (const std::bad_alloc&) {
+        munmap(ring, ring_size);
+        close(fd);
+        return std::unexpected{std::system_error{ENOMEM, std::system_category(), "Cannot allocate packet ring state"}};
+    }
+}
+
+PacketSocket::PacketSocket(PacketSocket&& other) noexcept
+    : fd{std::exchange(other.fd, -1)},
+      name{std::move(other.name)},
+      config{other.config},
+      ring{std::exchange(other.ring, nullptr)},
+      ring_size{other.ring_size},
+      rx_block{other.rx_block},
+      rx_packet{other.rx_packet},
+      rx_remaining{std::exchange(other.rx_remaining, 0)},
+      failed{other.failed},
+      lender{std::move(other.lender)},
+      held{std::move(other.held)},
+      tx_frame{other.tx_frame},
+      tx_pending{other.tx_pending}
+    {}
+
+PacketSocket::~PacketSocket() noexcept {
+    if (ring != nullptr) {
+        munmap(ring, ring_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void PacketSocket::release_block() noexcept {
+    if (rx_packet != nullptr) {
+        if (lender.in_use(rx_block)) {
+            held.push_back(rx_block);
+        } else {
+            auto& block = *reinterpret_cast<tpacket_block_desc*>(ring + rx_block * config.block_size);
+            store_status(block.hdr.bh1.block_status, TP_STATUS_KERNEL);
+        }
+        rx_block = (rx_block + 1) % config.rx_block_count;
+        rx_packet = nullptr;
+        rx_remaining = 0;
+    }
+}
+
+void PacketSocket::return_held_blocks() noexcept {
+    std::erase_if(held, [&](std::size_t index){
+        if (lender.in_use(index)) {
+            return false;
+        }
+        auto& block = *reinterpret_cast<tpacket_block_desc*>(ring + index * config.block_size);
+        store_status(block.hdr.bh1.block_status, TP_STATUS_KERNEL);
+        return true;
+    });
+}
+
+bool PacketSocket::acquire_block(device::Timeout timeout) noexcept {
+    release_block();
+    return_held_blocks();
+
+    if (std::ranges::find(held, rx_block) != held.end()) {
+        // Its status still says it is ours, the kernel is waiting for it too.
+        std::this_thread::sleep_for(std::min(timeout, device::Timeout{1}));
+        return false;
+    }
+
+    auto& block = *reinterpret_cast<tpacket_block_desc*>(ring + rx_block * config.block_size);
+
+    if ((load_status(block.hdr.bh1.block_status) & TP_STATUS_USER) == 0) {
+        pollfd poll_fd{fd, POLLIN | POLLERR, 0};
+        if (auto result = poll(&poll_fd, 1, timeout.count()); result < 0) {
+            failed = errno != EINTR;
+            return false;
+        }
+        if ((load_status(block.hdr.bh1.block_status) & TP_STATUS_USER) == 0) {
+            return false;
+        }
+    }
+
+    rx_packet = reinterpret_cast<std::byte*>(&block) + block.hdr.bh1.offset_to_first_pkt;
+    rx_remaining = block.hdr.bh1.num_pkts;
+
+    if (rx_remaining == 0) {
+        release_block();
+        return false;
+    }
+    return true;
+}
+
+std::span<const std::byte> PacketSocket::next_frame() noexcept {
+    if (rx_remaining == 0) {
+        return {};
+    }
+
+    const auto& header = *reinterpret_cast<const tpacket3_hdr*>(rx_packet);
+    std::span<const std::byte> frame{rx_packet + header.tp_mac, header.tp_snaplen};
+
+    rx_packet += header.tp_next_offset;
+    --rx_remaining;
+
+    return frame;
+}
+
+device::ssize_t PacketSocket::try_read(std::span<std::byte> buffer, device::Timeout timeout) noexcept {
+    if (rx_remaining == 0 && !acquire_block(timeout)) {
+        return failed ? -1 : 0;
+    }
+
+    auto frame = next_frame();
+    auto size = std::min(frame.size(), buffer.size());
+    std::ranges::copy(frame.first(size), buffer.begin());
+    if (rx_remaining == 0) {
+        release_block();
+    }
+
+    return static_cast<device::ssize_t>(size);
+}
+
+device::ssize_t PacketSocket::write(std::span<const std::byte> frame) noexcept {
+    if (frame.size() > config.frame_size - tx_data_offset) {
+        return -1;
+    }
+
+    std::lock_guard lock(tx_mutex);
+
+    const auto frames_per_block = config.block_size / config.frame_size;
+    auto tx_ring = ring + std::size_t{config.block_size} * config.rx_block_count;
+    auto slot = tx_ring + (tx_frame / frames_per_block) * config.block_size + (tx_frame % frames_per_block) * config.frame_size;
+    auto& header = *reinterpret_cast<tpacket3_hdr*>(slot);
+
+    auto status = load_status(header.tp_status);
+    if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT) {
+        // The ring is full: push out what is queued and wait for the kernel.
+        tx_pending = 0;
+        if (send(fd, nullptr, 0, 0) < 0) {
+            return -1;
+        }
+        status = load_status(header.tp_status);
+        if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT) {
+            return -1;
+        }
+    }
+
+    std::ranges::copy(frame, slot + tx_data_offset);
+    header.tp_len = static_cast<uint32_t>(frame.size());
+    header.tp_snaplen = static_cast<uint32_t>(frame.size());
+    header.tp_next_offset = 0;
+    store_status(header.tp_status, TP_STATUS_SEND_REQUEST);
+
+    tx_frame = (tx_frame + 1) % (frames_per_block * config.tx_block_count);
+    ++tx_pending;
+
+    if (receiving != std::this_thread::get_id() || tx_pending >= config.tx_batch) {
+        kick();
+    }
+
+    return static_cast<device::ssize_t>(frame.size());
+}
+
+void PacketSocket::kick() noexcept {
+    tx_pending = 0;
+    send(fd, nullptr, 0, MSG_DONTWAIT);
+}
+
+void PacketSocket::flush() noexcept {
+    std::lock_guard lock(tx_mutex);
+    if (tx_pending > 0) {
+        kick();
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <expected>
+#include <system_error>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <thread>
+#include <concepts>
+#include <vector>
+
+#include "device.h"
+#include "buffer_pool.h"
+
+// AF_PACKET socket bound to an existing interface, with TPACKET_V3 memory
+// mapped RX and TX rings. receive() hands the frames of a whole retired RX
+// block to the handler in place, along with a Buffer lending the block.
+// The block goes back to the kernel with the first receive() after the last
+// copy of that Buffer is gone. The kernel fills blocks in order and waits
+// for one still lent, so once half of them are, frames come without a
+// Buffer and have to be copied to be kept. Frames written from inside
+// receive() are transmitted with a single send() once the block has been
+// processed.
+//
+// The socket has to outlive the Buffers it lent.
+class PacketSocket {
+public:
+    struct Config {
+        uint32_t block_size = 1 << 18;
+        uint32_t rx_block_count = 64;
+        uint32_t tx_block_count = 8;
+        uint32_t frame_size = 2048;
+        uint32_t block_timeout_ms = 1;
+        uint32_t tx_batch = 32;
+    };
+
+private:
+    int fd = -1;
+    std::string name;
+    Config config;
+
+    std::byte* ring = nullptr;
+    std::size_t ring_size{};
+
+    std::size_t rx_block{};
+    std::byte* rx_packet = nullptr;
+    uint32_t rx_remaining{};
+    bool failed = false;
+
+    buffer::Lender lender;
+    // Blocks done with that are still lent.
+    std::vector<std::size_t> held;
+
+    std::mutex tx_mutex;
+    std::size_t tx_frame{};
+    uint32_t tx_pending{};
+    std::thread::id receiving;
+
+    PacketSocket(int fd, std::string name, Config config, std::byte* ring, std::size_t ring_size);
+
+    std::span<std::byte> rx_block_bytes(std::size_t block) const noexcept {
+        return {ring + block * config.block_size, config.block_size};
+    }
+
+    bool acquire_block(device::Timeout timeout) noexcept;
+    // Hands the current block back to the kernel, or holds it while lent.
+    void release_block() noexcept;
+    void return_held_blocks() noexcept;
+    std::span<const std::byte> next_frame() noexcept;
+    void kick() noexcept;
+public:
+    static std::expected<PacketSocket, std::system_error> try_new(std::string_view interface, Config config) noexcept;
+    static std::expected<PacketSocket, std::system_error> try_new(std::string_view interface) noexcept {
+        return try_new(interface, Config{});
+    }
+
+    PacketSocket(const PacketSocket&) = delete;
+    PacketSocket(PacketSocket&&) noexcept;
+    ~PacketSocket() noexcept;
+
+    device::ssize_t write(std::span<const std::byte>) noexcept;
+    device::ssize_t try_read(std::span<std::byte>, device::Timeout timeout) noexcept;
+
+    template<std::invocable<std::span<const std::byte>, const buffer::Buffer&> Handler>
+    device::ssize_t receive(Handler&& handler, device::Timeout timeout);
+
+    // Transmits frames written since the last send().
+    void flush() noexcept;
+
+    const std::string& get_name() const noexcept {
+        return name;
+    }
+};
+
+template<std::invocable<std::span<const std::byte>, const buffer::Buffer&> Handler>
+device::ssize_t PacketSocket::receive(Handler&& handler, device::Timeout timeout) {
+    if (rx_remaining == 0 && !acquire_block(timeout)) {
+        return failed ? -1 : 0;
+    }
+
+    {
+        std::lock_guard lock(tx_mutex);
+        receiving = std::this_thread::get_id();
+    }
+
+    device::ssize_t count{};
+    {
+        auto block = held.size() < config.rx_block_count / 2 ? lender.lend(rx_block, rx_block_bytes(rx_block)) : buffer::Buffer{};
+        for (auto frame = next_frame(); !frame.empty(); frame = next_frame()) {
+            handler(frame, block);
+            ++count;
+        }
+    }
+    release_block();
+
+    {
+        std::lock_guard lock(tx_mutex);
+        receiving = {};
+    }
+    flush();
+
+    return count;
+}
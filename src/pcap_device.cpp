@@ -0,0 +1,159 @@
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <cstdint>
+#include <bit>
+
+#include "pcap_device.h"
+
+namespace {
+    constexpr uint32_t magic = 0xa1b2c3d4;
+    constexpr uint32_t magic_ns = 0xa1b23c4d;
+    constexpr uint32_t linktype_ethernet = 1;
+    constexpr uint32_t snapshot_length = 65535;
+
+    struct FileHeader {
+        uint32_t magic;
+        uint16_t version_major;
+        uint16_t version_minor;
+        int32_t thiszone;
+        uint32_t sigfigs;
+        uint32_t snaplen;
+        uint32_t network;
+    };
+
+    struct RecordHeader {
+        uint32_t ts_sec;
+        uint32_t ts_usec;
+        uint32_t incl_len;
+        uint32_t orig_len;
+    };
+
+    std::system_error last_error(const char* what) {
+        return std::system_error{errno != 0 ? errno : EIO, std::system_category(), what};
+    }
+}
+
+PcapDevice::PcapDevice(File input, File output, bool swapped)
+    : input{std::move(input)},
+      output{std::move(output)},
+      swapped{swapped}
+    {}
+
+std::expected<PcapDevice, std::system_error> PcapDevice::try_open(
+    const std::filesystem::path& input_path,
+    const std::filesystem::path& output_path
+) noexcept {
+    File input;
+    File output;
+    bool swapped = false;
+
+    if (!input_path.empty()) {
+        errno = 0;
+        input.reset(std::fopen(input_path.c_str(), "rb"));
+        if (!input) {
+            return std::unexpected{last_error("Cannot open pcap input file")};
+        }
+
+        FileHeader header;
+        if (std::fread(&header, sizeof(header), 1, input.get()) != 1) {
+            return std::unexpected{last_error("Cannot read pcap file header")};
+        }
+
+        if (header.magic == std::byteswap(magic) || header.magic == std::byteswap(magic_ns)) {
+            swapped = true;
+            header.network = std::byteswap(header.network);
+        } else if (header.magic != magic && header.magic != magic_ns) {
+            return std::unexpected{std::system_error{EINVAL, std::system_category(), "Not a pcap file"}};
+        }
+
+        if (header.network != linktype_ethernet) {
+            return std::unexpected{std::system_error{EINVAL, std::system_category(), "Pcap file does not contain ethernet frames"}};
+        }
+    }
+
+    if (!output_path.empty()) {
+        errno = 0;
+        output.reset(std::fopen(output_path.c_str(), "wb"));
+        if (!output) {
+            return std::unexpected{last_error("Cannot open pcap output file")};
+        }
+
+        FileHeader header{magic, 2, 4, 0, 0, snapshot_length, linktype_ethernet};
+        if (std::fwrite(&header, sizeof(header), 1, output.get()) != 1) {
+            return std::unexpected{last_error("Cannot write pcap file header")};
+        }
+    }
+
+    return PcapDevice{std::move(input), std::move(output), swapped};
+}
+
+device::ssize_t PcapDevice::write(std::span<const std::byte> frame) noexcept {
+    return writev(device::Parts{&frame, 1});
+}
+
+device::ssize_t PcapDevice::writev(device::Parts parts) noexcept {
+    std::size_t size = 0;
+    for (auto part : parts) {
+        size += part.size();
+    }
+
+    if (!output) {
+        return static_cast<device::ssize_t>(size);
+    }
+
+    using namespace std::chrono;
+    auto now = system_clock::now().time_since_epoch();
+    auto seconds = duration_cast<std::chrono::seconds>(now);
+
+    RecordHeader header{
+        static_cast<uint32_t>(seconds.count()),
+        static_cast<uint32_t>(duration_cast<microseconds>(now - seconds).count()),
+        static_cast<uint32_t>(size),
+        static_cast<uint32_t>(size)
+    };
+
+    if (std::fwrite(&header, sizeof(header), 1, output.get()) != 1) {
+        return -1;
+    }
+    for (auto part : parts) {
+        if (std::fwrite(part.data(), 1, part.size(), output.get()) != part.size()) {
+            return -1;
+        }
+    }
+
+    return static_cast<device::ssize_t>(size);
+}
+
+device::ssize_t PcapDevice::read(std::span<std::byte> buffer) noexcept {
+    if (!input) {
+        return -1;
+    }
+
+    RecordHeader header;
+    if (std::fread(&header, sizeof(header), 1, input.get()) != 1) {
+        return -1;
+    }
+
+    auto length = swapped ? std::byteswap(header.incl_len) : header.incl_len;
+    auto size = std::min<std::size_t>(length, buffer.size());
+
+    if (std::fread(buffer.data(), 1, size, input.get()) != size) {
+        return -1;
+    }
+    if (size < length && std::fseek(input.get(), static_cast<long>(length - size), SEEK_CUR) != 0) {
+        return -1;
+    }
+
+    return static_cast<device::ssize_t>(size);
+}
+
+device::ssize_t PcapDevice::try_read(std::span<std::byte> buffer, device::Timeout timeout) noexcept {
+    if (!input) {
+        std::this_thread::sleep_for(timeout);
+        return 0;
+    }
+    return read(buffer);
+}
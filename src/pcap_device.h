@@ -0,0 +1,39 @@
+#pragma once
+
+#include <expected>
+#include <system_error>
+#include <cstddef>
+#include <cstdio>
+#include <span>
+#include <memory>
+#include <filesystem>
+
+#include "device.h"
+
+// Device that replays frames from a pcap file and records written frames
+// into another one. Either path may be empty. Reads fail at the end of the
+// input file, which stops LinkLayer::run.
+class PcapDevice {
+    struct Close {
+        void operator()(std::FILE* file) const noexcept {
+            std::fclose(file);
+        }
+    };
+    using File = std::unique_ptr<std::FILE, Close>;
+
+    File input;
+    File output;
+    bool swapped = false;
+
+    PcapDevice(File input, File output, bool swapped);
+public:
+    static std::expected<PcapDevice, std::system_error> try_open(
+        const std::filesystem::path& input,
+        const std::filesystem::path& output
+    ) noexcept;
+
+    device::ssize_t write(std::span<const std::byte>) noexcept;
+    device::ssize_t writev(device::Parts) noexcept;
+    device::ssize_t read(std::span<std::byte>) noexcept;
+    device::ssize_t try_read(std::span<std::byte>, device::Timeout timeout) noexcept;
+};
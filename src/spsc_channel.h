@@ -0,0 +1,287 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <optional>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <thread>
+
+// Bounded single producer, single consumer counterpart of Channel, with the
+// same close() and iteration semantics. Only one thread may push and only
+// one thread may pop. Either side spins for a while when it has to wait and
+// then sleeps on a futex, the other side only makes a syscall to wake it
+// when it actually sleeps.
+template <typename T>
+class SpscChannel {
+    static constexpr std::size_t cache_line_size = 64;
+    // Spinning only pays off when the other side runs on another CPU.
+    static inline const int spin_count = std::thread::hardware_concurrency() > 1 ? 512 : 0;
+
+    struct Slot {
+        alignas(T) std::byte storage[sizeof(T)];
+
+        T* get() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+    };
+
+    const std::size_t mask;
+    const std::unique_ptr<Slot[]> slots;
+
+    // Written by the producer.
+    alignas(cache_line_size) std::atomic<std::size_t> tail{};
+    std::size_t cached_head{};
+
+    // Written by the consumer.
+    alignas(cache_line_size) std::atomic<std::size_t> head{};
+    std::size_t cached_tail{};
+
+    // Only touched on the slow path.
+    alignas(cache_line_size) std::atomic<bool> is_open{true};
+    std::atomic<bool> consumer_waiting{};
+    std::atomic<uint32_t> consumer_signal{};
+    std::atomic<bool> producer_waiting{};
+    std::atomic<uint32_t> producer_signal{};
+
+    static void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    template <typename Ready>
+    static void wait(Ready ready, std::atomic<bool>& waiting, std::atomic<uint32_t>& signal);
+    static void wake(std::atomic<bool>& waiting, std::atomic<uint32_t>& signal);
+public:
+    // capacity is rounded up to a power of two.
+    explicit SpscChannel(std::size_t capacity = 1024);
+    SpscChannel(const SpscChannel&) = delete;
+    ~SpscChannel();
+
+    // Waits while the channel is full. Returns false once it is closed.
+    bool push(T value);
+
+    template <typename... U>
+    bool emplace(U&&... args);
+
+    // Returns false when the channel is full or closed.
+    bool try_push(T value);
+
+    template <typename... U>
+    bool try_emplace(U&&... args);
+
+    void close();
+
+    // Waits while the channel is empty. Returns nullopt once it is closed and drained.
+    std::optional<T> pop();
+    std::optional<T> try_pop();
+
+    std::size_t capacity() const noexcept {
+        return mask + 1;
+    }
+
+    class InputIter;
+    class Sentinel{};
+
+    InputIter begin();
+    Sentinel end();
+};
+
+template <typename T>
+SpscChannel<T>::SpscChannel(std::size_t capacity)
+    : mask{std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1},
+      slots{std::make_unique<Slot[]>(mask + 1)}
+{}
+
+template <typename T>
+SpscChannel<T>::~SpscChannel() {
+    for (auto i = head.load(std::memory_order_relaxed); i != tail.load(std::memory_order_relaxed); ++i) {
+        std::destroy_at(slots[i & mask].get());
+    }
+}
+
+template <typename T>
+template <typename Ready>
+void SpscChannel<T>::wait(Ready ready, std::atomic<bool>& waiting, std::atomic<uint32_t>& signal) {
+    for (int i = 0; i < spin_count; ++i) {
+        if (ready()) {
+            return;
+        }
+        pause();
+    }
+
+    while (true) {
+        auto observed = signal.load(std::memory_order_acquire);
+        waiting.store(true, std::memory_order_relaxed);
+        // Pairs with the fence in wake(), either the other side sees
+        // waiting or ready() sees its update.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ready()) {
+            break;
+        }
+        signal.wait(observed, std::memory_order_acquire);
+    }
+    waiting.store(false, std::memory_order_relaxed);
+}
+
+template <typename T>
+void SpscChannel<T>::wake(std::atomic<bool>& waiting, std::atomic<uint32_t>& signal) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // Only the first wake up after the other side went to sleep makes a syscall.
+    if (waiting.load(std::memory_order_relaxed) && waiting.exchange(false, std::memory_order_relaxed)) {
+        signal.fetch_add(1, std::memory_order_release);
+        signal.notify_one();
+    }
+}
+
+template <typename T>
+bool SpscChannel<T>::push(T value) {
+    return emplace(std::move(value));
+}
+
+template <typename T>
+template <typename... U>
+bool SpscChannel<T>::emplace(U&&... args) {
+    const auto tail_index = tail.load(std::memory_order_relaxed);
+
+    if (tail_index - cached_head > mask) {
+        wait(
+            [&]{
+                cached_head = head.load(std::memory_order_acquire);
+                return tail_index - cached_head <= mask || !is_open.load(std::memory_order_acquire);
+            },
+            producer_waiting,
+            producer_signal
+        );
+    }
+    if (!is_open.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    std::construct_at(slots[tail_index & mask].get(), std::forward<U>(args)...);
+    tail.store(tail_index + 1, std::memory_order_release);
+    wake(consumer_waiting, consumer_signal);
+    return true;
+}
+
+template <typename T>
+bool SpscChannel<T>::try_push(T value) {
+    return try_emplace(std::move(value));
+}
+
+template <typename T>
+template <typename... U>
+bool SpscChannel<T>::try_emplace(U&&... args) {
+    const auto tail_index = tail.load(std::memory_order_relaxed);
+
+    if (tail_index - cached_head > mask) {
+        cached_head = head.load(std::memory_order_acquire);
+        if (tail_index - cached_head > mask) {
+            return false;
+        }
+    }
+    if (!is_open.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    std::construct_at(slots[tail_index & mask].get(), std::forward<U>(args)...);
+    tail.store(tail_index + 1, std::memory_order_release);
+    wake(consumer_waiting, consumer_signal);
+    return true;
+}
+
+template <typename T>
+void SpscChannel<T>::close() {
+    is_open.store(false, std::memory_order_release);
+
+    consumer_signal.fetch_add(1, std::memory_order_release);
+    consumer_signal.notify_all();
+    producer_signal.fetch_add(1, std::memory_order_release);
+    producer_signal.notify_all();
+}
+
+template <typename T>
+std::optional<T> SpscChannel<T>::pop() {
+    const auto head_index = head.load(std::memory_order_relaxed);
+
+    if (head_index == cached_tail) {
+        wait(
+            [&]{
+                cached_tail = tail.load(std::memory_order_acquire);
+                return head_index != cached_tail || !is_open.load(std::memory_order_acquire);
+            },
+            consumer_waiting,
+            consumer_signal
+        );
+
+        // Values pushed right before close() are still delivered.
+        cached_tail = tail.load(std::memory_order_acquire);
+        if (head_index == cached_tail) {
+            return std::nullopt;
+        }
+    }
+
+    auto slot = slots[head_index & mask].get();
+    std::optional<T> value = std::move(*slot);
+    std::destroy_at(slot);
+
+    head.store(head_index + 1, std::memory_order_release);
+    wake(producer_waiting, producer_signal);
+    return value;
+}
+
+template <typename T>
+std::optional<T> SpscChannel<T>::try_pop() {
+    const auto head_index = head.load(std::memory_order_relaxed);
+
+    if (head_index == cached_tail) {
+        cached_tail = tail.load(std::memory_order_acquire);
+        if (head_index == cached_tail) {
+            return std::nullopt;
+        }
+    }
+
+    auto slot = slots[head_index & mask].get();
+    std::optional<T> value = std::move(*slot);
+    std::destroy_at(slot);
+
+    head.store(head_index + 1, std::memory_order_release);
+    wake(producer_waiting, producer_signal);
+    return value;
+}
+
+template <typename T>
+class SpscChannel<T>::InputIter {
+    friend class SpscChannel;
+
+    SpscChannel& channel;
+    std::optional<T> value;
+
+    InputIter(SpscChannel& channel) : channel{channel}, value{channel.pop()} {}
+public:
+    T& operator*() {
+        return *value;
+    }
+    bool operator==(SpscChannel::Sentinel) {
+        return !value.has_value();
+    }
+    InputIter& operator++() {
+        value = channel.pop();
+        return *this;
+    }
+};
+
+template <typename T>
+auto SpscChannel<T>::begin() -> InputIter {
+    return InputIter(*this);
+}
+
+template <typename T>
+auto SpscChannel<T>::end() -> Sentinel {
+    return Sentinel{};
+}
@@ -0,0 +1,196 @@
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+namespace stats {
+    namespace {
+        const Header& header(const std::byte* memory) {
+            return *reinterpret_cast<const Header*>(memory);
+        }
+
+        Block* blocks(std::byte* memory) {
+            return std::launder(reinterpret_cast<Block*>(memory + blocks_offset));
+        }
+
+        Values sum(const std::byte* memory) noexcept {
+            Values values{};
+            auto first = blocks(const_cast<std::byte*>(memory));
+            for (std::size_t block = 0; block < max_threads; ++block) {
+                for (std::size_t i = 0; i < counter_count; ++i) {
+                    values[i] += std::atomic_ref<uint64_t>{first[block].values[i]}.load(std::memory_order_relaxed);
+                }
+            }
+            return values;
+        }
+
+        // The segment of this process. It is left mapped at exit, threads
+        // may still count while static objects are destroyed.
+        class Segment {
+            std::string name;
+            std::byte* memory;
+            bool shared = false;
+
+            std::mutex mutex;
+            std::vector<Block*> free_blocks;
+
+        public:
+            Segment() : name{segment_name(getpid())} {
+                void* mapping = MAP_FAILED;
+                if (auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644); fd >= 0) {
+                    if (ftruncate(fd, segment_size) == 0) {
+                        mapping = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                    }
+                    close(fd);
+                    shared = mapping != MAP_FAILED;
+                    if (!shared) {
+                        shm_unlink(name.c_str());
+                    }
+                }
+                // Counting goes on unpublished without shared memory.
+                if (mapping == MAP_FAILED) {
+                    mapping = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                }
+                if (mapping == MAP_FAILED) {
+                    throw std::bad_alloc{};
+                }
+                memory = static_cast<std::byte*>(mapping);
+
+                auto first = blocks(memory);
+                for (std::size_t block = max_threads; block-- > 0;) {
+                    free_blocks.push_back(std::construct_at(first + block));
+                }
+
+                // The reader checks the header last.
+                std::construct_at(reinterpret_cast<Header*>(memory), Header{
+                    .magic = Header::magic_value,
+                    .version = Header::current_version,
+                    .counters = static_cast<uint32_t>(counter_count),
+                    .blocks = static_cast<uint32_t>(max_threads)
+                });
+            }
+
+            ~Segment() {
+                if (shared) {
+                    shm_unlink(name.c_str());
+                }
+            }
+
+            Block* acquire() {
+                std::lock_guard lock(mutex);
+                if (free_blocks.empty()) {
+                    return nullptr;
+                }
+                auto block = free_blocks.back();
+                free_blocks.pop_back();
+                return block;
+            }
+
+            void release(Block* block) {
+                std::lock_guard lock(mutex);
+                free_blocks.push_back(block);
+            }
+
+            const std::byte* data() const noexcept {
+                return memory;
+            }
+        };
+
+        Segment& segment() {
+            static Segment instance;
+            return instance;
+        }
+
+        // Hands the block back when the thread finishes.
+        struct Owner {
+            Block* block;
+
+            ~Owner() {
+                detail::block = nullptr;
+                if (block != nullptr) {
+                    segment().release(block);
+                }
+            }
+        };
+
+        // Threads beyond max_threads count here, unpublished.
+        thread_local Block overflow{};
+    }
+
+    std::string segment_name(pid_t pid) {
+        return std::format("/netstack.{}", pid);
+    }
+
+    Block* detail::register_thread() noexcept {
+        // Without memory for the segment the thread counts unpublished too.
+        try {
+            thread_local Owner owner{segment().acquire()};
+            detail::block = owner.block != nullptr ? owner.block : &overflow;
+        } catch (...) {
+            detail::block = &overflow;
+        }
+        return detail::block;
+    }
+
+    Values read() noexcept {
+        return sum(segment().data());
+    }
+
+    std::expected<Reader, std::system_error> Reader::open(pid_t pid) noexcept {
+        const auto name = segment_name(pid);
+        auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            return std::unexpected{std::system_error{errno, std::system_category(), name}};
+        }
+
+        // Reading past the end of a shorter object raises SIGBUS.
+        struct stat status{};
+        if (fstat(fd, &status) != 0) {
+            auto error = errno;
+            close(fd);
+            return std::unexpected{std::system_error{error, std::system_category(), name}};
+        }
+        if (static_cast<std::size_t>(status.st_size) < segment_size) {
+            close(fd);
+            return std::unexpected{std::system_error{std::make_error_code(std::errc::invalid_argument), name}};
+        }
+
+        auto mapping = mmap(nullptr, segment_size, PROT_READ, MAP_SHARED, fd, 0);
+        auto error = errno;
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            return std::unexpected{std::system_error{error, std::system_category(), name}};
+        }
+
+        Reader reader{static_cast<const std::byte*>(mapping)};
+        const auto& found = header(reader.memory);
+        if (found.magic != Header::magic_value ||
+            found.version != Header::current_version ||
+            found.counters != counter_count ||
+            found.blocks != max_threads)
+        {
+            return std::unexpected{std::system_error{std::make_error_code(std::errc::invalid_argument), name}};
+        }
+        return reader;
+    }
+
+    Reader::~Reader() {
+        if (memory != nullptr) {
+            munmap(const_cast<std::byte*>(memory), segment_size);
+        }
+    }
+
+    Values Reader::read() const noexcept {
+        return sum(memory);
+    }
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <sys/types.h>
+
+// Counters of the whole process, published in a shared memory segment
+// named after its pid so netstack_stat can read them while it runs. Every
+// thread counts into a cache line aligned block of its own, an increment
+// is a plain load and store to memory no other thread writes.
+namespace stats {
+    enum class Counter : uint8_t {
+        FramesReceived,
+        BytesReceived,
+        FramesSent,
+        BytesSent,
+        // Frames dropped by the link layer.
+        ShortFrames,
+        WrongDestination,
+        UnknownEthertype,
+        // Frames not sent because they do not fit in one the device takes.
+        OversizedFrames,
+        ArpReceived,
+        ArpInvalid,
+        ArpRequests,
+        ArpReplies,
+        ArpRetries,
+        // Requests held back by the rate limit.
+        ArpRateLimited,
+        // Sends and resolves failed fast during a hold down.
+        ArpHeldDown,
+        // Neighbors that did not answer any request.
+        ArpFailed,
+        // Unicast requests sent to neighbors in use.
+        ArpRefreshes,
+        // Packets dropped while their neighbor was unresolved.
+        ArpDrops,
+        IPv4Received,
+        IPv4Invalid,
+        IPv4Sent,
+        IPv4BytesSent,
+        // Datagrams of other protocols dropped because run() fell behind.
+        IPv4QueueFull,
+        ReassemblyCompleted,
+        ReassemblyTimeouts,
+        ReassemblyEvictions,
+        IcmpEchoRequests,
+        IcmpEchoReplies,
+        UdpReceived,
+        UdpSent,
+        UdpBytesSent,
+        // Datagrams dropped by UDP.
+        UdpNoSocket,
+        UdpChecksumErrors,
+        UdpMalformed,
+        UdpQueueFull,
+        TcpReceived,
+        TcpSent,
+        TcpBytesSent,
+        // Segments sent again after a timeout or a loss found from ACKs.
+        TcpRetransmitted,
+        // Losses recovered from without waiting for a timeout.
+        TcpFastRetransmits,
+        TcpTimeouts,
+        TcpResetsSent,
+        // Segments dropped by TCP.
+        TcpChecksumErrors,
+        TcpMalformed,
+        Count
+    };
+
+    inline constexpr std::size_t counter_count = static_cast<std::size_t>(Counter::Count);
+
+    inline constexpr std::array<std::string_view, counter_count> names{
+        "frames_received",
+        "bytes_received",
+        "frames_sent",
+        "bytes_sent",
+        "short_frames",
+        "wrong_destination",
+        "unknown_ethertype",
+        "oversized_frames",
+        "arp_received",
+        "arp_invalid",
+        "arp_requests",
+        "arp_replies",
+        "arp_retries",
+        "arp_rate_limited",
+        "arp_held_down",
+        "arp_failed",
+        "arp_refreshes",
+        "arp_drops",
+        "ipv4_received",
+        "ipv4_invalid",
+        "ipv4_sent",
+        "ipv4_bytes_sent",
+        "ipv4_queue_full",
+        "reassembly_completed",
+        "reassembly_timeouts",
+        "reassembly_evictions",
+        "icmp_echo_requests",
+        "icmp_echo_replies",
+        "udp_received",
+        "udp_sent",
+        "udp_bytes_sent",
+        "udp_no_socket",
+        "udp_checksum_errors",
+        "udp_malformed",
+        "udp_queue_full",
+        "tcp_received",
+        "tcp_sent",
+        "tcp_bytes_sent",
+        "tcp_retransmitted",
+        "tcp_fast_retransmits",
+        "tcp_timeouts",
+        "tcp_resets_sent",
+        "tcp_checksum_errors",
+        "tcp_malformed"
+    };
+
+    inline constexpr std::size_t cache_line_size = 64;
+
+    struct alignas(cache_line_size) Block {
+        uint64_t values[counter_count];
+    };
+
+    // Threads counting at once. Blocks of finished threads are handed to
+    // new ones, along with what they counted.
+    inline constexpr std::size_t max_threads = 256;
+
+    struct Header {
+        static constexpr uint64_t magic_value = 0x74617473'6b63746e; // "ntckstat"
+        static constexpr uint32_t current_version = 2;
+
+        uint64_t magic;
+        uint32_t version;
+        uint32_t counters;
+        uint32_t blocks;
+    };
+
+    // The segment is the header, padded to a cache line, and max_threads blocks.
+    inline constexpr std::size_t blocks_offset = (sizeof(Header) + cache_line_size - 1) / cache_line_size * cache_line_size;
+    inline constexpr std::size_t segment_size = blocks_offset + max_threads * sizeof(Block);
+
+    using Values = std::array<uint64_t, counter_count>;
+
+    // Name of the segment of a process, for shm_open().
+    std::string segment_name(pid_t pid);
+
+    namespace detail {
+        // Block of the calling thread, null until it first counts.
+        inline thread_local Block* block = nullptr;
+
+        Block* register_thread() noexcept;
+    }
+
+    inline void add(Counter counter, uint64_t value = 1) noexcept {
+        auto current = detail::block;
+        if (current == nullptr) [[unlikely]] {
+            current = detail::register_thread();
+        }
+        // Only this thread writes the block, the reader needs no more than
+        // untorn words.
+        std::atomic_ref<uint64_t> slot{current->values[static_cast<std::size_t>(counter)]};
+        slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // Totals of the calling process.
+    Values read() noexcept;
+
+    // Maps the segment of another process read only.
+    class Reader {
+        const std::byte* memory;
+
+        explicit Reader(const std::byte* memory) : memory{memory} {}
+    public:
+        static std::expected<Reader, std::system_error> open(pid_t pid) noexcept;
+
+        Reader(const Reader&) = delete;
+        Reader(Reader&& other) noexcept : memory{std::exchange(other.memory, nullptr)} {}
+        ~Reader();
+
+        // Sums of every thread's counters.
+        Values read() const noexcept;
+    };
+}
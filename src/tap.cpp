@@ -2,17 +2,23 @@
 #include <exception>
 #include <system_error>
 #include <algorithm>
+#include <array>
 #include <cstring>
 #include <cerrno>
+#include <bit>
+#include <optional>
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <net/if.h>
 #include <linux/if_tun.h>
 #include <poll.h>
 
 #include "tap.h"
+#include "device.h"
+#include "virtio_net.h"
 
 Tap::Tap() {
     auto tap = try_new();
@@ -24,7 +30,21 @@ Tap::Tap() {
 }
 
 std::expected<Tap, std::system_error> Tap::try_new() noexcept {
-    int fd = open("/dev/net/tap", O_RDWR);
+    return open({}, IFF_TAP | IFF_NO_PI);
+}
+
+std::expected<Tap, std::system_error> Tap::try_new(unsigned offloads) noexcept {
+    auto tap = open({}, IFF_TAP | IFF_NO_PI | IFF_VNET_HDR);
+    if (tap.has_value()) {
+        if (auto enabled = tap->enable_offloads(offloads); !enabled.has_value()) {
+            return std::unexpected{std::move(enabled.error())};
+        }
+    }
+    return tap;
+}
+
+std::expected<Tap, std::system_error> Tap::open(const std::string& name, short flags) noexcept {
+    int fd = ::open("/dev/net/tap", O_RDWR);
     if (fd < 0) {
         return std::unexpected{
             std::system_error{errno, std::system_category(), "Cannot open TUN/TAP device"}
@@ -32,7 +52,8 @@ std::expected<Tap, std::system_error> Tap::try_new() noexcept {
     }
 
     ifreq ifr{};
-    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    ifr.ifr_flags = flags;
+    name.copy(ifr.ifr_name, IFNAMSIZ - 1);
 
     if ((ioctl(fd, TUNSETIFF, (void *) &ifr)) < 0) {
         close(fd);
@@ -44,15 +65,41 @@ std::expected<Tap, std::system_error> Tap::try_new() noexcept {
     return Tap{fd, ifr.ifr_name};
 }
 
+std::expected<void, std::system_error> Tap::enable_offloads(unsigned offloads) noexcept {
+    // The header is little endian whatever the host, TUNSETVNETLE fails on
+    // kernels that only know the native order, which is then little endian.
+    int header_size = virtio_net::Format::byte_size();
+    int little_endian = 1;
+    if (
+        ioctl(fd, TUNSETVNETHDRSZ, &header_size) < 0 ||
+        (ioctl(fd, TUNSETVNETLE, &little_endian) < 0 && (errno != EINVAL || std::endian::native != std::endian::little)) ||
+        ioctl(fd, TUNSETOFFLOAD, static_cast<unsigned long>(offloads)) < 0
+    ) {
+        return std::unexpected{
+            std::system_error{errno, std::system_category(), "Could not enable TAP offloads"}
+        };
+    }
+
+    vnet_header = true;
+    offload_flags = offloads;
+    return {};
+}
+
 Tap::Tap(int fd, std::string name) : fd{fd}, name{name} {}
 
-Tap::Tap(Tap&& other) noexcept : name{std::move(other.name)} {
+Tap::Tap(Tap&& other) noexcept
+    : name{std::move(other.name)},
+      vnet_header{other.vnet_header},
+      offload_flags{other.offload_flags}
+{
     fd = std::exchange(other.fd, -1);
 }
 
 Tap& Tap::operator=(Tap other) noexcept {
     std::swap(fd, other.fd);
     std::swap(name, other.name);
+    std::swap(vnet_header, other.vnet_header);
+    std::swap(offload_flags, other.offload_flags);
 
     return *this;
 }
@@ -67,6 +114,20 @@ std::make_signed_t<std::size_t> Tap::write(std::span<const std::byte> buffer) no
     return ::write(fd, buffer.data(), buffer.size());
 }
 
+std::make_signed_t<std::size_t> Tap::writev(std::span<const std::span<const std::byte>> parts) noexcept {
+    std::array<iovec, device::max_parts> vectors;
+    if (parts.size() > vectors.size()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (std::size_t i = 0; i < parts.size(); ++i) {
+        // iovec is not const correct, the kernel only reads from it.
+        vectors[i] = {const_cast<std::byte*>(parts[i].data()), parts[i].size()};
+    }
+    return ::writev(fd, vectors.data(), static_cast<int>(parts.size()));
+}
+
 std::make_signed_t<std::size_t> Tap::read(std::span<std::byte> buffer) noexcept {
     return ::read(fd, buffer.data(), buffer.size());
 }
@@ -80,4 +141,41 @@ std::make_signed_t<std::size_t> Tap::try_read(std::span<std::byte> buffer, std::
         return -1;
     }
     return ::read(fd, buffer.data(), buffer.size());
-}
\ No newline at end of file
+}
+
+MultiQueueTap::MultiQueueTap(std::vector<Tap> queues) : queues{std::move(queues)} {}
+
+std::expected<MultiQueueTap, std::system_error> MultiQueueTap::try_new(std::size_t queue_count) noexcept {
+    return open(queue_count, IFF_TAP | IFF_NO_PI | IFF_MULTI_QUEUE, {});
+}
+
+std::expected<MultiQueueTap, std::system_error> MultiQueueTap::try_new(std::size_t queue_count, unsigned offloads) noexcept {
+    return open(queue_count, IFF_TAP | IFF_NO_PI | IFF_MULTI_QUEUE | IFF_VNET_HDR, offloads);
+}
+
+std::expected<MultiQueueTap, std::system_error> MultiQueueTap::open(std::size_t queue_count, short flags, std::optional<unsigned> offloads) noexcept {
+    if (queue_count == 0) {
+        return std::unexpected{
+            std::system_error{EINVAL, std::system_category(), "A TAP device needs at least one queue"}
+        };
+    }
+
+    // The first queue creates the interface, the others attach to it by name.
+    std::vector<Tap> queues;
+    queues.reserve(queue_count);
+    for (std::size_t i = 0; i < queue_count; ++i) {
+        auto name = queues.empty() ? std::string{} : queues.front().get_name();
+        auto queue = Tap::open(name, flags);
+        if (!queue.has_value()) {
+            return std::unexpected{std::move(queue.error())};
+        }
+        if (offloads) {
+            if (auto enabled = queue->enable_offloads(*offloads); !enabled.has_value()) {
+                return std::unexpected{std::move(enabled.error())};
+            }
+        }
+        queues.push_back(std::move(*queue));
+    }
+
+    return MultiQueueTap{std::move(queues)};
+}
@@ -7,24 +7,98 @@
 #include <type_traits>
 #include <string>
 #include <chrono>
+#include <vector>
+#include <optional>
 
 class Tap {
     int fd = -1;
     std::string name;
+    bool vnet_header = false;
+    unsigned offload_flags = 0;
     Tap(int fd, std::string name);
+
+    // Attaches to the interface called name, or creates one named by the
+    // kernel when it is empty.
+    static std::expected<Tap, std::system_error> open(const std::string& name, short flags) noexcept;
+    std::expected<void, std::system_error> enable_offloads(unsigned offloads) noexcept;
+    friend class MultiQueueTap;
 public:
     Tap();
     static std::expected<Tap, std::system_error> try_new() noexcept;
+    // Every frame read or written is preceded by a virtio-net header
+    // (IFF_VNET_HDR). offloads are the virtio_net::Offload flags the kernel
+    // may use on the frames it hands us.
+    static std::expected<Tap, std::system_error> try_new(unsigned offloads) noexcept;
     Tap(const Tap&) = delete;
     Tap(Tap&&) noexcept;
     Tap& operator=(Tap) noexcept;
     ~Tap() noexcept;
 
     std::make_signed_t<std::size_t> write(std::span<const std::byte>) noexcept;
+    std::make_signed_t<std::size_t> writev(std::span<const std::span<const std::byte>>) noexcept;
     std::make_signed_t<std::size_t> read(std::span<std::byte>) noexcept;
     std::make_signed_t<std::size_t> try_read(std::span<std::byte>, std::chrono::duration<int, std::milli> timeout) noexcept;
 
     const std::string& get_name() const noexcept {
         return name;
     }
+
+    int native_handle() const noexcept {
+        return fd;
+    }
+
+    bool has_vnet_header() const noexcept {
+        return vnet_header;
+    }
+
+    unsigned offloads() const noexcept {
+        return offload_flags;
+    }
+};
+
+// The queues of one TAP interface created with IFF_MULTI_QUEUE. The kernel
+// spreads received flows over them by hash, LinkLayer reads each queue from
+// a thread of its own. Frames are written to the first queue.
+class MultiQueueTap {
+    std::vector<Tap> queues;
+    explicit MultiQueueTap(std::vector<Tap> queues);
+
+    // offloads are enabled on every queue if given.
+    static std::expected<MultiQueueTap, std::system_error> open(std::size_t queue_count, short flags, std::optional<unsigned> offloads) noexcept;
+public:
+    using Queue = Tap;
+
+    static std::expected<MultiQueueTap, std::system_error> try_new(std::size_t queue_count) noexcept;
+    // All queues with a virtio-net header, as Tap::try_new(offloads).
+    static std::expected<MultiQueueTap, std::system_error> try_new(std::size_t queue_count, unsigned offloads) noexcept;
+
+    std::make_signed_t<std::size_t> write(std::span<const std::byte> frame) noexcept {
+        return queues.front().write(frame);
+    }
+    std::make_signed_t<std::size_t> writev(std::span<const std::span<const std::byte>> parts) noexcept {
+        return queues.front().writev(parts);
+    }
+    std::make_signed_t<std::size_t> try_read(std::span<std::byte> buffer, std::chrono::duration<int, std::milli> timeout) noexcept {
+        return queues.front().try_read(buffer, timeout);
+    }
+
+    std::size_t queue_count() const noexcept {
+        return queues.size();
+    }
+
+    Tap& queue(std::size_t index) noexcept {
+        return queues[index];
+    }
+
+    const std::string& get_name() const noexcept {
+        return queues.front().get_name();
+    }
+
+    bool has_vnet_header() const noexcept {
+        return queues.front().has_vnet_header();
+    }
+
+    unsigned offloads() const noexcept {
+        return queues.front().offloads();
+    }
 };
\ No newline at end of file
@@ -0,0 +1,496 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+#include "tcp.h"
+#include "checksum.h"
+
+namespace tcp {
+    namespace {
+        enum OptionKind : uint8_t {
+            End = 0,
+            NoOperation = 1,
+            MaximumSegmentSize = 2,
+            WindowScale = 3,
+            SackPermitted = 4,
+            Sack = 5
+        };
+
+        // Prepended to the segment for the checksum only (RFC 793, 3.1).
+        using PseudoHeader = packet::Format<
+            {"source_address", 32},
+            {"destination_address", 32},
+            {"zero", 8},
+            {"protocol", 8, packet::field_type<ipv4::Protocol>},
+            {"length", 16}
+        >;
+
+        uint32_t load32(std::span<const std::byte> bytes) noexcept {
+            return uint32_t{std::to_integer<uint8_t>(bytes[0])} << 24 |
+                   uint32_t{std::to_integer<uint8_t>(bytes[1])} << 16 |
+                   uint32_t{std::to_integer<uint8_t>(bytes[2])} << 8 |
+                   uint32_t{std::to_integer<uint8_t>(bytes[3])};
+        }
+
+        void store32(std::span<std::byte> bytes, uint32_t value) noexcept {
+            for (std::size_t i = 0; i < 4; ++i) {
+                bytes[i] = static_cast<std::byte>(value >> (24 - 8 * i));
+            }
+        }
+
+        // One's complement addition of folded sums.
+        uint16_t add(uint16_t a, uint16_t b) noexcept {
+            uint32_t sum = uint32_t{a} + b;
+            return static_cast<uint16_t>((sum & 0xFFFF) + (sum >> 16));
+        }
+    }
+
+    Options parse_options(std::span<const std::byte> bytes) noexcept {
+        Options options;
+        while (!bytes.empty()) {
+            const auto kind = std::to_integer<uint8_t>(bytes[0]);
+            if (kind == End) {
+                break;
+            }
+            if (kind == NoOperation) {
+                bytes = bytes.subspan(1);
+                continue;
+            }
+
+            if (bytes.size() < 2) {
+                break;
+            }
+            const std::size_t length = std::to_integer<uint8_t>(bytes[1]);
+            if (length < 2 || length > bytes.size()) {
+                break;
+            }
+            const auto value = bytes.subspan(2, length - 2);
+
+            switch (kind) {
+                case MaximumSegmentSize:
+                    if (value.size() == 2) {
+                        options.mss = static_cast<uint16_t>(std::to_integer<uint16_t>(value[0]) << 8 | std::to_integer<uint16_t>(value[1]));
+                    }
+                    break;
+                case WindowScale:
+                    if (value.size() == 1) {
+                        options.window_scale = std::to_integer<uint8_t>(value[0]);
+                    }
+                    break;
+                case SackPermitted:
+                    options.sack_permitted = value.empty();
+                    break;
+                case Sack:
+                    if (value.size() % 8 == 0) {
+                        options.sack_count = std::min(value.size() / 8, options.sack.size());
+                        for (std::size_t i = 0; i < options.sack_count; ++i) {
+                            options.sack[i] = {load32(value.subspan(8 * i)), load32(value.subspan(8 * i + 4))};
+                        }
+                    }
+                    break;
+                default:
+                    break;
+            }
+            bytes = bytes.subspan(length);
+        }
+        return options;
+    }
+
+    std::size_t write_options(const Options& options, std::span<std::byte, max_options_size> bytes) noexcept {
+        std::size_t size = 0;
+        auto put = [&](uint8_t byte) {
+            bytes[size++] = std::byte{byte};
+        };
+
+        if (options.mss) {
+            put(MaximumSegmentSize);
+            put(4);
+            put(static_cast<uint8_t>(*options.mss >> 8));
+            put(static_cast<uint8_t>(*options.mss));
+        }
+        if (options.window_scale) {
+            put(NoOperation);
+            put(WindowScale);
+            put(3);
+            put(*options.window_scale);
+        }
+        if (options.sack_permitted) {
+            put(NoOperation);
+            put(NoOperation);
+            put(SackPermitted);
+            put(2);
+        }
+
+        const auto room = (max_options_size - size - 4) / 8;
+        const auto count = std::min(options.sack_count, room);
+        if (count != 0) {
+            put(NoOperation);
+            put(NoOperation);
+            put(Sack);
+            put(static_cast<uint8_t>(2 + 8 * count));
+            for (std::size_t i = 0; i < count; ++i) {
+                store32(bytes.subspan(size), options.sack[i].left);
+                store32(bytes.subspan(size + 4), options.sack[i].right);
+                size += 8;
+            }
+        }
+
+        while (size % 4 != 0) {
+            put(End);
+        }
+        return size;
+    }
+
+    uint16_t pseudo_header_sum(IPv4_t source, IPv4_t destination, std::size_t length) noexcept {
+        PseudoHeader::Header pseudo_header;
+        pseudo_header.set<"source_address">(source);
+        pseudo_header.set<"destination_address">(destination);
+        pseudo_header.set<"protocol">(ipv4::Protocol::TCP);
+        pseudo_header.set<"length">(static_cast<uint16_t>(length));
+
+        std::array<std::byte, PseudoHeader::byte_size()> bytes{};
+        PseudoHeader::encode(bytes, pseudo_header);
+        return checksum::fold(checksum::sum(bytes));
+    }
+
+    uint16_t checksum(IPv4_t source, IPv4_t destination, std::span<const std::byte> header, device::Parts payload) noexcept {
+        std::size_t length = header.size();
+        for (auto part : payload) {
+            length += part.size();
+        }
+
+        // Pieces are summed on their own. One that starts at an odd offset
+        // has its bytes swapped relative to the rest (RFC 1071, 2.B).
+        auto sum = add(pseudo_header_sum(source, destination, length), checksum::fold(checksum::sum(header)));
+        bool odd = header.size() % 2 != 0;
+        for (auto part : payload) {
+            const auto part_sum = checksum::fold(checksum::sum(part));
+            sum = add(sum, odd ? std::byteswap(part_sum) : part_sum);
+            odd ^= part.size() % 2 != 0;
+        }
+        return static_cast<uint16_t>(~sum);
+    }
+
+    Ring::Ring(std::size_t capacity) : bytes(std::bit_ceil(std::max<std::size_t>(capacity, 1))) {}
+
+    void Ring::write(std::size_t offset, std::span<const std::byte> data) noexcept {
+        const auto mask = bytes.size() - 1;
+        const auto start = (head + offset) & mask;
+        const auto first = std::min(data.size(), bytes.size() - start);
+        std::memcpy(bytes.data() + start, data.data(), first);
+        std::memcpy(bytes.data(), data.data() + first, data.size() - first);
+    }
+
+    std::array<std::span<const std::byte>, 2> Ring::view(std::size_t offset, std::size_t length) const noexcept {
+        const auto mask = bytes.size() - 1;
+        const auto start = (head + offset) & mask;
+        const auto first = std::min(length, bytes.size() - start);
+        return {
+            std::span{bytes}.subspan(start, first),
+            std::span{bytes}.first(length - first)
+        };
+    }
+
+    void Ring::consume(std::size_t count) noexcept {
+        head = (head + count) & (bytes.size() - 1);
+    }
+
+    SackBlock RangeSet::add(uint32_t left, uint32_t right) {
+        auto first = std::ranges::find_if(ranges, [&](const SackBlock& range) {
+            return !before(range.right, left);
+        });
+        auto last = first;
+        while (last != ranges.end() && !after(last->left, right)) {
+            left = before(last->left, left) ? last->left : left;
+            right = after(last->right, right) ? last->right : right;
+            ++last;
+        }
+
+        const SackBlock merged{left, right};
+        ranges.insert(ranges.erase(first, last), merged);
+        return merged;
+    }
+
+    void RangeSet::remove_before(uint32_t sequence) noexcept {
+        auto first = std::ranges::find_if(ranges, [&](const SackBlock& range) {
+            return after(range.right, sequence);
+        });
+        ranges.erase(ranges.begin(), first);
+        if (!ranges.empty() && before(ranges.front().left, sequence)) {
+            ranges.front().left = sequence;
+        }
+    }
+
+    std::optional<uint32_t> RangeSet::take(uint32_t sequence) noexcept {
+        if (ranges.empty() || ranges.front().left != sequence) {
+            return std::nullopt;
+        }
+        const auto right = ranges.front().right;
+        ranges.erase(ranges.begin());
+        return right;
+    }
+
+    uint32_t RangeSet::covered(uint32_t left, uint32_t right) const noexcept {
+        uint32_t total = 0;
+        for (auto range : ranges) {
+            const auto start = after(range.left, left) ? range.left : left;
+            const auto end = before(range.right, right) ? range.right : right;
+            if (before(start, end)) {
+                total += end - start;
+            }
+        }
+        return total;
+    }
+
+    std::optional<SackBlock> RangeSet::first_gap(uint32_t left, uint32_t right) const noexcept {
+        for (auto range : ranges) {
+            if (!before(left, right)) {
+                return std::nullopt;
+            }
+            if (!after(range.right, left)) {
+                continue;
+            }
+            if (after(range.left, left)) {
+                return SackBlock{left, before(range.left, right) ? range.left : right};
+            }
+            left = range.right;
+        }
+        if (before(left, right)) {
+            return SackBlock{left, right};
+        }
+        return std::nullopt;
+    }
+
+    uint32_t RangeSet::bytes() const noexcept {
+        uint32_t total = 0;
+        for (auto range : ranges) {
+            total += range.right - range.left;
+        }
+        return total;
+    }
+
+    TimerWheel::TimerWheel(clock::time_point now)
+        : slots{std::make_unique<Timer[]>(slot_count)},
+          origin{now}
+    {
+        for (std::size_t i = 0; i < slot_count; ++i) {
+            slots[i].prev = &slots[i];
+            slots[i].next = &slots[i];
+        }
+    }
+
+    uint64_t TimerWheel::to_tick(clock::time_point time_point) const noexcept {
+        if (time_point <= origin) {
+            return 0;
+        }
+        return static_cast<uint64_t>(std::chrono::ceil<std::chrono::milliseconds>(time_point - origin).count());
+    }
+
+    void TimerWheel::arm(Timer& timer, clock::time_point deadline) noexcept {
+        cancel(timer);
+
+        timer.tick = std::max(to_tick(deadline), current + 1);
+        auto& head = slots[timer.tick & (slot_count - 1)];
+        timer.prev = head.prev;
+        timer.next = &head;
+        head.prev->next = &timer;
+        head.prev = &timer;
+    }
+
+    void TimerWheel::cancel(Timer& timer) noexcept {
+        if (timer.armed()) {
+            timer.prev->next = timer.next;
+            timer.next->prev = timer.prev;
+            timer.prev = nullptr;
+            timer.next = nullptr;
+        }
+    }
+
+    void TimerWheel::expire(clock::time_point now, std::vector<Timer*>& due) {
+        const auto target = static_cast<uint64_t>(std::chrono::floor<std::chrono::milliseconds>(std::max(now, origin) - origin).count());
+        if (target <= current) {
+            return;
+        }
+
+        // Timers a revolution or more ahead share the slot and stay in it.
+        const auto steps = std::min<uint64_t>(target - current, slot_count);
+        for (uint64_t step = 1; step <= steps; ++step) {
+            auto& head = slots[(current + step) & (slot_count - 1)];
+            for (auto timer = head.next; timer != &head;) {
+                auto next = timer->next;
+                if (timer->tick <= target) {
+                    cancel(*timer);
+                    due.push_back(timer);
+                }
+                timer = next;
+            }
+        }
+        current = target;
+    }
+
+    namespace {
+        class Reno : public CongestionControl {
+        protected:
+            double mss;
+            double cwnd;
+            double ssthresh = std::numeric_limits<double>::max();
+        public:
+            // Initial window of RFC 6928.
+            explicit Reno(uint32_t mss) : mss{static_cast<double>(mss)}, cwnd{10.0 * mss} {}
+
+            void on_ack(uint32_t acked, clock::time_point, clock::duration) override {
+                if (cwnd < ssthresh) {
+                    cwnd += std::min(static_cast<double>(acked), 2 * mss);
+                } else {
+                    cwnd += mss * static_cast<double>(acked) / cwnd;
+                }
+            }
+
+            void on_loss(uint32_t flight, clock::time_point) override {
+                ssthresh = std::max(flight / 2.0, 2 * mss);
+                cwnd = ssthresh;
+            }
+
+            void on_timeout(uint32_t flight, clock::time_point) override {
+                ssthresh = std::max(flight / 2.0, 2 * mss);
+                cwnd = mss;
+            }
+
+            uint32_t window() const override {
+                return static_cast<uint32_t>(std::min(cwnd, static_cast<double>(std::numeric_limits<int32_t>::max())));
+            }
+        };
+
+        class Cubic : public Reno {
+            static constexpr double c = 0.4;
+            static constexpr double beta = 0.7;
+
+            // In segments and seconds.
+            double w_max{};
+            double k{};
+            double w_est{};
+            std::optional<clock::time_point> epoch;
+
+            void reduce(uint32_t flight) {
+                const auto segments = cwnd / mss;
+                // Fast convergence: release bandwidth to newer flows.
+                w_max = segments < w_max ? segments * (1 + beta) / 2 : segments;
+                ssthresh = std::max(std::max(cwnd, static_cast<double>(flight)) * beta, 2 * mss);
+                epoch.reset();
+            }
+        public:
+            using Reno::Reno;
+
+            void on_ack(uint32_t acked, clock::time_point now, clock::duration rtt) override {
+                if (cwnd < ssthresh) {
+                    Reno::on_ack(acked, now, rtt);
+                    return;
+                }
+
+                const auto segments = cwnd / mss;
+                if (!epoch) {
+                    epoch = now;
+                    k = w_max > segments ? std::cbrt((w_max - segments) / c) : 0;
+                    w_max = std::max(w_max, segments);
+                    w_est = segments;
+                }
+
+                const auto t = std::chrono::duration<double>{now - *epoch + rtt}.count();
+                const auto target = std::clamp(c * std::pow(t - k, 3) + w_max, segments, 1.5 * segments);
+
+                // Grows at least like Reno would have (RFC 9438, 4.3).
+                w_est += 3 * (1 - beta) / (1 + beta) * (static_cast<double>(acked) / mss) / segments;
+                if (w_est > target) {
+                    cwnd = std::max(cwnd, w_est * mss);
+                } else {
+                    cwnd += (target - segments) / segments * static_cast<double>(acked);
+                }
+            }
+
+            void on_loss(uint32_t flight, clock::time_point) override {
+                reduce(flight);
+                cwnd = ssthresh;
+            }
+
+            void on_timeout(uint32_t flight, clock::time_point) override {
+                reduce(flight);
+                cwnd = mss;
+            }
+        };
+    }
+
+    std::unique_ptr<CongestionControl> reno(uint32_t mss) {
+        return std::make_unique<Reno>(mss);
+    }
+
+    std::unique_ptr<CongestionControl> cubic(uint32_t mss) {
+        return std::make_unique<Cubic>(mss);
+    }
+
+    Control::Control(const Key& key, const Config& config)
+        : key{key},
+          send_buffer{config.send_buffer},
+          receive_buffer{config.receive_buffer}
+        {}
+
+    ConnectionTable::ConnectionTable(std::size_t capacity)
+        : limit{std::max<std::size_t>(capacity, 1)},
+          mask{std::bit_ceil(limit * 2) - 1},
+          shift{static_cast<unsigned>(64 - std::countr_zero(mask + 1))},
+          slots(mask + 1)
+        {}
+
+    std::size_t ConnectionTable::home(const Key& key) const noexcept {
+        auto value = uint64_t{key.remote_address} << 32 | uint64_t{key.remote_port} << 16 | key.local_port;
+        return static_cast<std::size_t>((value * 0x9E37'79B9'7F4A'7C15) >> shift) & mask;
+    }
+
+    Control* ConnectionTable::find(const Key& key) const noexcept {
+        for (auto index = home(key); slots[index].control; index = (index + 1) & mask) {
+            if (slots[index].key == key) {
+                return slots[index].control.get();
+            }
+        }
+        return nullptr;
+    }
+
+    bool ConnectionTable::insert(std::shared_ptr<Control> control) {
+        if (count == limit) {
+            return false;
+        }
+
+        auto index = home(control->key);
+        while (slots[index].control) {
+            index = (index + 1) & mask;
+        }
+        slots[index].key = control->key;
+        slots[index].control = std::move(control);
+        ++count;
+        return true;
+    }
+
+    std::shared_ptr<Control> ConnectionTable::erase(const Key& key) noexcept {
+        auto index = home(key);
+        while (slots[index].control && slots[index].key != key) {
+            index = (index + 1) & mask;
+        }
+        if (!slots[index].control) {
+            return nullptr;
+        }
+
+        auto control = std::move(slots[index].control);
+        --count;
+
+        // Backward shift deletion, so lookups never have to skip tombstones.
+        auto hole = index;
+        for (auto i = (index + 1) & mask; slots[i].control; i = (i + 1) & mask) {
+            if (((i - home(slots[i].key)) & mask) >= ((i - hole) & mask)) {
+                slots[hole] = std::move(slots[i]);
+                hole = i;
+            }
+        }
+        slots[hole] = Slot{};
+        return control;
+    }
+}
@@ -0,0 +1,1544 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <optional>
+#include <expected>
+#include <system_error>
+#include <concepts>
+#include <utility>
+#include <algorithm>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+
+#include "types.h"
+#include "packet.h"
+#include "ipv4.h"
+#include "stats.h"
+#include "device.h"
+#include "virtio_net.h"
+
+namespace tcp {
+    using clock = std::chrono::steady_clock;
+
+    using Format = packet::Format<
+        {"source_port", 16},
+        {"destination_port", 16},
+        {"sequence", 32},
+        {"acknowledgment", 32},
+        {"data_offset", 4},
+        {"reserved", 4},
+        {"cwr", 1},
+        {"ece", 1},
+        {"urg", 1},
+        {"ack", 1},
+        {"psh", 1},
+        {"rst", 1},
+        {"syn", 1},
+        {"fin", 1},
+        {"window", 16},
+        {"checksum", 16},
+        {"urgent_pointer", 16}
+    >;
+
+    template<typename Range>
+    using Packet = packet::Packet<Range, Format>;
+
+    // Sequence numbers compare modulo 2^32 (RFC 793, 3.3).
+    constexpr bool before(uint32_t a, uint32_t b) noexcept {
+        return static_cast<int32_t>(a - b) < 0;
+    }
+
+    constexpr bool after(uint32_t a, uint32_t b) noexcept {
+        return before(b, a);
+    }
+
+    // Sequence numbers [left, right).
+    struct SackBlock {
+        uint32_t left;
+        uint32_t right;
+
+        bool operator==(const SackBlock&) const = default;
+    };
+
+    struct Options {
+        std::optional<uint16_t> mss;
+        std::optional<uint8_t> window_scale;
+        bool sack_permitted = false;
+        std::size_t sack_count = 0;
+        std::array<SackBlock, 4> sack{};
+    };
+
+    inline constexpr std::size_t max_options_size = 40;
+
+    // Unknown options are skipped, parsing stops at the first malformed one.
+    Options parse_options(std::span<const std::byte> bytes) noexcept;
+
+    // Writes the options padded to a multiple of 4 bytes and returns their
+    // length. SACK blocks that do not fit after the other options are left out.
+    std::size_t write_options(const Options& options, std::span<std::byte, max_options_size> bytes) noexcept;
+
+    // Checksum of a segment given as its header followed by payload pieces
+    // of any length. A received segment is intact when this returns 0.
+    uint16_t checksum(IPv4_t source, IPv4_t destination, std::span<const std::byte> header, device::Parts payload = {}) noexcept;
+
+    // Sum of the pseudo header of a segment of length bytes, what the
+    // checksum field holds for a device that completes the checksum.
+    uint16_t pseudo_header_sum(IPv4_t source, IPv4_t destination, std::size_t length) noexcept;
+
+    // Bytes of a send or receive buffer. Offsets count from the oldest byte
+    // held, the capacity is rounded up to a power of two.
+    class Ring {
+        std::vector<std::byte> bytes;
+        std::size_t head{};
+    public:
+        explicit Ring(std::size_t capacity);
+
+        std::size_t capacity() const noexcept {
+            return bytes.size();
+        }
+
+        // [offset, offset + data.size()) has to be within the capacity.
+        void write(std::size_t offset, std::span<const std::byte> data) noexcept;
+        // [offset, offset + length) in up to two pieces, the second one is
+        // empty unless it wraps around.
+        std::array<std::span<const std::byte>, 2> view(std::size_t offset, std::size_t length) const noexcept;
+        // Drops count bytes from the front.
+        void consume(std::size_t count) noexcept;
+    };
+
+    // Disjoint sequence ranges in order, used for the SACK scoreboard and
+    // the out of order data of a connection. All ranges have to lie within
+    // half the sequence space of each other.
+    class RangeSet {
+        std::vector<SackBlock> ranges;
+    public:
+        // Merges [left, right) with the ranges it overlaps or touches and
+        // returns the resulting range.
+        SackBlock add(uint32_t left, uint32_t right);
+        // Forgets everything before sequence.
+        void remove_before(uint32_t sequence) noexcept;
+        // Removes the range starting at sequence, returns its end.
+        std::optional<uint32_t> take(uint32_t sequence) noexcept;
+
+        // Bytes of [left, right) that are in the set.
+        uint32_t covered(uint32_t left, uint32_t right) const noexcept;
+        // First range within [left, right) that is not in the set.
+        std::optional<SackBlock> first_gap(uint32_t left, uint32_t right) const noexcept;
+
+        uint32_t bytes() const noexcept;
+        bool empty() const noexcept {
+            return ranges.empty();
+        }
+        std::span<const SackBlock> blocks() const noexcept {
+            return ranges;
+        }
+        void clear() noexcept {
+            ranges.clear();
+        }
+    };
+
+    // Node of a TimerWheel, embedded in what it times.
+    struct Timer {
+        Timer* prev = nullptr;
+        Timer* next = nullptr;
+        uint64_t tick{};
+        void* owner = nullptr;
+        uint8_t kind{};
+
+        Timer() = default;
+        Timer(void* owner, uint8_t kind) : owner{owner}, kind{kind} {}
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        bool armed() const noexcept {
+            return next != nullptr;
+        }
+    };
+
+    // Hashed timing wheel with millisecond ticks. Arming and cancelling a
+    // timer are O(1) list operations, expiring only visits the slots of the
+    // ticks that passed, so the cost does not grow with the number of
+    // connections that have a timer running.
+    class TimerWheel {
+        static constexpr std::size_t slot_count = 1024;
+
+        std::unique_ptr<Timer[]> slots;
+        clock::time_point origin;
+        uint64_t current{};
+
+        uint64_t to_tick(clock::time_point time_point) const noexcept;
+    public:
+        explicit TimerWheel(clock::time_point now = clock::now());
+        TimerWheel(const TimerWheel&) = delete;
+        TimerWheel& operator=(const TimerWheel&) = delete;
+
+        // Moves the timer if it is already armed.
+        void arm(Timer& timer, clock::time_point deadline) noexcept;
+        static void cancel(Timer& timer) noexcept;
+
+        // Disarms the timers due by now and appends them to due.
+        void expire(clock::time_point now, std::vector<Timer*>& due);
+    };
+
+    // Congestion window of a connection. Loss recovery itself is done by
+    // the connection, which tells the algorithm what happened.
+    class CongestionControl {
+    public:
+        virtual ~CongestionControl() = default;
+
+        // Bytes newly acknowledged outside of loss recovery, rtt is the
+        // smoothed round trip time.
+        virtual void on_ack(uint32_t acked, clock::time_point now, clock::duration rtt) = 0;
+        // Loss detected from duplicate ACKs or SACK, with flight bytes outstanding.
+        virtual void on_loss(uint32_t flight, clock::time_point now) = 0;
+        virtual void on_timeout(uint32_t flight, clock::time_point now) = 0;
+
+        // In bytes.
+        virtual uint32_t window() const = 0;
+    };
+
+    using CongestionFactory = std::unique_ptr<CongestionControl> (*)(uint32_t mss);
+
+    // RFC 5681 with appropriate byte counting (RFC 3465).
+    std::unique_ptr<CongestionControl> reno(uint32_t mss);
+    // RFC 9438.
+    std::unique_ptr<CongestionControl> cubic(uint32_t mss);
+
+    enum class State : uint8_t {
+        Closed,
+        SynSent,
+        SynReceived,
+        Established,
+        FinWait1,
+        FinWait2,
+        CloseWait,
+        Closing,
+        LastAck,
+        TimeWait
+    };
+
+    struct Config {
+        std::size_t send_buffer = 1 << 20;
+        std::size_t receive_buffer = 1 << 20;
+        std::size_t max_connections = 4096;
+        CongestionFactory congestion = cubic;
+        bool sack = true;
+        // Holds back short segments while data is unacknowledged (RFC 896).
+        bool nagle = true;
+        clock::duration delayed_ack = std::chrono::milliseconds{40};
+        clock::duration initial_rto = std::chrono::seconds{1};
+        clock::duration min_rto = std::chrono::milliseconds{200};
+        clock::duration max_rto = std::chrono::seconds{60};
+        // Also how long a closed connection waits for the peer's FIN.
+        clock::duration time_wait = std::chrono::seconds{30};
+        unsigned syn_retries = 5;
+        unsigned max_retries = 10;
+    };
+
+    struct Key {
+        IPv4_t remote_address;
+        uint16_t remote_port;
+        uint16_t local_port;
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct ListenerState;
+
+    // Transmission control block, the sequence variables are named as in
+    // RFC 793. snd_max is the highest sequence sent, snd_nxt goes back to
+    // snd_una after a timeout.
+    struct Control : std::enable_shared_from_this<Control> {
+        enum TimerKind : uint8_t {
+            Retransmit,
+            DelayedAck,
+            Wait
+        };
+
+        Key key;
+        State state = State::Closed;
+        std::error_code error;
+
+        bool window_scaling = true;
+        bool sack{};
+        uint16_t mss = 536;
+        uint8_t snd_wscale{};
+        uint8_t rcv_wscale{};
+
+        uint32_t iss{};
+        uint32_t snd_una{};
+        uint32_t snd_nxt{};
+        uint32_t snd_max{};
+        uint32_t snd_wnd{};
+        uint32_t snd_wl1{};
+        uint32_t snd_wl2{};
+
+        // Data from snd_una on, followed by a FIN once it is queued.
+        Ring send_buffer;
+        std::size_t send_size{};
+        bool fin_queued{};
+        bool fin_acked{};
+
+        RangeSet sacked;
+        unsigned dupacks{};
+        bool recovering{};
+        uint32_t recovery_point{};
+        // Holes below it were retransmitted in this recovery.
+        uint32_t high_rxt{};
+        std::unique_ptr<CongestionControl> congestion;
+
+        // RFC 6298, with one segment timed at a time.
+        clock::duration srtt{};
+        clock::duration rttvar{};
+        clock::duration rto{};
+        bool rtt_timing{};
+        uint32_t rtt_sequence{};
+        clock::time_point rtt_start{};
+        unsigned retries{};
+
+        uint32_t irs{};
+        uint32_t rcv_nxt{};
+        // Right edge of the window last advertised.
+        uint32_t rcv_adv{};
+        // Readable bytes from rcv_nxt back, out of order data after them.
+        Ring receive_buffer;
+        std::size_t readable{};
+        RangeSet out_of_order;
+        // Holds the latest out of order segment, reported first (RFC 2018).
+        SackBlock last_sack{};
+        std::optional<uint32_t> remote_fin;
+        bool fin_received{};
+        unsigned unacked_segments{};
+
+        Timer retransmit_timer{this, Retransmit};
+        Timer ack_timer{this, DelayedAck};
+        Timer wait_timer{this, Wait};
+
+        // Set while a passive open waits to be accepted.
+        ListenerState* listener = nullptr;
+        // No handle refers to it anymore.
+        bool detached{};
+        std::condition_variable changed;
+
+        Control(const Key& key, const Config& config);
+    };
+
+    // Open addressing table of the connections by their remote address and
+    // ports, with linear probing and backward shift deletion.
+    class ConnectionTable {
+        struct Slot {
+            Key key{};
+            std::shared_ptr<Control> control;
+        };
+
+        std::size_t limit;
+        std::size_t mask;
+        unsigned shift;
+        std::vector<Slot> slots;
+        std::size_t count{};
+
+        std::size_t home(const Key& key) const noexcept;
+    public:
+        explicit ConnectionTable(std::size_t capacity);
+
+        Control* find(const Key& key) const noexcept;
+        // Fails when the table holds capacity connections.
+        bool insert(std::shared_ptr<Control> control);
+        std::shared_ptr<Control> erase(const Key& key) noexcept;
+
+        std::size_t size() const noexcept {
+            return count;
+        }
+    };
+
+    struct ListenerState {
+        uint16_t port;
+        std::size_t backlog;
+        bool closed{};
+        std::vector<Control*> pending;
+        std::deque<std::shared_ptr<Control>> ready;
+        std::condition_variable changed;
+
+        ListenerState(uint16_t port, std::size_t backlog) : port{port}, backlog{backlog} {}
+    };
+
+    template<typename InternetLayer>
+    class Connection;
+
+    template<typename InternetLayer>
+    class Listener;
+
+    // Connections are found through a ConnectionTable and their timers run
+    // on a TimerWheel driven by poll(). State is shared between the link
+    // thread and the application threads under one mutex, which blocking
+    // calls wait on through the connection's condition variable.
+    template<typename InternetLayer>
+    class Handler {
+        friend class Connection<InternetLayer>;
+        friend class Listener<InternetLayer>;
+
+        enum Flags : uint8_t {
+            Fin = 1,
+            Syn = 2,
+            Rst = 4,
+            Psh = 8,
+            Ack = 16
+        };
+
+        static constexpr uint16_t first_ephemeral = 49152;
+
+        const Config config;
+        std::mutex mutex;
+        ConnectionTable connections;
+        std::unique_ptr<ListenerState*[]> listeners = std::make_unique<ListenerState*[]>(1 << 16);
+        TimerWheel timers;
+        std::vector<Timer*> due;
+        // Connections removed from the table while they may still be in use
+        // further up the stack, freed before the lock is released.
+        std::vector<std::shared_ptr<Control>> released;
+        uint16_t next_ephemeral = first_ephemeral;
+        std::mt19937 random{std::random_device{}()};
+
+
+        InternetLayer& internet_layer() {
+            return static_cast<InternetLayer&>(*this);
+        }
+
+        // Payload of the largest segment handed to a device that segments.
+        static constexpr uint32_t max_segmented = ipv4::Handler<InternetLayer>::max_payload - Format::byte_size() - max_options_size;
+
+        uint16_t local_mss() {
+            return static_cast<uint16_t>(internet_layer().get_mtu() - ipv4::Format::byte_size() - Format::byte_size());
+        }
+
+        static std::size_t receive_window(const Control& control) noexcept {
+            return control.receive_buffer.capacity() - control.readable;
+        }
+
+        std::shared_ptr<Control> make_control(const Key& key);
+        void negotiate(Control& control, const Options& options);
+        void establish(Control& control, uint32_t sequence, uint32_t acknowledgment, uint32_t window, clock::time_point now);
+
+        // A device with a virtio-net header cuts the payload into segments
+        // of segment_size less the options, and completes the checksums.
+        void emit(const Key& key, uint32_t sequence, uint32_t acknowledgment, uint8_t flags, uint16_t window, const Options& options, device::Parts payload, uint16_t segment_size = 0);
+        void transmit(Control& control, uint32_t sequence, std::size_t length, uint8_t flags);
+        void send_ack(Control& control) {
+            transmit(control, control.snd_nxt, 0, Ack);
+        }
+        void refuse(const Key& key, const Format::Header& header, std::size_t length);
+
+        // Sends [sequence, sequence + length), which may end with the FIN.
+        void send_range(Control& control, uint32_t sequence, uint32_t length, clock::time_point now);
+        void output(Control& control, clock::time_point now);
+        // End of the bytes considered lost during recovery.
+        uint32_t lost_end(const Control& control) const noexcept;
+        // Bytes in the network (RFC 6675).
+        uint32_t pipe(const Control& control) const noexcept;
+        void retransmit_first_hole(Control& control, clock::time_point now);
+
+        void open(ListenerState& listener, const Key& key, const Format::Header& header, const Options& options, clock::time_point now);
+        void process(Control& control, const Format::Header& header, const Options& options, std::span<const std::byte> payload, clock::time_point now);
+        void process_syn_sent(Control& control, const Format::Header& header, const Options& options, clock::time_point now);
+        void acknowledge(Control& control, const Format::Header& header, const Options& options, bool is_pure, clock::time_point now);
+        void receive_data(Control& control, uint32_t sequence, std::span<const std::byte> payload, clock::time_point now);
+        void receive_fin(Control& control, clock::time_point now);
+        void update_rtt(Control& control, clock::duration sample);
+
+        void on_timer(Timer& timer, clock::time_point now);
+        void retransmit_timeout(Control& control, clock::time_point now);
+        void enter_time_wait(Control& control, clock::time_point now);
+        void close(Control& control);
+        void abort(Control& control, std::errc error) {
+            control.error = std::make_error_code(error);
+            close(control);
+        }
+
+        std::size_t send(Control& control, std::span<const std::byte> data);
+        std::size_t receive(Control& control, std::span<std::byte> buffer);
+        void shutdown(Control& control);
+        void release(Control& control);
+        std::optional<Connection<InternetLayer>> accept(ListenerState& listener);
+        void unlisten(ListenerState& listener);
+    public:
+        explicit Handler(Config config = {}) requires(std::derived_from<InternetLayer, Handler>)
+            : config{config},
+              connections{config.max_connections}
+            {}
+
+        // Accepts connections to port, up to backlog of them may wait to be
+        // accepted or for their handshake to finish. The listener must not
+        // outlive the stack.
+        std::expected<Listener<InternetLayer>, std::system_error> listen(uint16_t port, std::size_t backlog = 128);
+
+        // Opens a connection from an ephemeral port and waits until it is
+        // established.
+        std::expected<Connection<InternetLayer>, std::system_error> connect(IPv4_t address, uint16_t port);
+
+        void handle(const ipv4::Datagram& datagram);
+
+        // Runs the timers that are due.
+        void poll(clock::time_point now = clock::now());
+    };
+
+    // Handle of an established connection. Dropping it closes the
+    // connection like shutdown(), which then finishes in the background.
+    template<typename InternetLayer>
+    class Connection {
+        friend class Handler<InternetLayer>;
+
+        Handler<InternetLayer>* handler;
+        std::shared_ptr<Control> control;
+
+        Connection(Handler<InternetLayer>& handler, std::shared_ptr<Control> control)
+            : handler{&handler},
+              control{std::move(control)}
+            {}
+    public:
+        Connection(Connection&&) noexcept = default;
+        Connection& operator=(Connection other) noexcept {
+            std::swap(handler, other.handler);
+            std::swap(control, other.control);
+            return *this;
+        }
+        ~Connection() {
+            if (control) {
+                handler->release(*control);
+            }
+        }
+
+        // Queues all of data, waiting for room in the send buffer. Returns
+        // less only when the connection failed or was shut down.
+        std::size_t send(std::span<const std::byte> data) {
+            return handler->send(*control, data);
+        }
+
+        // Waits for data and reads up to buffer.size() bytes of it. Returns 0
+        // at the end of the stream or when the connection failed.
+        std::size_t receive(std::span<std::byte> buffer) {
+            return handler->receive(*control, buffer);
+        }
+
+        // Sends a FIN after the queued data, receiving goes on.
+        void shutdown() {
+            handler->shutdown(*control);
+        }
+
+        State state() const {
+            std::lock_guard lock(handler->mutex);
+            return control->state;
+        }
+
+        // Why the connection failed, if it did.
+        std::error_code error() const {
+            std::lock_guard lock(handler->mutex);
+            return control->error;
+        }
+
+        uint16_t local_port() const noexcept {
+            return control->key.local_port;
+        }
+        IPv4_t remote_address() const noexcept {
+            return control->key.remote_address;
+        }
+        uint16_t remote_port() const noexcept {
+            return control->key.remote_port;
+        }
+    };
+
+    template<typename InternetLayer>
+    class Listener {
+        friend class Handler<InternetLayer>;
+
+        Handler<InternetLayer>* handler;
+        std::unique_ptr<ListenerState> state;
+
+        Listener(Handler<InternetLayer>& handler, std::unique_ptr<ListenerState> state)
+            : handler{&handler},
+              state{std::move(state)}
+            {}
+    public:
+        Listener(Listener&&) noexcept = default;
+        Listener& operator=(Listener other) noexcept {
+            std::swap(handler, other.handler);
+            std::swap(state, other.state);
+            return *this;
+        }
+        ~Listener() {
+            close();
+        }
+
+        uint16_t local_port() const noexcept {
+            return state->port;
+        }
+
+        // Waits for an established connection. Returns nothing once the
+        // listener is closed.
+        std::optional<Connection<InternetLayer>> accept() {
+            return handler->accept(*state);
+        }
+
+        // Stops listening and resets the connections not accepted yet. Safe
+        // to call from another thread than the one accepting.
+        void close() {
+            if (state) {
+                handler->unlisten(*state);
+            }
+        }
+    };
+
+    template<typename InternetLayer>
+    std::shared_ptr<Control> Handler<InternetLayer>::make_control(const Key& key) {
+        auto control = std::make_shared<Control>(key, config);
+        control->sack = config.sack;
+        control->iss = static_cast<uint32_t>(random());
+        control->snd_una = control->iss;
+        control->snd_nxt = control->iss + 1;
+        control->snd_max = control->iss + 1;
+        control->rto = config.initial_rto;
+        while (control->rcv_wscale < 14 && control->receive_buffer.capacity() >> control->rcv_wscale > 0xFFFF) {
+            ++control->rcv_wscale;
+        }
+        return control;
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::negotiate(Control& control, const Options& options) {
+        control.mss = std::min<uint16_t>(options.mss.value_or(536), local_mss());
+        control.sack = control.sack && options.sack_permitted;
+        if (control.window_scaling && options.window_scale) {
+            control.snd_wscale = std::min<uint8_t>(*options.window_scale, 14);
+        } else {
+            control.window_scaling = false;
+            control.snd_wscale = 0;
+            control.rcv_wscale = 0;
+        }
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::establish(Control& control, uint32_t sequence, uint32_t acknowledgment, uint32_t window, clock::time_point now) {
+        control.state = State::Established;
+        control.snd_una = acknowledgment;
+        control.snd_nxt = acknowledgment;
+        control.snd_max = acknowledgment;
+        control.recovery_point = acknowledgment;
+        control.snd_wnd = window;
+        control.snd_wl1 = sequence;
+        control.snd_wl2 = acknowledgment;
+        control.congestion = config.congestion(control.mss);
+
+        // The handshake gives the first round trip sample, unless the SYN
+        // had to be sent again.
+        if (control.rtt_timing) {
+            update_rtt(control, now - control.rtt_start);
+            control.rtt_timing = false;
+        }
+        control.retries = 0;
+        timers.cancel(control.retransmit_timer);
+        control.changed.notify_all();
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::emit(const Key& key, uint32_t sequence, uint32_t acknowledgment, uint8_t flags, uint16_t window, const Options& options, device::Parts payload, uint16_t segment_size) {
+        std::array<std::byte, Format::byte_size() + max_options_size> bytes{};
+        const auto options_size = write_options(options, std::span{bytes}.subspan<Format::byte_size(), max_options_size>());
+        const auto header_size = Format::byte_size() + options_size;
+
+        Format::Header header;
+        header.set<"source_port">(key.local_port);
+        header.set<"destination_port">(key.remote_port);
+        header.set<"sequence">(sequence);
+        header.set<"acknowledgment">(acknowledgment);
+        header.set<"data_offset">(static_cast<uint8_t>(header_size / 4));
+        header.set<"ack">((flags & Ack) != 0);
+        header.set<"psh">((flags & Psh) != 0);
+        header.set<"rst">((flags & Rst) != 0);
+        header.set<"syn">((flags & Syn) != 0);
+        header.set<"fin">((flags & Fin) != 0);
+        header.set<"window">(window);
+
+        Packet<std::span<std::byte>> packet{std::span{bytes}.first(header_size)};
+        packet.encode(header);
+
+        std::size_t payload_size = 0;
+        for (auto part : payload) {
+            payload_size += part.size();
+        }
+
+        virtio_net::Format::Header offload;
+        if (internet_layer().has_vnet_header()) {
+            packet.set<"checksum">(pseudo_header_sum(internet_layer().get_ip(), key.remote_address, header_size + payload_size));
+            offload.set<"flags">(virtio_net::NeedsChecksum);
+            offload.set<"checksum_offset">(16);
+
+            const auto gso_size = segment_size > options_size ? segment_size - options_size : 0u;
+            if (gso_size != 0 && payload_size > gso_size) {
+                offload.set<"gso_type">(virtio_net::GsoType::TCPv4);
+                offload.set<"gso_size">(static_cast<uint16_t>(gso_size));
+                offload.set<"header_length">(static_cast<uint16_t>(header_size));
+            }
+        } else {
+            packet.set<"checksum">(checksum(internet_layer().get_ip(), key.remote_address, packet.to_span(), payload));
+        }
+
+        std::array<std::span<const std::byte>, device::max_parts> parts;
+        parts[0] = packet.to_span();
+        std::ranges::copy(payload, parts.begin() + 1);
+
+        stats::add(stats::Counter::TcpSent);
+        stats::add(stats::Counter::TcpBytesSent, payload_size);
+        internet_layer().send(key.remote_address, ipv4::Protocol::TCP, std::span{parts}.first(payload.size() + 1), offload);
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::transmit(Control& control, uint32_t sequence, std::size_t length, uint8_t flags) {
+        Options options;
+        if (flags & Syn) {
+            options.mss = local_mss();
+            if (control.window_scaling) {
+                options.window_scale = control.rcv_wscale;
+            }
+            options.sack_permitted = control.sack;
+        } else if (control.sack && !control.out_of_order.empty()) {
+            for (auto block : control.out_of_order.blocks()) {
+                if (!before(control.last_sack.left, block.left) && !after(control.last_sack.right, block.right)) {
+                    options.sack[options.sack_count++] = block;
+                    break;
+                }
+            }
+            for (auto block : control.out_of_order.blocks()) {
+                if (options.sack_count == options.sack.size()) {
+                    break;
+                }
+                if (options.sack_count == 0 || block != options.sack[0]) {
+                    options.sack[options.sack_count++] = block;
+                }
+            }
+        }
+
+        // Windows in SYN segments are never scaled (RFC 7323).
+        const auto shift = (flags & Syn) ? 0 : control.rcv_wscale;
+        const auto window = static_cast<uint16_t>(std::min<std::size_t>(receive_window(control) >> shift, 0xFFFF));
+        const auto acknowledgment = (flags & Ack) ? control.rcv_nxt : 0;
+        if (flags & Ack) {
+            control.rcv_adv = control.rcv_nxt + (uint32_t{window} << shift);
+            control.unacked_segments = 0;
+            timers.cancel(control.ack_timer);
+        }
+
+        auto payload = control.send_buffer.view(sequence - control.snd_una, length);
+        const std::size_t pieces = length == 0 ? 0 : payload[1].empty() ? 1 : 2;
+        emit(control.key, sequence, acknowledgment, flags, window, options, std::span{payload}.first(pieces), control.mss);
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::refuse(const Key& key, const Format::Header& header, std::size_t length) {
+        // RFC 793, reset generation for a connection that does not exist.
+        stats::add(stats::Counter::TcpResetsSent);
+        if (header.get<"ack">()) {
+            emit(key, header.get<"acknowledgment">(), 0, Rst, 0, {}, {});
+        } else {
+            const auto end = header.get<"sequence">() + static_cast<uint32_t>(length) + header.get<"syn">() + header.get<"fin">();
+            emit(key, 0, end, Rst | Ack, 0, {}, {});
+        }
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::send_range(Control& control, uint32_t sequence, uint32_t length, clock::time_point now) {
+        const auto data_end = control.snd_una + static_cast<uint32_t>(control.send_size);
+        const auto data = std::min(length, data_end - sequence);
+
+        uint8_t flags = Ack;
+        if (data < length) {
+            flags |= Fin;
+        }
+        if (data != 0 && sequence + data == data_end) {
+            flags |= Psh;
+        }
+
+        // Karn's algorithm: no round trip samples from retransmitted data.
+        if (before(sequence, control.snd_max)) {
+            stats::add(stats::Counter::TcpRetransmitted);
+            control.rtt_timing = false;
+        } else if (!control.rtt_timing) {
+            control.rtt_timing = true;
+            control.rtt_sequence = sequence;
+            control.rtt_start = now;
+        }
+
+        transmit(control, sequence, data, flags);
+        if (!control.retransmit_timer.armed()) {
+            timers.arm(control.retransmit_timer, now + control.rto);
+        }
+    }
+
+    template<typename InternetLayer>
+    uint32_t Handler<InternetLayer>::lost_end(const Control& control) const noexcept {
+        // Without SACK only the first segment is known to be lost.
+        auto end = control.snd_una + control.mss;
+        if (control.sack && !control.sacked.empty()) {
+            end = control.sacked.blocks().back().right;
+        }
+        // After a timeout nothing from snd_nxt on is in flight.
+        return before(end, control.snd_nxt) ? end : control.snd_nxt;
+    }
+
+    template<typename InternetLayer>
+    uint32_t Handler<InternetLayer>::pipe(const Control& control) const noexcept {
+        auto flight = control.snd_nxt - control.snd_una - control.sacked.covered(control.snd_una, control.snd_nxt);
+        if (control.recovering) {
+            const auto start = after(control.high_rxt, control.snd_una) ? control.high_rxt : control.snd_una;
+            const auto end = lost_end(control);
+            if (before(start, end)) {
+                flight -= end - start - control.sacked.covered(start, end);
+            }
+        }
+        return flight;
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::retransmit_first_hole(Control& control, clock::time_point now) {
+        const auto start = after(control.high_rxt, control.snd_una) ? control.high_rxt : control.snd_una;
+        if (auto hole = control.sacked.first_gap(start, lost_end(control))) {
+            const auto length = std::min<uint32_t>(hole->right - hole->left, control.mss);
+            send_range(control, hole->left, length, now);
+            control.high_rxt = hole->left + length;
+        }
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::output(Control& control, clock::time_point now) {
+        switch (control.state) {
+            case State::Established:
+            case State::CloseWait:
+            case State::FinWait1:
+            case State::Closing:
+            case State::LastAck:
+                break;
+            default:
+                return;
+        }
+        if (control.fin_acked) {
+            return;
+        }
+
+        const auto end = control.snd_una + static_cast<uint32_t>(control.send_size) + (control.fin_queued ? 1u : 0u);
+        while (true) {
+            const auto window = control.congestion->window();
+            const auto in_flight = pipe(control);
+            if (in_flight >= window) {
+                break;
+            }
+
+            // Holes go before new data during recovery.
+            if (control.recovering) {
+                const auto start = after(control.high_rxt, control.snd_una) ? control.high_rxt : control.snd_una;
+                if (auto hole = control.sacked.first_gap(start, lost_end(control))) {
+                    const auto length = std::min<uint32_t>(hole->right - hole->left, control.mss);
+                    send_range(control, hole->left, length, now);
+                    control.high_rxt = hole->left + length;
+                    continue;
+                }
+            }
+
+            if (!before(control.snd_nxt, end)) {
+                break;
+            }
+            const auto available = end - control.snd_nxt;
+            const auto window_end = control.snd_una + control.snd_wnd;
+            const auto usable = after(window_end, control.snd_nxt) ? window_end - control.snd_nxt : 0u;
+
+            // A device that segments takes up to 64KB in one go (TSO).
+            auto limit = uint32_t{control.mss};
+            if (internet_layer().has_vnet_header() && window - in_flight > limit) {
+                limit = std::min<uint32_t>(window - in_flight, max_segmented) / control.mss * control.mss;
+            }
+            auto length = std::min({available, limit, usable});
+            const bool only_fin = control.fin_queued && available == 1;
+            if (length == 0 && only_fin) {
+                // A FIN takes no room in the window.
+                length = 1;
+            }
+            if (length == 0 || (in_flight != 0 && in_flight + length > window)) {
+                break;
+            }
+
+            // Short segments wait for the window to open (sender side silly
+            // window avoidance) and, with Nagle, for outstanding data to be
+            // acknowledged. Ones that end the stream go out right away.
+            const bool ends_stream = control.fin_queued && length == available;
+            if (length < control.mss && !ends_stream && control.snd_nxt != control.snd_una && (config.nagle || length < available)) {
+                break;
+            }
+
+            send_range(control, control.snd_nxt, length, now);
+            control.snd_nxt += length;
+            if (after(control.snd_nxt, control.snd_max)) {
+                control.snd_max = control.snd_nxt;
+            }
+        }
+
+        // Probes a closed window when nothing is in flight to bring an update.
+        if (control.snd_una == control.snd_max && before(control.snd_nxt, end) && !control.retransmit_timer.armed()) {
+            timers.arm(control.retransmit_timer, now + control.rto);
+        }
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::update_rtt(Control& control, clock::duration sample) {
+        if (control.srtt == clock::duration{}) {
+            control.srtt = sample;
+            control.rttvar = sample / 2;
+        } else {
+            const auto delta = control.srtt > sample ? control.srtt - sample : sample - control.srtt;
+            control.rttvar = (3 * control.rttvar + delta) / 4;
+            control.srtt = (7 * control.srtt + sample) / 8;
+        }
+        control.rto = std::clamp(control.srtt + std::max<clock::duration>(4 * control.rttvar, std::chrono::milliseconds{1}), config.min_rto, config.max_rto);
+    }
+
+    template<typename InternetLayer>
+    auto Handler<InternetLayer>::listen(uint16_t port, std::size_t backlog) -> std::expected<Listener<InternetLayer>, std::system_error> {
+        auto state = std::make_unique<ListenerState>(port, std::max<std::size_t>(backlog, 1));
+
+        std::lock_guard lock(mutex);
+        if (listeners[port] != nullptr) {
+            return std::unexpected{std::system_error{std::make_error_code(std::errc::address_in_use), "Port in use"}};
+        }
+        listeners[port] = state.get();
+        return Listener<InternetLayer>{*this, std::move(state)};
+    }
+
+    template<typename InternetLayer>
+    auto Handler<InternetLayer>::connect(IPv4_t address, uint16_t port) -> std::expected<Connection<InternetLayer>, std::system_error> {
+        std::unique_lock lock(mutex);
+
+        Key key{address, port, next_ephemeral};
+        for (std::size_t i = 0; i < (1 << 16) - first_ephemeral; ++i) {
+            key.local_port = next_ephemeral;
+            next_ephemeral = next_ephemeral == 0xFFFF ? first_ephemeral : static_cast<uint16_t>(next_ephemeral + 1);
+            if (listeners[key.local_port] == nullptr && connections.find(key) == nullptr) {
+                break;
+            }
+        }
+        if (listeners[key.local_port] != nullptr || connections.find(key) != nullptr) {
+            return std::unexpected{std::system_error{std::make_error_code(std::errc::address_in_use), "No free ephemeral port"}};
+        }
+
+        auto control = make_control(key);
+        if (!connections.insert(control)) {
+            return std::unexpected{std::system_error{std::make_error_code(std::errc::too_many_files_open), "Too many connections"}};
+        }
+
+        const auto now = clock::now();
+        control->state = State::SynSent;
+        control->rtt_timing = true;
+        control->rtt_start = now;
+        transmit(*control, control->iss, 0, Syn);
+        timers.arm(control->retransmit_timer, now + control->rto);
+
+        control->changed.wait(lock, [&]{
+            return control->state != State::SynSent && control->state != State::SynReceived;
+        });
+        released.clear();
+
+        if (control->state == State::Closed) {
+            return std::unexpected{std::system_error{control->error, "Connection failed"}};
+        }
+        return Connection<InternetLayer>{*this, std::move(control)};
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::handle(const ipv4::Datagram& datagram) {
+        stats::add(stats::Counter::TcpReceived);
+
+        const auto bytes = datagram.payload();
+        if (bytes.size() < Format::byte_size()) {
+            stats::add(stats::Counter::TcpMalformed);
+            return;
+        }
+
+        const auto header = Packet<std::span<const std::byte>>{bytes}.decode();
+        const std::size_t header_size = header.get<"data_offset">() * 4u;
+        if (header_size < Format::byte_size() || header_size > bytes.size()) {
+            stats::add(stats::Counter::TcpMalformed);
+            return;
+        }
+        if (!datagram.checksum_valid && checksum(datagram.source_address, datagram.destination_address, bytes) != 0) {
+            stats::add(stats::Counter::TcpChecksumErrors);
+            return;
+        }
+
+        const auto options = parse_options(bytes.subspan(Format::byte_size(), header_size - Format::byte_size()));
+        const auto payload = bytes.subspan(header_size);
+        const Key key{datagram.source_address, header.get<"source_port">(), header.get<"destination_port">()};
+
+        std::lock_guard lock(mutex);
+        const auto now = clock::now();
+        if (auto control = connections.find(key)) {
+            process(*control, header, options, payload, now);
+        } else if (!header.get<"rst">()) {
+            auto listener = listeners[key.local_port];
+            if (listener != nullptr && header.get<"syn">() && !header.get<"ack">()) {
+                open(*listener, key, header, options, now);
+            } else {
+                refuse(key, header, payload.size());
+            }
+        }
+        released.clear();
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::open(ListenerState& listener, const Key& key, const Format::Header& header, const Options& options, clock::time_point now) {
+        // A full backlog drops the SYN, the peer tries again later.
+        if (listener.pending.size() + listener.ready.size() >= listener.backlog) {
+            return;
+        }
+
+        auto control = make_control(key);
+        if (!connections.insert(control)) {
+            return;
+        }
+
+        control->state = State::SynReceived;
+        control->irs = header.get<"sequence">();
+        control->rcv_nxt = control->irs + 1;
+        negotiate(*control, options);
+
+        control->listener = &listener;
+        listener.pending.push_back(control.get());
+
+        control->rtt_timing = true;
+        control->rtt_start = now;
+        transmit(*control, control->iss, 0, Syn | Ack);
+        timers.arm(control->retransmit_timer, now + control->rto);
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::process_syn_sent(Control& control, const Format::Header& header, const Options& options, clock::time_point now) {
+        const bool has_ack = header.get<"ack">();
+        const uint32_t acknowledgment = header.get<"acknowledgment">();
+
+        if (has_ack && acknowledgment != control.iss + 1) {
+            if (!header.get<"rst">()) {
+                refuse(control.key, header, 0);
+            }
+            return;
+        }
+        if (header.get<"rst">()) {
+            if (has_ack) {
+                abort(control, std::errc::connection_refused);
+            }
+            return;
+        }
+        if (!header.get<"syn">()) {
+            return;
+        }
+
+        control.irs = header.get<"sequence">();
+        control.rcv_nxt = control.irs + 1;
+        negotiate(control, options);
+
+        if (has_ack) {
+            establish(control, control.irs, acknowledgment, header.get<"window">(), now);
+            send_ack(control);
+        } else {
+            // Simultaneous open.
+            control.state = State::SynReceived;
+            transmit(control, control.iss, 0, Syn | Ack);
+        }
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::process(Control& control, const Format::Header& header, const Options& options, std::span<const std::byte> payload, clock::time_point now) {
+        if (control.state == State::SynSent) {
+            process_syn_sent(control, header, options, now);
+            return;
+        }
+
+        const uint32_t sequence = header.get<"sequence">();
+        const bool syn = header.get<"syn">();
+        const bool fin = header.get<"fin">();
+
+        // The peer did not get our SYN-ACK.
+        if (control.state == State::SynReceived && syn && !header.get<"ack">() && sequence == control.irs) {
+            transmit(control, control.iss, 0, Syn | Ack);
+            return;
+        }
+
+        // Acceptability test of RFC 793, 3.9.
+        const auto length = static_cast<uint32_t>(payload.size()) + syn + fin;
+        const auto window = static_cast<uint32_t>(receive_window(control));
+        auto in_window = [&](uint32_t s) {
+            return !before(s, control.rcv_nxt) && before(s, control.rcv_nxt + window);
+        };
+        const bool acceptable = length == 0
+            ? (window == 0 ? sequence == control.rcv_nxt : in_window(sequence))
+            : window != 0 && (in_window(sequence) || in_window(sequence + length - 1));
+
+        if (!acceptable) {
+            if (!header.get<"rst">()) {
+                send_ack(control);
+            }
+            return;
+        }
+        if (header.get<"rst">()) {
+            abort(control, std::errc::connection_reset);
+            return;
+        }
+        if (syn) {
+            send_ack(control);
+            return;
+        }
+        if (!header.get<"ack">()) {
+            return;
+        }
+
+        const uint32_t acknowledgment = header.get<"acknowledgment">();
+        if (control.state == State::SynReceived) {
+            if (acknowledgment != control.iss + 1) {
+                refuse(control.key, header, payload.size());
+                return;
+            }
+
+            auto listener = std::exchange(control.listener, nullptr);
+            if (listener == nullptr) {
+                return;
+            }
+            std::erase(listener->pending, &control);
+            establish(control, sequence, acknowledgment, uint32_t{header.get<"window">()} << control.snd_wscale, now);
+
+            listener->ready.push_back(control.shared_from_this());
+            listener->changed.notify_all();
+        }
+
+        if (after(acknowledgment, control.snd_max)) {
+            send_ack(control);
+            return;
+        }
+        acknowledge(control, header, options, payload.empty() && !fin, now);
+
+        if (control.fin_acked) {
+            switch (control.state) {
+                case State::FinWait1:
+                    control.state = State::FinWait2;
+                    if (control.detached) {
+                        timers.arm(control.wait_timer, now + config.time_wait);
+                    }
+                    break;
+                case State::Closing:
+                    enter_time_wait(control, now);
+                    return;
+                case State::LastAck:
+                    close(control);
+                    return;
+                default:
+                    break;
+            }
+        }
+
+        if (!payload.empty() && (control.state == State::Established || control.state == State::FinWait1 || control.state == State::FinWait2)) {
+            receive_data(control, sequence, payload, now);
+        }
+        if (fin && !control.fin_received) {
+            control.remote_fin = sequence + static_cast<uint32_t>(payload.size());
+        }
+        if (control.remote_fin == control.rcv_nxt) {
+            receive_fin(control, now);
+        }
+
+        output(control, now);
+        control.changed.notify_all();
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::acknowledge(Control& control, const Format::Header& header, const Options& options, bool is_pure, clock::time_point now) {
+        const uint32_t sequence = header.get<"sequence">();
+        const uint32_t acknowledgment = header.get<"acknowledgment">();
+        const uint32_t window = uint32_t{header.get<"window">()} << control.snd_wscale;
+
+        if (control.sack) {
+            for (std::size_t i = 0; i < options.sack_count; ++i) {
+                const auto block = options.sack[i];
+                if (after(block.left, control.snd_una) && before(block.left, block.right) && !after(block.right, control.snd_max)) {
+                    control.sacked.add(block.left, block.right);
+                }
+            }
+        }
+
+        if (after(acknowledgment, control.snd_una)) {
+            const auto acked = acknowledgment - control.snd_una;
+            const auto data = std::min<std::size_t>(acked, control.send_size);
+            control.send_buffer.consume(data);
+            control.send_size -= data;
+            if (acked > data) {
+                control.fin_acked = true;
+            }
+
+            control.snd_una = acknowledgment;
+            if (before(control.snd_nxt, acknowledgment)) {
+                control.snd_nxt = acknowledgment;
+            }
+            control.sacked.remove_before(acknowledgment);
+            control.dupacks = 0;
+            control.retries = 0;
+
+            if (control.rtt_timing && after(acknowledgment, control.rtt_sequence)) {
+                update_rtt(control, now - control.rtt_start);
+                control.rtt_timing = false;
+            }
+
+            if (control.recovering) {
+                if (!before(acknowledgment, control.recovery_point)) {
+                    control.recovering = false;
+                } else if (!control.sack) {
+                    // NewReno (RFC 6582): a partial ACK shows the next loss.
+                    control.high_rxt = acknowledgment;
+                    retransmit_first_hole(control, now);
+                }
+            } else {
+                control.congestion->on_ack(acked, now, control.srtt);
+            }
+
+            if (control.snd_una == control.snd_max) {
+                timers.cancel(control.retransmit_timer);
+            } else {
+                timers.arm(control.retransmit_timer, now + control.rto);
+            }
+        } else if (is_pure && acknowledgment == control.snd_una && window == control.snd_wnd && control.snd_una != control.snd_max) {
+            ++control.dupacks;
+        }
+
+        if (before(control.snd_wl1, sequence) || (control.snd_wl1 == sequence && !before(acknowledgment, control.snd_wl2))) {
+            // A window probe that was all that was out got dropped by the
+            // closed window, it goes again with the data after it.
+            if (control.snd_wnd == 0 && window != 0 && control.snd_max == control.snd_una + 1) {
+                control.snd_nxt = control.snd_una;
+            }
+            control.snd_wnd = window;
+            control.snd_wl1 = sequence;
+            control.snd_wl2 = acknowledgment;
+        }
+
+        // Fast retransmit after three duplicate ACKs, or as much data
+        // SACKed above the first hole (RFC 6675). Not again for data that
+        // was outstanding at a timeout, the go-back-N resend covers it.
+        if (!control.recovering && !before(control.snd_una, control.recovery_point) && control.snd_una != control.snd_max && (control.dupacks >= 3 || control.sacked.bytes() > 2u * control.mss)) {
+            control.recovering = true;
+            control.recovery_point = control.snd_max;
+            control.high_rxt = control.snd_una;
+            control.congestion->on_loss(control.snd_max - control.snd_una, now);
+            stats::add(stats::Counter::TcpFastRetransmits);
+            retransmit_first_hole(control, now);
+        }
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::receive_data(Control& control, uint32_t sequence, std::span<const std::byte> payload, clock::time_point now) {
+        if (before(sequence, control.rcv_nxt)) {
+            const std::size_t duplicate = control.rcv_nxt - sequence;
+            if (duplicate >= payload.size()) {
+                send_ack(control);
+                return;
+            }
+            payload = payload.subspan(duplicate);
+            sequence = control.rcv_nxt;
+        }
+
+        const std::size_t offset = sequence - control.rcv_nxt;
+        payload = payload.first(std::min(payload.size(), receive_window(control) - offset));
+        if (payload.empty()) {
+            send_ack(control);
+            return;
+        }
+        control.receive_buffer.write(control.readable + offset, payload);
+
+        const auto end = sequence + static_cast<uint32_t>(payload.size());
+        if (sequence != control.rcv_nxt) {
+            // Out of order, the duplicate ACK with SACK tells what is missing.
+            // The sender counts them, so a merged segment gets one for each
+            // segment it stands for.
+            control.last_sack = control.out_of_order.add(sequence, end);
+            for (std::size_t acked = 0; acked < payload.size(); acked += control.mss) {
+                send_ack(control);
+            }
+            return;
+        }
+
+        const bool filled_hole = !control.out_of_order.empty();
+        control.readable += payload.size();
+        control.rcv_nxt = end;
+        control.out_of_order.remove_before(end);
+        while (auto last = control.out_of_order.take(control.rcv_nxt)) {
+            control.readable += *last - control.rcv_nxt;
+            control.rcv_nxt = *last;
+        }
+        control.changed.notify_all();
+
+        // Every second segment is acknowledged right away (RFC 1122, 4.2.3.2),
+        // a merged one may stand for several.
+        if (filled_hole || ++control.unacked_segments >= 2 || payload.size() > control.mss) {
+            send_ack(control);
+        } else if (!control.ack_timer.armed()) {
+            timers.arm(control.ack_timer, now + config.delayed_ack);
+        }
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::receive_fin(Control& control, clock::time_point now) {
+        control.remote_fin.reset();
+        control.fin_received = true;
+        control.rcv_nxt += 1;
+        send_ack(control);
+
+        switch (control.state) {
+            case State::Established:
+                control.state = State::CloseWait;
+                break;
+            case State::FinWait1:
+                control.state = State::Closing;
+                break;
+            case State::FinWait2:
+                enter_time_wait(control, now);
+                break;
+            default:
+                break;
+        }
+        control.changed.notify_all();
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::enter_time_wait(Control& control, clock::time_point now) {
+        control.state = State::TimeWait;
+        timers.cancel(control.retransmit_timer);
+        timers.cancel(control.ack_timer);
+        timers.arm(control.wait_timer, now + config.time_wait);
+        control.changed.notify_all();
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::close(Control& control) {
+        if (control.state == State::Closed) {
+            return;
+        }
+        control.state = State::Closed;
+        timers.cancel(control.retransmit_timer);
+        timers.cancel(control.ack_timer);
+        timers.cancel(control.wait_timer);
+        if (auto listener = std::exchange(control.listener, nullptr)) {
+            std::erase(listener->pending, &control);
+        }
+        released.push_back(connections.erase(control.key));
+        control.changed.notify_all();
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::poll(clock::time_point now) {
+        std::lock_guard lock(mutex);
+        due.clear();
+        timers.expire(now, due);
+        for (auto timer : due) {
+            on_timer(*timer, now);
+        }
+        released.clear();
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::on_timer(Timer& timer, clock::time_point now) {
+        auto& control = *static_cast<Control*>(timer.owner);
+        // Closed or armed again by a timer that ran before it.
+        if (control.state == State::Closed || timer.armed()) {
+            return;
+        }
+
+        switch (timer.kind) {
+            case Control::Retransmit:
+                retransmit_timeout(control, now);
+                break;
+            case Control::DelayedAck:
+                send_ack(control);
+                break;
+            case Control::Wait:
+                close(control);
+                break;
+        }
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::retransmit_timeout(Control& control, clock::time_point now) {
+        if (control.state == State::SynSent || control.state == State::SynReceived) {
+            if (++control.retries > config.syn_retries) {
+                abort(control, std::errc::timed_out);
+                return;
+            }
+            control.rto = std::min(control.rto * 2, config.max_rto);
+            control.rtt_timing = false;
+            transmit(control, control.iss, 0, control.state == State::SynSent ? Syn : Syn | Ack);
+            timers.arm(control.retransmit_timer, now + control.rto);
+            return;
+        }
+
+        if (control.snd_una == control.snd_max) {
+            // Persist timer: a byte beyond the closed window makes the peer
+            // send its current one.
+            if (control.snd_wnd == 0 && (control.send_size != 0 || control.fin_queued)) {
+                control.rto = std::min(control.rto * 2, config.max_rto);
+                send_range(control, control.snd_una, 1, now);
+                control.snd_nxt = control.snd_una + 1;
+                control.snd_max = control.snd_nxt;
+            }
+            return;
+        }
+
+        if (++control.retries > config.max_retries) {
+            abort(control, std::errc::timed_out);
+            return;
+        }
+        stats::add(stats::Counter::TcpTimeouts);
+
+        // Everything outstanding is sent again, SACK information may be
+        // reneged on (RFC 2018, 8).
+        control.congestion->on_timeout(control.snd_max - control.snd_una, now);
+        control.rto = std::min(control.rto * 2, config.max_rto);
+        control.snd_nxt = control.snd_una;
+        control.sacked.clear();
+        control.recovering = false;
+        control.recovery_point = control.snd_max;
+        control.dupacks = 0;
+        control.rtt_timing = false;
+        output(control, now);
+    }
+
+    template<typename InternetLayer>
+    std::size_t Handler<InternetLayer>::send(Control& control, std::span<const std::byte> data) {
+        std::unique_lock lock(mutex);
+        auto can_send = [&]{
+            return (control.state == State::Established || control.state == State::CloseWait) && !control.fin_queued;
+        };
+
+        std::size_t queued = 0;
+        while (queued < data.size()) {
+            control.changed.wait(lock, [&]{
+                return control.send_size < control.send_buffer.capacity() || !can_send();
+            });
+            if (!can_send()) {
+                break;
+            }
+
+            const auto count = std::min(data.size() - queued, control.send_buffer.capacity() - control.send_size);
+            control.send_buffer.write(control.send_size, data.subspan(queued, count));
+            control.send_size += count;
+            queued += count;
+            output(control, clock::now());
+        }
+        released.clear();
+        return queued;
+    }
+
+    template<typename InternetLayer>
+    std::size_t Handler<InternetLayer>::receive(Control& control, std::span<std::byte> buffer) {
+        std::unique_lock lock(mutex);
+        control.changed.wait(lock, [&]{
+            return control.readable != 0 || control.fin_received || control.state == State::Closed;
+        });
+
+        const auto count = std::min(buffer.size(), control.readable);
+        auto pieces = control.receive_buffer.view(0, count);
+        std::ranges::copy(pieces[1], std::ranges::copy(pieces[0], buffer.begin()).out);
+        control.receive_buffer.consume(count);
+        control.readable -= count;
+
+        // Window update once it opened by enough to matter (RFC 1122, 4.2.3.3).
+        if (count != 0 && !control.fin_received && control.state != State::Closed) {
+            const auto edge = control.rcv_nxt + static_cast<uint32_t>(receive_window(control));
+            if (after(edge, control.rcv_adv) && edge - control.rcv_adv >= std::min<std::size_t>(control.receive_buffer.capacity() / 2, control.mss)) {
+                send_ack(control);
+            }
+        }
+        released.clear();
+        return count;
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::shutdown(Control& control) {
+        std::lock_guard lock(mutex);
+        switch (control.state) {
+            case State::Established:
+                control.state = State::FinWait1;
+                break;
+            case State::CloseWait:
+                control.state = State::LastAck;
+                break;
+            default:
+                return;
+        }
+        control.fin_queued = true;
+        output(control, clock::now());
+        control.changed.notify_all();
+        released.clear();
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::release(Control& control) {
+        shutdown(control);
+
+        std::lock_guard lock(mutex);
+        control.detached = true;
+        // Do not wait forever for a peer that never closes its side.
+        if (control.state == State::FinWait2 && !control.wait_timer.armed()) {
+            timers.arm(control.wait_timer, clock::now() + config.time_wait);
+        }
+    }
+
+    template<typename InternetLayer>
+    auto Handler<InternetLayer>::accept(ListenerState& listener) -> std::optional<Connection<InternetLayer>> {
+        std::unique_lock lock(mutex);
+        listener.changed.wait(lock, [&]{
+            return !listener.ready.empty() || listener.closed;
+        });
+        if (listener.ready.empty()) {
+            return std::nullopt;
+        }
+
+        auto control = std::move(listener.ready.front());
+        listener.ready.pop_front();
+        return Connection<InternetLayer>{*this, std::move(control)};
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::unlisten(ListenerState& listener) {
+        std::lock_guard lock(mutex);
+        if (listeners[listener.port] == &listener) {
+            listeners[listener.port] = nullptr;
+        }
+        listener.closed = true;
+
+        auto reset = [&](Control& control) {
+            if (control.state != State::Closed) {
+                stats::add(stats::Counter::TcpResetsSent);
+                transmit(control, control.snd_nxt, 0, Rst);
+                close(control);
+            }
+        };
+        for (auto control : std::vector{listener.pending}) {
+            reset(*control);
+        }
+        for (auto& control : listener.ready) {
+            reset(*control);
+        }
+        listener.ready.clear();
+
+        listener.changed.notify_all();
+        released.clear();
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+// Rate limiter allowing bursts of up to burst tokens, refilled at rate tokens
+// per second. Refilling is done lazily from the times passed in. Not thread
+// safe, callers serialize access themselves.
+class TokenBucket {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct Config {
+        double rate = 10;
+        double burst = 10;
+    };
+
+private:
+    Config config;
+    double tokens;
+    clock::time_point refilled;
+
+    void refill(clock::time_point now) {
+        if (now > refilled) {
+            std::chrono::duration<double> elapsed = now - refilled;
+            tokens = std::min(config.burst, tokens + elapsed.count() * config.rate);
+            refilled = now;
+        }
+    }
+public:
+    explicit TokenBucket(Config config, clock::time_point now = clock::now())
+        : config{config},
+          tokens{config.burst},
+          refilled{now}
+        {}
+
+    bool try_acquire(clock::time_point now = clock::now(), double count = 1) {
+        refill(now);
+        if (tokens < count) {
+            return false;
+        }
+        tokens -= count;
+        return true;
+    }
+
+    // Earliest time at which try_acquire(count) can succeed.
+    clock::time_point available_at(clock::time_point now = clock::now(), double count = 1) {
+        refill(now);
+        if (tokens >= count) {
+            return now;
+        }
+        if (config.rate <= 0) {
+            return clock::time_point::max();
+        }
+        std::chrono::duration<double> wait{(count - tokens) / config.rate};
+        return now + std::chrono::ceil<clock::duration>(wait);
+    }
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <optional>
+#include <expected>
+#include <system_error>
+#include <concepts>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "types.h"
+#include "packet.h"
+#include "ipv4.h"
+#include "stats.h"
+#include "checksum.h"
+#include "bounded_channel.h"
+
+namespace udp {
+    using Format = packet::Format<
+        {"source_port", 16},
+        {"destination_port", 16},
+        {"length", 16},
+        {"checksum", 16}
+    >;
+
+    template<typename Range>
+    using Packet = packet::Packet<Range, Format>;
+
+    // Prepended to the datagram for the checksum only (RFC 768).
+    using PseudoHeader = packet::Format<
+        {"source_address", 32},
+        {"destination_address", 32},
+        {"zero", 8},
+        {"protocol", 8, packet::field_type<ipv4::Protocol>},
+        {"length", 16}
+    >;
+
+    // Checksum of a datagram given as its header followed by its payload.
+    // The header's checksum field has to be 0 when computing one to send,
+    // a received datagram is intact when this returns 0.
+    inline uint16_t checksum(IPv4_t source, IPv4_t destination, std::span<const std::byte> header, std::span<const std::byte> payload) noexcept {
+        PseudoHeader::Header pseudo_header;
+        pseudo_header.set<"source_address">(source);
+        pseudo_header.set<"destination_address">(destination);
+        pseudo_header.set<"protocol">(ipv4::Protocol::UDP);
+        pseudo_header.set<"length">(static_cast<uint16_t>(header.size() + payload.size()));
+
+        std::array<std::byte, PseudoHeader::byte_size()> bytes{};
+        PseudoHeader::encode(bytes, pseudo_header);
+
+        return static_cast<uint16_t>(~checksum::fold(checksum::sum(payload, checksum::sum(header, checksum::sum(bytes)))));
+    }
+
+    struct Datagram {
+        IPv4_t source_address;
+        uint16_t source_port;
+        IPv4_t destination_address;
+
+        // Points into the IPv4 datagram below, which holds the frame or the
+        // reassembled bytes it was received in.
+        std::span<std::byte> payload;
+        ipv4::Datagram ip;
+    };
+
+    // A datagram to send with send_many().
+    struct Outgoing {
+        IPv4_t address;
+        uint16_t port;
+        std::span<const std::byte> payload;
+    };
+
+    template<typename InternetLayer>
+    class Socket;
+
+    // Delivers received datagrams to the socket bound to their destination
+    // port. Ports index a flat table of endpoints, the lock is only held to
+    // copy one out of it. Datagrams are queued after it is released, so
+    // receiving threads do not wait on each other's queues.
+    template<typename InternetLayer>
+    class Handler {
+        friend class Socket<InternetLayer>;
+
+        struct Endpoint {
+            BoundedChannel<Datagram> queue;
+
+            explicit Endpoint(BoundedChannel<Datagram>::Config config) : queue{config} {}
+        };
+
+        static constexpr uint16_t first_ephemeral = 49152;
+
+        // Sockets bind and unbind under mutex, the receive path only loads
+        // the slot of the destination port. The copy of an endpoint taken
+        // from the table keeps it alive while a datagram is pushed into it,
+        // even if its socket is closed meanwhile.
+        std::mutex mutex;
+        std::unique_ptr<std::atomic<std::shared_ptr<Endpoint>>[]> ports = std::make_unique<std::atomic<std::shared_ptr<Endpoint>>[]>(1 << 16);
+        uint16_t next_ephemeral = first_ephemeral;
+
+        InternetLayer& internet_layer() {
+            return static_cast<InternetLayer&>(*this);
+        }
+
+        void unbind(uint16_t port, const Endpoint* endpoint);
+        bool send(uint16_t source_port, IPv4_t address, uint16_t port, std::span<const std::byte> payload);
+    public:
+        Handler() requires(std::derived_from<InternetLayer, Handler>) = default;
+
+        // Binds a socket to port, or to a free ephemeral port when it is 0.
+        // Up to capacity received datagrams wait in its queue, the ones
+        // beyond are dropped. The socket must not outlive the stack.
+        std::expected<Socket<InternetLayer>, std::system_error> bind(uint16_t port = 0, std::size_t capacity = 1024);
+
+        void handle(ipv4::Datagram&& datagram);
+    };
+
+    template<typename InternetLayer>
+    class Socket {
+        friend class Handler<InternetLayer>;
+        using Endpoint = typename Handler<InternetLayer>::Endpoint;
+
+        Handler<InternetLayer>* handler;
+        std::shared_ptr<Endpoint> endpoint;
+        uint16_t port;
+
+        Socket(Handler<InternetLayer>& handler, std::shared_ptr<Endpoint> endpoint, uint16_t port)
+            : handler{&handler},
+              endpoint{std::move(endpoint)},
+              port{port}
+            {}
+    public:
+        Socket(Socket&&) noexcept = default;
+        Socket& operator=(Socket other) noexcept {
+            std::swap(handler, other.handler);
+            std::swap(endpoint, other.endpoint);
+            std::swap(port, other.port);
+            return *this;
+        }
+        ~Socket() {
+            close();
+        }
+
+        uint16_t local_port() const noexcept {
+            return port;
+        }
+
+        bool send_to(IPv4_t address, uint16_t port, std::span<const std::byte> payload) {
+            return handler->send(this->port, address, port, payload);
+        }
+
+        // Sends the datagrams in order, each through send_to() on its own,
+        // so this saves the caller a loop and nothing more. Returns how many
+        // were sent, stopping at the first that could not be.
+        std::size_t send_many(std::span<const Outgoing> datagrams) {
+            std::size_t count = 0;
+            while (count < datagrams.size() && send_to(datagrams[count].address, datagrams[count].port, datagrams[count].payload)) {
+                ++count;
+            }
+            return count;
+        }
+
+        // Waits for a datagram and appends it and up to max - 1 more queued
+        // ones to out, under one lock. Returns 0 once the socket is closed,
+        // max must be at least 1.
+        std::size_t recv_many(std::vector<Datagram>& out, std::size_t max) {
+            return endpoint->queue.pop_bulk(out, max);
+        }
+
+        std::optional<Datagram> recv() {
+            return endpoint->queue.pop();
+        }
+
+        uint64_t dropped() const {
+            return endpoint->queue.dropped();
+        }
+
+        // Unbinds the port and wakes up receivers. Safe to call from another
+        // thread than the one receiving.
+        void close() {
+            if (endpoint) {
+                handler->unbind(port, endpoint.get());
+                endpoint->queue.close();
+            }
+        }
+    };
+
+    template<typename InternetLayer>
+    auto Handler<InternetLayer>::bind(uint16_t port, std::size_t capacity) -> std::expected<Socket<InternetLayer>, std::system_error> {
+        auto endpoint = std::make_shared<Endpoint>(BoundedChannel<Datagram>::Config{
+            .capacity = capacity,
+            .overflow = BoundedChannel<Datagram>::Overflow::DropNewest
+        });
+
+        std::lock_guard lock(mutex);
+        if (port == 0) {
+            for (std::size_t i = 0; i < (1 << 16) - first_ephemeral && ports[next_ephemeral].load() != nullptr; ++i) {
+                next_ephemeral = next_ephemeral == 0xFFFF ? first_ephemeral : static_cast<uint16_t>(next_ephemeral + 1);
+            }
+            if (ports[next_ephemeral].load() != nullptr) {
+                return std::unexpected{std::system_error{std::make_error_code(std::errc::address_in_use), "No free ephemeral port"}};
+            }
+            port = next_ephemeral;
+        } else if (ports[port].load() != nullptr) {
+            return std::unexpected{std::system_error{std::make_error_code(std::errc::address_in_use), "Port in use"}};
+        }
+
+        ports[port].store(endpoint);
+        return Socket<InternetLayer>{*this, std::move(endpoint), port};
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::unbind(uint16_t port, const Endpoint* endpoint) {
+        std::lock_guard lock(mutex);
+        if (ports[port].load().get() == endpoint) {
+            ports[port].store(nullptr);
+        }
+    }
+
+    template<typename InternetLayer>
+    bool Handler<InternetLayer>::send(uint16_t source_port, IPv4_t address, uint16_t port, std::span<const std::byte> payload) {
+        if (payload.size() > ipv4::Handler<InternetLayer>::max_payload - Format::byte_size()) {
+            return false;
+        }
+
+        Format::Header header;
+        header.set<"source_port">(source_port);
+        header.set<"destination_port">(port);
+        header.set<"length">(static_cast<uint16_t>(Format::byte_size() + payload.size()));
+
+        Packet<std::array<std::byte, Format::byte_size()>> packet;
+        packet.encode(header);
+
+        // 0 means no checksum, its one's complement twin is sent instead.
+        auto sum = checksum(internet_layer().get_ip(), address, packet.bytes, payload);
+        packet.set<"checksum">(sum != 0 ? sum : 0xFFFF);
+
+        std::array<std::span<const std::byte>, 2> parts{packet.to_span(), payload};
+        if (!internet_layer().send(address, ipv4::Protocol::UDP, parts)) {
+            return false;
+        }
+        stats::add(stats::Counter::UdpSent);
+        stats::add(stats::Counter::UdpBytesSent, payload.size());
+        return true;
+    }
+
+    template<typename InternetLayer>
+    void Handler<InternetLayer>::handle(ipv4::Datagram&& datagram) {
+        stats::add(stats::Counter::UdpReceived);
+
+        auto bytes = datagram.payload();
+        if (bytes.size() < Format::byte_size()) {
+            stats::add(stats::Counter::UdpMalformed);
+            return;
+        }
+
+        const auto header = Packet<std::span<const std::byte>>{bytes}.decode();
+        const std::size_t length = header.get<"length">();
+        if (length < Format::byte_size() || length > bytes.size()) {
+            stats::add(stats::Counter::UdpMalformed);
+            return;
+        }
+
+        const auto message = bytes.first(length);
+        if (
+            !datagram.checksum_valid &&
+            header.get<"checksum">() != 0 &&
+            checksum(datagram.source_address, datagram.destination_address, message.first(Format::byte_size()), message.subspan(Format::byte_size())) != 0
+        ) {
+            stats::add(stats::Counter::UdpChecksumErrors);
+            return;
+        }
+
+        const auto source_address = datagram.source_address;
+        const auto destination_address = datagram.destination_address;
+        const auto payload = message.subspan(Format::byte_size());
+
+        auto endpoint = ports[header.get<"destination_port">()].load();
+        if (endpoint == nullptr) {
+            stats::add(stats::Counter::UdpNoSocket);
+            return;
+        }
+
+        // Moving the IPv4 datagram leaves the payload where it is.
+        if (!endpoint->queue.emplace(source_address, header.get<"source_port">(), destination_address, payload, std::move(datagram))) {
+            stats::add(stats::Counter::UdpQueueFull);
+        }
+    }
+}
@@ -0,0 +1,386 @@
+#include <utility>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "uring_tap.h"
+#include "ethernet.h"
+
+namespace {
+    int io_uring_setup(unsigned entries, io_uring_params* params) {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, std::size_t arg_size) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size));
+    }
+
+    int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned count) {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+    }
+
+    template<typename T>
+    T* offset(void* base, uint32_t offset) {
+        return reinterpret_cast<T*>(static_cast<std::byte*>(base) + offset);
+    }
+
+    std::system_error error(const char* what) {
+        return std::system_error{errno, std::system_category(), what};
+    }
+}
+
+class UringTap::Ring {
+    struct Mapping {
+        void* address = MAP_FAILED;
+        std::size_t size{};
+
+        Mapping() = default;
+        Mapping(int fd, std::size_t size, off_t offset)
+            : address{mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset)},
+              size{size}
+            {}
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(Mapping&& other) noexcept {
+            std::swap(address, other.address);
+            std::swap(size, other.size);
+            return *this;
+        }
+        ~Mapping() {
+            if (address != MAP_FAILED) {
+                munmap(address, size);
+            }
+        }
+    };
+
+    struct Completion {
+        uint32_t slot;
+        uint32_t length;
+    };
+
+    static constexpr std::size_t slot_size = ethernet::max_size;
+
+    int fd = -1;
+    Config config;
+
+    Mapping sq_mapping;
+    Mapping cq_mapping;
+    Mapping sqe_mapping;
+
+    uint32_t* sq_tail{};
+    uint32_t* sq_mask{};
+    uint32_t* sq_array{};
+    io_uring_sqe* sqes{};
+    uint32_t* cq_head{};
+    uint32_t* cq_tail{};
+    uint32_t* cq_mask{};
+    io_uring_cqe* cqes{};
+
+    std::vector<std::byte> buffers;
+
+    std::mutex mutex;
+    std::vector<uint32_t> free_tx;
+    std::vector<Completion> ready;
+    std::size_t ready_head{};
+    std::size_t ready_count{};
+    unsigned unsubmitted{};
+    bool failed = false;
+    std::thread::id reader;
+
+    std::byte* slot_buffer(uint32_t slot) {
+        return buffers.data() + slot * slot_size;
+    }
+
+    io_uring_sqe& next_sqe() {
+        auto index = *sq_tail & *sq_mask;
+        sq_array[index] = index;
+        auto& sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        return sqe;
+    }
+
+    void publish() {
+        std::atomic_ref{*sq_tail}.store(*sq_tail + 1, std::memory_order_release);
+        ++unsubmitted;
+    }
+
+    void prepare(uint8_t opcode, uint32_t slot, uint32_t length) {
+        auto& sqe = next_sqe();
+        sqe.opcode = opcode;
+        sqe.flags = IOSQE_FIXED_FILE;
+        sqe.fd = 0;
+        sqe.off = static_cast<uint64_t>(-1);
+        sqe.addr = reinterpret_cast<uint64_t>(slot_buffer(slot));
+        sqe.len = length;
+        sqe.buf_index = static_cast<uint16_t>(slot);
+        sqe.user_data = slot;
+        publish();
+    }
+
+    void prepare_read(uint32_t slot) {
+        prepare(IORING_OP_READ_FIXED, slot, slot_size);
+    }
+
+    void reap() {
+        auto head = *cq_head;
+        auto tail = std::atomic_ref{*cq_tail}.load(std::memory_order_acquire);
+
+        for (; head != tail; ++head) {
+            const auto& cqe = cqes[head & *cq_mask];
+            auto slot = static_cast<uint32_t>(cqe.user_data);
+
+            if (slot >= config.rx_depth) {
+                free_tx.push_back(slot);
+            } else if (cqe.res > 0) {
+                ready[(ready_head + ready_count) % ready.size()] = {slot, static_cast<uint32_t>(cqe.res)};
+                ++ready_count;
+            } else if (cqe.res == 0 || cqe.res == -EAGAIN || cqe.res == -EINTR) {
+                prepare_read(slot);
+            } else {
+                failed = true;
+            }
+        }
+
+        std::atomic_ref{*cq_head}.store(head, std::memory_order_release);
+    }
+
+    int submit(unsigned min_complete) {
+        auto to_submit = std::exchange(unsubmitted, 0);
+        auto flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0u;
+        auto result = io_uring_enter(fd, to_submit, min_complete, flags, nullptr, 0);
+        keep_unsubmitted(to_submit, result);
+        return result;
+    }
+
+    // Entries io_uring_enter did not consume are still in the queue, past
+    // sq_tail, and go with the next submission.
+    void keep_unsubmitted(unsigned to_submit, int result) {
+        unsubmitted += to_submit - std::min(static_cast<unsigned>(std::max(result, 0)), to_submit);
+    }
+
+    static bool is_transient(int error) {
+        return error == EINTR || error == ETIME || error == EAGAIN || error == EBUSY;
+    }
+public:
+    Ring(const Ring&) = delete;
+
+    Ring(Config config) : config{config} {}
+
+    ~Ring() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    std::expected<void, std::system_error> init(int tap_fd) {
+        if (config.rx_depth == 0 || config.tx_depth == 0) {
+            return std::unexpected{std::system_error{EINVAL, std::system_category(), "io_uring queue depth must be positive"}};
+        }
+
+        io_uring_params params{};
+        fd = io_uring_setup(std::bit_ceil(config.rx_depth + config.tx_depth), &params);
+        if (fd < 0) {
+            return std::unexpected{error("Could not set up io_uring")};
+        }
+        if ((params.features & IORING_FEAT_EXT_ARG) == 0) {
+            return std::unexpected{std::system_error{ENOSYS, std::system_category(), "io_uring does not support timeouts in io_uring_enter"}};
+        }
+
+        auto sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        auto cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+
+        sq_mapping = Mapping{fd, sq_size, IORING_OFF_SQ_RING};
+        if (!single_mmap) {
+            cq_mapping = Mapping{fd, cq_size, IORING_OFF_CQ_RING};
+        }
+        sqe_mapping = Mapping{fd, params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES};
+
+        auto cq_address = single_mmap ? sq_mapping.address : cq_mapping.address;
+        if (sq_mapping.address == MAP_FAILED || cq_address == MAP_FAILED || sqe_mapping.address == MAP_FAILED) {
+            return std::unexpected{error("Could not map io_uring rings")};
+        }
+
+        sq_tail = offset<uint32_t>(sq_mapping.address, params.sq_off.tail);
+        sq_mask = offset<uint32_t>(sq_mapping.address, params.sq_off.ring_mask);
+        sq_array = offset<uint32_t>(sq_mapping.address, params.sq_off.array);
+        sqes = static_cast<io_uring_sqe*>(sqe_mapping.address);
+        cq_head = offset<uint32_t>(cq_address, params.cq_off.head);
+        cq_tail = offset<uint32_t>(cq_address, params.cq_off.tail);
+        cq_mask = offset<uint32_t>(cq_address, params.cq_off.ring_mask);
+        cqes = offset<io_uring_cqe>(cq_address, params.cq_off.cqes);
+
+        if (io_uring_register(fd, IORING_REGISTER_FILES, &tap_fd, 1) < 0) {
+            return std::unexpected{error("Could not register TAP file with io_uring")};
+        }
+
+        const auto slots = config.rx_depth + config.tx_depth;
+        buffers.resize(slots * slot_size);
+
+        std::vector<iovec> iovecs;
+        for (uint32_t slot = 0; slot < slots; ++slot) {
+            iovecs.push_back({slot_buffer(slot), slot_size});
+        }
+        if (io_uring_register(fd, IORING_REGISTER_BUFFERS, iovecs.data(), slots) < 0) {
+            return std::unexpected{error("Could not register io_uring buffers")};
+        }
+
+        ready.resize(config.rx_depth);
+        for (uint32_t slot = config.rx_depth; slot < slots; ++slot) {
+            free_tx.push_back(slot);
+        }
+        for (uint32_t slot = 0; slot < config.rx_depth; ++slot) {
+            prepare_read(slot);
+        }
+        if (submit(0) < 0) {
+            return std::unexpected{error("Could not submit io_uring reads")};
+        }
+
+        return {};
+    }
+
+    device::ssize_t write(std::span<const std::byte> frame) {
+        if (frame.size() > slot_size) {
+            return -1;
+        }
+
+        std::lock_guard lock(mutex);
+
+        while (free_tx.empty()) {
+            reap();
+            if (!free_tx.empty()) {
+                break;
+            }
+            if (submit(1) < 0 && !is_transient(errno)) {
+                return -1;
+            }
+        }
+
+        auto slot = free_tx.back();
+        free_tx.pop_back();
+
+        std::ranges::copy(frame, slot_buffer(slot));
+        prepare(IORING_OP_WRITE_FIXED, slot, static_cast<uint32_t>(frame.size()));
+
+        if (std::this_thread::get_id() != reader || unsubmitted >= config.tx_batch) {
+            submit(0);
+        }
+
+        return static_cast<device::ssize_t>(frame.size());
+    }
+
+    device::ssize_t try_read(std::span<std::byte> buffer, const __kernel_timespec* timeout) {
+        std::unique_lock lock(mutex);
+        reader = std::this_thread::get_id();
+
+        reap();
+        if (ready_count == 0 && !failed) {
+            io_uring_getevents_arg arg{};
+            arg.ts = reinterpret_cast<uint64_t>(timeout);
+
+            auto to_submit = std::exchange(unsubmitted, 0);
+            lock.unlock();
+            auto result = io_uring_enter(
+                fd, to_submit, 1,
+                IORING_ENTER_GETEVENTS | (timeout != nullptr ? IORING_ENTER_EXT_ARG : 0u),
+                timeout != nullptr ? &arg : nullptr, timeout != nullptr ? sizeof(arg) : 0
+            );
+            auto enter_error = errno;
+            lock.lock();
+            keep_unsubmitted(to_submit, result);
+
+            if (result < 0 && !is_transient(enter_error)) {
+                failed = true;
+            }
+            reap();
+        }
+
+        if (ready_count == 0) {
+            return failed ? -1 : 0;
+        }
+
+        auto [slot, length] = ready[ready_head];
+        ready_head = (ready_head + 1) % ready.size();
+        --ready_count;
+
+        auto size = std::min<std::size_t>(length, buffer.size());
+        std::ranges::copy_n(slot_buffer(slot), static_cast<std::ptrdiff_t>(size), buffer.begin());
+        prepare_read(slot);
+
+        if (unsubmitted >= config.tx_batch) {
+            submit(0);
+        }
+
+        return static_cast<device::ssize_t>(size);
+    }
+
+    void flush() {
+        std::lock_guard lock(mutex);
+        if (unsubmitted > 0) {
+            submit(0);
+        }
+    }
+};
+
+UringTap::UringTap(Tap tap, std::unique_ptr<Ring> ring)
+    : tap{std::move(tap)},
+      ring{std::move(ring)}
+    {}
+
+std::expected<UringTap, std::system_error> UringTap::try_new(Tap tap, Config config) noexcept {
+    // Frames are passed on as read, there is no room for a virtio-net header.
+    if (tap.has_vnet_header()) {
+        return std::unexpected{std::system_error{EINVAL, std::system_category(), "TAP device has a virtio-net header"}};
+    }
+    try {
+        auto ring = std::make_unique<Ring>(config);
+        if (auto result = ring->init(tap.native_handle()); !result) {
+            return std::unexpected{result.error()};
+        }
+        return UringTap{std::move(tap), std::move(ring)};
+    } catch (const std::bad_alloc&) {
+        return std::unexpected{std::system_error{ENOMEM, std::system_category(), "Could not allocate io_uring buffers"}};
+    }
+}
+
+UringTap::UringTap(UringTap&&) noexcept = default;
+UringTap& UringTap::operator=(UringTap&&) noexcept = default;
+UringTap::~UringTap() noexcept = default;
+
+device::ssize_t UringTap::write(std::span<const std::byte> frame) noexcept {
+    return ring->write(frame);
+}
+
+device::ssize_t UringTap::read(std::span<std::byte> buffer) noexcept {
+    device::ssize_t result;
+    do {
+        result = ring->try_read(buffer, nullptr);
+    } while (result == 0);
+    return result;
+}
+
+device::ssize_t UringTap::try_read(std::span<std::byte> buffer, device::Timeout timeout) noexcept {
+    __kernel_timespec timespec{
+        timeout.count() / 1000,
+        (timeout.count() % 1000) * 1'000'000ll
+    };
+    return ring->try_read(buffer, &timespec);
+}
+
+void UringTap::flush() noexcept {
+    ring->flush();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <expected>
+#include <system_error>
+#include <cstddef>
+#include <span>
+#include <memory>
+#include <string>
+
+#include "device.h"
+#include "tap.h"
+
+// TAP device driven through io_uring. Frames are read into registered
+// buffers with up to rx_depth reads in flight, so a burst of frames costs a
+// single io_uring_enter. Frames written from the thread calling try_read are
+// queued and submitted together with the next wait (or once tx_batch writes
+// are pending); writes from other threads are submitted immediately.
+class UringTap {
+public:
+    struct Config {
+        unsigned rx_depth = 64;
+        unsigned tx_depth = 64;
+        unsigned tx_batch = 16;
+    };
+
+private:
+    class Ring;
+
+    Tap tap;
+    std::unique_ptr<Ring> ring;
+
+    UringTap(Tap tap, std::unique_ptr<Ring> ring);
+public:
+    static std::expected<UringTap, std::system_error> try_new(Tap tap, Config config) noexcept;
+    static std::expected<UringTap, std::system_error> try_new(Tap tap) noexcept {
+        return try_new(std::move(tap), Config{});
+    }
+
+    UringTap(UringTap&&) noexcept;
+    UringTap& operator=(UringTap&&) noexcept;
+    ~UringTap() noexcept;
+
+    device::ssize_t write(std::span<const std::byte>) noexcept;
+    device::ssize_t read(std::span<std::byte>) noexcept;
+    device::ssize_t try_read(std::span<std::byte>, device::Timeout timeout) noexcept;
+
+    // Submits queued writes without waiting for their completion.
+    void flush() noexcept;
+
+    const std::string& get_name() const noexcept {
+        return tap.get_name();
+    }
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <bit>
+#include <concepts>
+#include <type_traits>
+
+#include "packet.h"
+
+// The header in front of every frame of a TAP device opened with
+// IFF_VNET_HDR (struct virtio_net_hdr in linux/virtio_net.h). It carries
+// the checksum and segmentation offloads of the frame.
+namespace virtio_net {
+    enum Flags : uint8_t {
+        // The checksum at checksum_start + checksum_offset is to be completed
+        // over the bytes from checksum_start on. It holds the sum of the
+        // pseudo header meanwhile.
+        NeedsChecksum = 1,
+        // The kernel checked the checksums of the frame.
+        DataValid = 2
+    };
+
+    enum class GsoType : uint8_t {
+        None = 0,
+        TCPv4 = 1,
+        UDP = 3,
+        TCPv6 = 4
+    };
+
+    // Offloads set with TUNSETOFFLOAD (TUN_F_*), the kernel only hands us
+    // frames that need the ones we accept.
+    enum Offload : unsigned {
+        Checksum = 0x01,
+        TSO4 = 0x02,
+        TSO6 = 0x04,
+        TSOEcn = 0x08
+    };
+
+    // Lengths and offsets are counted from the start of the ethernet frame.
+    using Format = packet::Format<
+        {"flags", 8},
+        {"gso_type", 8, packet::field_type<GsoType>},
+        {"header_length", 16},
+        {"gso_size", 16},
+        {"checksum_start", 16},
+        {"checksum_offset", 16}
+    >;
+
+    // The 16 bit fields are little endian (TUNSETVNETLE) rather than in
+    // network order, get, set, decode and encode convert them.
+    template<typename Range>
+    struct Packet : packet::Packet<Range, Format> {
+        using Base = packet::Packet<Range, Format>;
+        using Base::Base;
+
+        template<utils::StringLiteral name>
+        Format::template field_type<name> get() const {
+            return swap(Base::template get<name>());
+        }
+
+        template<utils::StringLiteral name>
+            requires (!std::is_const_v<typename Base::ValueType>)
+        void set(Format::template field_type<name> value) {
+            Base::template set<name>(swap(value));
+        }
+
+        Format::Header decode() const {
+            auto header = Base::decode();
+            swap_words(header);
+            return header;
+        }
+
+        void encode(Format::Header header)
+            requires (!std::is_const_v<typename Base::ValueType>)
+        {
+            swap_words(header);
+            Base::encode(header);
+        }
+
+    private:
+        template<typename T>
+        static constexpr T swap(T value) noexcept {
+            if constexpr (std::same_as<T, uint16_t>) {
+                return std::byteswap(value);
+            } else {
+                return value;
+            }
+        }
+
+        static void swap_words(Format::Header& header) noexcept {
+            header.set<"header_length">(swap(header.get<"header_length">()));
+            header.set<"gso_size">(swap(header.get<"gso_size">()));
+            header.set<"checksum_start">(swap(header.get<"checksum_start">()));
+            header.set<"checksum_offset">(swap(header.get<"checksum_offset">()));
+        }
+    };
+
+    template<typename Range>
+    Packet(Range r) -> Packet<Range>;
+
+    // Whether the checksums of a received frame need not be verified.
+    inline bool checksum_valid(const Format::Header& header) noexcept {
+        return (header.get<"flags">() & (NeedsChecksum | DataValid)) != 0;
+    }
+}
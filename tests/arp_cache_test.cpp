@@ -0,0 +1,172 @@
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+#include "gtest/gtest.h"
+
+#include "arp_cache.h"
+
+using namespace std::chrono_literals;
+using clock_type = arp::Cache::clock;
+
+TEST(ArpCache, InsertLookup) {
+    arp::Cache cache;
+    auto now = clock_type::now();
+
+    EXPECT_FALSE(cache.lookup("10.0.0.1"_ipv4, now).has_value());
+    EXPECT_FALSE(cache.update("10.0.0.1"_ipv4, 0x01, now));
+
+    EXPECT_TRUE(cache.insert("10.0.0.1"_ipv4, 0x01, now));
+    EXPECT_TRUE(cache.insert("10.0.0.2"_ipv4, 0x02, now));
+    EXPECT_EQ(cache.size(), 2u);
+
+    auto neighbor = cache.lookup("10.0.0.1"_ipv4, now);
+    ASSERT_TRUE(neighbor.has_value());
+    EXPECT_EQ(neighbor->mac_address, 0x01u);
+    EXPECT_EQ(neighbor->state, arp::State::Reachable);
+
+    EXPECT_TRUE(cache.update("10.0.0.1"_ipv4, 0x11, now));
+    EXPECT_EQ(cache.lookup("10.0.0.1"_ipv4, now)->mac_address, 0x11u);
+    EXPECT_EQ(cache.size(), 2u);
+}
+
+TEST(ArpCache, Aging) {
+    arp::Cache cache{{.capacity = 16, .reachable_time = 10s, .stale_time = 20s}};
+    auto now = clock_type::now();
+
+    cache.insert("10.0.0.1"_ipv4, 0x01, now);
+
+    EXPECT_EQ(cache.lookup("10.0.0.1"_ipv4, now + 9s)->state, arp::State::Reachable);
+    EXPECT_EQ(cache.lookup("10.0.0.1"_ipv4, now + 11s)->state, arp::State::Stale);
+    EXPECT_EQ(cache.lookup("10.0.0.1"_ipv4, now + 31s)->state, arp::State::Expired);
+
+    cache.update("10.0.0.1"_ipv4, 0x01, now + 31s);
+    EXPECT_EQ(cache.lookup("10.0.0.1"_ipv4, now + 31s)->state, arp::State::Reachable);
+
+    EXPECT_EQ(cache.expire(now + 60s), 0u);
+    EXPECT_EQ(cache.expire(now + 62s), 1u);
+    EXPECT_FALSE(cache.lookup("10.0.0.1"_ipv4, now + 62s).has_value());
+    EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST(ArpCache, Refresh) {
+    arp::Cache cache{{.capacity = 16, .reachable_time = 10s, .stale_time = 20s}};
+    auto now = clock_type::now();
+
+    cache.insert("10.0.0.1"_ipv4, 0x01, now);
+    cache.insert("10.0.0.2"_ipv4, 0x02, now);
+    EXPECT_TRUE(cache.reference("10.0.0.1"_ipv4, now).has_value());
+    EXPECT_FALSE(cache.reference("10.0.0.3"_ipv4, now).has_value());
+
+    EXPECT_TRUE(cache.refresh(now + 7s, 2s).empty());
+
+    // Only the referenced entry, and only once per reference.
+    auto due = cache.refresh(now + 8s, 2s);
+    ASSERT_EQ(due.size(), 1u);
+    EXPECT_EQ(due[0].ip_address, "10.0.0.1"_ipv4);
+    EXPECT_EQ(due[0].mac_address, 0x01u);
+    EXPECT_TRUE(cache.refresh(now + 8s, 2s).empty());
+
+    // The next probe is one lead later.
+    cache.reference("10.0.0.1"_ipv4, now + 8s);
+    EXPECT_TRUE(cache.refresh(now + 9s, 2s).empty());
+    EXPECT_EQ(cache.refresh(now + 10s, 2s).size(), 1u);
+
+    // An update starts over.
+    cache.reference("10.0.0.1"_ipv4, now + 10s);
+    cache.update("10.0.0.1"_ipv4, 0x01, now + 10s);
+    EXPECT_TRUE(cache.refresh(now + 17s, 2s).empty());
+    EXPECT_EQ(cache.refresh(now + 18s, 2s).size(), 1u);
+
+    // Expired entries are left alone.
+    cache.reference("10.0.0.2"_ipv4, now);
+    EXPECT_TRUE(cache.refresh(now + 30s, 2s).empty());
+}
+
+TEST(ArpCache, Full) {
+    arp::Cache cache{{.capacity = 4, .reachable_time = 10s, .stale_time = 10s}};
+    auto now = clock_type::now();
+
+    for (IPv4_t i = 1; i <= 4; ++i) {
+        EXPECT_TRUE(cache.insert(i, i, now));
+    }
+    EXPECT_FALSE(cache.insert(5, 5, now + 1s));
+    EXPECT_TRUE(cache.insert(4, 44, now + 1s));
+
+    // Expired entries make room.
+    EXPECT_TRUE(cache.insert(5, 5, now + 20500ms));
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_EQ(cache.lookup(4, now + 20500ms)->mac_address, 44u);
+    EXPECT_FALSE(cache.lookup(1, now + 20500ms).has_value());
+}
+
+TEST(ArpCache, EraseKeepsProbeChains) {
+    arp::Cache cache{{.capacity = 64}};
+    auto now = clock_type::now();
+
+    for (IPv4_t i = 1; i <= 64; ++i) {
+        EXPECT_TRUE(cache.insert(i, i, now));
+    }
+    for (IPv4_t i = 1; i <= 64; i += 2) {
+        EXPECT_TRUE(cache.erase(i));
+    }
+    EXPECT_FALSE(cache.erase(1));
+
+    for (IPv4_t i = 1; i <= 64; ++i) {
+        EXPECT_EQ(cache.lookup(i, now).has_value(), i % 2 == 0) << i;
+    }
+    for (IPv4_t i = 1000; i < 1032; ++i) {
+        EXPECT_TRUE(cache.insert(i, i, now));
+    }
+    EXPECT_EQ(cache.size(), 64u);
+    for (IPv4_t i = 1000; i < 1032; ++i) {
+        EXPECT_EQ(cache.lookup(i, now)->mac_address, i);
+    }
+}
+
+TEST(ArpCache, ConcurrentReaders) {
+    arp::Cache cache{{.capacity = 320}};
+    std::atomic<bool> done{};
+
+    // Never erased, lookups must find them while erasing moves them around.
+    for (IPv4_t ip = 1001; ip <= 1064; ++ip) {
+        cache.insert(ip, ip);
+    }
+
+    // The MAC is always derived from the IP, a torn read would break that.
+    auto mac_of = [](IPv4_t ip, uint64_t version) {
+        return (version << 32) | ip;
+    };
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]{
+            while (!done.load(std::memory_order_relaxed)) {
+                for (IPv4_t ip = 1; ip <= 256; ++ip) {
+                    if (auto neighbor = cache.lookup(ip)) {
+                        EXPECT_EQ(neighbor->mac_address & 0xFFFF'FFFF, ip);
+                    }
+                }
+                for (IPv4_t ip = 1001; ip <= 1064; ++ip) {
+                    EXPECT_TRUE(cache.lookup(ip).has_value()) << ip;
+                }
+            }
+        });
+    }
+
+    for (uint64_t version = 0; version < 200; ++version) {
+        for (IPv4_t ip = 1; ip <= 256; ++ip) {
+            if ((ip + version) % 3 == 0) {
+                cache.erase(ip);
+            } else {
+                cache.insert(ip, mac_of(ip, version));
+            }
+        }
+    }
+
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+}
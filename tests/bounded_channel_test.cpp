@@ -0,0 +1,174 @@
+#include <thread>
+#include <utility>
+#include <vector>
+#include <latch>
+#include <algorithm>
+#include <set>
+#include <chrono>
+
+#include "gtest/gtest.h"
+
+#include "bounded_channel.h"
+
+using namespace std::chrono_literals;
+
+struct Value {
+    int thread_id;
+    int value;
+
+    auto operator<=>(const Value&) const = default;
+};
+
+struct BoundedChannelTest : public testing::TestWithParam<std::pair<int, int>> {
+    BoundedChannel<Value> channel{{.capacity = 16}};
+    int writing_threads;
+    int reading_threads;
+
+    BoundedChannelTest() {
+        std::tie(writing_threads, reading_threads) = GetParam();
+    }
+};
+
+TEST_P(BoundedChannelTest, Block) {
+    int values_per_thread = 1000;
+
+    std::vector<std::thread> writing;
+    std::vector<std::thread> reading;
+
+    std::vector<std::vector<Value>> read_values(reading_threads);
+    std::vector<Value> expected;
+
+    std::latch latch(writing_threads + reading_threads);
+
+    for (int id = 0; id < writing_threads; ++id) {
+        writing.push_back(std::thread{[&, id]{
+            latch.arrive_and_wait();
+
+            for (int i = 0; i < values_per_thread; i += 10) {
+                channel.push({id, i});
+                channel.emplace(id, i + 1);
+
+                std::vector<Value> batch;
+                for (int j = 2; j < 10; ++j) {
+                    batch.push_back({id, i + j});
+                }
+                channel.push_bulk(batch);
+            }
+        }});
+
+        for (int i = 0; i < values_per_thread; ++i) {
+            expected.push_back({id, i});
+        }
+    }
+
+    for (int id = 0; id < reading_threads; ++id) {
+        reading.push_back(std::thread{[&, id]{
+            latch.arrive_and_wait();
+
+            if (id % 2 == 0) {
+                for (auto v : channel) {
+                    read_values[id].push_back(v);
+                }
+            } else {
+                while (channel.pop_bulk(read_values[id], 7) != 0) {}
+            }
+        }});
+    }
+
+    for (auto& t : writing) t.join();
+    channel.close();
+    for (auto& t : reading) t.join();
+
+    std::set<Value> set;
+
+    for (auto& values : read_values) {
+        std::ranges::stable_sort(values, {}, &Value::thread_id);
+        EXPECT_TRUE(std::ranges::is_sorted(values));
+        set.insert(values.begin(), values.end());
+    }
+
+    std::ranges::sort(expected);
+    EXPECT_TRUE(std::ranges::equal(set, expected));
+    EXPECT_EQ(channel.dropped(), 0u);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    BoundedChannel,
+    BoundedChannelTest,
+    testing::Values(std::pair{1, 1}, std::pair{1, 4}, std::pair{4, 1}, std::pair{4, 4})
+);
+
+TEST(BoundedChannel, DropNewest) {
+    BoundedChannel<int> channel{{.capacity = 4, .overflow = BoundedChannel<int>::Overflow::DropNewest}};
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(channel.push(i));
+    }
+    EXPECT_FALSE(channel.push(4));
+    EXPECT_EQ(channel.push_bulk(std::vector{5, 6}), 0u);
+    EXPECT_EQ(channel.dropped(), 3u);
+
+    std::vector<int> values;
+    EXPECT_EQ(channel.pop_bulk(values, 10), 4u);
+    EXPECT_EQ(values, (std::vector{0, 1, 2, 3}));
+
+    // 0 would read as closed.
+    channel.close();
+    EXPECT_DEBUG_DEATH(channel.pop_bulk(values, 0), "max != 0");
+}
+
+TEST(BoundedChannel, DropOldest) {
+    BoundedChannel<int> channel{{.capacity = 4, .overflow = BoundedChannel<int>::Overflow::DropOldest}};
+
+    EXPECT_EQ(channel.push_bulk(std::vector{0, 1, 2, 3, 4, 5}), 6u);
+    EXPECT_TRUE(channel.push(6));
+    EXPECT_EQ(channel.dropped(), 3u);
+
+    std::vector<int> values;
+    EXPECT_EQ(channel.pop_bulk(values, 3), 3u);
+    EXPECT_EQ(channel.pop_bulk(values, 3), 1u);
+    EXPECT_EQ(values, (std::vector{3, 4, 5, 6}));
+}
+
+TEST(BoundedChannel, BlockedProducer) {
+    BoundedChannel<int> channel{{.capacity = 2}};
+
+    std::thread producer{[&]{
+        EXPECT_EQ(channel.push_bulk(std::vector{0, 1, 2, 3, 4}), 5u);
+    }};
+
+    std::this_thread::sleep_for(20ms);
+    std::vector<int> values;
+    while (values.size() < 5) {
+        channel.pop_bulk(values, 2);
+    }
+    EXPECT_EQ(values, (std::vector{0, 1, 2, 3, 4}));
+    producer.join();
+}
+
+TEST(BoundedChannel, CloseWakesProducer) {
+    BoundedChannel<int> channel{{.capacity = 1}};
+    channel.push(0);
+
+    std::thread producer{[&]{
+        EXPECT_FALSE(channel.push(1));
+    }};
+
+    std::this_thread::sleep_for(20ms);
+    channel.close();
+    producer.join();
+    EXPECT_EQ(channel.pop(), 0);
+}
+
+TEST(BoundedChannel, Close) {
+    BoundedChannel<int> channel;
+    channel.push(1);
+    channel.close();
+
+    EXPECT_FALSE(channel.push(2));
+    EXPECT_EQ(channel.pop(), 1);
+    EXPECT_FALSE(channel.pop().has_value());
+
+    std::vector<int> values;
+    EXPECT_EQ(channel.pop_bulk(values, 8), 0u);
+}
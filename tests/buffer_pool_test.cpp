@@ -0,0 +1,103 @@
+#include <vector>
+#include <thread>
+#include <latch>
+#include <algorithm>
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+#include "buffer_pool.h"
+
+TEST(BufferPool, AllocateAndRelease) {
+    buffer::Pool pool{{.buffer_count = 16, .buffer_size = 100, .cache_size = 4}};
+
+    std::vector<buffer::Buffer> buffers;
+    for (int i = 0; i < 16; ++i) {
+        auto buffer = pool.allocate();
+        ASSERT_TRUE(buffer);
+        EXPECT_EQ(buffer.capacity(), 100u);
+        EXPECT_EQ(buffer.data().size(), 0u);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(buffer.bytes().data()) % buffer::cache_line_size, 0u);
+        buffers.push_back(std::move(buffer));
+    }
+    EXPECT_FALSE(pool.allocate());
+
+    for (std::size_t i = 0; i < buffers.size(); ++i) {
+        for (std::size_t j = i + 1; j < buffers.size(); ++j) {
+            EXPECT_NE(buffers[i].bytes().data(), buffers[j].bytes().data());
+        }
+    }
+
+    buffers.pop_back();
+    EXPECT_TRUE(pool.allocate());
+
+    buffers.clear();
+    for (int i = 0; i < 16; ++i) {
+        buffers.push_back(pool.allocate());
+        EXPECT_TRUE(buffers.back());
+    }
+    EXPECT_FALSE(pool.allocate());
+}
+
+TEST(BufferPool, ReferenceCounting) {
+    buffer::Pool pool{{.buffer_count = 1, .buffer_size = 64}};
+
+    auto buffer = pool.allocate();
+    ASSERT_TRUE(buffer);
+    EXPECT_EQ(buffer.use_count(), 1u);
+
+    buffer.resize(3);
+    std::ranges::fill(buffer.data(), std::byte{7});
+    EXPECT_EQ(buffer.data().size(), 3u);
+
+    buffer.resize(10);
+    buffer.trim_front(4);
+    EXPECT_EQ(buffer.data().data(), buffer.bytes().data() + 4);
+    EXPECT_EQ(buffer.data().size(), 6u);
+    buffer.resize(3);
+    EXPECT_EQ(buffer.data().data(), buffer.bytes().data());
+
+    {
+        auto copy = buffer;
+        EXPECT_EQ(buffer.use_count(), 2u);
+        EXPECT_EQ(copy.data().data(), buffer.data().data());
+
+        auto moved = std::move(copy);
+        EXPECT_FALSE(copy);
+        EXPECT_EQ(buffer.use_count(), 2u);
+    }
+    EXPECT_EQ(buffer.use_count(), 1u);
+    EXPECT_FALSE(pool.allocate());
+
+    buffer = {};
+    EXPECT_FALSE(buffer);
+    EXPECT_TRUE(pool.allocate());
+}
+
+TEST(BufferPool, CrossThreadRelease) {
+    constexpr int count = 256;
+    buffer::Pool pool{{.buffer_count = count, .buffer_size = 64, .cache_size = 16}};
+
+    for (int round = 0; round < 4; ++round) {
+        std::vector<buffer::Buffer> buffers;
+        for (int i = 0; i < count; ++i) {
+            buffers.push_back(pool.allocate());
+            ASSERT_TRUE(buffers.back());
+        }
+        EXPECT_FALSE(pool.allocate());
+
+        std::latch latch(4);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t]{
+                latch.arrive_and_wait();
+                for (int i = t; i < count; i += 4) {
+                    auto released = std::move(buffers[static_cast<std::size_t>(i)]);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#include <array>
+#include <vector>
+#include <random>
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+#include "checksum.h"
+
+static uint16_t reference(std::span<const std::byte> bytes) {
+    uint32_t sum{};
+    for (std::size_t i = 0; i < bytes.size(); i += 2) {
+        auto high = std::to_integer<uint32_t>(bytes[i]) << 8;
+        auto low = i + 1 < bytes.size() ? std::to_integer<uint32_t>(bytes[i + 1]) : 0;
+        sum += high | low;
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+}
+
+TEST(Checksum, IPv4Header) {
+    std::array<unsigned char, 20> header{0x45, 0x00, 0x00, 0x73, 0x00, 0x00, 0x40, 0x00, 0x40, 0x11, 0x00, 0x00, 0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0xc7};
+    auto bytes = std::as_writable_bytes(std::span{header});
+
+    EXPECT_EQ(checksum::compute(bytes), 0xb861);
+
+    header[10] = 0xb8;
+    header[11] = 0x61;
+    EXPECT_EQ(checksum::compute(bytes), 0);
+}
+
+TEST(Checksum, KernelsMatchReference) {
+    std::mt19937 generator{42};
+    std::uniform_int_distribution<int> byte{0, 255};
+
+    std::vector<std::byte> data(4096 + 64);
+    for (auto& b : data) {
+        b = static_cast<std::byte>(byte(generator));
+    }
+
+    for (auto kernel : {checksum::Kernel::Generic, checksum::Kernel::SSE2, checksum::Kernel::AVX2}) {
+        if (!checksum::is_supported(kernel)) {
+            continue;
+        }
+
+        for (std::size_t offset : {0, 1, 3, 8, 31}) {
+            for (std::size_t size = 0; size < 300; ++size) {
+                auto bytes = std::span{data}.subspan(offset, size);
+                EXPECT_EQ(
+                    static_cast<uint16_t>(~checksum::fold(checksum::sum(bytes, 0, kernel))),
+                    reference(bytes)
+                ) << "kernel " << static_cast<int>(kernel) << " offset " << offset << " size " << size;
+            }
+        }
+
+        auto bytes = std::span{data}.subspan(1, 4096);
+        EXPECT_EQ(static_cast<uint16_t>(~checksum::fold(checksum::sum(bytes, 0, kernel))), reference(bytes));
+    }
+}
+
+TEST(Checksum, AllOnes) {
+    std::vector<std::byte> data(100'000, std::byte{0xFF});
+    EXPECT_EQ(checksum::compute(data), reference(data));
+
+    for (auto kernel : {checksum::Kernel::Generic, checksum::Kernel::SSE2, checksum::Kernel::AVX2}) {
+        if (checksum::is_supported(kernel)) {
+            EXPECT_EQ(static_cast<uint16_t>(~checksum::fold(checksum::sum(data, 0, kernel))), reference(data));
+        }
+    }
+}
+
+TEST(Checksum, Chained) {
+    std::vector<std::byte> data(1000);
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<std::byte>(i * 7);
+    }
+
+    auto first = std::span{data}.first(128);
+    auto second = std::span{data}.subspan(128);
+
+    auto sum = checksum::sum(second, checksum::sum(first));
+    EXPECT_EQ(static_cast<uint16_t>(~checksum::fold(sum)), reference(data));
+}
+
+TEST(Checksum, Update) {
+    std::mt19937 generator{7};
+    std::uniform_int_distribution<int> byte{0, 255};
+
+    std::vector<std::byte> data(64);
+    for (auto& b : data) {
+        b = static_cast<std::byte>(byte(generator));
+    }
+
+    auto word = [&](std::size_t offset) {
+        return static_cast<uint16_t>(std::to_integer<unsigned>(data[offset]) << 8 | std::to_integer<unsigned>(data[offset + 1]));
+    };
+
+    for (int i = 0; i < 1000; ++i) {
+        auto offset = static_cast<std::size_t>(byte(generator) % 32) * 2;
+        auto checksum = checksum::compute(data);
+        auto old_word = word(offset);
+
+        data[offset] = static_cast<std::byte>(byte(generator));
+        data[offset + 1] = i % 10 == 0 ? data[offset] : static_cast<std::byte>(byte(generator));
+        EXPECT_EQ(checksum::update(checksum, old_word, word(offset)), checksum::compute(data));
+    }
+}
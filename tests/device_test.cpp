@@ -0,0 +1,397 @@
+#include <array>
+#include <ranges>
+#include <algorithm>
+#include <filesystem>
+#include <chrono>
+#include <thread>
+#include <optional>
+#include <vector>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+
+#include "gtest/gtest.h"
+
+#include "device.h"
+#include "memory_device.h"
+#include "pcap_device.h"
+#include "tap.h"
+#include "uring_tap.h"
+#include "packet_socket.h"
+#include "virtio_net.h"
+
+static_assert(device::Device<Tap>);
+static_assert(device::Device<MemoryDevice>);
+static_assert(device::Device<PcapDevice>);
+static_assert(device::Device<UringTap>);
+static_assert(device::BurstDevice<PacketSocket>);
+static_assert(device::GatherDevice<Tap>);
+static_assert(device::GatherDevice<MemoryDevice>);
+static_assert(device::GatherDevice<PcapDevice>);
+static_assert(device::GatherDevice<MultiQueueTap>);
+static_assert(device::MultiQueueDevice<MultiQueueTap>);
+static_assert(device::VnetDevice<Tap>);
+static_assert(device::VnetDevice<MultiQueueTap>);
+
+using namespace std::chrono_literals;
+
+template<std::size_t N>
+std::array<std::byte, N> make_frame(int first) {
+    std::array<std::byte, N> frame;
+    std::ranges::copy(
+        std::views::iota(first, first + static_cast<int>(N)) | std::views::transform([](auto v){return static_cast<std::byte>(v);}),
+        frame.begin()
+    );
+    return frame;
+}
+
+TEST(MemoryDevice, InjectAndRead) {
+    MemoryDevice device{4};
+    std::array<std::byte, ethernet::max_size> buffer;
+
+    EXPECT_EQ(device.try_read(buffer, 1ms), 0);
+
+    auto frame1 = make_frame<60>(0);
+    auto frame2 = make_frame<100>(7);
+    EXPECT_TRUE(device.inject(frame1));
+    EXPECT_TRUE(device.inject(frame2));
+
+    ASSERT_EQ(device.try_read(buffer, 1ms), 60);
+    EXPECT_TRUE(std::ranges::equal(std::span{buffer}.first(60), frame1));
+    ASSERT_EQ(device.read(buffer), 100);
+    EXPECT_TRUE(std::ranges::equal(std::span{buffer}.first(100), frame2));
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(device.inject(frame1));
+    }
+    EXPECT_FALSE(device.inject(frame1));
+
+    device.close();
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(device.try_read(buffer, 1ms), 60);
+    }
+    EXPECT_LT(device.try_read(buffer, 1ms), 0);
+    EXPECT_LT(device.read(buffer), 0);
+}
+
+TEST(MemoryDevice, WriteAndTake) {
+    MemoryDevice device{2};
+    std::array<std::byte, ethernet::max_size> buffer;
+
+    auto frame = make_frame<64>(3);
+    EXPECT_EQ(device.write(frame), 64);
+    EXPECT_EQ(device.write(frame), 64);
+    EXPECT_LT(device.write(frame), 0);
+
+    ASSERT_EQ(device.take(buffer, 1ms), 64);
+    EXPECT_TRUE(std::ranges::equal(std::span{buffer}.first(64), frame));
+    EXPECT_EQ(device.take(buffer, 1ms), 64);
+    EXPECT_EQ(device.take(buffer, 1ms), 0);
+}
+
+TEST(MemoryDevice, GatherWrite) {
+    MemoryDevice device{2};
+    std::array<std::byte, ethernet::max_size> buffer;
+
+    auto frame = make_frame<100>(0);
+    std::array<std::span<const std::byte>, 3> parts{
+        std::span{frame}.first(14),
+        std::span{frame}.subspan(14, 0),
+        std::span{frame}.subspan(14)
+    };
+    EXPECT_EQ(device.writev(parts), 100);
+    ASSERT_EQ(device.take(buffer, 1ms), 100);
+    EXPECT_TRUE(std::ranges::equal(std::span{buffer}.first(100), frame));
+
+    auto large = make_frame<ethernet::max_size>(0);
+    std::array<std::span<const std::byte>, 2> too_large{std::span{large}, std::span{frame}};
+    EXPECT_LT(device.writev(too_large), 0);
+}
+
+TEST(MemoryDevice, Pair) {
+    auto [a, b] = MemoryDevice::pair();
+    std::array<std::byte, ethernet::max_size> buffer;
+
+    auto frame = make_frame<80>(1);
+
+    std::jthread writer([&]{
+        std::this_thread::sleep_for(10ms);
+        a.write(frame);
+    });
+
+    ASSERT_EQ(b.try_read(buffer, 1s), 80);
+    EXPECT_TRUE(std::ranges::equal(std::span{buffer}.first(80), frame));
+
+    b.write(frame);
+    ASSERT_EQ(a.try_read(buffer, 1s), 80);
+    EXPECT_EQ(b.try_read(buffer, 1ms), 0);
+}
+
+TEST(PcapDevice, RoundTrip) {
+    auto path = std::filesystem::temp_directory_path() / "network_stack_device_test.pcap";
+    std::array<std::byte, ethernet::max_size> buffer;
+
+    auto frame1 = make_frame<60>(0);
+    auto frame2 = make_frame<ethernet::max_size>(5);
+
+    {
+        auto device = PcapDevice::try_open({}, path);
+        ASSERT_TRUE(device.has_value());
+        EXPECT_EQ(device->try_read(buffer, 1ms), 0);
+        EXPECT_EQ(device->write(frame1), 60);
+        EXPECT_EQ(device->write(frame2), static_cast<device::ssize_t>(ethernet::max_size));
+    }
+
+    auto device = PcapDevice::try_open(path, {});
+    ASSERT_TRUE(device.has_value());
+
+    ASSERT_EQ(device->try_read(buffer, 1ms), 60);
+    EXPECT_TRUE(std::ranges::equal(std::span{buffer}.first(60), frame1));
+
+    std::array<std::byte, 100> small;
+    ASSERT_EQ(device->read(small), 100);
+    EXPECT_TRUE(std::ranges::equal(small, std::span{frame2}.first(100)));
+
+    EXPECT_LT(device->try_read(buffer, 1ms), 0);
+
+    std::filesystem::remove(path);
+}
+
+TEST(PcapDevice, InvalidFile) {
+    auto path = std::filesystem::temp_directory_path() / "network_stack_device_test.txt";
+    {
+        auto device = PcapDevice::try_open({}, path);
+        ASSERT_TRUE(device.has_value());
+    }
+    std::filesystem::resize_file(path, 4);
+
+    EXPECT_FALSE(PcapDevice::try_open(path, {}).has_value());
+    EXPECT_FALSE(PcapDevice::try_open(path.string() + ".missing", {}).has_value());
+
+    std::filesystem::remove(path);
+}
+
+// Ethertype of the frames the TAP tests exchange, the kernel's own traffic
+// on the interface is skipped.
+constexpr uint16_t test_ethertype = 0x88B5;
+
+static std::vector<std::byte> test_frame(int index) {
+    auto bytes = make_frame<60>(index);
+    std::fill_n(bytes.begin(), 6, std::byte{0xFF});
+    bytes[12] = std::byte{test_ethertype >> 8};
+    bytes[13] = std::byte{test_ethertype & 0xFF};
+    return {bytes.begin(), bytes.end()};
+}
+
+static bool is_test_frame(std::span<const std::byte> frame) {
+    return frame.size() >= 14 && frame[12] == std::byte{test_ethertype >> 8} && frame[13] == std::byte{test_ethertype & 0xFF};
+}
+
+// A TAP interface that is up, with a packet socket bound to it standing in
+// for the kernel side. Skipped without CAP_NET_ADMIN.
+class TapInterface : public testing::Test {
+protected:
+    std::optional<Tap> tap;
+    int peer = -1;
+
+    void SetUp() override {
+        auto created = Tap::try_new();
+        if (!created) {
+            GTEST_SKIP() << created.error().what();
+        }
+        tap = std::move(*created);
+
+        int control = socket(AF_INET, SOCK_DGRAM, 0);
+        ifreq ifr{};
+        tap->get_name().copy(ifr.ifr_name, IFNAMSIZ - 1);
+        bool up = control >= 0 && ioctl(control, SIOCGIFFLAGS, &ifr) == 0;
+        if (up) {
+            ifr.ifr_flags = static_cast<short>(ifr.ifr_flags | IFF_UP);
+            up = ioctl(control, SIOCSIFFLAGS, &ifr) == 0;
+        }
+        close(control);
+        if (!up) {
+            GTEST_SKIP() << "Cannot bring " << tap->get_name() << " up";
+        }
+
+        peer = socket(AF_PACKET, SOCK_RAW, htons(test_ethertype));
+        sockaddr_ll address{};
+        address.sll_family = AF_PACKET;
+        address.sll_protocol = htons(test_ethertype);
+        address.sll_ifindex = static_cast<int>(if_nametoindex(tap->get_name().c_str()));
+        if (peer < 0 || bind(peer, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            GTEST_SKIP() << "Cannot bind a packet socket to " << tap->get_name();
+        }
+    }
+
+    void TearDown() override {
+        if (peer >= 0) {
+            close(peer);
+        }
+    }
+
+    void peer_send(std::span<const std::byte> frame) {
+        ASSERT_EQ(send(peer, frame.data(), frame.size(), 0), static_cast<ssize_t>(frame.size()));
+    }
+
+    // The next frame the device wrote, if one comes within timeout.
+    std::optional<std::vector<std::byte>> peer_receive(device::Timeout timeout) {
+        pollfd poll_fd{peer, POLLIN, 0};
+        if (poll(&poll_fd, 1, timeout.count()) <= 0) {
+            return std::nullopt;
+        }
+        std::vector<std::byte> frame(ethernet::max_size);
+        auto size = recv(peer, frame.data(), frame.size(), 0);
+        if (size < 0) {
+            return std::nullopt;
+        }
+        frame.resize(static_cast<std::size_t>(size));
+        return frame;
+    }
+};
+
+// The next test frame read from device, skipping the kernel's traffic.
+template<device::Device Device>
+static std::optional<std::vector<std::byte>> read_test_frame(Device& device, device::Timeout timeout) {
+    std::array<std::byte, ethernet::max_size> buffer;
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        auto read = device.try_read(buffer, 10ms);
+        if (read < 0) {
+            break;
+        }
+        auto frame = std::span{buffer}.first(static_cast<std::size_t>(read));
+        if (is_test_frame(frame)) {
+            return std::vector<std::byte>{frame.begin(), frame.end()};
+        }
+    }
+    return std::nullopt;
+}
+
+TEST_F(TapInterface, UringTap) {
+    auto device = UringTap::try_new(std::move(*tap), {.rx_depth = 8, .tx_depth = 8, .tx_batch = 4});
+    if (!device) {
+        GTEST_SKIP() << device.error().what();
+    }
+
+    // Frames written by the reading thread wait for flush().
+    std::array<std::byte, ethernet::max_size> buffer;
+    EXPECT_GE(device->try_read(buffer, 0ms), 0);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(device->write(test_frame(i)), 60);
+    }
+    EXPECT_FALSE(peer_receive(20ms).has_value());
+
+    device->flush();
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(peer_receive(1s), test_frame(i));
+    }
+
+    // Or go out once tx_batch of them are queued.
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(device->write(test_frame(10 + i)), 60);
+    }
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(peer_receive(1s), test_frame(10 + i));
+    }
+
+    for (int i = 0; i < 20; ++i) {
+        peer_send(test_frame(20 + i));
+    }
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_EQ(read_test_frame(*device, 1s), test_frame(20 + i));
+    }
+}
+
+TEST_F(TapInterface, PacketSocketLendsBlocks) {
+    auto socket = PacketSocket::try_new(tap->get_name(), {
+        .block_size = 4096,
+        .rx_block_count = 4,
+        .tx_block_count = 1,
+        .frame_size = 2048,
+        .block_timeout_ms = 1
+    });
+    if (!socket) {
+        GTEST_SKIP() << socket.error().what();
+    }
+
+    struct Received {
+        std::vector<std::byte> bytes;
+        std::span<const std::byte> frame;
+        buffer::Buffer buffer;
+    };
+    // Frames the interface receives, each in a block of its own.
+    auto receive = [&](int index) {
+        EXPECT_EQ(tap->write(test_frame(index)), 60);
+        std::optional<Received> received;
+        const auto deadline = std::chrono::steady_clock::now() + 1s;
+        while (!received && std::chrono::steady_clock::now() < deadline) {
+            EXPECT_GE(socket->receive([&](std::span<const std::byte> frame, const buffer::Buffer& buffer){
+                received = Received{{frame.begin(), frame.end()}, frame, buffer};
+            }, 10ms), 0);
+        }
+        return received;
+    };
+
+    // Borrowed frames keep their blocks, and their bytes, until let go.
+    std::vector<Received> kept;
+    for (int i = 0; i < 2; ++i) {
+        auto received = receive(i);
+        ASSERT_TRUE(received.has_value());
+        EXPECT_EQ(received->bytes, test_frame(i));
+        ASSERT_TRUE(received->buffer);
+        EXPECT_GE(received->frame.data(), received->buffer.data().data());
+        EXPECT_LE(received->frame.data() + received->frame.size(), received->buffer.data().data() + received->buffer.data().size());
+        kept.push_back(std::move(*received));
+    }
+
+    // With half the ring lent, frames have to be copied.
+    for (int i = 2; i < 4; ++i) {
+        auto received = receive(i);
+        ASSERT_TRUE(received.has_value());
+        EXPECT_EQ(received->bytes, test_frame(i));
+        EXPECT_FALSE(received->buffer);
+    }
+
+    // The kernel waits for the lent blocks.
+    EXPECT_FALSE(receive(4).has_value());
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_TRUE(std::ranges::equal(kept[static_cast<std::size_t>(i)].frame, test_frame(i)));
+    }
+
+    // They go back on the next receive().
+    kept.clear();
+    EXPECT_EQ(socket->receive([](std::span<const std::byte>, const buffer::Buffer&){}, 10ms), 0);
+    auto received = receive(5);
+    ASSERT_TRUE(received.has_value());
+    EXPECT_EQ(received->bytes, test_frame(5));
+    EXPECT_TRUE(received->buffer);
+}
+
+TEST(VirtioNet, HeaderIsLittleEndian) {
+    virtio_net::Format::Header header;
+    header.set<"flags">(virtio_net::NeedsChecksum);
+    header.set<"gso_type">(virtio_net::GsoType::TCPv4);
+    header.set<"header_length">(66);
+    header.set<"gso_size">(1448);
+    header.set<"checksum_start">(34);
+    header.set<"checksum_offset">(16);
+
+    virtio_net::Packet<std::array<std::byte, virtio_net::Format::byte_size()>> packet;
+    packet.encode(header);
+    EXPECT_EQ(packet.bytes, (std::array<std::byte, 10>{
+        std::byte{1}, std::byte{1}, std::byte{66}, std::byte{0}, std::byte{0xA8}, std::byte{0x05}, std::byte{34}, std::byte{0}, std::byte{16}, std::byte{0}
+    }));
+    EXPECT_EQ(packet.decode(), header);
+    EXPECT_EQ(packet.get<"gso_size">(), 1448);
+
+    packet.set<"checksum_start">(0x1234);
+    EXPECT_EQ(packet.bytes[6], std::byte{0x34});
+    EXPECT_FALSE(virtio_net::checksum_valid(virtio_net::Format::Header{}));
+    EXPECT_TRUE(virtio_net::checksum_valid(header));
+}
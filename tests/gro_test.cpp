@@ -0,0 +1,183 @@
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+#include "gro.h"
+#include "ipv4.h"
+#include "tcp.h"
+#include "buffer_pool.h"
+
+constexpr IPv4_t ip = "10.0.0.4"_ipv4;
+constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+
+struct Segment {
+    uint32_t sequence;
+    std::size_t size;
+    uint16_t source_port = 40000;
+    uint16_t window = 1000;
+    bool push = false;
+    bool fin = false;
+    ipv4::Protocol protocol = ipv4::Protocol::TCP;
+};
+
+// Payload bytes follow the sequence numbers, so merged payloads can be checked.
+static std::byte payload_byte(uint32_t sequence) {
+    return static_cast<std::byte>(sequence % 251);
+}
+
+// IPv4 packet carrying a segment from the peer, in a buffer of pool.
+static buffer::Buffer make_packet(buffer::Pool& pool, const Segment& segment) {
+    constexpr std::size_t headers = ipv4::Format::byte_size() + tcp::Format::byte_size();
+    auto buffer = pool.allocate();
+    buffer.resize(headers + segment.size);
+    std::ranges::fill(buffer.data(), std::byte{0});
+
+    ipv4::Packet<std::span<std::byte>> packet{buffer.data()};
+    packet.set<"version">(4);
+    packet.set<"header_length">(5);
+    packet.set<"total_length">(static_cast<uint16_t>(buffer.data().size()));
+    packet.set<"ttl">(64);
+    packet.set<"protocol">(segment.protocol);
+    packet.set<"source_address">(peer_ip);
+    packet.set<"destination_address">(ip);
+    packet.update_checksum();
+
+    auto bytes = packet.payload();
+    for (std::size_t i = 0; i < segment.size; ++i) {
+        bytes[tcp::Format::byte_size() + i] = payload_byte(segment.sequence + static_cast<uint32_t>(i));
+    }
+
+    tcp::Packet<std::span<std::byte>> tcp_segment{bytes};
+    tcp_segment.set<"source_port">(segment.source_port);
+    tcp_segment.set<"destination_port">(5001);
+    tcp_segment.set<"sequence">(segment.sequence);
+    tcp_segment.set<"acknowledgment">(7);
+    tcp_segment.set<"data_offset">(5);
+    tcp_segment.set<"ack">(1);
+    tcp_segment.set<"psh">(segment.push);
+    tcp_segment.set<"fin">(segment.fin);
+    tcp_segment.set<"window">(segment.window);
+    tcp_segment.set<"checksum">(tcp::checksum(peer_ip, ip, bytes));
+    return buffer;
+}
+
+struct Delivered {
+    std::vector<std::byte> bytes;
+    const std::byte* data;
+};
+
+static tcp::Format::Header tcp_header(const Delivered& packet) {
+    return tcp::Packet<std::span<const std::byte>>{std::span{packet.bytes}.subspan(ipv4::Format::byte_size())}.decode();
+}
+
+class GRO : public testing::Test {
+protected:
+    buffer::Pool frames{{.buffer_count = 64, .buffer_size = 2048}};
+    buffer::Pool merged{{.buffer_count = 8, .buffer_size = gro::Config{}.max_size}};
+    gro::Merger merger{{.max_flows = 2}, merged};
+    std::vector<Delivered> delivered;
+
+    bool add(const Segment& segment, bool checksum_valid = false) {
+        auto buffer = make_packet(frames, segment);
+        const bool taken = merger.add(gro::Merger::Packet{std::span<const std::byte>{buffer.data()}}, buffer, checksum_valid);
+        drain();
+        return taken;
+    }
+
+    void drain() {
+        merger.drain([&](gro::Merger::Packet packet, const buffer::Buffer&){
+            delivered.push_back({{packet.bytes.begin(), packet.bytes.end()}, packet.bytes.data()});
+        });
+    }
+};
+
+TEST_F(GRO, MergesConsecutiveSegments) {
+    EXPECT_TRUE(add({.sequence = 1000, .size = 1000}));
+    EXPECT_TRUE(add({.sequence = 2000, .size = 1000}));
+    EXPECT_TRUE(add({.sequence = 3000, .size = 1000}));
+    EXPECT_TRUE(delivered.empty());
+    // A short segment ends the flow, the window is the latest one.
+    EXPECT_TRUE(add({.sequence = 4000, .size = 500, .window = 900}));
+    EXPECT_TRUE(merger.empty());
+
+    ASSERT_EQ(delivered.size(), 1u);
+    ipv4::Packet packet{std::span<const std::byte>{delivered[0].bytes}};
+    EXPECT_TRUE(packet.is_valid());
+    EXPECT_EQ(packet.get<"total_length">(), 40 + 3500);
+
+    const auto bytes = packet.payload();
+    tcp::Packet<std::span<const std::byte>> segment{bytes};
+    EXPECT_EQ(segment.get<"sequence">(), 1000u);
+    EXPECT_EQ(segment.get<"window">(), 900);
+    for (std::size_t i = 0; i < 3500; ++i) {
+        ASSERT_EQ(bytes[20 + i], payload_byte(static_cast<uint32_t>(1000 + i))) << i;
+    }
+
+    EXPECT_EQ(merger.stats().merged, 4u);
+    EXPECT_EQ(merger.stats().flushed, 1u);
+}
+
+TEST_F(GRO, KeepsSegmentNothingJoins) {
+    auto buffer = make_packet(frames, {.sequence = 1000, .size = 1000});
+    const auto data = buffer.data();
+    EXPECT_TRUE(merger.add(gro::Merger::Packet{std::span<const std::byte>{data}}, buffer, false));
+    merger.flush();
+    drain();
+
+    ASSERT_EQ(delivered.size(), 1u);
+    EXPECT_EQ(delivered[0].data, data.data());
+    EXPECT_EQ(merger.stats().flushed, 0u);
+}
+
+TEST_F(GRO, KeepsOrderWithinFlow) {
+    EXPECT_TRUE(add({.sequence = 1000, .size = 1000}));
+    EXPECT_TRUE(add({.sequence = 2000, .size = 1000}));
+    // Out of order, the held segments go up first.
+    EXPECT_TRUE(add({.sequence = 4000, .size = 1000}));
+    ASSERT_EQ(delivered.size(), 1u);
+    EXPECT_EQ(ipv4::Packet{std::span<const std::byte>{delivered[0].bytes}}.get<"total_length">(), 40 + 2000);
+
+    // A FIN is not merged, it goes up after the flow.
+    EXPECT_FALSE(add({.sequence = 5000, .size = 0, .fin = true}));
+    ASSERT_EQ(delivered.size(), 2u);
+    EXPECT_EQ(tcp_header(delivered[1]).get<"sequence">(), 4000u);
+
+    // Pushed data ends the flow.
+    EXPECT_TRUE(add({.sequence = 6000, .size = 1000}));
+    EXPECT_TRUE(add({.sequence = 7000, .size = 1000, .push = true}));
+    ASSERT_EQ(delivered.size(), 3u);
+    EXPECT_EQ(tcp_header(delivered[2]).get<"psh">(), 1);
+    EXPECT_TRUE(merger.empty());
+}
+
+TEST_F(GRO, PassesOthersThrough) {
+    EXPECT_FALSE(add({.sequence = 1000, .size = 100, .protocol = ipv4::Protocol::UDP}));
+
+    auto corrupted = make_packet(frames, {.sequence = 1000, .size = 1000});
+    corrupted.data()[100] ^= std::byte{1};
+    EXPECT_FALSE(merger.add(gro::Merger::Packet{std::span<const std::byte>{corrupted.data()}}, corrupted, false));
+    // Unless the device checked the checksum.
+    EXPECT_TRUE(merger.add(gro::Merger::Packet{std::span<const std::byte>{corrupted.data()}}, corrupted, true));
+    drain();
+    EXPECT_TRUE(delivered.empty());
+}
+
+TEST_F(GRO, FlushesOldestFlow) {
+    EXPECT_TRUE(add({.sequence = 1000, .size = 1000, .source_port = 1}));
+    EXPECT_TRUE(add({.sequence = 1000, .size = 1000, .source_port = 2}));
+    EXPECT_TRUE(add({.sequence = 2000, .size = 1000, .source_port = 1}));
+    EXPECT_TRUE(delivered.empty());
+
+    EXPECT_TRUE(add({.sequence = 1000, .size = 1000, .source_port = 3}));
+    ASSERT_EQ(delivered.size(), 1u);
+    EXPECT_EQ(tcp_header(delivered[0]).get<"source_port">(), 1);
+
+    merger.flush();
+    drain();
+    ASSERT_EQ(delivered.size(), 3u);
+    EXPECT_EQ(tcp_header(delivered[1]).get<"source_port">(), 2);
+    EXPECT_EQ(tcp_header(delivered[2]).get<"source_port">(), 3);
+}
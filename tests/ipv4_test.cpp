@@ -22,6 +22,30 @@ TEST(IPv4, Checksum) {
     EXPECT_EQ(packet.calculate_checksum(), 0);
 }
 
+TEST(IPv4, Validation) {
+    std::array<unsigned char, 24> buffer{0x45, 0x00, 0x00, 0x18, 0x00, 0x00, 0x40, 0x00, 0x40, 0x11, 0x00, 0x00, 0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0xc7, 0x01, 0x02, 0x04, 0x08};
+    ipv4::Packet packet{std::as_writable_bytes(std::span{buffer})};
+
+    EXPECT_FALSE(packet.is_valid());
+    packet.update_checksum();
+    EXPECT_TRUE(packet.is_valid());
+
+    buffer[20] = 0xFF;
+    EXPECT_TRUE(packet.is_valid());
+    buffer[12] = 0xFF;
+    EXPECT_FALSE(packet.is_valid());
+    buffer[12] = 0xc0;
+
+    packet.set<"total_length">(25);
+    packet.update_checksum();
+    EXPECT_FALSE(packet.is_valid());
+
+    packet.set<"total_length">(24);
+    packet.set<"header_length">(4);
+    packet.update_checksum();
+    EXPECT_FALSE(packet.is_valid());
+}
+
 TEST(IPv4, PacketReassembly) {
     std::array<std::byte, 24> payload;
     std::ranges::copy(
@@ -105,6 +129,7 @@ TEST(IPv4, PacketReassembly) {
 
     datagram = assembler.assemble(packet2_2);
     EXPECT_FALSE(datagram.has_value());
+    EXPECT_EQ(assembler.stats().timeouts, 1u);
 
     assembler = {};
 
@@ -125,3 +150,218 @@ TEST(IPv4, PacketReassembly) {
     EXPECT_TRUE(std::ranges::equal(datagram->data, payload));
     EXPECT_EQ(datagram->protocol, ipv4::Protocol{0});
 }
+
+TEST(IPv4, BorrowedPayload) {
+    buffer::Pool pool{{.buffer_count = 2, .buffer_size = 128}};
+    auto frame = pool.allocate();
+    ASSERT_TRUE(frame);
+
+    constexpr uint16_t header_length = ipv4::Format::byte_size();
+    constexpr std::size_t frame_header_length = 14;
+
+    frame.resize(frame_header_length + header_length + 24);
+    ipv4::Packet packet{frame.data().subspan(frame_header_length)};
+    packet.set<"version">(4);
+    packet.set<"header_length">(5);
+    packet.set<"total_length">(header_length + 24);
+    packet.set<"protocol">(ipv4::Protocol::UDP);
+    std::ranges::copy(
+        std::views::iota(0, 24) | std::views::transform([](auto v){return static_cast<std::byte>(v);}),
+        packet.payload().begin()
+    );
+
+    ipv4::Assembler assembler;
+    ipv4::Packet<std::span<const std::byte>> received{packet};
+
+    auto datagram = assembler.assemble(received, frame);
+    ASSERT_TRUE(datagram.has_value());
+    EXPECT_TRUE(datagram->is_borrowed());
+    EXPECT_TRUE(datagram->data.empty());
+    EXPECT_EQ(datagram->payload().data(), packet.payload().data());
+    EXPECT_EQ(datagram->payload().size(), 24u);
+    EXPECT_EQ(datagram->protocol, ipv4::Protocol::UDP);
+    EXPECT_EQ(frame.use_count(), 2u);
+
+    datagram.reset();
+    EXPECT_EQ(frame.use_count(), 1u);
+
+    datagram = assembler.assemble(received);
+    ASSERT_TRUE(datagram.has_value());
+    EXPECT_FALSE(datagram->is_borrowed());
+    EXPECT_TRUE(std::ranges::equal(datagram->payload(), packet.payload()));
+
+    auto other = pool.allocate();
+    other.resize(16);
+    datagram = assembler.assemble(received, other);
+    ASSERT_TRUE(datagram.has_value());
+    EXPECT_FALSE(datagram->is_borrowed());
+}
+
+// Fragment of a datagram whose payload byte i is i.
+static std::vector<std::byte> fragment(uint16_t id, std::size_t offset, std::size_t length, bool more_fragments, IPv4_t source = 0) {
+    constexpr uint16_t header_length = ipv4::Format::byte_size();
+
+    std::vector<std::byte> bytes(header_length + length);
+    ipv4::Packet packet{std::span{bytes}};
+    packet.set<"version">(4);
+    packet.set<"header_length">(5);
+    packet.set<"total_length">(static_cast<uint16_t>(header_length + length));
+    packet.set<"id">(id);
+    packet.set<"more_fragments">(more_fragments);
+    packet.set<"fragment_offset">(static_cast<uint16_t>(offset / 8));
+    packet.set<"source_address">(source);
+    for (std::size_t i = 0; i < length; ++i) {
+        packet.payload()[i] = static_cast<std::byte>(offset + i);
+    }
+    return bytes;
+}
+
+static bool is_sequence(std::span<const std::byte> data, std::size_t size) {
+    return data.size() == size && std::ranges::equal(
+        data,
+        std::views::iota(std::size_t{0}, size) | std::views::transform([](auto v){return static_cast<std::byte>(v);})
+    );
+}
+
+TEST(IPv4, ReassemblyHoles) {
+    ipv4::Assembler assembler;
+    auto assemble = [&](const std::vector<std::byte>& bytes) {
+        return assembler.assemble(ipv4::Packet{std::span<const std::byte>{bytes}});
+    };
+
+    // The middle splits the initial hole, overlaps fill the rest.
+    EXPECT_FALSE(assemble(fragment(1, 40, 16, true)));
+    EXPECT_FALSE(assemble(fragment(1, 80, 20, false)));
+    EXPECT_FALSE(assemble(fragment(1, 0, 48, true)));
+    EXPECT_FALSE(assemble(fragment(1, 40, 16, true)));
+    EXPECT_EQ(assembler.size(), 1u);
+
+    auto datagram = assemble(fragment(1, 48, 32, true));
+    ASSERT_TRUE(datagram.has_value());
+    EXPECT_TRUE(is_sequence(datagram->payload(), 100));
+    EXPECT_EQ(assembler.size(), 0u);
+
+    // A fragment covering everything at once.
+    EXPECT_FALSE(assemble(fragment(2, 96, 4, false)));
+    EXPECT_FALSE(assemble(fragment(2, 8, 8, true)));
+    datagram = assemble(fragment(2, 0, 96, true));
+    ASSERT_TRUE(datagram.has_value());
+    EXPECT_TRUE(is_sequence(datagram->payload(), 100));
+}
+
+TEST(IPv4, ReassemblyRejectsInconsistentFragments) {
+    ipv4::Assembler assembler;
+    auto assemble = [&](const std::vector<std::byte>& bytes) {
+        return assembler.assemble(ipv4::Packet{std::span<const std::byte>{bytes}});
+    };
+
+    EXPECT_FALSE(assemble(fragment(1, 0, 12, true)));
+    EXPECT_EQ(assembler.size(), 0u);
+
+    EXPECT_FALSE(assemble(fragment(1, 16, 16, true)));
+    // Ends before data already received.
+    EXPECT_FALSE(assemble(fragment(1, 8, 8, false)));
+
+    // Once the end is known, no other end nor data past it.
+    EXPECT_FALSE(assemble(fragment(1, 32, 4, false)));
+    EXPECT_FALSE(assemble(fragment(1, 32, 8, false)));
+    EXPECT_FALSE(assemble(fragment(1, 32, 8, true)));
+
+    auto datagram = assemble(fragment(1, 0, 16, true));
+    ASSERT_TRUE(datagram.has_value());
+    EXPECT_TRUE(is_sequence(datagram->payload(), 36));
+
+    // Beyond the largest possible datagram.
+    EXPECT_FALSE(assemble(fragment(2, 65528, 16, false)));
+    EXPECT_EQ(assembler.size(), 0u);
+}
+
+TEST(IPv4, ReassemblyTableFull) {
+    constexpr auto evictions = static_cast<std::size_t>(stats::Counter::ReassemblyEvictions);
+    constexpr auto completed = static_cast<std::size_t>(stats::Counter::ReassemblyCompleted);
+    const auto before = stats::read();
+    ipv4::Assembler assembler{{.max_datagrams = 4}};
+    auto assemble = [&](const std::vector<std::byte>& bytes) {
+        return assembler.assemble(ipv4::Packet{std::span<const std::byte>{bytes}});
+    };
+
+    // The oldest one makes room.
+    for (uint16_t id = 0; id < 5; ++id) {
+        EXPECT_FALSE(assemble(fragment(id, 0, 8, true)));
+    }
+    EXPECT_EQ(assembler.size(), 4u);
+    EXPECT_EQ(assembler.stats().evictions, 1u);
+    EXPECT_FALSE(assemble(fragment(0, 8, 8, false)));
+    EXPECT_EQ(assembler.stats().evictions, 2u);
+    EXPECT_EQ(stats::read()[evictions] - before[evictions], 2u);
+
+    // Probe chains stay intact.
+    for (uint16_t id : {uint16_t{2}, uint16_t{4}, uint16_t{3}}) {
+        auto datagram = assemble(fragment(id, 8, 8, false));
+        ASSERT_TRUE(datagram.has_value());
+        EXPECT_TRUE(is_sequence(datagram->payload(), 16));
+    }
+    EXPECT_TRUE(assemble(fragment(0, 0, 8, true)).has_value());
+    EXPECT_EQ(assembler.size(), 0u);
+    EXPECT_EQ(assembler.memory_used(), 0u);
+    EXPECT_EQ(assembler.stats().completed, 4u);
+    EXPECT_EQ(stats::read()[completed] - before[completed], 4u);
+}
+
+TEST(IPv4, ReassemblyExpiresWhileIdle) {
+    ipv4::Assembler assembler{{.timeout = std::chrono::seconds{1}}};
+    auto bytes = fragment(0, 0, 8, true);
+    EXPECT_FALSE(assembler.assemble(ipv4::Packet{std::span<const std::byte>{bytes}}));
+
+    const auto now = ipv4::Assembler::clock::now();
+    assembler.expire(now);
+    EXPECT_EQ(assembler.size(), 1u);
+
+    assembler.expire(now + std::chrono::seconds{2});
+    EXPECT_EQ(assembler.size(), 0u);
+    EXPECT_EQ(assembler.memory_used(), 0u);
+    EXPECT_EQ(assembler.stats().timeouts, 1u);
+}
+
+TEST(IPv4, ReassemblyBudgets) {
+    ipv4::Assembler assembler{{.max_datagrams = 16, .max_bytes = 10'000, .max_bytes_per_source = 5'000}};
+    auto assemble = [&](const std::vector<std::byte>& bytes) {
+        return assembler.assemble(ipv4::Packet{std::span<const std::byte>{bytes}});
+    };
+
+    constexpr IPv4_t a = "10.0.0.1"_ipv4;
+    constexpr IPv4_t b = "10.0.0.2"_ipv4;
+    constexpr IPv4_t c = "10.0.0.3"_ipv4;
+
+    // Each last fragment sizes its datagram to 2000 bytes.
+    for (uint16_t id = 1; id <= 3; ++id) {
+        EXPECT_FALSE(assemble(fragment(id, 1992, 8, false, a)));
+    }
+    EXPECT_EQ(assembler.stats().evictions, 1u);
+    EXPECT_EQ(assembler.size(), 2u);
+
+    for (uint16_t id = 1; id <= 3; ++id) {
+        EXPECT_FALSE(assemble(fragment(id, 1992, 8, false, b)));
+    }
+    EXPECT_EQ(assembler.stats().evictions, 2u);
+
+    // Over the global budget, the oldest datagram of any source goes.
+    EXPECT_FALSE(assemble(fragment(1, 1992, 8, false, c)));
+    EXPECT_EQ(assembler.stats().evictions, 3u);
+    EXPECT_EQ(assembler.size(), 4u);
+    EXPECT_LE(assembler.memory_used(), 10'000u);
+
+    // The evicted one starts over.
+    EXPECT_FALSE(assemble(fragment(2, 0, 8, true, a)));
+    EXPECT_EQ(assembler.size(), 5u);
+    auto datagram = assemble(fragment(3, 0, 1992, true, a));
+    ASSERT_TRUE(datagram.has_value());
+    EXPECT_TRUE(is_sequence(datagram->payload(), 2000));
+
+    // Larger than a source may ever hold, dropped without evicting anything.
+    auto dropped = assembler.stats().dropped;
+    EXPECT_FALSE(assemble(fragment(4, 5992, 8, false, b)));
+    EXPECT_EQ(assembler.stats().dropped, dropped + 1);
+    EXPECT_EQ(assembler.stats().evictions, 3u);
+    EXPECT_EQ(assembler.size(), 4u);
+}
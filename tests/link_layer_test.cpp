@@ -0,0 +1,940 @@
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "gtest/gtest.h"
+
+#include "internet_layer.h"
+#include "memory_device.h"
+#include "tap.h"
+#include "packet_socket.h"
+
+using namespace std::chrono_literals;
+
+constexpr IPv4_t ip = "10.0.0.4"_ipv4;
+constexpr IPv4_t gateway = "10.0.0.1"_ipv4;
+constexpr MAC_t mac = "00:0c:29:6d:50:25"_mac;
+constexpr MAC_t peer_mac = "02:00:00:00:00:01"_mac;
+
+// Counters are shared by the stacks of the process, tests look at how much
+// they grew.
+static uint64_t count(stats::Counter counter) {
+    return stats::read()[static_cast<std::size_t>(counter)];
+}
+
+// Reads the next frame sent by the stack, skipping its gratuitous ARP.
+static device::ssize_t read_frame(MemoryDevice& peer, std::span<std::byte> buffer, device::Timeout timeout) {
+    while (true) {
+        auto read = peer.try_read(buffer, timeout);
+        if (read <= 0) {
+            return read;
+        }
+
+        ethernet::Packet frame{buffer.first(static_cast<std::size_t>(read))};
+        if (frame.get<"ethertype">() != ethernet::Ethertype::ARP) {
+            return read;
+        }
+        auto header = frame.data<arp::Packet>().decode();
+        if (header.get<"source_ip">() != header.get<"destination_ip">()) {
+            return read;
+        }
+    }
+}
+
+TEST(LinkLayer, ArpReplyOverMemoryDevice) {
+    auto [stack_device, peer] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)});
+
+    std::jthread thread([&](std::stop_token stop_token){
+        stack.run(stop_token);
+    });
+
+    ethernet::Packet<std::array<std::byte, ethernet::Format::byte_size() + arp::Format::byte_size()>> frame;
+    frame.set<"destination_mac">(ethernet::mac_broadcast);
+    frame.set<"source_mac">(peer_mac);
+    frame.set<"ethertype">(ethernet::Ethertype::ARP);
+
+    auto request = frame.data<arp::Packet>();
+    request.set<"hardware_type">(1);
+    request.set<"protocol_type">(0x0800);
+    request.set<"hardware_size">(6);
+    request.set<"protocol_size">(4);
+    request.set<"opcode">(arp::OpCode::REQUEST);
+    request.set<"source_mac">(peer_mac);
+    request.set<"source_ip">(gateway);
+    request.set<"destination_mac">(0);
+    request.set<"destination_ip">(ip);
+
+    ASSERT_EQ(peer.write(frame.bytes), static_cast<device::ssize_t>(frame.bytes.size()));
+
+    std::array<std::byte, ethernet::max_size> buffer;
+    auto read = read_frame(peer, buffer, 1s);
+    ASSERT_GT(read, 0);
+
+    ethernet::Packet reply_frame{std::span{buffer}.first(static_cast<std::size_t>(read))};
+    EXPECT_EQ(reply_frame.get<"destination_mac">(), peer_mac);
+    EXPECT_EQ(reply_frame.get<"source_mac">(), mac);
+    EXPECT_EQ(reply_frame.get<"ethertype">(), ethernet::Ethertype::ARP);
+
+    auto reply = reply_frame.data<arp::Packet>();
+    EXPECT_EQ(reply.get<"opcode">(), arp::OpCode::REPLY);
+    EXPECT_EQ(reply.get<"source_mac">(), mac);
+    EXPECT_EQ(reply.get<"source_ip">(), ip);
+    EXPECT_EQ(reply.get<"destination_mac">(), peer_mac);
+    EXPECT_EQ(reply.get<"destination_ip">(), gateway);
+}
+
+static auto arp_frame(MAC_t destination, arp::OpCode opcode, MAC_t sender_mac, IPv4_t sender_ip, MAC_t target_mac, IPv4_t target_ip) {
+    ethernet::Packet<std::array<std::byte, ethernet::Format::byte_size() + arp::Format::byte_size()>> frame;
+    frame.set<"destination_mac">(destination);
+    frame.set<"source_mac">(sender_mac);
+    frame.set<"ethertype">(ethernet::Ethertype::ARP);
+
+    arp::Format::Header header;
+    header.set<"hardware_type">(1);
+    header.set<"protocol_type">(0x0800);
+    header.set<"hardware_size">(6);
+    header.set<"protocol_size">(4);
+    header.set<"opcode">(opcode);
+    header.set<"source_mac">(sender_mac);
+    header.set<"source_ip">(sender_ip);
+    header.set<"destination_mac">(target_mac);
+    header.set<"destination_ip">(target_ip);
+    frame.data<arp::Packet>().encode(header);
+
+    return frame;
+}
+
+TEST(LinkLayer, SendToParksUntilArpReply) {
+    const auto drops = count(stats::Counter::ArpDrops);
+    auto [stack_device, peer] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)});
+
+    std::jthread thread([&](std::stop_token stop_token){
+        stack.run(stop_token);
+    });
+
+    std::array payload{std::byte{1}, std::byte{2}, std::byte{3}, std::byte{4}};
+    EXPECT_TRUE(stack.send_to(gateway, ethernet::Ethertype::IPv4, payload));
+    EXPECT_TRUE(stack.send_to(gateway, ethernet::Ethertype::IPv4, payload));
+
+    std::array<std::byte, ethernet::max_size> buffer;
+    auto read = read_frame(peer, buffer, 1s);
+    ASSERT_GT(read, 0);
+
+    ethernet::Packet request_frame{std::span{buffer}.first(static_cast<std::size_t>(read))};
+    EXPECT_EQ(request_frame.get<"destination_mac">(), ethernet::mac_broadcast);
+    EXPECT_EQ(request_frame.get<"ethertype">(), ethernet::Ethertype::ARP);
+    auto request = request_frame.data<arp::Packet>().decode();
+    EXPECT_EQ(request.get<"opcode">(), arp::OpCode::REQUEST);
+    EXPECT_EQ(request.get<"destination_ip">(), gateway);
+
+    // Both packets share the one outstanding request.
+    EXPECT_LE(read_frame(peer, buffer, 50ms), 0);
+
+    auto reply = arp_frame(mac, arp::OpCode::REPLY, peer_mac, gateway, mac, ip);
+    ASSERT_EQ(peer.write(reply.bytes), static_cast<device::ssize_t>(reply.bytes.size()));
+
+    for (int i = 0; i < 2; ++i) {
+        read = read_frame(peer, buffer, 1s);
+        ASSERT_GT(read, 0);
+
+        ethernet::Packet frame{std::span{buffer}.first(static_cast<std::size_t>(read))};
+        EXPECT_EQ(frame.get<"destination_mac">(), peer_mac);
+        EXPECT_EQ(frame.get<"ethertype">(), ethernet::Ethertype::IPv4);
+        EXPECT_TRUE(std::ranges::equal(frame.data().first(payload.size()), payload));
+    }
+
+    // Resolved now, sent right away.
+    EXPECT_TRUE(stack.send_to(gateway, ethernet::Ethertype::IPv4, payload));
+    read = read_frame(peer, buffer, 1s);
+    ASSERT_GT(read, 0);
+    EXPECT_EQ(ethernet::Packet{std::span{buffer}.first(static_cast<std::size_t>(read))}.get<"ethertype">(), ethernet::Ethertype::IPv4);
+    EXPECT_EQ(count(stats::Counter::ArpDrops) - drops, 0u);
+}
+
+TEST(LinkLayer, SendToBoundsParkedPackets) {
+    const auto drops = count(stats::Counter::ArpDrops);
+    auto [stack_device, peer] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)});
+
+    std::array payload{std::byte{1}};
+    using Handler = arp::Handler<InternetLayer<MemoryDevice>>;
+    for (std::size_t i = 0; i < Handler::max_parked; ++i) {
+        EXPECT_TRUE(stack.send_to(gateway, ethernet::Ethertype::IPv4, payload));
+    }
+    EXPECT_FALSE(stack.send_to(gateway, ethernet::Ethertype::IPv4, payload));
+    EXPECT_EQ(count(stats::Counter::ArpDrops) - drops, 1u);
+}
+
+static int count_requests(MemoryDevice& peer) {
+    std::array<std::byte, ethernet::max_size> buffer;
+    int count = 0;
+    device::ssize_t read;
+    while ((read = peer.try_read(buffer, 0ms)) > 0) {
+        ethernet::Packet frame{std::span{buffer}.first(static_cast<std::size_t>(read))};
+        if (frame.get<"ethertype">() == ethernet::Ethertype::ARP &&
+            frame.data<arp::Packet>().get<"opcode">() == arp::OpCode::REQUEST) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+TEST(LinkLayer, ArpRetriesThenHoldsDown) {
+    const auto drops = count(stats::Counter::ArpDrops);
+    const auto requests = count(stats::Counter::ArpRequests);
+    const auto retries = count(stats::Counter::ArpRetries);
+    const auto failed = count(stats::Counter::ArpFailed);
+    const auto held_down = count(stats::Counter::ArpHeldDown);
+    auto [stack_device, peer] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)}, {
+        .max_attempts = 3,
+        .retry_interval = 100ms,
+        .max_retry_interval = 200ms,
+        .hold_down = 10s
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    std::array payload{std::byte{1}};
+    EXPECT_TRUE(stack.send_to(gateway, ethernet::Ethertype::IPv4, payload));
+    EXPECT_EQ(count_requests(peer), 1);
+    EXPECT_EQ(stack.state(gateway), arp::State::Incomplete);
+
+    // Not due yet.
+    stack.poll(start + 50ms);
+    EXPECT_EQ(count_requests(peer), 0);
+
+    stack.poll(start + 1s);
+    EXPECT_EQ(count_requests(peer), 1);
+    stack.poll(start + 2s);
+    EXPECT_EQ(count_requests(peer), 1);
+
+    // Out of attempts, the parked packet is dropped.
+    stack.poll(start + 3s);
+    EXPECT_EQ(count_requests(peer), 0);
+    EXPECT_EQ(stack.state(gateway), arp::State::Failed);
+    EXPECT_EQ(count(stats::Counter::ArpDrops) - drops, 1u);
+
+    // Held down, fails fast without asking again.
+    EXPECT_FALSE(stack.send_to(gateway, ethernet::Ethertype::IPv4, payload));
+    EXPECT_EQ(stack.resolve(gateway), std::nullopt);
+    EXPECT_EQ(count_requests(peer), 0);
+
+    EXPECT_EQ(count(stats::Counter::ArpRequests) - requests, 3u);
+    EXPECT_EQ(count(stats::Counter::ArpRetries) - retries, 2u);
+    EXPECT_EQ(count(stats::Counter::ArpFailed) - failed, 1u);
+    EXPECT_EQ(count(stats::Counter::ArpHeldDown) - held_down, 2u);
+
+    // Asked again once the hold down is over.
+    stack.poll(start + 20s);
+    EXPECT_EQ(stack.state(gateway), std::nullopt);
+    EXPECT_TRUE(stack.send_to(gateway, ethernet::Ethertype::IPv4, payload));
+    EXPECT_EQ(count_requests(peer), 1);
+}
+
+TEST(LinkLayer, ArpReplyEndsHoldDown) {
+    auto [stack_device, peer] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)}, {
+        .max_attempts = 1,
+        .hold_down = 1h
+    });
+
+    std::array payload{std::byte{1}};
+    EXPECT_TRUE(stack.send_to(gateway, ethernet::Ethertype::IPv4, payload));
+    stack.poll(std::chrono::steady_clock::now() + 1min);
+    EXPECT_EQ(stack.state(gateway), arp::State::Failed);
+
+    auto reply = arp_frame(mac, arp::OpCode::REPLY, peer_mac, gateway, mac, ip);
+    stack.handle(ethernet::Packet{std::span<const std::byte>{reply.bytes}}.data<arp::Packet>());
+    EXPECT_EQ(stack.state(gateway), arp::State::Reachable);
+    EXPECT_EQ(stack.resolve(gateway), peer_mac);
+}
+
+TEST(LinkLayer, ResolveGivesUpAfterRetries) {
+    auto [stack_device, peer] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)}, {
+        .max_attempts = 3,
+        .retry_interval = 10ms,
+        .max_retry_interval = 10ms
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(stack.resolve(gateway), std::nullopt);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 30ms);
+    EXPECT_EQ(count_requests(peer), 3);
+    EXPECT_EQ(stack.state(gateway), arp::State::Failed);
+}
+
+TEST(LinkLayer, ArpRequestsAreRateLimited) {
+    const auto rate_limited = count(stats::Counter::ArpRateLimited);
+    auto [stack_device, peer] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)}, {
+        .retry_interval = 1h,
+        .max_retry_interval = 1h,
+        .request_limit = {.rate = 1, .burst = 2}
+    });
+
+    std::array payload{std::byte{1}};
+    for (uint32_t i = 0; i < 4; ++i) {
+        EXPECT_TRUE(stack.send_to(IPv4_t{gateway + i}, ethernet::Ethertype::IPv4, payload));
+    }
+    EXPECT_EQ(count_requests(peer), 2);
+    EXPECT_EQ(count(stats::Counter::ArpRateLimited) - rate_limited, 2u);
+
+    // The held back requests go out as tokens come back.
+    stack.poll(std::chrono::steady_clock::now() + 2s);
+    EXPECT_EQ(count_requests(peer), 2);
+    EXPECT_EQ(count(stats::Counter::ArpRateLimited) - rate_limited, 2u);
+}
+
+TEST(LinkLayer, GratuitousArpAtStartup) {
+    auto [stack_device, peer] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)});
+
+    auto start = std::chrono::steady_clock::now();
+    stack.announce(start);
+
+    std::array<std::byte, ethernet::max_size> buffer;
+    auto read = peer.try_read(buffer, 0ms);
+    ASSERT_GT(read, 0);
+
+    ethernet::Packet frame{std::span{buffer}.first(static_cast<std::size_t>(read))};
+    EXPECT_EQ(frame.get<"destination_mac">(), ethernet::mac_broadcast);
+    auto announcement = frame.data<arp::Packet>().decode();
+    EXPECT_EQ(announcement.get<"opcode">(), arp::OpCode::REQUEST);
+    EXPECT_EQ(announcement.get<"source_mac">(), mac);
+    EXPECT_EQ(announcement.get<"source_ip">(), ip);
+    EXPECT_EQ(announcement.get<"destination_mac">(), 0u);
+    EXPECT_EQ(announcement.get<"destination_ip">(), ip);
+
+    stack.poll(start + 1s);
+    EXPECT_EQ(count_requests(peer), 0);
+    stack.poll(start + 2s);
+    EXPECT_EQ(count_requests(peer), 1);
+    stack.poll(start + 10s);
+    EXPECT_EQ(count_requests(peer), 0);
+}
+
+TEST(LinkLayer, ArpRefreshesNeighborsInUse) {
+    const auto refreshes = count(stats::Counter::ArpRefreshes);
+    auto [stack_device, peer] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)}, {
+        .cache = {.reachable_time = 30s},
+        .refresh_lead = 5s
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    auto reply = arp_frame(mac, arp::OpCode::REPLY, peer_mac, gateway, mac, ip);
+    stack.handle(ethernet::Packet{std::span<const std::byte>{reply.bytes}}.data<arp::Packet>());
+
+    std::array payload{std::byte{1}};
+    EXPECT_TRUE(stack.send_to(gateway, ethernet::Ethertype::IPv4, payload));
+    EXPECT_EQ(count_requests(peer), 0);
+
+    stack.poll(start + 20s);
+    EXPECT_EQ(count_requests(peer), 0);
+
+    // Unicast, shortly before the entry would go stale.
+    stack.poll(start + 26s);
+    std::array<std::byte, ethernet::max_size> buffer;
+    auto read = peer.try_read(buffer, 0ms);
+    ASSERT_GT(read, 0);
+    ethernet::Packet frame{std::span{buffer}.first(static_cast<std::size_t>(read))};
+    EXPECT_EQ(frame.get<"destination_mac">(), peer_mac);
+    auto request = frame.data<arp::Packet>().decode();
+    EXPECT_EQ(request.get<"opcode">(), arp::OpCode::REQUEST);
+    EXPECT_EQ(request.get<"destination_ip">(), gateway);
+
+    // Not used since, not asked again.
+    stack.poll(start + 32s);
+    EXPECT_EQ(count_requests(peer), 0);
+
+    EXPECT_TRUE(stack.send_to(gateway, ethernet::Ethertype::IPv4, payload));
+    stack.poll(start + 33s);
+    EXPECT_EQ(count_requests(peer), 1);
+    EXPECT_EQ(count(stats::Counter::ArpRefreshes) - refreshes, 2u);
+}
+
+TEST(LinkLayer, SendFragmentsLargeDatagrams) {
+    auto [stack_device, peer] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)}, {}, {.mtu = 1500});
+
+    auto reply = arp_frame(mac, arp::OpCode::REPLY, peer_mac, gateway, mac, ip);
+    stack.handle(ethernet::Packet{std::span<const std::byte>{reply.bytes}}.data<arp::Packet>());
+
+    std::vector<std::byte> header(8, std::byte{0xAA});
+    std::vector<std::byte> payload(4000);
+    for (std::size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<std::byte>(i);
+    }
+
+    // Off the subnet, through the gateway.
+    constexpr IPv4_t destination = "192.168.1.1"_ipv4;
+    std::array<std::span<const std::byte>, 2> parts{header, payload};
+    EXPECT_TRUE(stack.send(destination, ipv4::Protocol::UDP, parts));
+
+    ipv4::Assembler assembler;
+    std::optional<ipv4::Datagram> datagram;
+    std::array<std::byte, ethernet::max_size> buffer;
+    int fragments = 0;
+    while (!datagram) {
+        auto read = peer.try_read(buffer, 0ms);
+        ASSERT_GT(read, 0);
+        ++fragments;
+
+        ethernet::Packet frame{std::span<const std::byte>{buffer}.first(static_cast<std::size_t>(read))};
+        EXPECT_EQ(frame.get<"destination_mac">(), peer_mac);
+        EXPECT_EQ(frame.get<"ethertype">(), ethernet::Ethertype::IPv4);
+
+        auto packet = frame.data<ipv4::Packet>();
+        ASSERT_TRUE(packet.is_valid());
+        EXPECT_LE(packet.bytes.size(), 1500u);
+        EXPECT_EQ(packet.get<"source_address">(), ip);
+        EXPECT_EQ(packet.get<"destination_address">(), destination);
+        EXPECT_EQ(packet.get<"ttl">(), 64);
+        datagram = assembler.assemble(packet);
+    }
+
+    EXPECT_EQ(fragments, 3);
+    EXPECT_EQ(datagram->protocol, ipv4::Protocol::UDP);
+    ASSERT_EQ(datagram->payload().size(), header.size() + payload.size());
+    EXPECT_TRUE(std::ranges::equal(datagram->payload().first(header.size()), header));
+    EXPECT_TRUE(std::ranges::equal(datagram->payload().subspan(header.size()), payload));
+
+    // Fits in one packet, not fragmented.
+    EXPECT_TRUE(stack.send(destination, ipv4::Protocol::UDP, std::span{payload}.first(1480)));
+    auto read = peer.try_read(buffer, 0ms);
+    ASSERT_EQ(read, static_cast<device::ssize_t>(ethernet::Format::byte_size() + 1500));
+    auto single = ethernet::Packet{std::span<const std::byte>{buffer}.first(static_cast<std::size_t>(read))}.data<ipv4::Packet>();
+    EXPECT_EQ(single.get<"more_fragments">(), 0);
+    EXPECT_EQ(single.get<"fragment_offset">(), 0);
+
+    std::vector<std::byte> too_large(ipv4::Handler<InternetLayer<MemoryDevice>>::max_payload + 1);
+    EXPECT_FALSE(stack.send(destination, ipv4::Protocol::UDP, too_large));
+}
+
+// Reads the next IPv4 frame, skipping ARP.
+static device::ssize_t read_ipv4(MemoryDevice& peer, std::span<std::byte> buffer) {
+    while (true) {
+        auto read = peer.try_read(buffer, 1s);
+        if (read <= 0 || ethernet::Packet{buffer}.get<"ethertype">() == ethernet::Ethertype::IPv4) {
+            return read;
+        }
+    }
+}
+
+TEST(LinkLayer, AnswersEchoRequests) {
+    const auto echo_requests = count(stats::Counter::IcmpEchoRequests);
+    const auto echo_replies = count(stats::Counter::IcmpEchoReplies);
+    constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+
+    auto [stack_device, peer_device] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)}, {}, {.ttl = 32});
+    InternetLayer<MemoryDevice> peer(peer_ip, gateway, {peer_mac, std::move(peer_device)});
+    auto& device = peer.get_device();
+
+    // Both sides know each other.
+    auto reply = arp_frame(peer_mac, arp::OpCode::REPLY, mac, ip, peer_mac, peer_ip);
+    peer.handle(ethernet::Packet{std::span<const std::byte>{reply.bytes}}.data<arp::Packet>());
+    auto request = arp_frame(mac, arp::OpCode::REQUEST, peer_mac, peer_ip, 0, ip);
+    ASSERT_EQ(device.write(request.bytes), static_cast<device::ssize_t>(request.bytes.size()));
+
+    std::jthread thread([&](std::stop_token stop_token){
+        stack.run(stop_token);
+    });
+
+    auto echo = [&](uint16_t sequence, std::size_t size) {
+        std::vector<std::byte> message(icmp::Format::byte_size() + size);
+        icmp::Packet<std::span<std::byte>> packet{std::span{message}};
+        packet.set<"type">(icmp::Type::EchoRequest);
+        packet.set<"id">(0x1234);
+        packet.set<"sequence">(sequence);
+        for (std::size_t i = 0; i < size; ++i) {
+            packet.data()[i] = static_cast<std::byte>(i);
+        }
+        packet.set<"checksum">(checksum::compute(message));
+
+        EXPECT_TRUE(peer.send(ip, ipv4::Protocol::ICMP, message));
+        return message;
+    };
+
+    auto expect_reply = [](std::span<const std::byte> reply, std::span<const std::byte> request) {
+        ASSERT_EQ(reply.size(), request.size());
+        icmp::Packet<std::span<const std::byte>> packet{reply};
+        EXPECT_EQ(packet.get<"type">(), icmp::Type::EchoReply);
+        EXPECT_EQ(checksum::compute(reply), 0);
+        EXPECT_TRUE(std::ranges::equal(reply.subspan(4), request.subspan(4)));
+    };
+
+    // Answered in place.
+    auto message = echo(1, 56);
+    std::array<std::byte, ethernet::max_size> buffer;
+    auto read = read_ipv4(device, buffer);
+    ASSERT_GT(read, 0);
+
+    ethernet::Packet frame{std::span<const std::byte>{buffer}.first(static_cast<std::size_t>(read))};
+    EXPECT_EQ(frame.get<"destination_mac">(), peer_mac);
+    EXPECT_EQ(frame.get<"source_mac">(), mac);
+
+    auto packet = frame.data<ipv4::Packet>();
+    ASSERT_TRUE(packet.is_valid());
+    EXPECT_EQ(packet.get<"source_address">(), ip);
+    EXPECT_EQ(packet.get<"destination_address">(), peer_ip);
+    EXPECT_EQ(packet.get<"ttl">(), 32);
+    EXPECT_EQ(packet.get<"protocol">(), ipv4::Protocol::ICMP);
+    expect_reply(packet.payload(), message);
+
+    // Reassembled first, the reply is fragmented again.
+    message = echo(2, 4000);
+    ipv4::Assembler assembler;
+    std::optional<ipv4::Datagram> datagram;
+    while (!datagram) {
+        read = read_ipv4(device, buffer);
+        ASSERT_GT(read, 0);
+        datagram = assembler.assemble(ethernet::Packet{std::span<const std::byte>{buffer}.first(static_cast<std::size_t>(read))}.data<ipv4::Packet>());
+    }
+    EXPECT_EQ(datagram->source_address, ip);
+    expect_reply(datagram->payload(), message);
+
+    thread.request_stop();
+    thread.join();
+    EXPECT_EQ(count(stats::Counter::IcmpEchoRequests) - echo_requests, 2u);
+    EXPECT_EQ(count(stats::Counter::IcmpEchoReplies) - echo_replies, 2u);
+}
+
+TEST(LinkLayer, ReassemblyTimesOutWhileIdle) {
+    constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+
+    auto [stack_device, stack_wire] = MemoryDevice::pair();
+    auto [peer_device, peer_wire] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(stack_device)}, {}, {.reassembly = {.timeout = 50ms}});
+    InternetLayer<MemoryDevice> peer(peer_ip, gateway, {peer_mac, std::move(peer_device)});
+
+    auto reply = arp_frame(peer_mac, arp::OpCode::REPLY, mac, ip, peer_mac, peer_ip);
+    peer.handle(ethernet::Packet{std::span<const std::byte>{reply.bytes}}.data<arp::Packet>());
+
+    // Only the first fragment reaches the stack, nothing else follows it.
+    std::vector<std::byte> payload(3000);
+    ASSERT_TRUE(peer.send(ip, ipv4::Protocol::UDP, payload));
+    std::array<std::byte, ethernet::max_size> buffer;
+    auto read = read_ipv4(peer_wire, buffer);
+    ASSERT_GT(read, 0);
+
+    const auto timeouts = [] {
+        return count(stats::Counter::ReassemblyTimeouts);
+    };
+    const auto before = timeouts();
+
+    std::jthread thread([&](std::stop_token stop_token){
+        stack.run(stop_token);
+    });
+    ASSERT_EQ(stack_wire.write(std::span{buffer}.first(static_cast<std::size_t>(read))), read);
+
+    for (int i = 0; i < 100 && timeouts() == before; ++i) {
+        std::this_thread::sleep_for(10ms);
+    }
+    EXPECT_EQ(timeouts() - before, 1u);
+
+    thread.request_stop();
+    thread.join();
+}
+
+// Frames too large for the slots of a MemoryDevice, passed on whole with
+// their virtio-net header.
+struct LargeFrames {
+    std::mutex mutex;
+    std::deque<std::vector<std::byte>> frames;
+    std::size_t taken = 0;
+};
+
+// Frames of a TAP device with a virtio-net header: the header in front of
+// every frame read is empty, unless it is a large one, and checksums of
+// frames written are completed. Large frames are written to large_tx and
+// read from large_rx if given.
+struct VnetMemory {
+    MemoryDevice device;
+    unsigned offload_flags = 0;
+    std::shared_ptr<LargeFrames> large_rx{};
+    std::shared_ptr<LargeFrames> large_tx{};
+
+    bool has_vnet_header() const noexcept {
+        return true;
+    }
+
+    unsigned offloads() const noexcept {
+        return offload_flags;
+    }
+
+    device::ssize_t write(std::span<const std::byte> frame) noexcept {
+        return writev(device::Parts{&frame, 1});
+    }
+
+    device::ssize_t writev(device::Parts parts) noexcept {
+        std::vector<std::byte> bytes;
+        for (auto part : parts) {
+            bytes.insert(bytes.end(), part.begin(), part.end());
+        }
+        if (bytes.size() < virtio_net::Format::byte_size()) {
+            return -1;
+        }
+        const auto written = static_cast<device::ssize_t>(bytes.size());
+        if (large_tx && bytes.size() > virtio_net::Format::byte_size() + ethernet::max_size) {
+            std::lock_guard lock(large_tx->mutex);
+            large_tx->frames.push_back(std::move(bytes));
+            return written;
+        }
+
+        const auto header = virtio_net::Packet{std::span<const std::byte>{bytes}}.decode();
+        auto frame = std::span{bytes}.subspan(virtio_net::Format::byte_size());
+        if (header.get<"flags">() & virtio_net::NeedsChecksum) {
+            const std::size_t start = header.get<"checksum_start">();
+            const std::size_t offset = header.get<"checksum_offset">();
+            const auto sum = checksum::compute(frame.subspan(start));
+            frame[start + offset] = static_cast<std::byte>(sum >> 8);
+            frame[start + offset + 1] = static_cast<std::byte>(sum);
+        }
+        device.write(frame);
+        return written;
+    }
+
+    device::ssize_t try_read(std::span<std::byte> buffer, device::Timeout timeout) noexcept {
+        if (large_rx) {
+            std::unique_lock lock(large_rx->mutex);
+            if (!large_rx->frames.empty()) {
+                auto frame = std::move(large_rx->frames.front());
+                large_rx->frames.pop_front();
+                ++large_rx->taken;
+                lock.unlock();
+
+                // Cut short like a read into a small buffer.
+                const auto size = std::min(frame.size(), buffer.size());
+                std::copy_n(frame.begin(), size, buffer.begin());
+                return static_cast<device::ssize_t>(size);
+            }
+        }
+
+        constexpr auto header_size = virtio_net::Format::byte_size();
+        auto read = device.try_read(buffer.subspan(header_size), timeout);
+        if (read <= 0) {
+            return read;
+        }
+        std::fill_n(buffer.begin(), header_size, std::byte{0});
+        return read + static_cast<device::ssize_t>(header_size);
+    }
+};
+
+static_assert(device::VnetDevice<VnetMemory>);
+
+TEST(LinkLayer, AnswersEchoRequestsBehindVnetHeader) {
+    const auto echo_replies = count(stats::Counter::IcmpEchoReplies);
+    constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+
+    auto [stack_device, peer_device] = MemoryDevice::pair();
+    InternetLayer<VnetMemory> stack(ip, gateway, {mac, VnetMemory{std::move(stack_device)}}, {}, {.ttl = 32});
+    InternetLayer<MemoryDevice> peer(peer_ip, gateway, {peer_mac, std::move(peer_device)});
+    auto& device = peer.get_device();
+
+    auto reply = arp_frame(peer_mac, arp::OpCode::REPLY, mac, ip, peer_mac, peer_ip);
+    peer.handle(ethernet::Packet{std::span<const std::byte>{reply.bytes}}.data<arp::Packet>());
+    auto request = arp_frame(mac, arp::OpCode::REQUEST, peer_mac, peer_ip, 0, ip);
+    ASSERT_EQ(device.write(request.bytes), static_cast<device::ssize_t>(request.bytes.size()));
+
+    std::jthread thread([&](std::stop_token stop_token){
+        stack.run(stop_token);
+    });
+
+    // Answered in the frame it came in, behind the header. A full sized
+    // frame fits in the receive buffer along with it.
+    for (std::size_t size : {56, 1472}) {
+        std::vector<std::byte> message(icmp::Format::byte_size() + size);
+        icmp::Packet<std::span<std::byte>> echo{std::span{message}};
+        echo.set<"type">(icmp::Type::EchoRequest);
+        echo.set<"id">(0x1234);
+        echo.set<"sequence">(1);
+        echo.set<"checksum">(checksum::compute(message));
+        ASSERT_TRUE(peer.send(ip, ipv4::Protocol::ICMP, message));
+
+        std::array<std::byte, ethernet::max_size> buffer;
+        auto read = read_ipv4(device, buffer);
+        ASSERT_GT(read, 0);
+
+        ethernet::Packet frame{std::span<const std::byte>{buffer}.first(static_cast<std::size_t>(read))};
+        EXPECT_EQ(frame.get<"destination_mac">(), peer_mac);
+        EXPECT_EQ(frame.get<"source_mac">(), mac);
+
+        auto packet = frame.data<ipv4::Packet>();
+        ASSERT_TRUE(packet.is_valid());
+        EXPECT_EQ(packet.get<"source_address">(), ip);
+        EXPECT_EQ(packet.get<"destination_address">(), peer_ip);
+        EXPECT_EQ(packet.get<"ttl">(), 32);
+
+        const auto answer = packet.payload();
+        ASSERT_EQ(answer.size(), message.size());
+        EXPECT_EQ(icmp::Packet{answer}.get<"type">(), icmp::Type::EchoReply);
+        EXPECT_EQ(checksum::compute(answer), 0);
+        EXPECT_TRUE(std::ranges::equal(answer.subspan(4), std::span{message}.subspan(4)));
+    }
+
+    thread.request_stop();
+    thread.join();
+    EXPECT_EQ(count(stats::Counter::IcmpEchoReplies) - echo_replies, 2u);
+}
+
+TEST(LinkLayer, DropsFramesTooLargeToJoin) {
+    const auto oversized = count(stats::Counter::OversizedFrames);
+
+    auto [stack_device, peer_device] = MemoryDevice::pair();
+    InternetLayer<VnetMemory> stack(ip, gateway, {mac, VnetMemory{std::move(stack_device)}});
+
+    // Behind the virtio-net and ethernet headers the pieces are too many to
+    // gather, they are joined into one frame if they fit in it.
+    std::vector<std::byte> payload(device::max_parts * 400);
+    std::array<std::span<const std::byte>, device::max_parts> parts;
+    for (std::size_t size : {100, 400}) {
+        for (std::size_t i = 0; i < parts.size(); ++i) {
+            parts[i] = std::span{payload}.subspan(i * size, size);
+        }
+        EXPECT_EQ(stack.send(peer_mac, ethernet::Ethertype::IPv4, parts), size == 100);
+    }
+    EXPECT_EQ(count(stats::Counter::OversizedFrames) - oversized, 1u);
+}
+
+TEST(LinkLayer, ReceivesSegmentationOffloadedFrames) {
+    const auto checksum_errors = count(stats::Counter::TcpChecksumErrors);
+    constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+    constexpr unsigned offloads = virtio_net::Checksum | virtio_net::TSO4;
+
+    // The peer's TCP segments of up to 64KB reach the stack uncut, as the
+    // kernel hands them over with TSO4.
+    auto [stack_device, peer_device] = MemoryDevice::pair();
+    auto large_frames = std::make_shared<LargeFrames>();
+    InternetLayer<VnetMemory> stack(ip, gateway, {mac, VnetMemory{std::move(stack_device), offloads, large_frames, nullptr}});
+    InternetLayer<VnetMemory> peer(peer_ip, gateway, {peer_mac, VnetMemory{std::move(peer_device), offloads, nullptr, large_frames}});
+
+    std::jthread stack_thread([&](std::stop_token stop_token){
+        stack.run(stop_token);
+    });
+    std::jthread peer_thread([&](std::stop_token stop_token){
+        peer.run(stop_token);
+    });
+
+    auto listener = stack.listen(8000);
+    ASSERT_TRUE(listener.has_value());
+
+    std::vector<std::byte> data(1 << 20);
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<std::byte>(i * 31 + i / 251);
+    }
+    std::vector<std::byte> received;
+    std::jthread server([&]{
+        auto connection = listener->accept();
+        ASSERT_TRUE(connection.has_value());
+
+        std::vector<std::byte> buffer(64 << 10);
+        while (auto count = connection->receive(buffer)) {
+            received.insert(received.end(), buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(count));
+        }
+    });
+
+    auto connection = peer.connect(ip, 8000);
+    ASSERT_TRUE(connection.has_value());
+    EXPECT_EQ(connection->send(data), data.size());
+    connection->shutdown();
+    server.join();
+
+    EXPECT_EQ(received.size(), data.size());
+    EXPECT_TRUE(std::ranges::equal(received, data));
+    EXPECT_EQ(count(stats::Counter::TcpChecksumErrors) - checksum_errors, 0u);
+    std::lock_guard lock(large_frames->mutex);
+    EXPECT_GT(large_frames->taken, 0u);
+}
+
+static bool bring_up(const Tap& tap) {
+    int control = socket(AF_INET, SOCK_DGRAM, 0);
+    ifreq ifr{};
+    tap.get_name().copy(ifr.ifr_name, IFNAMSIZ - 1);
+    bool up = control >= 0 && ioctl(control, SIOCGIFFLAGS, &ifr) == 0;
+    if (up) {
+        ifr.ifr_flags = static_cast<short>(ifr.ifr_flags | IFF_UP);
+        up = ioctl(control, SIOCSIFFLAGS, &ifr) == 0;
+    }
+    close(control);
+    return up;
+}
+
+TEST(LinkLayer, AnswersEchoRequestsThroughPacketSocket) {
+    const auto echo_requests = count(stats::Counter::IcmpEchoRequests);
+    const auto echo_replies = count(stats::Counter::IcmpEchoReplies);
+    constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+
+    // The stack is attached to a TAP interface, the test writes the peer's
+    // frames into it and reads the stack's frames from it.
+    auto tap = Tap::try_new();
+    if (!tap) {
+        GTEST_SKIP() << tap.error().what();
+    }
+    if (!bring_up(*tap)) {
+        GTEST_SKIP() << "Cannot bring " << tap->get_name() << " up";
+    }
+    auto socket = PacketSocket::try_new(tap->get_name());
+    if (!socket) {
+        GTEST_SKIP() << socket.error().what();
+    }
+
+    auto [peer_device, wire] = MemoryDevice::pair();
+    InternetLayer<PacketSocket> stack(ip, gateway, {mac, std::move(*socket)}, {}, {.ttl = 32});
+    InternetLayer<MemoryDevice> peer(peer_ip, gateway, {peer_mac, std::move(peer_device)});
+
+    auto reply = arp_frame(peer_mac, arp::OpCode::REPLY, mac, ip, peer_mac, peer_ip);
+    peer.handle(ethernet::Packet{std::span<const std::byte>{reply.bytes}}.data<arp::Packet>());
+
+    std::jthread thread([&](std::stop_token stop_token){
+        stack.run(stop_token);
+    });
+
+    // Answered in place, in the ring block the request was received in.
+    std::array<std::byte, ethernet::max_size> buffer;
+    for (uint16_t sequence = 0; sequence < 8; ++sequence) {
+        const std::size_t size = sequence % 2 == 0 ? 56 : 1472;
+        std::vector<std::byte> message(icmp::Format::byte_size() + size);
+        icmp::Packet<std::span<std::byte>> echo{std::span{message}};
+        echo.set<"type">(icmp::Type::EchoRequest);
+        echo.set<"id">(0x1234);
+        echo.set<"sequence">(sequence);
+        echo.set<"checksum">(checksum::compute(message));
+        ASSERT_TRUE(peer.send(ip, ipv4::Protocol::ICMP, message));
+
+        auto read = read_ipv4(wire, buffer);
+        ASSERT_GT(read, 0);
+        ASSERT_EQ(tap->write(std::span{buffer}.first(static_cast<std::size_t>(read))), read);
+
+        // Skip whatever else the kernel sends on the interface.
+        std::optional<ethernet::Packet<std::span<const std::byte>>> frame;
+        while (!frame) {
+            read = tap->try_read(buffer, 1s);
+            ASSERT_GT(read, 0);
+            ethernet::Packet candidate{std::span<const std::byte>{buffer}.first(static_cast<std::size_t>(read))};
+            if (candidate.get<"source_mac">() == mac && candidate.get<"ethertype">() == ethernet::Ethertype::IPv4) {
+                frame = candidate;
+            }
+        }
+        EXPECT_EQ(frame->get<"destination_mac">(), peer_mac);
+
+        auto packet = frame->data<ipv4::Packet>();
+        ASSERT_TRUE(packet.is_valid());
+        EXPECT_EQ(packet.get<"source_address">(), ip);
+        EXPECT_EQ(packet.get<"destination_address">(), peer_ip);
+        EXPECT_EQ(packet.get<"ttl">(), 32);
+
+        const auto answer = packet.payload();
+        ASSERT_EQ(answer.size(), message.size());
+        EXPECT_EQ(icmp::Packet{answer}.get<"type">(), icmp::Type::EchoReply);
+        EXPECT_EQ(checksum::compute(answer), 0);
+        EXPECT_TRUE(std::ranges::equal(answer.subspan(4), std::span{message}.subspan(4)));
+    }
+
+    thread.request_stop();
+    thread.join();
+    EXPECT_EQ(count(stats::Counter::IcmpEchoRequests) - echo_requests, 8u);
+    EXPECT_EQ(count(stats::Counter::IcmpEchoReplies) - echo_replies, 8u);
+}
+
+// Receive queues backed by memory devices, frames are written to the first one.
+struct MultiQueueMemory {
+    using Queue = MemoryDevice;
+    std::vector<MemoryDevice> queues;
+
+    device::ssize_t write(std::span<const std::byte> frame) noexcept {
+        return queues.front().write(frame);
+    }
+
+    device::ssize_t try_read(std::span<std::byte> buffer, device::Timeout timeout) noexcept {
+        return queues.front().try_read(buffer, timeout);
+    }
+
+    std::size_t queue_count() const noexcept {
+        return queues.size();
+    }
+
+    MemoryDevice& queue(std::size_t index) noexcept {
+        return queues[index];
+    }
+};
+
+static_assert(device::MultiQueueDevice<MultiQueueMemory>);
+
+TEST(LinkLayer, ReceivesOnEveryQueue) {
+    const auto echo_requests = count(stats::Counter::IcmpEchoRequests);
+    constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+    constexpr std::size_t queue_count = 3;
+
+    MultiQueueMemory device;
+    std::vector<MemoryDevice> queues;
+    for (std::size_t i = 0; i < queue_count; ++i) {
+        auto [queue, peer_queue] = MemoryDevice::pair();
+        device.queues.push_back(std::move(queue));
+        queues.push_back(std::move(peer_queue));
+    }
+    InternetLayer<MultiQueueMemory> stack(ip, gateway, {mac, std::move(device), {}, {0, -1}});
+
+    // The peer is not running, its frames are dealt out to the queues by hand.
+    auto [peer_device, wire] = MemoryDevice::pair();
+    InternetLayer<MemoryDevice> peer(peer_ip, gateway, {peer_mac, std::move(peer_device)});
+    auto reply = arp_frame(peer_mac, arp::OpCode::REPLY, mac, ip, peer_mac, peer_ip);
+    peer.handle(ethernet::Packet{std::span<const std::byte>{reply.bytes}}.data<arp::Packet>());
+
+    std::jthread thread([&](std::stop_token stop_token){
+        stack.run(stop_token);
+    });
+
+    // Learned from a request on the second queue, answered through the first.
+    auto request = arp_frame(mac, arp::OpCode::REQUEST, peer_mac, peer_ip, 0, ip);
+    ASSERT_EQ(queues[1].write(request.bytes), static_cast<device::ssize_t>(request.bytes.size()));
+
+    std::array<std::byte, ethernet::max_size> buffer;
+    auto read = read_frame(queues[0], buffer, 1s);
+    ASSERT_GT(read, 0);
+    EXPECT_EQ(ethernet::Packet{buffer}.data<arp::Packet>().get<"opcode">(), arp::OpCode::REPLY);
+
+    // One fragment of the echo request on each queue, reassembled as one.
+    std::vector<std::byte> message(icmp::Format::byte_size() + 4000);
+    icmp::Packet<std::span<std::byte>> echo{std::span{message}};
+    echo.set<"type">(icmp::Type::EchoRequest);
+    echo.set<"id">(0x1234);
+    echo.set<"sequence">(1);
+    echo.set<"checksum">(checksum::compute(message));
+    ASSERT_TRUE(peer.send(ip, ipv4::Protocol::ICMP, message));
+
+    for (std::size_t i = 0; i < queue_count; ++i) {
+        read = wire.try_read(buffer, 0ms);
+        ASSERT_GT(read, 0);
+        ASSERT_EQ(queues[i].write(std::span{buffer}.first(static_cast<std::size_t>(read))), read);
+    }
+    EXPECT_EQ(wire.try_read(buffer, 0ms), 0);
+
+    ipv4::Assembler assembler;
+    std::optional<ipv4::Datagram> datagram;
+    while (!datagram) {
+        read = read_ipv4(queues[0], buffer);
+        ASSERT_GT(read, 0);
+        datagram = assembler.assemble(ethernet::Packet{std::span<const std::byte>{buffer}.first(static_cast<std::size_t>(read))}.data<ipv4::Packet>());
+    }
+    ASSERT_EQ(datagram->payload().size(), message.size());
+    EXPECT_EQ(icmp::Packet{datagram->payload()}.get<"type">(), icmp::Type::EchoReply);
+
+    thread.request_stop();
+    thread.join();
+    EXPECT_EQ(count(stats::Counter::IcmpEchoRequests) - echo_requests, 1u);
+}
@@ -0,0 +1,100 @@
+#include <sstream>
+#include <iostream>
+#include <format>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "gtest/gtest.h"
+
+#include "logging.h"
+
+// Messages written since the output was set, without their timestamps.
+static std::vector<std::string> messages(const std::ostringstream& output) {
+    std::vector<std::string> lines;
+    std::istringstream input{output.str()};
+    for (std::string line; std::getline(input, line);) {
+        lines.push_back(line.substr(line.find("] ") + 2));
+    }
+    return lines;
+}
+
+class Logging : public testing::Test {
+protected:
+    std::ostringstream output;
+
+    void SetUp() override {
+        logging::flush();
+        logging::set_output(output);
+    }
+
+    void TearDown() override {
+        logging::flush();
+        logging::set_output(std::cout);
+    }
+};
+
+TEST_F(Logging, FormatsArguments) {
+    std::string name = "tap0";
+    logging::info("Created TAP device {} with {} queues", name, 4u);
+    logging::error("Failed: {}", "Operation not permitted");
+    logging::warning("{:0>2X} {}", 10, std::string(100, 'x'));
+    name = "changed";
+    logging::flush();
+
+    const std::vector<std::string> expected{
+        "Created TAP device tap0 with 4 queues",
+        "Failed: Operation not permitted",
+        "0A " + std::string(60, 'x') + "..."
+    };
+    EXPECT_EQ(messages(output), expected);
+}
+
+TEST_F(Logging, FiltersAtCompileTime) {
+    static_assert(logging::min_level == logging::Level{NETSTACK_LOG_LEVEL});
+
+    logging::debug("read {} bytes", 60);
+    logging::flush();
+
+    EXPECT_EQ(messages(output).size(), logging::min_level == logging::Level::Debug ? 1u : 0u);
+}
+
+TEST_F(Logging, CollectsEveryThread) {
+    constexpr int count = 100;
+    std::vector<std::jthread> threads;
+    for (int thread = 0; thread < 4; ++thread) {
+        threads.emplace_back([thread]{
+            for (int i = 0; i < count; ++i) {
+                logging::info("{} {}", thread, i);
+            }
+        });
+    }
+    threads.clear();
+    logging::flush();
+
+    auto lines = messages(output);
+    ASSERT_EQ(lines.size(), 4u * count);
+    // Every thread's messages stay in order.
+    for (int thread = 0; thread < 4; ++thread) {
+        int next = 0;
+        for (const auto& line : lines) {
+            if (line.starts_with(std::to_string(thread) + " ")) {
+                EXPECT_EQ(line, std::format("{} {}", thread, next));
+                ++next;
+            }
+        }
+        EXPECT_EQ(next, count);
+    }
+}
+
+TEST_F(Logging, DropsWhenFull) {
+    constexpr std::size_t count = 10000;
+    const auto dropped = logging::dropped();
+    for (std::size_t i = 0; i < count; ++i) {
+        logging::info("{}", i);
+    }
+    logging::flush();
+
+    EXPECT_EQ(messages(output).size() + (logging::dropped() - dropped), count);
+}
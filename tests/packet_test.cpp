@@ -2,6 +2,8 @@
 #include <ranges>
 #include <algorithm>
 #include <format>
+#include <utility>
+#include <cstdint>
 
 #include "gtest/gtest.h"
 #include "packet.h"
@@ -231,3 +233,114 @@ TEST(FormatSet, ByteUnaligned) {
         "end",   0b1000'0001u
     >(format{}, packet);
 }
+
+template<std::size_t first_bit, std::size_t bit_length>
+void expect_word_matches_bitwise(std::span<const std::byte> random, uint64_t value) {
+    using Type = utils::leastN_t<bit_length>;
+    constexpr auto byte_length = utils::bits_to_bytes(first_bit + bit_length);
+
+    std::array<std::byte, byte_length> bytes;
+    std::ranges::copy(random.first(byte_length), bytes.begin());
+    auto expected = bytes;
+
+    EXPECT_EQ(
+        (packet::get_word<first_bit, bit_length, Type>(bytes)),
+        (packet::get_bitwise<first_bit, bit_length, Type>(bytes))
+    ) << "first bit " << first_bit << " length " << bit_length;
+
+    auto field = static_cast<Type>(value & ((uint64_t{1} << (bit_length - 1) << 1) - 1));
+    packet::set_word<first_bit, bit_length>(std::span{bytes}, field);
+    packet::set_bitwise<first_bit, bit_length>(std::span{expected}, field);
+    EXPECT_EQ(bytes, expected) << "first bit " << first_bit << " length " << bit_length;
+}
+
+template<std::size_t first_bit, std::size_t... lengths>
+void expect_words_match_bitwise(std::span<const std::byte> random, uint64_t value, std::index_sequence<lengths...>) {
+    (expect_word_matches_bitwise<first_bit, lengths + 1>(random, value), ...);
+}
+
+TEST(Format, WordMatchesBitwise) {
+    std::array<std::byte, 8> random;
+    uint64_t value = 0x9E37'79B9'7F4A'7C15;
+
+    for (int i = 0; i < 16; ++i) {
+        value = value * 6364136223846793005 + 1442695040888963407;
+        for (std::size_t j = 0; j < random.size(); ++j) {
+            random[j] = static_cast<std::byte>(value >> (j * 8));
+        }
+
+        [&]<std::size_t... first_bits>(std::index_sequence<first_bits...>) {
+            (expect_words_match_bitwise<first_bits>(random, ~value, std::make_index_sequence<64 - first_bits>{}), ...);
+        }(std::make_index_sequence<8>{});
+    }
+}
+
+TEST(Format, DecodeEncode) {
+    using format = Format<
+        Field{"a", 4},
+        Field{"b", 4},
+        Field{"c", 16},
+        Field{"d", 1},
+        Field{"e", 2},
+        Field{"f", 13},
+        Field{"g", 48},
+        Field{"h", 3},
+        Field{"i", 71},
+        Field{"j", 6},
+        Field{"k", 5}
+    >;
+
+    std::array<std::byte, format::byte_size()> bytes;
+    for (std::size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = static_cast<std::byte>(i * 73 + 5);
+    }
+    // The format ends 3 bits before the last byte does.
+    bytes.back() &= 0xF8_b;
+
+    auto header = format::decode(bytes);
+    EXPECT_EQ(header.get<"a">(), format::get<"a">(bytes));
+    EXPECT_EQ(header.get<"b">(), format::get<"b">(bytes));
+    EXPECT_EQ(header.get<"c">(), format::get<"c">(bytes));
+    EXPECT_EQ(header.get<"d">(), format::get<"d">(bytes));
+    EXPECT_EQ(header.get<"e">(), format::get<"e">(bytes));
+    EXPECT_EQ(header.get<"f">(), format::get<"f">(bytes));
+    EXPECT_EQ(header.get<"g">(), format::get<"g">(bytes));
+    EXPECT_EQ(header.get<"h">(), format::get<"h">(bytes));
+    EXPECT_EQ(header.get<"i">(), format::get<"i">(bytes));
+    EXPECT_EQ(header.get<"j">(), format::get<"j">(bytes));
+    EXPECT_EQ(header.get<"k">(), format::get<"k">(bytes));
+
+    std::array<std::byte, format::byte_size()> encoded{};
+    format::encode(encoded, header);
+    EXPECT_EQ(encoded, bytes);
+
+    header.set<"b">(0b1010);
+    header.set<"e">(0b01);
+    header.set<"h">(0b110);
+    header.set<"k">(0b11111);
+    format::encode(encoded, header);
+
+    auto expected = bytes;
+    format::set<"b">(expected, 0b1010);
+    format::set<"e">(expected, 0b01);
+    format::set<"h">(expected, 0b110);
+    format::set<"k">(expected, 0b11111);
+    EXPECT_EQ(encoded, expected);
+    EXPECT_EQ(format::decode(encoded), header);
+}
+
+TEST(Format, EncodeKeepsTrailingBits) {
+    using format = Format<
+        Field{"a", 3},
+        Field{"b", 9}
+    >;
+
+    std::array<std::byte, 2> bytes{0x00_b, 0x0F_b};
+    format::Header header;
+    header.set<"a">(0b101);
+    header.set<"b">(0b1'1111'1111);
+    format::encode(bytes, header);
+
+    EXPECT_EQ(bytes, (std::array{0xBF_b, 0xFF_b}));
+    EXPECT_EQ(format::decode(bytes), header);
+}
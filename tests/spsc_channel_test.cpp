@@ -0,0 +1,113 @@
+#include <thread>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+#include "gtest/gtest.h"
+
+#include "spsc_channel.h"
+
+using namespace std::chrono_literals;
+
+TEST(SpscChannel, Order) {
+    SpscChannel<int> channel(64);
+    constexpr int count = 100'000;
+
+    std::thread producer{[&]{
+        for (int i = 0; i < count; i += 2) {
+            channel.push(i);
+            channel.emplace(i + 1);
+        }
+        channel.close();
+    }};
+
+    int expected = 0;
+    for (auto value : channel) {
+        EXPECT_EQ(value, expected);
+        ++expected;
+    }
+    EXPECT_EQ(expected, count);
+
+    producer.join();
+}
+
+TEST(SpscChannel, Bounded) {
+    SpscChannel<std::unique_ptr<int>> channel(3);
+    ASSERT_EQ(channel.capacity(), 4u);
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(channel.try_emplace(std::make_unique<int>(i)));
+    }
+    EXPECT_FALSE(channel.try_push(std::make_unique<int>(4)));
+
+    EXPECT_EQ(**channel.try_pop(), 0);
+    EXPECT_TRUE(channel.try_push(std::make_unique<int>(4)));
+
+    for (int i = 1; i < 5; ++i) {
+        EXPECT_EQ(**channel.try_pop(), i);
+    }
+    EXPECT_FALSE(channel.try_pop().has_value());
+}
+
+TEST(SpscChannel, ProducerWaitsForSpace) {
+    SpscChannel<int> channel(2);
+    channel.push(0);
+    channel.push(1);
+
+    std::thread producer{[&]{
+        EXPECT_TRUE(channel.push(2));
+    }};
+
+    std::this_thread::sleep_for(20ms);
+    EXPECT_EQ(channel.pop(), 0);
+    producer.join();
+
+    EXPECT_EQ(channel.pop(), 1);
+    EXPECT_EQ(channel.pop(), 2);
+}
+
+TEST(SpscChannel, Close) {
+    SpscChannel<int> channel;
+
+    std::thread consumer{[&]{
+        EXPECT_EQ(channel.pop(), 1);
+        EXPECT_FALSE(channel.pop().has_value());
+    }};
+
+    channel.push(1);
+    std::this_thread::sleep_for(20ms);
+    channel.close();
+    consumer.join();
+
+    EXPECT_FALSE(channel.push(2));
+}
+
+TEST(SpscChannel, CloseWakesProducer) {
+    SpscChannel<int> channel(2);
+    channel.push(0);
+    channel.push(1);
+
+    std::thread producer{[&]{
+        EXPECT_FALSE(channel.push(2));
+    }};
+
+    std::this_thread::sleep_for(20ms);
+    channel.close();
+    producer.join();
+
+    EXPECT_EQ(channel.pop(), 0);
+    EXPECT_EQ(channel.pop(), 1);
+    EXPECT_FALSE(channel.pop().has_value());
+}
+
+TEST(SpscChannel, DestroysRemaining) {
+    auto value = std::make_shared<int>(0);
+    {
+        SpscChannel<std::shared_ptr<int>> channel(8);
+        channel.push(value);
+        channel.push(value);
+        channel.pop();
+        EXPECT_EQ(value.use_count(), 2);
+    }
+    EXPECT_EQ(value.use_count(), 1);
+}
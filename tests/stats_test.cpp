@@ -0,0 +1,84 @@
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "stats.h"
+
+using stats::Counter;
+
+static uint64_t value(const stats::Values& values, Counter counter) {
+    return values[static_cast<std::size_t>(counter)];
+}
+
+static_assert(sizeof(stats::Block) % stats::cache_line_size == 0);
+static_assert(stats::names.back() == "tcp_malformed");
+
+TEST(Stats, SumsThreads) {
+    const auto before = stats::read();
+
+    stats::add(Counter::FramesReceived);
+    stats::add(Counter::BytesReceived, 60);
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([]{
+                for (int j = 0; j < 1000; ++j) {
+                    stats::add(Counter::FramesReceived);
+                }
+            });
+        }
+    }
+    // Blocks of finished threads keep what they counted.
+    std::jthread([]{
+        stats::add(Counter::FramesReceived);
+    }).join();
+
+    const auto after = stats::read();
+    EXPECT_EQ(value(after, Counter::FramesReceived) - value(before, Counter::FramesReceived), 4002u);
+    EXPECT_EQ(value(after, Counter::BytesReceived) - value(before, Counter::BytesReceived), 60u);
+    EXPECT_EQ(value(after, Counter::FramesSent), value(before, Counter::FramesSent));
+}
+
+TEST(Stats, PublishedToOtherProcesses) {
+    stats::add(Counter::ArpInvalid, 3);
+
+    auto reader = stats::Reader::open(getpid());
+    if (!reader) {
+        GTEST_SKIP() << reader.error().what();
+    }
+    EXPECT_EQ(reader->read(), stats::read());
+
+    stats::add(Counter::ArpInvalid);
+    EXPECT_EQ(value(reader->read(), Counter::ArpInvalid), value(stats::read(), Counter::ArpInvalid));
+
+    EXPECT_FALSE(stats::Reader::open(0).has_value());
+}
+
+TEST(Stats, RejectsTruncatedSegments) {
+    // No process has this pid, the segment only looks like one.
+    constexpr pid_t pid = 0x7FFF'FFF0;
+    const auto name = stats::segment_name(pid);
+    auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        GTEST_SKIP() << "Cannot create " << name;
+    }
+
+    const stats::Header header{
+        .magic = stats::Header::magic_value,
+        .version = stats::Header::current_version,
+        .counters = static_cast<uint32_t>(stats::counter_count),
+        .blocks = static_cast<uint32_t>(stats::max_threads)
+    };
+    const bool written = write(fd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header));
+    close(fd);
+
+    auto reader = stats::Reader::open(pid);
+    shm_unlink(name.c_str());
+    ASSERT_TRUE(written);
+    EXPECT_FALSE(reader.has_value());
+}
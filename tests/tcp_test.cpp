@@ -0,0 +1,440 @@
+#include <array>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "internet_layer.h"
+#include "memory_device.h"
+#include "tcp.h"
+
+using namespace std::chrono_literals;
+
+constexpr IPv4_t ip = "10.0.0.4"_ipv4;
+constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+constexpr IPv4_t gateway = "10.0.0.1"_ipv4;
+constexpr MAC_t mac = "00:0c:29:6d:50:25"_mac;
+constexpr MAC_t peer_mac = "02:00:00:00:00:01"_mac;
+
+// Counters are shared by the stacks of the process, tests look at how much
+// they grew.
+static uint64_t count(stats::Counter counter) {
+    return stats::read()[static_cast<std::size_t>(counter)];
+}
+
+TEST(TCP, Options) {
+    tcp::Options options;
+    options.mss = 1460;
+    options.window_scale = 7;
+    options.sack_permitted = true;
+    options.sack_count = 4;
+    options.sack = {{{1, 2}, {3, 4}, {5, 6}, {7, 8}}};
+
+    std::array<std::byte, tcp::max_options_size> bytes{};
+    auto size = tcp::write_options(options, bytes);
+    EXPECT_EQ(size % 4, 0u);
+    EXPECT_LE(size, bytes.size());
+
+    // Only three blocks fit next to the other options.
+    auto parsed = tcp::parse_options(std::span{bytes}.first(size));
+    EXPECT_EQ(parsed.mss, 1460);
+    EXPECT_EQ(parsed.window_scale, 7);
+    EXPECT_TRUE(parsed.sack_permitted);
+    ASSERT_EQ(parsed.sack_count, 3u);
+    EXPECT_EQ(parsed.sack[2], (tcp::SackBlock{5, 6}));
+
+    tcp::Options sack_only;
+    sack_only.sack_count = 4;
+    sack_only.sack = options.sack;
+    parsed = tcp::parse_options(std::span{bytes}.first(tcp::write_options(sack_only, bytes)));
+    EXPECT_FALSE(parsed.mss.has_value());
+    ASSERT_EQ(parsed.sack_count, 4u);
+    EXPECT_EQ(parsed.sack[3], (tcp::SackBlock{7, 8}));
+
+    // A length running past the end stops parsing.
+    std::array truncated{std::byte{2}, std::byte{4}, std::byte{5}};
+    EXPECT_FALSE(tcp::parse_options(truncated).mss.has_value());
+}
+
+TEST(TCP, ChecksumOfPieces) {
+    std::vector<std::byte> segment(20 + 101);
+    for (std::size_t i = 0; i < segment.size(); ++i) {
+        segment[i] = static_cast<std::byte>(i * 7 + 3);
+    }
+    auto header = std::span<const std::byte>{segment}.first(20);
+    auto payload = std::span<const std::byte>{segment}.subspan(20);
+
+    std::array contiguous{payload};
+    std::array pieces{payload.first(33), payload.subspan(33, 1), payload.subspan(34)};
+    auto expected = tcp::checksum(ip, peer_ip, header, contiguous);
+    EXPECT_EQ(tcp::checksum(ip, peer_ip, header, pieces), expected);
+    EXPECT_EQ(tcp::checksum(ip, peer_ip, segment), expected);
+}
+
+TEST(TCP, RangeSet) {
+    tcp::RangeSet set;
+    set.add(100, 200);
+    set.add(300, 400);
+    EXPECT_EQ(set.bytes(), 200u);
+    EXPECT_EQ(set.covered(150, 350), 100u);
+    EXPECT_EQ(set.first_gap(100, 400), (tcp::SackBlock{200, 300}));
+    EXPECT_EQ(set.first_gap(50, 400), (tcp::SackBlock{50, 100}));
+    EXPECT_FALSE(set.first_gap(300, 400).has_value());
+
+    // Touching ranges merge.
+    EXPECT_EQ(set.add(200, 300), (tcp::SackBlock{100, 400}));
+    EXPECT_EQ(set.blocks().size(), 1u);
+
+    set.remove_before(150);
+    EXPECT_EQ(set.take(150), 400u);
+    EXPECT_TRUE(set.empty());
+
+    // Across the wrap of the sequence space.
+    set.add(0xFFFF'FFF0, 0x10);
+    set.add(0x20, 0x30);
+    EXPECT_EQ(set.bytes(), 0x30u);
+    EXPECT_EQ(set.first_gap(0xFFFF'FFF0, 0x30), (tcp::SackBlock{0x10, 0x20}));
+}
+
+TEST(TCP, TimerWheel) {
+    auto start = tcp::clock::now();
+    tcp::TimerWheel wheel{start};
+
+    tcp::Timer soon, later, far, cancelled;
+    wheel.arm(soon, start + 5ms);
+    wheel.arm(later, start + 40ms);
+    // More than a revolution of the wheel ahead.
+    wheel.arm(far, start + 3s);
+    wheel.arm(cancelled, start + 5ms);
+    wheel.cancel(cancelled);
+
+    std::vector<tcp::Timer*> due;
+    wheel.expire(start + 4ms, due);
+    EXPECT_TRUE(due.empty());
+
+    wheel.expire(start + 10ms, due);
+    ASSERT_EQ(due.size(), 1u);
+    EXPECT_EQ(due[0], &soon);
+    EXPECT_FALSE(soon.armed());
+
+    due.clear();
+    wheel.expire(start + 2s, due);
+    ASSERT_EQ(due.size(), 1u);
+    EXPECT_EQ(due[0], &later);
+    EXPECT_TRUE(far.armed());
+
+    due.clear();
+    wheel.expire(start + 3s, due);
+    ASSERT_EQ(due.size(), 1u);
+    EXPECT_EQ(due[0], &far);
+}
+
+TEST(TCP, CongestionControl) {
+    constexpr uint32_t mss = 1000;
+    auto now = tcp::clock::now();
+
+    for (auto factory : {tcp::reno, tcp::cubic}) {
+        auto congestion = factory(mss);
+        EXPECT_EQ(congestion->window(), 10 * mss);
+
+        // Slow start doubles the window every round trip.
+        congestion->on_ack(10 * mss, now, 10ms);
+        EXPECT_GT(congestion->window(), 10 * mss);
+
+        auto window = congestion->window();
+        congestion->on_loss(window, now);
+        EXPECT_LT(congestion->window(), window);
+        EXPECT_GE(congestion->window(), window / 2);
+
+        // Congestion avoidance grows it again.
+        auto reduced = congestion->window();
+        for (int i = 0; i < 100; ++i) {
+            now += 10ms;
+            congestion->on_ack(mss, now, 10ms);
+        }
+        EXPECT_GT(congestion->window(), reduced);
+
+        congestion->on_timeout(congestion->window(), now);
+        EXPECT_EQ(congestion->window(), mss);
+    }
+}
+
+// Drops every nth large frame it writes.
+struct LossyDevice {
+    MemoryDevice device;
+    std::size_t every;
+    std::unique_ptr<std::atomic<std::size_t>> written = std::make_unique<std::atomic<std::size_t>>();
+    // Every frame written, dropped or not.
+    std::unique_ptr<std::atomic<std::size_t>> frames = std::make_unique<std::atomic<std::size_t>>();
+
+    device::ssize_t write(std::span<const std::byte> frame) noexcept {
+        frames->fetch_add(1);
+        if (every != 0 && frame.size() > 1000 && written->fetch_add(1) % every == every - 1) {
+            return static_cast<device::ssize_t>(frame.size());
+        }
+        return device.write(frame);
+    }
+
+    device::ssize_t try_read(std::span<std::byte> buffer, device::Timeout timeout) noexcept {
+        return device.try_read(buffer, timeout);
+    }
+};
+
+using Stack = InternetLayer<LossyDevice>;
+
+// Two stacks connected back to back, the one at peer_ip loses every nth
+// of the data segments it sends.
+struct Link {
+    std::unique_ptr<Stack> stack;
+    std::unique_ptr<Stack> peer;
+    std::jthread stack_thread;
+    std::jthread peer_thread;
+
+    explicit Link(std::size_t every = 0, tcp::Config config = {}) {
+        auto [device, peer_device] = MemoryDevice::pair();
+        stack = std::make_unique<Stack>(ip, gateway, Stack::LinkLayer{mac, LossyDevice{std::move(device), 0}}, arp::Config{}, ipv4::Config{}, config);
+        peer = std::make_unique<Stack>(peer_ip, gateway, Stack::LinkLayer{peer_mac, LossyDevice{std::move(peer_device), every}}, arp::Config{}, ipv4::Config{}, config);
+
+        stack_thread = std::jthread([this](std::stop_token stop_token){
+            stack->run(stop_token);
+        });
+        peer_thread = std::jthread([this](std::stop_token stop_token){
+            peer->run(stop_token);
+        });
+    }
+};
+
+static std::vector<std::byte> pattern(std::size_t size) {
+    std::vector<std::byte> bytes(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        bytes[i] = static_cast<std::byte>(i * 31 + i / 251);
+    }
+    return bytes;
+}
+
+// Sends size bytes from the peer to the stack and checks what arrives.
+static void transfer(Link& link, std::size_t size) {
+    auto listener = link.stack->listen(8000);
+    ASSERT_TRUE(listener.has_value());
+
+    const auto data = pattern(size);
+    std::vector<std::byte> received;
+    std::jthread server([&]{
+        auto connection = listener->accept();
+        ASSERT_TRUE(connection.has_value());
+        EXPECT_EQ(connection->remote_address(), peer_ip);
+
+        std::vector<std::byte> buffer(64 << 10);
+        while (auto count = connection->receive(buffer)) {
+            received.insert(received.end(), buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(count));
+        }
+        EXPECT_EQ(connection->state(), tcp::State::CloseWait);
+    });
+
+    auto connection = link.peer->connect(ip, 8000);
+    ASSERT_TRUE(connection.has_value());
+    EXPECT_EQ(connection->state(), tcp::State::Established);
+    EXPECT_GE(connection->local_port(), 49152);
+
+    EXPECT_EQ(connection->send(data), data.size());
+    connection->shutdown();
+    server.join();
+
+    EXPECT_EQ(received.size(), data.size());
+    EXPECT_TRUE(std::ranges::equal(received, data));
+}
+
+TEST(TCP, Transfer) {
+    const auto checksum_errors = count(stats::Counter::TcpChecksumErrors);
+    const auto timeouts = count(stats::Counter::TcpTimeouts);
+
+    Link link;
+    transfer(link, 4 << 20);
+
+    EXPECT_EQ(count(stats::Counter::TcpChecksumErrors) - checksum_errors, 0u);
+    EXPECT_EQ(count(stats::Counter::TcpTimeouts) - timeouts, 0u);
+    const auto sent = link.peer->get_device().frames->load();
+    EXPECT_GT(sent, (4u << 20) / 1460);
+    // Delayed ACKs cover two segments each.
+    EXPECT_LT(link.stack->get_device().frames->load(), sent * 3 / 4);
+}
+
+TEST(TCP, RecoversFromLossWithSack) {
+    const auto fast_retransmits = count(stats::Counter::TcpFastRetransmits);
+    const auto retransmitted = count(stats::Counter::TcpRetransmitted);
+
+    Link link{50};
+    transfer(link, 2 << 20);
+
+    EXPECT_GT(count(stats::Counter::TcpFastRetransmits), fast_retransmits);
+    EXPECT_GT(count(stats::Counter::TcpRetransmitted), retransmitted);
+}
+
+TEST(TCP, RecoversFromLossWithNewReno) {
+    const auto fast_retransmits = count(stats::Counter::TcpFastRetransmits);
+
+    Link link{50, {.congestion = tcp::reno, .sack = false}};
+    transfer(link, 1 << 20);
+
+    EXPECT_GT(count(stats::Counter::TcpFastRetransmits), fast_retransmits);
+}
+
+TEST(TCP, ConnectionRefused) {
+    const auto resets_sent = count(stats::Counter::TcpResetsSent);
+    Link link;
+
+    auto connection = link.peer->connect(ip, 9000);
+    ASSERT_FALSE(connection.has_value());
+    EXPECT_EQ(connection.error().code(), std::errc::connection_refused);
+    EXPECT_EQ(count(stats::Counter::TcpResetsSent) - resets_sent, 1u);
+}
+
+TEST(TCP, Listen) {
+    Link link;
+
+    auto listener = link.stack->listen(8000);
+    ASSERT_TRUE(listener.has_value());
+    EXPECT_FALSE(link.stack->listen(8000).has_value());
+
+    // Closing wakes up a blocked accept and frees the port.
+    std::jthread closer([&]{
+        std::this_thread::sleep_for(10ms);
+        listener->close();
+    });
+    EXPECT_FALSE(listener->accept().has_value());
+    closer.join();
+    EXPECT_TRUE(link.stack->listen(8000).has_value());
+}
+
+// Does for the stack what the kernel does for a TAP device with a virtio-net
+// header: frames written to it have their checksums completed and are cut
+// into MTU sized ones, frames read from it are marked as checked.
+struct OffloadingDevice {
+    MemoryDevice device;
+    std::unique_ptr<std::atomic<std::size_t>> segmented = std::make_unique<std::atomic<std::size_t>>();
+    // Frames cut out of them.
+    std::unique_ptr<std::atomic<std::size_t>> segments = std::make_unique<std::atomic<std::size_t>>();
+
+    bool has_vnet_header() const noexcept {
+        return true;
+    }
+
+    unsigned offloads() const noexcept {
+        return virtio_net::Checksum | virtio_net::TSO4;
+    }
+
+    device::ssize_t write(std::span<const std::byte> frame) noexcept {
+        return writev(device::Parts{&frame, 1});
+    }
+
+    device::ssize_t writev(device::Parts parts) noexcept {
+        std::vector<std::byte> bytes;
+        for (auto part : parts) {
+            bytes.insert(bytes.end(), part.begin(), part.end());
+        }
+        const auto written = static_cast<device::ssize_t>(bytes.size());
+
+        const auto header = virtio_net::Packet{std::span<const std::byte>{bytes}}.decode();
+        auto frame = std::span{bytes}.subspan(virtio_net::Format::byte_size());
+        if (header.get<"gso_type">() == virtio_net::GsoType::None) {
+            if (header.get<"flags">() & virtio_net::NeedsChecksum) {
+                complete_checksum(frame, header.get<"checksum_start">(), header.get<"checksum_offset">());
+            }
+            device.write(frame);
+            return written;
+        }
+
+        segmented->fetch_add(1);
+        const std::size_t headers = header.get<"header_length">();
+        const std::size_t gso_size = header.get<"gso_size">();
+        const auto ip_offset = ethernet::Format::byte_size();
+        const auto tcp_offset = ip_offset + ipv4::Format::byte_size();
+
+        for (std::size_t offset = headers; offset < frame.size(); offset += gso_size) {
+            const auto length = std::min(gso_size, frame.size() - offset);
+            std::vector<std::byte> segment(frame.begin(), frame.begin() + static_cast<std::ptrdiff_t>(headers));
+            segment.insert(segment.end(), frame.begin() + static_cast<std::ptrdiff_t>(offset), frame.begin() + static_cast<std::ptrdiff_t>(offset + length));
+
+            ipv4::Packet<std::span<std::byte>> packet{std::span{segment}.subspan(ip_offset)};
+            packet.set<"total_length">(static_cast<uint16_t>(segment.size() - ip_offset));
+            packet.update_checksum();
+
+            tcp::Packet<std::span<std::byte>> tcp_segment{std::span{segment}.subspan(tcp_offset)};
+            tcp_segment.set<"sequence">(tcp_segment.get<"sequence">() + static_cast<uint32_t>(offset - headers));
+            if (offset + length < frame.size()) {
+                tcp_segment.set<"fin">(0);
+                tcp_segment.set<"psh">(0);
+            }
+            tcp_segment.set<"checksum">(0);
+            tcp_segment.set<"checksum">(tcp::checksum(packet.get<"source_address">(), packet.get<"destination_address">(), tcp_segment.to_span()));
+            device.write(segment);
+            segments->fetch_add(1);
+        }
+        return written;
+    }
+
+    device::ssize_t try_read(std::span<std::byte> buffer, device::Timeout timeout) noexcept {
+        auto read = device.try_read(buffer.subspan(virtio_net::Format::byte_size()), timeout);
+        if (read <= 0) {
+            return read;
+        }
+
+        virtio_net::Format::Header header;
+        header.set<"flags">(virtio_net::DataValid);
+        virtio_net::Packet{buffer.first(virtio_net::Format::byte_size())}.encode(header);
+        return read + static_cast<device::ssize_t>(virtio_net::Format::byte_size());
+    }
+
+    static void complete_checksum(std::span<std::byte> frame, std::size_t start, std::size_t offset) {
+        const auto sum = checksum::compute(frame.subspan(start));
+        frame[start + offset] = static_cast<std::byte>(sum >> 8);
+        frame[start + offset + 1] = static_cast<std::byte>(sum);
+    }
+};
+
+TEST(TCP, SegmentationOffload) {
+    const auto checksum_errors = count(stats::Counter::TcpChecksumErrors);
+
+    auto [device, peer_device] = MemoryDevice::pair();
+    // Without GRO every segment the device cut goes up on its own.
+    InternetLayer<MemoryDevice> stack(ip, gateway, {mac, std::move(device), {}, {}, {.enabled = false}});
+    InternetLayer<OffloadingDevice> peer(peer_ip, gateway, {peer_mac, OffloadingDevice{std::move(peer_device)}});
+
+    std::jthread stack_thread([&](std::stop_token stop_token){
+        stack.run(stop_token);
+    });
+    std::jthread peer_thread([&](std::stop_token stop_token){
+        peer.run(stop_token);
+    });
+
+    auto listener = stack.listen(8000);
+    ASSERT_TRUE(listener.has_value());
+
+    const auto data = pattern(4 << 20);
+    std::vector<std::byte> received;
+    std::jthread server([&]{
+        auto connection = listener->accept();
+        ASSERT_TRUE(connection.has_value());
+
+        std::vector<std::byte> buffer(64 << 10);
+        while (auto count = connection->receive(buffer)) {
+            received.insert(received.end(), buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(count));
+        }
+    });
+
+    auto connection = peer.connect(ip, 8000);
+    ASSERT_TRUE(connection.has_value());
+    EXPECT_EQ(connection->send(data), data.size());
+    connection->shutdown();
+    server.join();
+
+    EXPECT_TRUE(std::ranges::equal(received, data));
+    // Every segment is checked by the stack without offloads.
+    EXPECT_EQ(count(stats::Counter::TcpChecksumErrors) - checksum_errors, 0u);
+    EXPECT_GT(peer.get_device().segmented->load(), 0u);
+    EXPECT_GT(peer.get_device().segments->load(), peer.get_device().segmented->load());
+}
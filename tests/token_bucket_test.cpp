@@ -0,0 +1,32 @@
+#include <chrono>
+
+#include "gtest/gtest.h"
+
+#include "token_bucket.h"
+
+using namespace std::chrono_literals;
+
+TEST(TokenBucket, Burst) {
+    auto now = TokenBucket::clock::now();
+    TokenBucket bucket({.rate = 1, .burst = 3}, now);
+
+    EXPECT_TRUE(bucket.try_acquire(now));
+    EXPECT_TRUE(bucket.try_acquire(now, 2));
+    EXPECT_FALSE(bucket.try_acquire(now));
+}
+
+TEST(TokenBucket, Refill) {
+    auto now = TokenBucket::clock::now();
+    TokenBucket bucket({.rate = 10, .burst = 2}, now);
+
+    EXPECT_TRUE(bucket.try_acquire(now, 2));
+    auto available = bucket.available_at(now);
+    EXPECT_GE(available, now + 99ms);
+    EXPECT_LE(available, now + 101ms);
+    EXPECT_FALSE(bucket.try_acquire(now + 50ms));
+    EXPECT_TRUE(bucket.try_acquire(now + 150ms));
+
+    // Never more than burst tokens.
+    EXPECT_TRUE(bucket.try_acquire(now + 1h, 2));
+    EXPECT_FALSE(bucket.try_acquire(now + 1h));
+}
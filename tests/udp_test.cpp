@@ -0,0 +1,198 @@
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "internet_layer.h"
+#include "memory_device.h"
+#include "udp.h"
+
+using namespace std::chrono_literals;
+
+constexpr IPv4_t ip = "10.0.0.4"_ipv4;
+constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+constexpr IPv4_t gateway = "10.0.0.1"_ipv4;
+constexpr MAC_t mac = "00:0c:29:6d:50:25"_mac;
+constexpr MAC_t peer_mac = "02:00:00:00:00:01"_mac;
+
+using Stack = InternetLayer<MemoryDevice>;
+
+// Counters are shared by the stacks of the process, tests look at how much
+// they grew.
+static uint64_t count(stats::Counter counter) {
+    return stats::read()[static_cast<std::size_t>(counter)];
+}
+
+// Frame carrying a UDP datagram from the peer to the stack.
+static std::vector<std::byte> udp_frame(uint16_t source_port, uint16_t destination_port, std::span<const std::byte> payload) {
+    constexpr std::size_t headers = ethernet::Format::byte_size() + ipv4::Format::byte_size();
+    std::vector<std::byte> bytes(headers + udp::Format::byte_size() + payload.size());
+
+    ethernet::Packet<std::span<std::byte>> frame{std::span{bytes}};
+    frame.set<"destination_mac">(mac);
+    frame.set<"source_mac">(peer_mac);
+    frame.set<"ethertype">(ethernet::Ethertype::IPv4);
+
+    auto packet = frame.data<ipv4::Packet>();
+    packet.set<"version">(4);
+    packet.set<"header_length">(5);
+    packet.set<"total_length">(static_cast<uint16_t>(bytes.size() - ethernet::Format::byte_size()));
+    packet.set<"ttl">(64);
+    packet.set<"protocol">(ipv4::Protocol::UDP);
+    packet.set<"source_address">(peer_ip);
+    packet.set<"destination_address">(ip);
+    packet.update_checksum();
+
+    udp::Packet<std::span<std::byte>> datagram{std::span{bytes}.subspan(headers)};
+    datagram.set<"source_port">(source_port);
+    datagram.set<"destination_port">(destination_port);
+    datagram.set<"length">(static_cast<uint16_t>(udp::Format::byte_size() + payload.size()));
+    std::ranges::copy(payload, datagram.data().begin());
+    datagram.set<"checksum">(udp::checksum(peer_ip, ip, datagram.to_span(0, udp::Format::byte_size()), payload));
+
+    return bytes;
+}
+
+static void deliver(Stack& stack, std::span<const std::byte> bytes) {
+    ethernet::Packet frame{bytes};
+    stack.handle(frame.data<ipv4::Packet>());
+}
+
+TEST(UDP, Checksum) {
+    // Sums to 0 with its checksum filled in.
+    std::array payload{std::byte{1}, std::byte{2}, std::byte{3}};
+    auto bytes = udp_frame(1000, 2000, payload);
+    auto message = std::span<const std::byte>{bytes}.subspan(ethernet::Format::byte_size() + ipv4::Format::byte_size());
+
+    EXPECT_NE(udp::Packet{message}.get<"checksum">(), 0);
+    EXPECT_EQ(udp::checksum(peer_ip, ip, message.first(8), message.subspan(8)), 0);
+    EXPECT_NE(udp::checksum(ip, peer_ip + 1, message.first(8), message.subspan(8)), 0);
+}
+
+TEST(UDP, Bind) {
+    auto [device, peer] = MemoryDevice::pair();
+    Stack stack(ip, gateway, {mac, std::move(device)});
+
+    auto socket = stack.bind(5000);
+    ASSERT_TRUE(socket.has_value());
+    EXPECT_EQ(socket->local_port(), 5000);
+    EXPECT_FALSE(stack.bind(5000).has_value());
+
+    auto ephemeral = stack.bind();
+    ASSERT_TRUE(ephemeral.has_value());
+    EXPECT_GE(ephemeral->local_port(), 49152);
+    auto other = stack.bind();
+    ASSERT_TRUE(other.has_value());
+    EXPECT_NE(other->local_port(), ephemeral->local_port());
+
+    // Closing frees the port.
+    socket->close();
+    EXPECT_TRUE(stack.bind(5000).has_value());
+}
+
+TEST(UDP, Demux) {
+    auto [device, peer] = MemoryDevice::pair();
+    Stack stack(ip, gateway, {mac, std::move(device)});
+
+    auto first = stack.bind(5000);
+    auto second = stack.bind(5001);
+    ASSERT_TRUE(first.has_value() && second.has_value());
+
+    const auto received = count(stats::Counter::UdpReceived);
+    const auto no_socket = count(stats::Counter::UdpNoSocket);
+    const auto checksum_errors = count(stats::Counter::UdpChecksumErrors);
+
+    std::array payload{std::byte{0xAB}, std::byte{0xCD}};
+    deliver(stack, udp_frame(1234, 5001, payload));
+    deliver(stack, udp_frame(1234, 5000, payload));
+    deliver(stack, udp_frame(1234, 5001, payload));
+    deliver(stack, udp_frame(1234, 6000, payload));
+
+    auto bad = udp_frame(1234, 5000, payload);
+    bad.back() ^= std::byte{1};
+    deliver(stack, bad);
+
+    std::vector<udp::Datagram> datagrams;
+    EXPECT_EQ(second->recv_many(datagrams, 8), 2u);
+    EXPECT_EQ(first->recv_many(datagrams, 8), 1u);
+    for (auto& datagram : datagrams) {
+        EXPECT_EQ(datagram.source_address, peer_ip);
+        EXPECT_EQ(datagram.source_port, 1234);
+        EXPECT_TRUE(std::ranges::equal(datagram.payload, payload));
+    }
+
+    EXPECT_EQ(count(stats::Counter::UdpReceived) - received, 5u);
+    EXPECT_EQ(count(stats::Counter::UdpNoSocket) - no_socket, 1u);
+    EXPECT_EQ(count(stats::Counter::UdpChecksumErrors) - checksum_errors, 1u);
+}
+
+TEST(UDP, QueueBound) {
+    auto [device, peer] = MemoryDevice::pair();
+    Stack stack(ip, gateway, {mac, std::move(device)});
+
+    auto socket = stack.bind(5000, 2);
+    ASSERT_TRUE(socket.has_value());
+
+    const auto queue_full = count(stats::Counter::UdpQueueFull);
+    std::array payload{std::byte{1}};
+    for (int i = 0; i < 3; ++i) {
+        deliver(stack, udp_frame(1234, 5000, payload));
+    }
+    EXPECT_EQ(count(stats::Counter::UdpQueueFull) - queue_full, 1u);
+    EXPECT_EQ(socket->dropped(), 1u);
+}
+
+TEST(UDP, SendAndReceiveMany) {
+    auto [device, peer_device] = MemoryDevice::pair();
+    Stack stack(ip, gateway, {mac, std::move(device)});
+    Stack peer(peer_ip, gateway, {peer_mac, std::move(peer_device)});
+
+    std::jthread stack_thread([&](std::stop_token stop_token){
+        stack.run(stop_token);
+    });
+    std::jthread peer_thread([&](std::stop_token stop_token){
+        peer.run(stop_token);
+    });
+
+    auto receiver = stack.bind(7000);
+    auto sender = peer.bind();
+    ASSERT_TRUE(receiver.has_value() && sender.has_value());
+
+    std::vector<std::vector<std::byte>> payloads;
+    std::vector<udp::Outgoing> outgoing;
+    for (std::size_t i = 0; i < 6; ++i) {
+        payloads.emplace_back(100 + i * 500, static_cast<std::byte>(i));
+    }
+    for (auto& payload : payloads) {
+        outgoing.push_back({ip, 7000, payload});
+    }
+
+    // Fragments of several datagrams would not all fit in the ARP queue.
+    ASSERT_TRUE(peer.resolve(ip).has_value());
+    const auto sent = count(stats::Counter::UdpSent);
+    const auto bytes_sent = count(stats::Counter::UdpBytesSent);
+    EXPECT_EQ(sender->send_many(outgoing), outgoing.size());
+
+    std::vector<udp::Datagram> received;
+    while (received.size() < outgoing.size()) {
+        ASSERT_NE(receiver->recv_many(received, 4), 0u);
+    }
+
+    for (std::size_t i = 0; i < received.size(); ++i) {
+        EXPECT_EQ(received[i].source_address, peer_ip);
+        EXPECT_EQ(received[i].source_port, sender->local_port());
+        EXPECT_TRUE(std::ranges::equal(received[i].payload, payloads[i]));
+    }
+    EXPECT_EQ(count(stats::Counter::UdpSent) - sent, outgoing.size());
+    EXPECT_EQ(count(stats::Counter::UdpBytesSent) - bytes_sent, 6 * 100 + 15 * 500u);
+
+    // Wakes up a blocked receiver.
+    std::jthread closer([&]{
+        std::this_thread::sleep_for(10ms);
+        receiver->close();
+    });
+    EXPECT_EQ(receiver->recv_many(received, 4), 0u);
+}
@@ -0,0 +1,131 @@
+// Prints the counters of a running network stack. They are read from the
+// shared memory segment the stack publishes them in, which costs it nothing.
+//
+//   netstack_stat [-p pid] [-i seconds]
+//
+// Without -p the first stack found in /dev/shm is shown. With -i the
+// counters are printed again every interval, along with their rates.
+
+#include <iostream>
+#include <format>
+#include <chrono>
+#include <thread>
+#include <optional>
+#include <charconv>
+#include <string_view>
+#include <filesystem>
+#include <cerrno>
+#include <cstdint>
+
+#include <signal.h>
+#include <sys/types.h>
+
+#include "stats.h"
+
+struct Options {
+    std::optional<pid_t> pid;
+    std::optional<unsigned> interval;
+};
+
+template<typename T>
+static std::optional<T> parse_number(std::string_view text) {
+    T value{};
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc{} || end != text.data() + text.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+static std::optional<Options> parse_options(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string_view flag{argv[i]};
+        std::string_view value{argv[i + 1]};
+
+        if (flag == "-p") {
+            options.pid = parse_number<pid_t>(value);
+            if (!options.pid) {
+                return std::nullopt;
+            }
+        } else if (flag == "-i") {
+            options.interval = parse_number<unsigned>(value);
+            if (!options.interval || *options.interval == 0) {
+                return std::nullopt;
+            }
+        } else {
+            return std::nullopt;
+        }
+    }
+    if (argc % 2 == 0) {
+        return std::nullopt;
+    }
+    return options;
+}
+
+static bool is_running(pid_t pid) {
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+// A segment left behind by a stack that did not exit cleanly is skipped.
+static std::optional<pid_t> find_stack() {
+    constexpr std::string_view prefix = "netstack.";
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator("/dev/shm", error)) {
+        const auto name = entry.path().filename().string();
+        if (!name.starts_with(prefix)) {
+            continue;
+        }
+        if (auto pid = parse_number<pid_t>(std::string_view{name}.substr(prefix.size())); pid && is_running(*pid)) {
+            return pid;
+        }
+    }
+    return std::nullopt;
+}
+
+static void print(pid_t pid, const stats::Values& values, const stats::Values* previous, double seconds) {
+    std::cout << std::format("netstack {}\n", pid);
+    for (std::size_t i = 0; i < stats::counter_count; ++i) {
+        std::cout << std::format("  {:<20} {:>16}", stats::names[i], values[i]);
+        if (previous != nullptr) {
+            std::cout << std::format(" {:>14.1f}/s", static_cast<double>(values[i] - (*previous)[i]) / seconds);
+        }
+        std::cout << '\n';
+    }
+    std::cout.flush();
+}
+
+int main(int argc, char* argv[]) {
+    auto options = parse_options(argc, argv);
+    if (!options) {
+        std::cout << "Usage: netstack_stat [-p pid] [-i seconds]\n";
+        return 1;
+    }
+
+    auto pid = options->pid ? options->pid : find_stack();
+    if (!pid) {
+        std::cout << "No running network stack found\n";
+        return 1;
+    }
+
+    auto reader = stats::Reader::open(*pid);
+    if (!reader) {
+        std::cout << std::format("Failed to open the counters of {}\n{}\n", *pid, reader.error().what());
+        return 1;
+    }
+
+    auto values = reader->read();
+    print(*pid, values, nullptr, 0);
+    if (!options->interval) {
+        return 0;
+    }
+
+    const std::chrono::seconds interval{*options->interval};
+    while (is_running(*pid)) {
+        std::this_thread::sleep_for(interval);
+        auto previous = values;
+        values = reader->read();
+        print(*pid, values, &previous, static_cast<double>(interval.count()));
+    }
+    return 0;
+}
@@ -0,0 +1,335 @@
+// Load generator for the ICMP echo responder. Keeps a window of echo
+// requests in flight and reports the round trip latency percentiles.
+//
+//   ping_load [-c count] [-s size] [-w window] [-t address]
+//
+// By default the stack runs in process behind a MemoryDevice. With -t the
+// requests are sent to address through the kernel instead, e.g. to the
+// stack on its TAP device. That needs a raw socket, so CAP_NET_RAW.
+
+#include <iostream>
+#include <format>
+#include <vector>
+#include <array>
+#include <span>
+#include <chrono>
+#include <thread>
+#include <optional>
+#include <utility>
+#include <algorithm>
+#include <charconv>
+#include <string_view>
+#include <system_error>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "types.h"
+#include "ethernet.h"
+#include "ipv4.h"
+#include "icmp.h"
+#include "checksum.h"
+#include "memory_device.h"
+#include "internet_layer.h"
+
+using namespace std::chrono_literals;
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+    std::size_t count = 10'000;
+    std::size_t size = 56;
+    std::size_t window = 1;
+    std::optional<IPv4_t> target;
+};
+
+static std::optional<Options> parse_options(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string_view flag{argv[i]};
+        std::string_view value{argv[i + 1]};
+
+        if (flag == "-t") {
+            options.target = parse_ipv4(value);
+            if (!options.target) {
+                return std::nullopt;
+            }
+            continue;
+        }
+
+        std::size_t number{};
+        auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+        if (error != std::errc{} || end != value.data() + value.size()) {
+            return std::nullopt;
+        }
+
+        if (flag == "-c") {
+            options.count = number;
+        } else if (flag == "-s") {
+            options.size = number;
+        } else if (flag == "-w") {
+            options.window = std::max<std::size_t>(number, 1);
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    if (argc % 2 == 0) {
+        return std::nullopt;
+    }
+    return options;
+}
+
+// Echo reply of ours in a received IPv4 packet, returns its sequence number.
+static std::optional<uint16_t> echo_reply(std::span<const std::byte> bytes, uint16_t id) {
+    ipv4::Packet packet{bytes};
+    if (bytes.size() < ipv4::Format::byte_size() || !packet.is_valid() || packet.get<"protocol">() != ipv4::Protocol::ICMP) {
+        return std::nullopt;
+    }
+
+    auto message = packet.payload();
+    if (message.size() < icmp::Format::byte_size()) {
+        return std::nullopt;
+    }
+
+    icmp::Packet<std::span<const std::byte>> reply{message};
+    if (reply.get<"type">() != icmp::Type::EchoReply || reply.get<"id">() != id) {
+        return std::nullopt;
+    }
+    return reply.get<"sequence">();
+}
+
+static clock_type::duration percentile(const std::vector<clock_type::duration>& sorted, double q) {
+    auto rank = static_cast<std::size_t>(q * static_cast<double>(sorted.size()) + 0.999999);
+    return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+}
+
+struct Summary {
+    std::size_t sent;
+    std::size_t lost;
+    std::vector<clock_type::duration> round_trips;
+};
+
+// send(message) returns false on failure, receive(timeout) the sequence
+// number of the next echo reply, or nothing once timeout passed.
+template<typename Send, typename Receive>
+static std::optional<Summary> measure(const Options& options, uint16_t id, Send send, Receive receive) {
+    std::vector<std::byte> message(icmp::Format::byte_size() + options.size);
+    icmp::Packet<std::span<std::byte>> request{std::span{message}};
+    request.set<"type">(icmp::Type::EchoRequest);
+    request.set<"id">(id);
+    for (std::size_t i = 0; i < options.size; ++i) {
+        request.data()[i] = static_cast<std::byte>(i);
+    }
+
+    std::vector<clock_type::time_point> sent_at(1 << 16);
+    std::vector<bool> outstanding(1 << 16);
+    std::vector<clock_type::duration> round_trips;
+    round_trips.reserve(options.count);
+
+    std::size_t sent = 0;
+    std::size_t in_flight = 0;
+    std::size_t lost = 0;
+
+    while (sent < options.count || in_flight != 0) {
+        while (sent < options.count && in_flight < options.window) {
+            auto sequence = static_cast<uint16_t>(sent);
+            request.set<"sequence">(sequence);
+            request.set<"checksum">(0);
+            request.set<"checksum">(checksum::compute(message));
+
+            sent_at[sequence] = clock_type::now();
+            if (!send(std::span<const std::byte>{message})) {
+                return std::nullopt;
+            }
+            outstanding[sequence] = true;
+            ++sent;
+            ++in_flight;
+        }
+
+        auto sequence = receive(1000ms);
+        if (!sequence) {
+            // Everything in flight is given up on.
+            lost += in_flight;
+            in_flight = 0;
+            std::fill(outstanding.begin(), outstanding.end(), false);
+            continue;
+        }
+        if (!outstanding[*sequence]) {
+            continue;
+        }
+
+        round_trips.push_back(clock_type::now() - sent_at[*sequence]);
+        outstanding[*sequence] = false;
+        --in_flight;
+    }
+
+    std::ranges::sort(round_trips);
+    return Summary{sent, lost, std::move(round_trips)};
+}
+
+static int report(const std::optional<Summary>& summary) {
+    if (!summary) {
+        std::cout << "Failed to send a request\n";
+        return 1;
+    }
+
+    auto& round_trips = summary->round_trips;
+    std::cout << std::format("{} requests, {} replies, {} lost\n", summary->sent, round_trips.size(), summary->lost);
+    if (round_trips.empty()) {
+        return 1;
+    }
+
+    auto us = [](clock_type::duration duration) {
+        return std::chrono::duration<double, std::micro>{duration}.count();
+    };
+    std::cout << std::format(
+        "rtt min {:.1f} us, p50 {:.1f} us, p99 {:.1f} us, p99.9 {:.1f} us, max {:.1f} us\n",
+        us(round_trips.front()),
+        us(percentile(round_trips, 0.5)),
+        us(percentile(round_trips, 0.99)),
+        us(percentile(round_trips, 0.999)),
+        us(round_trips.back())
+    );
+    return 0;
+}
+
+// Pings a stack running in this process, the frames are built here.
+static int run_in_memory(const Options& options) {
+    constexpr IPv4_t ip = "10.0.0.4"_ipv4;
+    constexpr IPv4_t peer_ip = "10.0.0.7"_ipv4;
+    constexpr MAC_t mac = "02:00:00:00:00:04"_mac;
+    constexpr MAC_t peer_mac = "02:00:00:00:00:07"_mac;
+    constexpr std::size_t headers = ethernet::Format::byte_size() + ipv4::Format::byte_size();
+
+    if (headers + icmp::Format::byte_size() + options.size > ethernet::Format::byte_size() + 1500) {
+        std::cout << "Size does not fit in one frame\n";
+        return 1;
+    }
+
+    auto [stack_device, peer] = MemoryDevice::pair(std::max<std::size_t>(options.window, MemoryDevice::default_capacity));
+    InternetLayer<MemoryDevice> stack(ip, "10.0.0.1"_ipv4, {mac, std::move(stack_device)});
+
+    std::jthread thread([&](std::stop_token stop_token){
+        stack.run(stop_token);
+    });
+
+    std::array<std::byte, ethernet::max_size> frame{};
+    ethernet::Packet<std::span<std::byte>> request{std::span{frame}};
+    request.set<"destination_mac">(mac);
+    request.set<"source_mac">(peer_mac);
+    request.set<"ethertype">(ethernet::Ethertype::IPv4);
+
+    auto packet = request.data<ipv4::Packet>();
+    packet.set<"version">(4);
+    packet.set<"header_length">(5);
+    packet.set<"ttl">(64);
+    packet.set<"protocol">(ipv4::Protocol::ICMP);
+    packet.set<"source_address">(peer_ip);
+    packet.set<"destination_address">(ip);
+
+    std::array<std::byte, ethernet::max_size> buffer;
+    auto summary = measure(
+        options,
+        0x4242,
+        [&](std::span<const std::byte> message) {
+            packet.set<"total_length">(static_cast<uint16_t>(ipv4::Format::byte_size() + message.size()));
+            packet.update_checksum();
+            std::ranges::copy(message, frame.begin() + headers);
+            return peer.write(std::span{frame}.first(headers + message.size())) > 0;
+        },
+        [&](std::chrono::milliseconds timeout) -> std::optional<uint16_t> {
+            auto deadline = clock_type::now() + timeout;
+            for (auto now = clock_type::now(); now < deadline; now = clock_type::now()) {
+                auto read = peer.try_read(buffer, std::chrono::ceil<device::Timeout>(deadline - now));
+                if (read <= 0) {
+                    return std::nullopt;
+                }
+
+                ethernet::Packet reply{std::span<const std::byte>{buffer}.first(static_cast<std::size_t>(read))};
+                if (reply.get<"ethertype">() != ethernet::Ethertype::IPv4) {
+                    continue;
+                }
+                if (auto sequence = echo_reply(reply.data(), 0x4242)) {
+                    return sequence;
+                }
+            }
+            return std::nullopt;
+        }
+    );
+
+    thread.request_stop();
+    thread.join();
+    return report(summary);
+}
+
+// Pings address through the kernel.
+static int run_socket(const Options& options, IPv4_t address) {
+    struct Socket {
+        int fd;
+        ~Socket() {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    } socket{::socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)};
+
+    if (socket.fd < 0) {
+        std::cout << std::format("Failed to open raw socket\n{}\n", std::system_error{errno, std::system_category()}.what());
+        return 1;
+    }
+
+    sockaddr_in destination{};
+    destination.sin_family = AF_INET;
+    destination.sin_addr.s_addr = htonl(address);
+
+    const auto id = static_cast<uint16_t>(::getpid());
+    std::vector<std::byte> buffer(1 << 16);
+
+    return report(measure(
+        options,
+        id,
+        [&](std::span<const std::byte> message) {
+            auto sent = ::sendto(socket.fd, message.data(), message.size(), 0, reinterpret_cast<const sockaddr*>(&destination), sizeof(destination));
+            return sent == static_cast<ssize_t>(message.size());
+        },
+        [&](std::chrono::milliseconds timeout) -> std::optional<uint16_t> {
+            auto deadline = clock_type::now() + timeout;
+            for (auto now = clock_type::now(); now < deadline; now = clock_type::now()) {
+                pollfd descriptor{socket.fd, POLLIN, 0};
+                auto wait = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+                if (::poll(&descriptor, 1, static_cast<int>(wait.count())) <= 0) {
+                    return std::nullopt;
+                }
+
+                // Raw sockets see every ICMP message, with its IP header.
+                auto received = ::recv(socket.fd, buffer.data(), buffer.size(), 0);
+                if (received < 0) {
+                    return std::nullopt;
+                }
+                if (auto sequence = echo_reply(std::span{buffer}.first(static_cast<std::size_t>(received)), id)) {
+                    return sequence;
+                }
+            }
+            return std::nullopt;
+        }
+    ));
+}
+
+int main(int argc, char* argv[]) {
+    auto options = parse_options(argc, argv);
+    if (!options) {
+        std::cout << "Usage: ping_load [-c count] [-s size] [-w window] [-t address]\n";
+        return 1;
+    }
+
+    if (options->target) {
+        return run_socket(*options, *options->target);
+    }
+    return run_in_memory(*options);
+}